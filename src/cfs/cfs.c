@@ -5,6 +5,11 @@
 #include "dn_conf.h"
 #include "cfs_faio.h"
 
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+
 extern faio_manager_t *faio_mgr;
 
 // setup cfs meta \sp \ faio
@@ -71,6 +76,206 @@ int cfs_sendfile_chain(cfs_t *cfs, file_io_t *fio, log_t *log)
     }
 }
 
+#ifndef __NR_cachestat
+#define __NR_cachestat 451
+#endif
+
+typedef struct cfs_cachestat_range_s
+{
+    uint64_t off;
+	uint64_t len;
+} cfs_cachestat_range_t;
+
+typedef struct cfs_cachestat_s
+{
+    uint64_t nr_cache;
+	uint64_t nr_dirty;
+	uint64_t nr_writeback;
+	uint64_t nr_evicted;
+	uint64_t nr_recently_evicted;
+} cfs_cachestat_t;
+
+static int cfs_cachestat_off = DFS_FALSE;
+
+// DFS_OK when every page of the range, at most CFS_CACHED_CHUNK, is in 
+// the page cache, DFS_DECLINED if not; cachestat only looks at the page 
+// cache, mincore needs the range mapped first and that serializes with 
+// the other threads on the mm
+int cfs_resident(int fd, off_t offset, size_t len)
+{
+    static long            pagesize = 0;
+    uchar_t                vec[CFS_CACHED_CHUNK / 4096 + 2];
+	cfs_cachestat_range_t  range;
+	cfs_cachestat_t        cst;
+	void                  *addr = NULL;
+    off_t                  start = 0;
+	size_t                 maplen = 0;
+	size_t                 pages = 0;
+	size_t                 i = 0;
+	int                    rc = DFS_OK;
+
+	if (!pagesize) 
+	{
+        pagesize = sysconf(_SC_PAGESIZE);
+	}
+
+	start = offset & ~((off_t)pagesize - 1);
+	maplen = offset - start + len;
+	pages = (maplen + pagesize - 1) / pagesize;
+
+	if (!cfs_cachestat_off) 
+	{
+	    range.off = start;
+		range.len = maplen;
+
+        if (syscall(__NR_cachestat, fd, &range, &cst, 0) == 0) 
+		{
+            return cst.nr_cache >= pages ? DFS_OK : DFS_DECLINED;
+		}
+
+		if (errno != ENOSYS) 
+		{
+            return DFS_ERROR;
+		}
+
+		// older kernel
+		cfs_cachestat_off = DFS_TRUE;
+	}
+
+	if (pages > sizeof(vec)) 
+	{
+        return DFS_ERROR;
+	}
+
+	// mapped only to ask, nothing gets faulted in
+	addr = mmap(NULL, maplen, PROT_READ, MAP_SHARED, fd, start);
+	if (addr == MAP_FAILED) 
+	{
+        return DFS_ERROR;
+	}
+
+	if (mincore(addr, maplen, vec) < 0) 
+	{
+        rc = DFS_ERROR;
+	}
+
+	munmap(addr, maplen);
+
+	for (i = 0; rc == DFS_OK && i < pages; i++) 
+	{
+        if (!(vec[i] & 1)) 
+		{
+            rc = DFS_DECLINED;
+		}
+	}
+
+	return rc;
+}
+
+static int cfs_nowait_off = DFS_FALSE;
+
+// sends what is in the page cache on the calling thread, never waits on 
+// the disk: a chunk is read with RWF_NOWAIT into the fio buffer and sent 
+// from there, so a page evicted meanwhile makes the read short rather 
+// than block. DFS_AGAIN when the socket is full, DFS_DECLINED at the 
+// first missing page with the buffer sent, the rest is for 
+// cfs_sendfile_chain
+int cfs_send_cached(cfs_t *cfs, file_io_t *fio, log_t *log)
+{
+    sendfile_chain_task_t *sf_chain_task = NULL;
+	buffer_t              *b = NULL;
+	struct iovec           iov;
+	size_t                 chunk = 0;
+	ssize_t                rc = 0;
+
+    if (!cfs || !fio || !fio->sf_chain_task) 
+	{
+        return DFS_ERROR;
+    }
+
+	sf_chain_task = (sendfile_chain_task_t *)fio->sf_chain_task;
+	b = fio->b;
+
+	for ( ;; ) 
+	{
+	    while (b->pos < b->last) 
+		{
+		    rc = send(sf_chain_task->conn_fd, b->pos, b->last - b->pos, 0);
+			if (rc < 0) 
+			{
+			    if (errno == EAGAIN) 
+				{
+                    return DFS_AGAIN;
+				}
+				else if (errno == EINTR) 
+				{
+                    continue;
+				}
+
+				dfs_log_error(log, DFS_LOG_ALERT, errno, 
+					"send to conn_fd %d failed", sf_chain_task->conn_fd);
+
+                return DFS_ERROR;
+			}
+
+			b->pos += rc;
+		}
+
+		if (!fio->need) 
+		{
+            return DFS_OK;
+		}
+
+		if (cfs_nowait_off) 
+		{
+            return DFS_DECLINED;
+		}
+
+		chunk = b->end - b->start;
+		chunk = chunk < CFS_CACHED_CHUNK ? chunk : CFS_CACHED_CHUNK;
+		chunk = fio->need < chunk ? fio->need : chunk;
+
+		iov.iov_base = b->start;
+		iov.iov_len = chunk;
+
+		rc = preadv2(fio->fd, &iov, 1, fio->offset, RWF_NOWAIT);
+		if (rc < 0) 
+		{
+		    if (errno == EAGAIN) 
+			{
+                return DFS_DECLINED;
+			}
+			else if (errno == EINTR) 
+			{
+                continue;
+			}
+			else if (errno == EOPNOTSUPP || errno == ENOSYS) 
+			{
+			    // older kernel or a file system without it, all to faio
+			    cfs_nowait_off = DFS_TRUE;
+
+                return DFS_DECLINED;
+			}
+
+			dfs_log_error(log, DFS_LOG_ALERT, errno, 
+				"read fd %d at %l failed", fio->fd, (long)fio->offset);
+
+            return DFS_ERROR;
+		}
+
+		// the blk is shorter than asked for
+		if (!rc) 
+		{
+            return DFS_ERROR;
+		}
+
+		b->pos = b->start;
+		b->last = b->start + rc;
+		fio->offset += rc;
+		fio->need -= rc;
+	}
+}
+
 int cfs_write(cfs_t *cfs, file_io_t *fio, log_t *log)
 {
     int rc = DFS_ERROR;
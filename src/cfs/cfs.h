@@ -12,6 +12,7 @@
 #include "cfs_fio.h"
 
 #define MAX_PATH 512 
+#define CFS_CACHED_CHUNK (256 * 1024) // read without waiting at a time
 
 typedef struct fs_meta_s fs_meta_t;
 typedef struct swap_opt_s swap_opt_t;
@@ -82,7 +83,7 @@ typedef struct sendfile_chain_task_s
     void     *buf_chain;
     int       conn_fd;  // connection fd
     int       store_fd; // store fd
-    uint64_t  limit;
+    uint64_t  limit;    // bytes per faio run, 0 for no bound
     uint64_t  sent;
     void     *file_io;
 } sendfile_chain_task_t;
@@ -94,6 +95,8 @@ int  cfs_read(cfs_t *, file_io_t *, log_t *);
 int  cfs_write(cfs_t *, file_io_t *, log_t *);
 int  cfs_sendfile(cfs_t *, int, int, off_t *, size_t, log_t *);
 int  cfs_sendfile_chain(cfs_t *, file_io_t *, log_t *);
+int  cfs_send_cached(cfs_t *, file_io_t *, log_t *);
+int  cfs_resident(int, off_t, size_t);
 int  cfs_size_add(volatile uint64_t *, uint64_t);
 int  cfs_size_sub(volatile uint64_t *, uint64_t, log_t *);
 int  cfs_prepare_work(cycle_t *cycle);
@@ -1712,6 +1712,22 @@ eio_dent_sort (eio_dirent *dents, int size, signed char score_bits, eio_ino_t in
   eio_dent_insertion_sort (dents, size);
 }
 
+/* sort dents by inode only, for callers that read the dir themselves */
+void
+eio_dent_sort_inode (eio_dirent *dents, int size)
+{
+  eio_ino_t inode_bits = 0;
+  int i;
+
+  for (i = 0; i < size; ++i)
+    {
+      dents [i].score = 0;
+      inode_bits |= dents [i].inode;
+    }
+
+  eio_dent_sort (dents, size, 0, inode_bits);
+}
+
 /* read a full directory */
 static void
 eio__scandir (eio_req *req, etp_worker *self)
@@ -403,6 +403,8 @@ void eio_cancel (eio_req *req);
 /* convenience functions */
 
 eio_ssize_t eio_sendfile_sync (int ofd, int ifd, off_t offset, size_t count);
+/* sorts dents by inode, so that stat()ing them in order is mostly sequential */
+void eio_dent_sort_inode (eio_dirent *dents, int size);
 
 #ifdef __cplusplus
 }
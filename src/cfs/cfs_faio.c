@@ -21,8 +21,10 @@
 #include "dfs_hashtable.h"
 #include "dfs_array.h"
 #include "dfs_conn.h"
+#include "dfs_time.h"
 #include "cfs.h"
 #include "cfs_faio.h"
+#include "cfs_zblk.h"
 
 #define DFS_SENDFILE_LIMIT 2147479552L
 
@@ -104,6 +106,8 @@ static int cfs_faio_read(file_io_t *data, log_t *log)
 
     faio_noty = data->faio_noty;
     
+    data->submit_us = time_monotonic_us();
+
     if (faio_read(faio_noty, cfs_faio_read_callback, &data->faio_task, &error) 
         != FAIO_OK) 
     {
@@ -120,6 +124,8 @@ static int cfs_faio_write(file_io_t *data, log_t *log)
 
     faio_noty = data->faio_noty;
 
+    data->submit_us = time_monotonic_us();
+
     if (faio_write(faio_noty, cfs_faio_write_callback, &data->faio_task, &error) 
         != FAIO_OK) 
     {
@@ -136,6 +142,8 @@ static int cfs_faio_sendfile(file_io_t *data, log_t *log)
 
     faio_noty = data->faio_noty;
 
+    data->submit_us = time_monotonic_us();
+
     if (faio_sendfile(faio_noty, cfs_faio_send_file_callback, &data->faio_task, 
         &error) != FAIO_OK) 
     {
@@ -185,7 +193,9 @@ void cfs_faio_read_callback(faio_data_task_t *task)
 	{
         file_io->result = AIO_OK;
 		
-        if (file_io->event == AIO_READ_EV) 
+        // a sendfile run leaves the buffer alone, its ret is a state
+        if (file_io->event == AIO_READ_EV 
+			&& task->io_type == FAIO_IO_TYPE_READ) 
 		{
             file_io->b->last += res;
             file_io->ret = res;
@@ -228,10 +238,21 @@ int cfs_faio_io_read(faio_data_task_t *task)
 	//会生成一个类型为 size_t 的整型常量，它是一个结构成员相对于结构开头的字节偏移量。
 
     file_task = (file_io_t *)((char *)task - offsetof(file_io_t, faio_task));
-	
+	file_task->start_us = time_monotonic_us();
+
+    if (file_task->zip) 
+	{
+        ret = cfs_zblk_read(file_task->fd, file_task->b->last, 
+			file_task->need, file_task->offset);
+	}
+	else 
+	{
+        ret = pread(file_task->fd, file_task->b->last, file_task->need, 
+            file_task->offset);
+	}
+	file_task->end_us = time_monotonic_us();
 
-    if ((ret = pread(file_task->fd, file_task->b->last, file_task->need, 
-        file_task->offset)) < 0) 
+    if (ret < 0) 
     {
         task->err.sys = errno;
 		
@@ -249,9 +270,26 @@ int cfs_faio_io_write(faio_data_task_t *task)
     int        ret = 0;
 
     file_task = (file_io_t *)((char *)task - offsetof(file_io_t, faio_task));
+	file_task->start_us = time_monotonic_us();
+
+    // a compressed blk is laid out by the writer, not at offset
+    if (file_task->work) 
+	{
+        ret = file_task->work(file_task);
+	}
+	else if (file_task->zblk) 
+	{
+        ret = cfs_zblk_write((cfs_zblk_t *)file_task->zblk, file_task->fd, 
+			file_task->b->start, file_task->b->last - file_task->b->start);
+	}
+	else 
+	{
+        ret = pwrite(file_task->fd, file_task->b->start, 
+            file_task->b->last - file_task->b->start, file_task->offset);
+	}
+	file_task->end_us = time_monotonic_us();
 
-    if ((ret = pwrite(file_task->fd, file_task->b->start, 
-        file_task->b->last - file_task->b->start, file_task->offset)) < 0) 
+    if (ret < 0) 
     {
         task->err.sys = errno;
 		
@@ -269,9 +307,11 @@ int cfs_faio_io_send_file(faio_data_task_t *task)
     file_io_t             *file_task = NULL;
     int                    rc = 0;
     size_t                 limit = 0;
+    size_t                 sent = 0;
     sendfile_chain_task_t *sf_chain_task = NULL;
 
     file_task = (file_io_t *)((char *)task - offsetof(file_io_t, faio_task));    
+	file_task->start_us = time_monotonic_us();
 
     sf_chain_task = (sendfile_chain_task_t *)file_task->sf_chain_task;
     limit = sf_chain_task->limit;
@@ -281,16 +321,19 @@ int cfs_faio_io_send_file(faio_data_task_t *task)
         limit = DFS_SENDFILE_LIMIT;
     }
 
-    while (file_task->need > 0)
+    // one slice per run, the rest goes back behind the queued tasks
+    while (file_task->need > 0 && sent < limit)
 	{
 		rc = sendfile(sf_chain_task->conn_fd, sf_chain_task->store_fd, 
-			&file_task->offset, file_task->need);
+			&file_task->offset, file_task->need < limit - sent 
+			? file_task->need : limit - sent);
         
         if (rc == DFS_ERROR) 
 		{
             if (errno == DFS_EAGAIN) 
 			{
                 file_task->faio_ret = DFS_EAGAIN;
+                file_task->end_us = time_monotonic_us();
 				
                 return DFS_OK;
             } 
@@ -300,6 +343,7 @@ int cfs_faio_io_send_file(faio_data_task_t *task)
             }
 			
             file_task->faio_ret = DFS_ERROR;
+            file_task->end_us = time_monotonic_us();
 			
             return DFS_ERROR;
         }
@@ -307,6 +351,7 @@ int cfs_faio_io_send_file(faio_data_task_t *task)
         if (!rc) 
 		{
             file_task->faio_ret = DFS_ERROR;
+            file_task->end_us = time_monotonic_us();
 			
             return DFS_ERROR;
         }
@@ -314,10 +359,12 @@ int cfs_faio_io_send_file(faio_data_task_t *task)
         if (rc > 0) 
 		{
 			file_task->need -= rc;
+			sent += rc;
         }
     }
 
-    file_task->faio_ret = DFS_OK;
+    file_task->faio_ret = file_task->need > 0 ? DFS_AGAIN : DFS_OK;
+    file_task->end_us = time_monotonic_us();
 
     return DFS_OK;
 }
@@ -125,10 +125,10 @@ static uint32_t cfs_fio_manager_refill(uint32_t n, fio_manager_t *fio_manager)
         }
 
         fio->b = (buffer_t *)(fio + 1);
-        reallength = my_align(extralength, 512); // 512 字节对齐
-        // 预对齐内存的分配 512 的倍数
+        reallength = my_align(extralength, CFS_FIO_ALIGN);
+        // page aligned, an O_DIRECT pread may land in it
         // 给 buffer 分配内存
-        posix_memalign((void **)&fio->b->start, 512, reallength);
+        posix_memalign((void **)&fio->b->start, CFS_FIO_ALIGN, reallength);
 
         fio->b->temporary = DFS_FALSE;
         fio->b->pos = fio->b->start; /* 待处理缓冲区起始位置 */
@@ -187,6 +187,12 @@ int cfs_fio_manager_free(file_io_t *fio, fio_manager_t *fio_manager)
 	fio->fd = -1;
     fio->able = AIO_ABLE;
     fio->type = TASK_STORE_BODY;
+    fio->sf_chain_task = NULL;
+    fio->zblk = NULL;
+    fio->zip = DFS_FALSE;
+    fio->work = NULL;
+    // a write borrows the request buffer, take the own one back
+    fio->b = (buffer_t *)(fio + 1);
     fio->b->last = fio->b->pos = fio->b->start;
 
     queue_insert_head(&fio_manager->freeq, &fio->q);
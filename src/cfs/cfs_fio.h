@@ -26,6 +26,7 @@
 #define FIO_MANAGER_MEM_EDGE  	0.95
 #define AIO_NUM_STEP			128
 #define AIO_BUF_MAX_DEF    	 	1048576
+#define CFS_FIO_ALIGN           4096
 #define AIO_MAX_TASK_NUM		3
 
 #define AIO_MGR_OPEN   1
@@ -39,7 +40,10 @@ enum
     TASK_STORE_BODY
 };
 
+struct file_io_s;
+
 typedef int (*file_io_handler_pt) (void *, void *);
+typedef ssize_t (*file_io_work_pt) (struct file_io_s *);
 
 typedef struct file_s
 {
@@ -76,6 +80,12 @@ typedef struct file_io_s
     faio_data_task_t         faio_task;
     int                      faio_ret;
     void                    *sf_chain_task;
+    void                    *zblk; // cfs_zblk_t, a write compresses
+    int                      zip;  // a read decompresses
+    file_io_work_pt          work; // a write runs this in place of pwrite
+    uint64_t                 submit_us; // queued to faio
+    uint64_t                 start_us;  // picked up by a faio thread
+    uint64_t                 end_us;
 } file_io_t;
 
 typedef struct fio_manager_s 
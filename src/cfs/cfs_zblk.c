@@ -0,0 +1,472 @@
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <sys/stat.h>
+
+#include "cfs_zblk.h"
+#include "dfs_lz.h"
+#include "dfs_memory.h"
+
+#define zblk_align_down(v)  ((v) & ~((uint64_t)CFS_ZBLK_ALIGN - 1))
+#define zblk_align_up(v)    zblk_align_down((v) + CFS_ZBLK_ALIGN - 1)
+#define zblk_off(v)         ((v) & ~CFS_ZBLK_RAW)
+
+// read side scratch of a faio thread, grown on demand, never shrunk
+static __thread uchar_t *zblk_scratch;
+static __thread size_t   zblk_scratch_size;
+
+static int      zblk_put(cfs_zblk_t *z, int fd, uchar_t *src, uint32_t len);
+static int      zblk_flush(cfs_zblk_t *z, int fd);
+static int      zblk_finish(cfs_zblk_t *z, int fd);
+static int      zblk_pwrite(int fd, uchar_t *buf, size_t len, uint64_t off);
+static uchar_t *zblk_pread(int fd, uchar_t *dst, uint64_t off, size_t len);
+static uchar_t *zblk_scratch_get(size_t size);
+static int      zblk_hdr_valid(cfs_zblk_hdr_t *hdr);
+static uint32_t zblk_checksum(const void *data, size_t len);
+
+cfs_zblk_t *cfs_zblk_create(pool_t *pool, uint64_t size)
+{
+    cfs_zblk_t *z = NULL;
+
+	z = (cfs_zblk_t *)pool_calloc(pool, sizeof(cfs_zblk_t));
+	if (!z)
+	{
+        return NULL;
+	}
+
+	z->size = size;
+	z->n = (uint32_t)((size + CFS_ZBLK_CHUNK - 1) / CFS_ZBLK_CHUNK);
+	z->stored = cfs_zblk_data_off(z->n);
+	z->outoff = z->stored;
+
+	z->index = (uint64_t *)pool_alloc(pool,
+		((uint64_t)z->n + 1) * sizeof(uint64_t));
+	z->stage = (uchar_t *)pool_alloc(pool, CFS_ZBLK_CHUNK);
+	z->out = (uchar_t *)pool_alloc(pool, CFS_ZBLK_BATCH);
+	if (!z->index || !z->stage || !z->out)
+	{
+        return NULL;
+	}
+
+	return z;
+}
+
+// consumes len logical bytes, whole chunks are compressed and written
+// out, a partial one waits in the stage for the next call
+ssize_t cfs_zblk_write(cfs_zblk_t *z, int fd, uchar_t *buf, size_t len)
+{
+    uchar_t  *p = buf;
+	size_t    left = len;
+	uint32_t  want = 0;
+	uint32_t  take = 0;
+
+	if (z->taken + len > z->size)
+	{
+	    errno = EINVAL;
+
+        return DFS_ERROR;
+	}
+
+	while (left > 0)
+	{
+	    want = z->size - (uint64_t)z->done * CFS_ZBLK_CHUNK < CFS_ZBLK_CHUNK
+			? (uint32_t)(z->size - (uint64_t)z->done * CFS_ZBLK_CHUNK)
+			: CFS_ZBLK_CHUNK;
+
+        if (!z->staged && left >= want)
+		{
+		    if (zblk_put(z, fd, p, want) != DFS_OK)
+			{
+                return DFS_ERROR;
+			}
+
+			p += want;
+			left -= want;
+
+			continue;
+		}
+
+		take = want - z->staged < left ? want - z->staged : (uint32_t)left;
+		memory_memcpy(z->stage + z->staged, p, take);
+		z->staged += take;
+		p += take;
+		left -= take;
+
+		if (z->staged == want)
+		{
+		    if (zblk_put(z, fd, z->stage, want) != DFS_OK)
+			{
+                return DFS_ERROR;
+			}
+
+			z->staged = 0;
+		}
+	}
+
+	z->taken += len;
+
+	if (z->done == z->n)
+	{
+        return zblk_finish(z, fd) == DFS_OK ? (ssize_t)len : DFS_ERROR;
+	}
+
+	return zblk_flush(z, fd) == DFS_OK ? (ssize_t)len : DFS_ERROR;
+}
+
+// offset must start a chunk and len cover whole chunks, the last chunk
+// of the blk may come out short. returns the logical bytes produced
+ssize_t cfs_zblk_read(int fd, uchar_t *buf, size_t len, uint64_t offset)
+{
+    cfs_zblk_hdr_t *hdr = NULL;
+	uchar_t        *s = NULL;
+	uchar_t        *s1 = NULL;
+	uchar_t        *s2 = NULL;
+	uchar_t        *head = NULL;
+	uchar_t        *data = NULL;
+	uint64_t       *idx = NULL;
+	uint64_t        ilen = 0;
+	uint64_t        k0 = 0;
+	uint64_t        k1 = 0;
+	uint64_t        k = 0;
+	uint64_t        base = 0;
+	uint64_t        slen = 0;
+	uint64_t        want = 0;
+	size_t          r0 = 0;
+	size_t          r1 = 0;
+	ssize_t         out = 0;
+
+	if (offset % CFS_ZBLK_CHUNK || len % CFS_ZBLK_CHUNK)
+	{
+	    errno = EINVAL;
+
+        return DFS_ERROR;
+	}
+
+	k0 = offset / CFS_ZBLK_CHUNK;
+	k1 = k0 + len / CFS_ZBLK_CHUNK;
+	ilen = cfs_zblk_data_off(k1);
+
+	r0 = CFS_ZBLK_NEAR + CFS_ZBLK_ALIGN;
+	r1 = zblk_align_up((k1 - k0 + 1) * sizeof(uint64_t)) + 2 * CFS_ZBLK_ALIGN;
+
+	s = zblk_scratch_get(r0 + r1 + len + 2 * CFS_ZBLK_ALIGN);
+	if (!s)
+	{
+        return DFS_ERROR;
+	}
+
+	s1 = s + r0;
+	s2 = s1 + r1;
+
+	// the index of the first chunks comes along with the header
+	head = zblk_pread(fd, s, 0, ilen <= CFS_ZBLK_NEAR
+		? ilen : sizeof(cfs_zblk_hdr_t));
+	if (!head)
+	{
+        return DFS_ERROR;
+	}
+
+	hdr = (cfs_zblk_hdr_t *)head;
+	if (!zblk_hdr_valid(hdr))
+	{
+        goto corrupt;
+	}
+
+	if (k0 >= hdr->n)
+	{
+        return 0;
+	}
+
+	if (k1 > hdr->n)
+	{
+        k1 = hdr->n;
+	}
+
+	if (ilen <= CFS_ZBLK_NEAR)
+	{
+        idx = (uint64_t *)(head + sizeof(cfs_zblk_hdr_t)) + k0;
+	}
+	else
+	{
+	    idx = (uint64_t *)zblk_pread(fd, s1,
+			sizeof(cfs_zblk_hdr_t) + k0 * sizeof(uint64_t),
+			(k1 - k0 + 1) * sizeof(uint64_t));
+		if (!idx)
+		{
+            return DFS_ERROR;
+		}
+	}
+
+	base = zblk_off(idx[0]);
+	if (base < cfs_zblk_data_off(hdr->n))
+	{
+        goto corrupt;
+	}
+
+	for (k = 0; k < k1 - k0; k++)
+	{
+	    if (zblk_off(idx[k + 1]) < zblk_off(idx[k])
+			|| zblk_off(idx[k + 1]) - zblk_off(idx[k]) > CFS_ZBLK_CHUNK)
+		{
+            goto corrupt;
+		}
+	}
+
+	data = zblk_pread(fd, s2, base, zblk_off(idx[k1 - k0]) - base);
+	if (!data)
+	{
+        return DFS_ERROR;
+	}
+
+	for (k = k0; k < k1; k++)
+	{
+	    slen = zblk_off(idx[k - k0 + 1]) - zblk_off(idx[k - k0]);
+		want = hdr->size - k * CFS_ZBLK_CHUNK < CFS_ZBLK_CHUNK
+			? hdr->size - k * CFS_ZBLK_CHUNK : CFS_ZBLK_CHUNK;
+
+		if (idx[k - k0] & CFS_ZBLK_RAW)
+		{
+		    if (slen != want)
+			{
+                goto corrupt;
+			}
+
+            memory_memcpy(buf + out, data, slen);
+		}
+		else if (dfs_lz_decompress(data, slen, buf + out, want)
+			!= (ssize_t)want)
+		{
+            goto corrupt;
+		}
+
+		data += slen;
+		out += want;
+	}
+
+	return out;
+
+corrupt:
+	errno = EIO;
+
+	return DFS_ERROR;
+}
+
+// DFS_OK with the logical length for a compressed blk, DFS_DECLINED
+// for a plain one
+int cfs_zblk_probe(char *path, uint64_t *size)
+{
+    cfs_zblk_hdr_t hdr;
+	struct stat    sb;
+	uint64_t       end = 0;
+	int            fd = -1;
+	int            rs = DFS_DECLINED;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+	{
+        return DFS_ERROR;
+	}
+
+	if (pread(fd, &hdr, sizeof(hdr), 0) == sizeof(hdr)
+		&& zblk_hdr_valid(&hdr)
+		&& pread(fd, &end, sizeof(end), sizeof(hdr)
+			+ (uint64_t)hdr.n * sizeof(uint64_t)) == sizeof(end)
+		&& fstat(fd, &sb) == DFS_OK
+		&& end == (uint64_t)sb.st_size)
+	{
+	    *size = hdr.size;
+        rs = DFS_OK;
+	}
+
+	close(fd);
+
+	return rs;
+}
+
+static int zblk_put(cfs_zblk_t *z, int fd, uchar_t *src, uint32_t len)
+{
+    size_t c = 0;
+
+	if (z->outlen + CFS_ZBLK_CHUNK > CFS_ZBLK_BATCH
+		&& zblk_flush(z, fd) != DFS_OK)
+	{
+        return DFS_ERROR;
+	}
+
+	// what does not come out smaller is stored as is
+	c = dfs_lz_compress(src, len, z->out + z->outlen, len);
+	if (c)
+	{
+        z->index[z->done] = z->stored;
+	}
+	else
+	{
+	    memory_memcpy(z->out + z->outlen, src, len);
+		c = len;
+        z->index[z->done] = z->stored | CFS_ZBLK_RAW;
+	}
+
+	z->outlen += c;
+	z->stored += c;
+	z->done++;
+
+	return DFS_OK;
+}
+
+static int zblk_flush(cfs_zblk_t *z, int fd)
+{
+    if (!z->outlen)
+	{
+        return DFS_OK;
+	}
+
+	if (zblk_pwrite(fd, z->out, z->outlen, z->outoff) != DFS_OK)
+	{
+        return DFS_ERROR;
+	}
+
+	z->outoff += z->outlen;
+	z->outlen = 0;
+
+	return DFS_OK;
+}
+
+// the header goes last, a blk cut short never looks complete
+static int zblk_finish(cfs_zblk_t *z, int fd)
+{
+    cfs_zblk_hdr_t hdr;
+
+	if (zblk_flush(z, fd) != DFS_OK)
+	{
+        return DFS_ERROR;
+	}
+
+	z->index[z->n] = z->stored;
+
+	if (zblk_pwrite(fd, (uchar_t *)z->index,
+		((uint64_t)z->n + 1) * sizeof(uint64_t), sizeof(hdr)) != DFS_OK)
+	{
+        return DFS_ERROR;
+	}
+
+	memory_zero(&hdr, sizeof(hdr));
+	hdr.magic = CFS_ZBLK_MAGIC;
+	hdr.version = CFS_ZBLK_VERSION;
+	hdr.codec = CFS_ZBLK_CODEC_LZ;
+	hdr.chunk = CFS_ZBLK_CHUNK;
+	hdr.n = z->n;
+	hdr.size = z->size;
+	hdr.checksum = zblk_checksum(&hdr, offsetof(cfs_zblk_hdr_t, checksum));
+
+	return zblk_pwrite(fd, (uchar_t *)&hdr, sizeof(hdr), 0);
+}
+
+static int zblk_pwrite(int fd, uchar_t *buf, size_t len, uint64_t off)
+{
+    ssize_t rs = 0;
+
+	while (len > 0)
+	{
+	    rs = pwrite(fd, buf, len, off);
+		if (rs < 0)
+		{
+		    if (errno == EINTR)
+			{
+                continue;
+			}
+
+            return DFS_ERROR;
+		}
+
+		buf += rs;
+		len -= rs;
+		off += rs;
+	}
+
+	return DFS_OK;
+}
+
+// whole aligned blocks into dst, returns where off landed in it or
+// NULL if the file ends before off + len
+static uchar_t *zblk_pread(int fd, uchar_t *dst, uint64_t off, size_t len)
+{
+    uint64_t from = zblk_align_down(off);
+	uint64_t to = zblk_align_up(off + len);
+	uint64_t got = 0;
+	ssize_t  rs = 0;
+
+	while (from + got < off + len)
+	{
+	    rs = pread(fd, dst + got, to - from - got, from + got);
+		if (rs < 0 && errno == EINTR)
+		{
+            continue;
+		}
+
+		if (rs <= 0)
+		{
+		    if (!rs)
+			{
+                errno = EIO;
+			}
+
+            return NULL;
+		}
+
+		got += rs;
+	}
+
+	return dst + (off - from);
+}
+
+static uchar_t *zblk_scratch_get(size_t size)
+{
+    void *p = NULL;
+
+	if (size <= zblk_scratch_size)
+	{
+        return zblk_scratch;
+	}
+
+	if (posix_memalign(&p, CFS_ZBLK_ALIGN, size) != 0)
+	{
+	    errno = ENOMEM;
+
+        return NULL;
+	}
+
+	free(zblk_scratch);
+	zblk_scratch = (uchar_t *)p;
+	zblk_scratch_size = size;
+
+	return zblk_scratch;
+}
+
+static int zblk_hdr_valid(cfs_zblk_hdr_t *hdr)
+{
+    return hdr->magic == CFS_ZBLK_MAGIC
+		&& hdr->version == CFS_ZBLK_VERSION
+		&& hdr->codec == CFS_ZBLK_CODEC_LZ
+		&& hdr->chunk == CFS_ZBLK_CHUNK
+		&& hdr->n == (hdr->size + CFS_ZBLK_CHUNK - 1) / CFS_ZBLK_CHUNK
+		&& hdr->checksum == zblk_checksum(hdr,
+			offsetof(cfs_zblk_hdr_t, checksum));
+}
+
+// fnv-1a
+static uint32_t zblk_checksum(const void *data, size_t len)
+{
+    const uchar_t *p = (const uchar_t *)data;
+	uint32_t       h = 2166136261U;
+	size_t         i = 0;
+
+	for (i = 0; i < len; i++)
+	{
+	    h ^= p[i];
+        h *= 16777619U;
+	}
+
+	return h;
+}
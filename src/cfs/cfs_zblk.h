@@ -0,0 +1,54 @@
+#ifndef CFS_ZBLK_H
+#define CFS_ZBLK_H
+
+#include "dfs_types.h"
+#include "dfs_memory_pool.h"
+
+#define CFS_ZBLK_MAGIC     0x5a534644 // "DFSZ"
+#define CFS_ZBLK_VERSION   1
+#define CFS_ZBLK_CODEC_LZ  1
+#define CFS_ZBLK_CHUNK     (64 * 1024) // the unit a read decompresses
+#define CFS_ZBLK_BATCH     (512 * 1024) // compressed bytes per pwrite
+#define CFS_ZBLK_RAW       (1ULL << 63) // index flag, chunk stored as is
+#define CFS_ZBLK_NEAR      (64 * 1024) // index read along with the header
+#define CFS_ZBLK_ALIGN     4096 // every pread is fine on an O_DIRECT fd
+
+// file layout: the header, n + 1 offsets, the chunks back to back.
+// offset k is where chunk k starts, offset n is the file length
+typedef struct cfs_zblk_hdr_s
+{
+    uint32_t magic;
+	uint16_t version;
+	uint16_t codec;
+	uint32_t chunk;
+	uint32_t n;        // chunks
+	uint64_t size;     // logical length of the blk
+	uint32_t reserved;
+	uint32_t checksum; // of the fields above
+} cfs_zblk_hdr_t;
+
+#define cfs_zblk_data_off(n) \
+	(sizeof(cfs_zblk_hdr_t) + ((uint64_t)(n) + 1) * sizeof(uint64_t))
+
+// one blk being written, fed in order by the faio thread of its request
+typedef struct cfs_zblk_s
+{
+    uint64_t  size;   // logical length, known up front
+	uint64_t  taken;  // logical bytes consumed
+	uint64_t  stored; // file offset of the next chunk
+	uint32_t  n;
+	uint32_t  done;   // chunks out
+	uint64_t *index;
+	uchar_t  *stage;  // a chunk split across two writes
+	uint32_t  staged;
+	uchar_t  *out;    // compressed chunks waiting for one pwrite
+	uint32_t  outlen;
+	uint64_t  outoff;
+} cfs_zblk_t;
+
+cfs_zblk_t *cfs_zblk_create(pool_t *pool, uint64_t size);
+ssize_t cfs_zblk_write(cfs_zblk_t *z, int fd, uchar_t *buf, size_t len);
+ssize_t cfs_zblk_read(int fd, uchar_t *buf, size_t len, uint64_t offset);
+int     cfs_zblk_probe(char *path, uint64_t *size);
+
+#endif
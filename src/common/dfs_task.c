@@ -92,3 +92,466 @@ int task_decodefstr(char *buff, int len, task_t *task)
     return need_size;
 }
 
+
+/*
+ * v2 frame, little endian:
+ *   int32   total length, this field included
+ *   uint8   TASK_V2_MAGIC
+ *   uint8   version
+ *   uint16  flags
+ *   uint32  seq, fixed so a queued frame can be renumbered
+ *   varint  cmd, zigzag ret, data_len
+ *   TLVs    varint tag, varint len, value; tag 0 ends them
+ *   data
+ * unknown tags are skipped, so newer peers may add fields
+ */
+
+#define TASK_V2_F_TLV  0x0001
+
+#define TASK_TLV_END         0
+#define TASK_TLV_KEY         1
+#define TASK_TLV_USER        2
+#define TASK_TLV_GROUP       3
+#define TASK_TLV_PERMISSION  4
+#define TASK_TLV_MASTER      5
+
+#define TASK_VARINT_MAX  10
+
+static int task_put_varint(unsigned char *p, uint64_t v);
+static int task_get_varint(unsigned char **p, unsigned char *end, uint64_t *v);
+static int task_varint_size(uint64_t v);
+static int task_tlv_size(int tag, int len);
+static unsigned char *task_put_tlv(unsigned char *p, int tag, 
+	const void *val, int len);
+static int task_get_str(char *dst, int cap, unsigned char *val, uint64_t len);
+
+static int task_put_varint(unsigned char *p, uint64_t v)
+{
+    int n = 0;
+
+	while (v >= 0x80)
+	{
+        p[n++] = (unsigned char)(v | 0x80);
+		v >>= 7;
+	}
+
+	p[n++] = (unsigned char)v;
+
+	return n;
+}
+
+static int task_get_varint(unsigned char **p, unsigned char *end, uint64_t *v)
+{
+    unsigned char *q = *p;
+	uint64_t       r = 0;
+	int            shift = 0;
+
+	while (q < end && shift < 64)
+	{
+        r |= (uint64_t)(*q & 0x7f) << shift;
+
+		if (!(*q++ & 0x80))
+		{
+		    *v = r;
+			*p = q;
+			
+            return TASK_OK;
+		}
+
+		shift += 7;
+	}
+
+	return TASK_ERROR;
+}
+
+static int task_varint_size(uint64_t v)
+{
+    int n = 1;
+
+	while (v >= 0x80)
+	{
+	    v >>= 7;
+        n++;
+	}
+
+	return n;
+}
+
+static int task_tlv_size(int tag, int len)
+{
+    return task_varint_size(tag) + task_varint_size(len) + len;
+}
+
+static unsigned char *task_put_tlv(unsigned char *p, int tag, 
+	const void *val, int len)
+{
+    p += task_put_varint(p, tag);
+	p += task_put_varint(p, len);
+	memcpy(p, val, len);
+
+	return p + len;
+}
+
+static int task_get_str(char *dst, int cap, unsigned char *val, uint64_t len)
+{
+    if (len >= (uint64_t)cap)
+	{
+        return TASK_ERROR;
+	}
+
+	memcpy(dst, val, len);
+	dst[len] = '\0';
+
+	return TASK_OK;
+}
+
+#define task_zigzag(v)    (((uint64_t)(v) << 1) ^ (uint64_t)((int64_t)(v) >> 63))
+#define task_unzigzag(v)  ((int64_t)((v) >> 1) ^ -(int64_t)((v) & 1))
+
+int task_encode_size(task_t *task, int ver)
+{
+    int tlv = 0;
+	int n = 0;
+
+	if (ver != TASK_V2)
+	{
+        return (int)(sizeof(int) * 2 + sizeof(task_t)) + task->data_len;
+	}
+
+	if ((n = strnlen(task->key, KEY_LEN)) > 0)
+	{
+        tlv += task_tlv_size(TASK_TLV_KEY, n);
+	}
+
+	if ((n = strnlen(task->user, OWNER_LEN)) > 0)
+	{
+        tlv += task_tlv_size(TASK_TLV_USER, n);
+	}
+
+	if ((n = strnlen(task->group, GROUP_LEN)) > 0)
+	{
+        tlv += task_tlv_size(TASK_TLV_GROUP, n);
+	}
+
+	if (task->permission)
+	{
+        tlv += task_tlv_size(TASK_TLV_PERMISSION, 
+			task_varint_size((uint16_t)task->permission));
+	}
+
+	if (task->master_nodeid)
+	{
+        tlv += task_tlv_size(TASK_TLV_MASTER, 
+			task_varint_size(task_zigzag(task->master_nodeid)));
+	}
+
+	return TASK_V2_HDR_LEN + task_varint_size(task->cmd)
+		+ task_varint_size(task_zigzag(task->ret))
+		+ task_varint_size(task->data_len)
+		+ (tlv ? tlv + 1 : 0) + task->data_len;
+}
+
+int task_encode2str_v2(task_t *task, char *buff, int len)
+{
+    unsigned char  *p = (unsigned char *)buff;
+	unsigned char   num[TASK_VARINT_MAX];
+	unsigned char  *tlv = NULL;
+	uint16_t        flags = 0;
+	int             need_size = task_encode_size(task, TASK_V2);
+	int             n = 0;
+
+	if (len < need_size || task->data_len < 0)
+	{
+        return TASK_EAGIN;
+	}
+
+	memcpy(p, &need_size, sizeof(int));
+	p[4] = TASK_V2_MAGIC;
+	p[5] = TASK_V2;
+	memcpy(p + 8, &task->seq, sizeof(uint32_t));
+	p += TASK_V2_HDR_LEN;
+
+	p += task_put_varint(p, task->cmd);
+	p += task_put_varint(p, task_zigzag(task->ret));
+	p += task_put_varint(p, task->data_len);
+
+	tlv = p;
+
+	if ((n = strnlen(task->key, KEY_LEN)) > 0)
+	{
+        p = task_put_tlv(p, TASK_TLV_KEY, task->key, n);
+	}
+
+	if ((n = strnlen(task->user, OWNER_LEN)) > 0)
+	{
+        p = task_put_tlv(p, TASK_TLV_USER, task->user, n);
+	}
+
+	if ((n = strnlen(task->group, GROUP_LEN)) > 0)
+	{
+        p = task_put_tlv(p, TASK_TLV_GROUP, task->group, n);
+	}
+
+	if (task->permission)
+	{
+	    n = task_put_varint(num, (uint16_t)task->permission);
+        p = task_put_tlv(p, TASK_TLV_PERMISSION, num, n);
+	}
+
+	if (task->master_nodeid)
+	{
+	    n = task_put_varint(num, task_zigzag(task->master_nodeid));
+        p = task_put_tlv(p, TASK_TLV_MASTER, num, n);
+	}
+
+	if (p != tlv)
+	{
+	    *p++ = TASK_TLV_END;
+        flags |= TASK_V2_F_TLV;
+	}
+
+	memcpy(buff + 6, &flags, sizeof(uint16_t));
+
+	if (task->data_len > 0)
+	{
+        memcpy(p, task->data, task->data_len);
+	}
+
+	return need_size;
+}
+
+// data is borrowed, it points into buff and lives as long as buff does
+int task_decodefstr_v2(char *buff, int len, task_t *task)
+{
+    unsigned char *p = (unsigned char *)buff + TASK_V2_HDR_LEN;
+	unsigned char *q = NULL;
+	unsigned char *end = NULL;
+	uint64_t       v = 0;
+	uint64_t       tag = 0;
+	uint64_t       tlen = 0;
+	uint16_t       flags = 0;
+	int            need_size = 0;
+
+	if (len < TASK_V2_HDR_LEN)
+	{
+        return TASK_EAGIN;
+	}
+
+	memcpy(&need_size, buff, sizeof(int));
+
+	if (need_size < TASK_V2_HDR_LEN)
+	{
+        return TASK_ERROR;
+	}
+
+	if (len < need_size)
+	{
+        return TASK_EAGIN;
+	}
+
+	end = (unsigned char *)buff + need_size;
+
+	memset(task, 0x00, sizeof(task_t));
+	memcpy(&flags, buff + 6, sizeof(uint16_t));
+	memcpy(&task->seq, buff + 8, sizeof(uint32_t));
+
+	if (task_get_varint(&p, end, &v) != TASK_OK)
+	{
+        return TASK_ERROR;
+	}
+
+	task->cmd = (cmd_t)v;
+
+	if (task_get_varint(&p, end, &v) != TASK_OK)
+	{
+        return TASK_ERROR;
+	}
+
+	task->ret = (int)task_unzigzag(v);
+
+	if (task_get_varint(&p, end, &v) != TASK_OK || v > (uint64_t)need_size)
+	{
+        return TASK_ERROR;
+	}
+
+	task->data_len = (int)v;
+
+	while (flags & TASK_V2_F_TLV)
+	{
+        if (task_get_varint(&p, end, &tag) != TASK_OK)
+		{
+            return TASK_ERROR;
+		}
+
+		if (tag == TASK_TLV_END)
+		{
+            break;
+		}
+
+		if (task_get_varint(&p, end, &tlen) != TASK_OK 
+			|| tlen > (uint64_t)(end - p))
+		{
+            return TASK_ERROR;
+		}
+
+		switch (tag)
+		{
+		case TASK_TLV_KEY:
+			if (task_get_str(task->key, KEY_LEN, p, tlen) != TASK_OK)
+			{
+                return TASK_ERROR;
+			}
+			break;
+
+		case TASK_TLV_USER:
+			if (task_get_str(task->user, OWNER_LEN, p, tlen) != TASK_OK)
+			{
+                return TASK_ERROR;
+			}
+			break;
+
+		case TASK_TLV_GROUP:
+			if (task_get_str(task->group, GROUP_LEN, p, tlen) != TASK_OK)
+			{
+                return TASK_ERROR;
+			}
+			break;
+
+		case TASK_TLV_PERMISSION:
+		    q = p;
+			
+		    if (task_get_varint(&q, p + tlen, &v) != TASK_OK)
+			{
+                return TASK_ERROR;
+			}
+			
+			task->permission = (short)v;
+			break;
+
+		case TASK_TLV_MASTER:
+		    q = p;
+			
+		    if (task_get_varint(&q, p + tlen, &v) != TASK_OK)
+			{
+                return TASK_ERROR;
+			}
+			
+			task->master_nodeid = (int)task_unzigzag(v);
+			break;
+
+		default:
+			break;
+		}
+
+		p += tlen;
+	}
+
+	if (task->data_len > end - p)
+	{
+        return TASK_ERROR;
+	}
+
+	if (task->data_len > 0)
+	{
+        task->data = p;
+	}
+
+	return need_size;
+}
+
+int task_encode2str_ver(task_t *task, int ver, char *buff, int len)
+{
+    return ver == TASK_V2 ? task_encode2str_v2(task, buff, len)
+		: task_encode2str(task, buff, len);
+}
+
+// either version, told apart by the byte after the length
+int task_decodefstr_any(char *buff, int len, task_t *task)
+{
+    int need_size = 0;
+	
+    switch (task_frame_version(buff, len))
+	{
+	case TASK_V2:
+		return task_decodefstr_v2(buff, len, task);
+
+	case TASK_V1:
+		memcpy(&need_size, buff, sizeof(int));
+		
+		if (len >= need_size 
+			&& need_size < (int)(sizeof(int) * 2 + sizeof(task_t)))
+		{
+            return TASK_ERROR;
+		}
+		
+		memset(task, 0x00, sizeof(task_t));
+		need_size = task_decodefstr(buff, len, task);
+		
+		if (need_size > 0 && (task->data_len < 0 || task->data_len 
+			> need_size - (int)(sizeof(int) * 2 + sizeof(task_t))))
+		{
+            return TASK_ERROR;
+		}
+		
+		if (need_size > 0 && task->data_len == 0)
+		{
+            task->data = NULL;
+		}
+
+		return need_size;
+
+	default:
+		return len < (int)sizeof(int) + 2 ? TASK_EAGIN : TASK_ERROR;
+	}
+}
+
+int task_frame_version(char *buff, int len)
+{
+    unsigned char *p = (unsigned char *)buff;
+	
+    if (len < (int)sizeof(int) + 2)
+	{
+        return TASK_ERROR;
+	}
+
+	if (p[4] == TASK_V2_MAGIC)
+	{
+        return p[5] == TASK_V2 ? TASK_V2 : TASK_ERROR;
+	}
+
+	return TASK_V1;
+}
+
+// renumbers an encoded frame, either version
+void task_frame_set_seq(char *buff, uint32_t seq)
+{
+    if ((unsigned char)buff[4] == TASK_V2_MAGIC)
+	{
+	    memcpy(buff + 8, &seq, sizeof(uint32_t));
+		
+        return;
+	}
+
+	memcpy(buff + sizeof(int) + offsetof(task_t, seq), &seq, 
+		sizeof(uint32_t));
+}
+
+// the version to answer a DN_REGISTER with, v1 for an old datanode
+int task_wire_negotiate(void *data, int data_len, int max_ver)
+{
+    task_wire_hello_t hello;
+
+	if (!data || data_len < (int)sizeof(task_wire_hello_t))
+	{
+        return TASK_V1;
+	}
+
+	memcpy(&hello, data, sizeof(task_wire_hello_t));
+
+	if (hello.magic != TASK_WIRE_HELLO_MAGIC || hello.min_ver > max_ver)
+	{
+        return TASK_V1;
+	}
+
+	return hello.max_ver < max_ver ? hello.max_ver : max_ver;
+}
@@ -10,6 +10,14 @@
 #define TASK_EAGIN -2
 #define TASK_OK 0
 
+#define TASK_V1          1 // task_t as it is in memory
+#define TASK_V2          2 // small fixed header, varints and TLVs
+#define TASK_V2_MAGIC    0xD2 // never the low byte of a v1 cmd
+#define TASK_V2_HDR_LEN  12
+#define TASK_WIRE_MAX    TASK_V2
+
+#define TASK_WIRE_HELLO_MAGIC 0x56534644 // "DFSV"
+
 #define KEY_LEN   256
 #define OWNER_LEN 16
 #define GROUP_LEN 16
@@ -29,11 +37,28 @@ typedef struct task_s
 	void     *data;
 } task_t;
 
+// data of a DN_REGISTER, a namenode that knows it answers with the
+// version both sides speak after the namespace id
+typedef struct task_wire_hello_s
+{
+	uint32_t magic;
+	uint16_t min_ver;
+	uint16_t max_ver;
+} task_wire_hello_t;
+
 task_t * task_new();
 void task_free(task_t* task);
 void task_clear(task_t* task);
 int task_encode2str(task_t *task, char *buff, int len);
 int task_decodefstr(char *buff, int len, task_t *task);
+int task_encode_size(task_t *task, int ver);
+int task_encode2str_v2(task_t *task, char *buff, int len);
+int task_decodefstr_v2(char *buff, int len, task_t *task);
+int task_encode2str_ver(task_t *task, int ver, char *buff, int len);
+int task_decodefstr_any(char *buff, int len, task_t *task);
+int task_frame_version(char *buff, int len);
+void task_frame_set_seq(char *buff, uint32_t seq);
+int task_wire_negotiate(void *data, int data_len, int max_ver);
 
 #endif
 
@@ -8,6 +8,8 @@
 #define OP_COPY_BLOCK              84
 #define OP_BLOCK_CHECKSUM          85
 #define OP_READ_BLOCK_ACCELERATOR  86
+#define OP_EC_WRITE_GROUP          87
+#define OP_EC_RECONSTRUCT          88
   
 #define OP_STATUS_SUCCESS          0
 #define OP_STATUS_ERROR            1  
@@ -31,7 +33,8 @@ typedef enum
     DN_HEARTBEAT,
     DN_RECV_BLK_REPORT,
     DN_DEL_BLK_REPORT,
-    DN_BLK_REPORT
+    DN_BLK_REPORT,
+    DN_BLK_REPORT_BULK
 } cmd_t;
 
 typedef enum
@@ -82,6 +85,63 @@ typedef struct report_blk_info_s
 	char     dn_ip[32];
 } report_blk_info_t;
 
+#define BLK_REPORT_CHUNK_MAX  65536 // varint bytes of one bulk report chunk
+
+#define BLK_REPORT_FULL     0x01 // part of a full report, not an increment
+#define BLK_REPORT_VOL_END  0x02 // last chunk of a volume
+#define BLK_REPORT_END      0x04 // last chunk of the report
+
+// payload of DN_BLK_REPORT_BULK: the header, then count pairs of varints,
+// the blk id as delta to the previous one (the first to base) and the size.
+// ids are sorted within a volume, a full report sends every volume
+// of the datanode, an empty one as a chunk of count 0
+typedef struct blk_report_hdr_s
+{
+    uint64_t report_id; // the same for every chunk of a full report
+	int64_t  ns_id;
+	int64_t  base;
+	uint32_t seq;       // chunk number within the report
+	uint32_t count;
+	int32_t  vol;       // -1 for an increment
+	uint32_t vol_gen;   // bumped by every add and del on the volume
+	uint32_t flags;
+	uint32_t pad;
+} blk_report_hdr_t;
+
+#define DN_STATS_VERSION    1
+
+#define DN_VOL_FAILED       0x01
+
+// payload of DN_HEARTBEAT: the header, then vol_n dn_vol_stats_t.
+// sizes in bytes, remaining is what may still be placed on the volume
+typedef struct dn_stats_hdr_s
+{
+    uint16_t version;
+	uint16_t vol_n;
+	uint32_t failed_vols;
+	uint64_t capacity;
+	uint64_t used;
+	uint64_t remaining;
+	uint32_t xceivers;   // blk transfers in progress
+	uint32_t io_pending; // faio tasks queued or running
+	uint32_t fio_busy;
+	uint32_t fio_free;
+	uint32_t io_lat_us;  // moving average over the volumes
+	uint32_t pad;
+} dn_stats_hdr_t;
+
+typedef struct dn_vol_stats_s
+{
+    uint64_t capacity;
+	uint64_t used;
+	uint64_t remaining;
+	uint64_t io_errors;
+	uint32_t xceivers;
+	uint32_t io_pending;
+	uint32_t io_lat_us;
+	uint32_t flags;
+} dn_vol_stats_t;
+
 //数据传输头
 typedef struct data_transfer_header_s
 {
@@ -99,5 +159,30 @@ typedef struct data_transfer_header_rsp_s
 	int err;
 } data_transfer_header_rsp_t;
 
+#define EC_MAX_UNITS        16 // internal blks of a group, the low id bits
+
+// where an internal blk of a group lives, ip 0 if it is lost
+typedef struct ec_peer_s
+{
+    uint32_t ip;   // network order
+	uint16_t port; // network order
+	uint16_t pad;
+} ec_peer_t;
+
+// follows the data_transfer_header_t of the ec ops. block_id there is
+// the group, a multiple of EC_MAX_UNITS, and its internal blk i is
+// block_id + i. len is the length of the data striped over the group,
+// cell_size bytes to each data unit in turn
+typedef struct ec_transfer_header_s
+{
+    int       data_units;
+	int       parity_units;
+	int       cell_size;
+	int       index; // OP_EC_RECONSTRUCT: the internal blk rebuilt here
+	// OP_EC_RECONSTRUCT: the others. OP_EC_WRITE_GROUP: the datanode
+	// each unit goes to, ip 0 keeps it on the one written to
+	ec_peer_t peers[EC_MAX_UNITS];
+} ec_transfer_header_t;
+
 #endif
 
@@ -9,7 +9,7 @@ int task_decode(buffer_t *buff, task_t *task)
 		return DFS_AGAIN;
     }
 
-    ret = task_decodefstr((char*)buff->pos, buffer_size(buff), task);
+    ret = task_decodefstr_any((char*)buff->pos, buffer_size(buff), task);
     if (ret <= 0) 
 	{
         return ret;
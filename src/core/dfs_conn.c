@@ -113,6 +113,13 @@ int conn_tcp_delay(int s)
         (const void *) &nodelay, sizeof(int));
 }
 
+// writable only while less than lowat is queued and unsent
+int conn_tcp_notsent_lowat(int s, int lowat)
+{
+    return setsockopt(s, IPPROTO_TCP, TCP_NOTSENT_LOWAT,
+        (const void *) &lowat, sizeof(int));
+}
+
 // 根据 fd 初始化 connection
 conn_t * conn_get_from_mem(int s)
 {
@@ -202,6 +209,18 @@ void conn_close(conn_t *c)
 		{
             event_del_conn(c->ev_base, c, EVENT_CLOSE_EVENT);
         }
+
+        // the other event of this epoll round may still be posted, it
+        // must not fire on whoever gets the conn next
+        if (c->read->post_queue.prev)
+		{
+            queue_remove(&c->read->post_queue);
+        }
+
+        if (c->write->post_queue.prev)
+		{
+            queue_remove(&c->write->post_queue);
+        }
     } 
 }
 
@@ -123,6 +123,7 @@ int  conn_tcp_nopush(int s);
 int  conn_tcp_push(int s);
 int  conn_tcp_nodelay(int s);
 int  conn_tcp_delay(int s);
+int  conn_tcp_notsent_lowat(int s, int lowat);
 
 #endif
 
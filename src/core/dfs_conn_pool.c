@@ -106,40 +106,40 @@ void conn_pool_free(conn_pool_t *pool)
     pool->free_connection_n = 0;
 }
 
-conn_t * conn_pool_get_connection(conn_pool_t *pool) {
-    conn_t *c = NULL;
-    int num = 0;
-    uint32_t n = 0;
+conn_t * conn_pool_get_connection(conn_pool_t *pool)
+{
+    conn_t   *c = NULL;
+    int       num = 0;
+    uint32_t  n = 0;
 
     c = pool->free_connections;
-    // 当free_connection中没有可以用的connection时，扫描连接池，找到一个可以用的
-    if (c == NULL) {
-        if (!c) {
-            if (pool->change_n >= 0) {
-                return NULL;
-            }
-
-            n = -pool->change_n;
-            c = get_comm_conn(n, &num);
-            if (c) {
-                pool->free_connections = c;
-                pool->free_connection_n += num;
-                pool->change_n += num;
-
-                goto out_conn;
-            }
-
+    // 当free_connection中没有可以用的connection时，从公共池借
+    if (!c) 
+	{
+        if (pool->change_n >= 0) 
+		{
             return NULL;
         }
 
-        out_conn:
-        pool->free_connections = (conn_t *) c->next; // 指向下一个connections
-        pool->free_connection_n--;    // 空闲connection数-1
-        pool->used_n++;
+        n = -pool->change_n;
+        c = get_comm_conn(n, &num);
+        if (!c) 
+		{
+            return NULL;
+        }
 
-        return c;
+        pool->free_connections = c;
+        pool->free_connection_n += num;
+        pool->change_n += num;
     }
+
+    pool->free_connections = (conn_t *) c->next; // 指向下一个connections
+    pool->free_connection_n--;    // 空闲connection数-1
+    pool->used_n++;
+
+    return c;
 }
+
 void conn_pool_free_connection(conn_pool_t *pool, conn_t *c)
 {   
     if (pool->change_n > 0) 
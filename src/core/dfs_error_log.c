@@ -1,11 +1,60 @@
 #include <string.h>
+#include <pthread.h>
+#include <sys/uio.h>
 
 #include "dfs_error_log.h"
 #include "dfs_memory.h"
 #include "dfs_memory_pool.h"
 #include "dfs_ipc.h"
 
+#define LOG_FLUSH_IOV  1024
+
+// one per logging thread, the thread moves head and the flusher tail.
+// a ring outlives its thread and is taken over by the next new one
+typedef struct log_ring_s log_ring_t;
+
+struct log_ring_s
+{
+    volatile uint64_t  head;
+    uint64_t           lines;
+    uint64_t           dropped;
+    uint64_t           blocked;
+    char               pad[32];  // head and tail on their own lines
+    volatile uint64_t  tail;
+    volatile int       owned;
+    size_t             size;     // a power of 2
+    uchar_t           *data;
+    log_ring_t        *next;
+};
+
+struct log_async_s
+{
+    log_ring_t        *rings;    // only grows, pushed lock-free
+    size_t             ring_size;
+    int                overflow;
+    volatile int       running;
+    volatile int       idle;     // the flusher waits on cond
+    pthread_mutex_t    lock;
+    pthread_cond_t     cond;
+    volatile int       sync;     // lines are written by their threads
+    volatile int       crashed;
+    pthread_t          tid;
+    pthread_key_t      key;
+    uint64_t           bytes;
+    uint64_t           writes;
+    uint64_t           reported; // drops already logged
+    uint32_t           ring_n;
+};
+
+static __thread log_ring_t *log_ring_self;
+
 static uchar_t *error_log_strerror(int err, uchar_t *errstr, size_t size);
+static void error_log_write(log_t *log, uchar_t *buf, size_t len);
+static log_ring_t *error_log_ring(log_async_t *la);
+static void error_log_ring_put(log_async_t *la, uchar_t *buf, size_t len);
+static void error_log_ring_exit(void *arg);
+static int error_log_flush(log_async_t *la, int fd);
+static void *error_log_flusher(void *arg);
 
 static string_t error_levels[] = 
 {
@@ -90,8 +139,6 @@ void error_log_core(log_t *log, uint32_t level, char *file,
     va_list   args;
     uchar_t  *p = NULL;
     uchar_t  *last = NULL;
-    ssize_t   n = 0;
-    ssize_t   logsz = 0;
     uchar_t   errstr[DFS_MAX_ERROR_STR];
     int       len = 0;
     string_t *stime;
@@ -149,24 +196,13 @@ void error_log_core(log_t *log, uint32_t level, char *file,
 
     *p++ = LF;
 	
-    if (log->file->fd > 0) 
-	{
-        logsz = p - errstr;
-		
-        n = dfs_write_fd(log->file->fd, errstr, logsz);
-        if (n < 0) 
-		{
-            error_log_close(log);
-        }
-    }
+    error_log_write(log, errstr, p - errstr);
 }
 
 void error_log_debug_core(log_t *log, uint32_t level, char *file, 
 	                              int line, int err, const char *fmt, ...)
 {
     va_list   args;
-    ssize_t   n = 0;
-    ssize_t   logsz = 0;
     uchar_t  *p = NULL;
     uchar_t  *last = NULL;
     uchar_t   errstr[DFS_MAX_ERROR_STR];
@@ -233,18 +269,14 @@ void error_log_debug_core(log_t *log, uint32_t level, char *file,
     }
 
     *p++ = LF;
-    printf("%s\n", errstr);
 
-    if (log->file->fd > 0) 
+    // stdout may block as well, the async logger only writes the file
+    if (!log->async) 
 	{
-        logsz = p - errstr;
-		
-        n = dfs_write_fd(log->file->fd, errstr, logsz);
-        if (n < 0) 
-		{
-            error_log_close(log);
-        }
+        printf("%s\n", errstr);
     }
+
+    error_log_write(log, errstr, p - errstr);
 }
 
 static uchar_t * error_log_strerror(int err, uchar_t *errstr, size_t size)
@@ -334,3 +366,371 @@ int error_log_set_handle(log_t *log, log_time_ptr tm_handler,
     return DFS_OK;
 }
 
+
+static void error_log_write(log_t *log, uchar_t *buf, size_t len)
+{
+    log_async_t *la = log->async;
+
+    if (la && !la->sync) 
+	{
+        error_log_ring_put(la, buf, len);
+
+        return;
+    }
+
+    if (log->file->fd > 0 && dfs_write_fd(log->file->fd, buf, len) < 0) 
+	{
+        error_log_close(log);
+    }
+}
+
+// the ring of this thread, a new or a free one the first time
+static log_ring_t *error_log_ring(log_async_t *la)
+{
+    log_ring_t *r = log_ring_self;
+
+    if (r) 
+	{
+        return r;
+    }
+
+    for (r = __atomic_load_n(&la->rings, __ATOMIC_ACQUIRE); r; r = r->next) 
+	{
+        if (!r->owned && __sync_bool_compare_and_swap(&r->owned, 0, 1)) 
+		{
+            break;
+        }
+    }
+
+    if (!r) 
+	{
+        r = (log_ring_t *)memory_calloc(sizeof(log_ring_t));
+        if (!r) 
+		{
+            return NULL;
+        }
+
+        r->data = (uchar_t *)memory_alloc(la->ring_size);
+        if (!r->data) 
+		{
+            memory_free(r, sizeof(log_ring_t));
+
+            return NULL;
+        }
+
+        r->size = la->ring_size;
+        r->owned = DFS_TRUE;
+
+        do 
+		{
+            r->next = __atomic_load_n(&la->rings, __ATOMIC_RELAXED);
+        } while (!__sync_bool_compare_and_swap(&la->rings, r->next, r));
+
+        __sync_fetch_and_add(&la->ring_n, 1);
+    }
+
+    pthread_setspecific(la->key, r);
+    log_ring_self = r;
+
+    return r;
+}
+
+static void error_log_ring_exit(void *arg)
+{
+    log_ring_t *r = (log_ring_t *)arg;
+
+    log_ring_self = NULL;
+    __atomic_store_n(&r->owned, DFS_FALSE, __ATOMIC_RELEASE);
+}
+
+// never blocks with the drop policy, a full ring loses the line
+static void error_log_ring_put(log_async_t *la, uchar_t *buf, size_t len)
+{
+    log_ring_t *r = error_log_ring(la);
+    uint64_t    head = 0;
+    size_t      off = 0;
+    size_t      n = 0;
+    int         waited = DFS_FALSE;
+
+    if (!r) 
+	{
+        return;
+    }
+
+    head = r->head;
+
+    while (r->size - (head - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE))
+        < len) 
+	{
+        if (la->overflow != DFS_LOG_OVERFLOW_BLOCK || !la->running) 
+		{
+            r->dropped++;
+
+            return;
+        }
+
+        if (!waited) 
+		{
+            r->blocked++;
+            waited = DFS_TRUE;
+        }
+
+        usleep(DFS_LOG_BLOCK_US);
+    }
+
+    off = head & (r->size - 1);
+    n = r->size - off < len ? r->size - off : len;
+
+    memory_memcpy(r->data + off, buf, n);
+    memory_memcpy(r->data, buf + n, len - n);
+
+    r->lines++;
+    __atomic_store_n(&r->head, head + len, __ATOMIC_RELEASE);
+
+    // half full, the flusher should not sleep out its interval
+    if (la->idle && head + len - r->tail > r->size / 2) 
+	{
+        pthread_cond_signal(&la->cond);
+    }
+}
+
+// one writev for whatever all rings hold
+static int error_log_flush(log_async_t *la, int fd)
+{
+    struct iovec  iov[LOG_FLUSH_IOV];
+    log_ring_t   *rings[LOG_FLUSH_IOV / 2];
+    uint64_t      heads[LOG_FLUSH_IOV / 2];
+    log_ring_t   *r = NULL;
+    uint64_t      tail = 0;
+    size_t        off = 0;
+    size_t        len = 0;
+    size_t        total = 0;
+    ssize_t       n = 0;
+    int           iov_n = 0;
+    int           ring_n = 0;
+    int           i = 0;
+
+    for (r = __atomic_load_n(&la->rings, __ATOMIC_ACQUIRE); 
+        r && ring_n < LOG_FLUSH_IOV / 2; r = r->next) 
+	{
+        heads[ring_n] = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+        tail = r->tail;
+
+        if (heads[ring_n] == tail) 
+		{
+            continue;
+        }
+
+        off = tail & (r->size - 1);
+        len = heads[ring_n] - tail;
+
+        iov[iov_n].iov_base = r->data + off;
+        iov[iov_n].iov_len = r->size - off < len ? r->size - off : len;
+        len -= iov[iov_n++].iov_len;
+
+        if (len) 
+		{
+            iov[iov_n].iov_base = r->data;
+            iov[iov_n++].iov_len = len;
+        }
+
+        total += heads[ring_n] - tail;
+        rings[ring_n++] = r;
+    }
+
+    if (!ring_n) 
+	{
+        return 0;
+    }
+
+    // a short write goes on where it stopped, an error loses the batch
+    for (i = 0; i < iov_n && fd > 0; ) 
+	{
+        n = writev(fd, iov + i, iov_n - i);
+        if (n < 0) 
+		{
+            if (errno == EINTR) 
+			{
+                continue;
+            }
+
+            break;
+        }
+
+        la->writes++;
+
+        while (i < iov_n && (size_t)n >= iov[i].iov_len) 
+		{
+            n -= iov[i++].iov_len;
+        }
+
+        if (i < iov_n) 
+		{
+            iov[i].iov_base = (uchar_t *)iov[i].iov_base + n;
+            iov[i].iov_len -= n;
+        }
+    }
+
+    for (i = 0; i < ring_n; i++) 
+	{
+        __atomic_store_n(&rings[i]->tail, heads[i], __ATOMIC_RELEASE);
+    }
+
+    la->bytes += total;
+
+    return ring_n;
+}
+
+static void *error_log_flusher(void *arg)
+{
+    log_t            *log = (log_t *)arg;
+    log_async_t      *la = log->async;
+    log_async_stat_t  st;
+    struct timespec   ts;
+
+    while (la->running) 
+	{
+        if (la->crashed) 
+		{
+            return NULL;
+        }
+
+        // busy rings are drained back to back, idle ones every few ms
+        if (!error_log_flush(la, log->file->fd)) 
+		{
+            clock_gettime(CLOCK_REALTIME, &ts);
+            ts.tv_nsec += DFS_LOG_FLUSH_MS * 1000000;
+            ts.tv_sec += ts.tv_nsec / 1000000000;
+            ts.tv_nsec %= 1000000000;
+
+            pthread_mutex_lock(&la->lock);
+            la->idle = DFS_TRUE;
+            pthread_cond_timedwait(&la->cond, &la->lock, &ts);
+            la->idle = DFS_FALSE;
+            pthread_mutex_unlock(&la->lock);
+        }
+
+        error_log_async_stat(log, &st);
+
+        if (st.dropped > la->reported) 
+		{
+            error_log_core(log, DFS_LOG_WARN, (char *)__FILE__, __LINE__, 0,
+                "log rings full, %uL lines dropped", 
+                st.dropped - la->reported);
+
+            la->reported = st.dropped;
+        }
+    }
+
+    error_log_flush(la, log->file->fd);
+
+    return NULL;
+}
+
+// called in the worker after the fork, the flusher is a thread
+int error_log_async_start(log_t *log, size_t ring_size, int overflow)
+{
+    log_async_t *la = NULL;
+    size_t       size = DFS_LOG_RING_MIN;
+
+    if (!log || log->async) 
+	{
+        return DFS_OK;
+    }
+
+    while (size < ring_size) 
+	{
+        size <<= 1;
+    }
+
+    la = (log_async_t *)memory_calloc(sizeof(log_async_t));
+    if (!la) 
+	{
+        return DFS_ERROR;
+    }
+
+    la->ring_size = size;
+    la->overflow = overflow;
+    la->running = DFS_TRUE;
+    pthread_mutex_init(&la->lock, NULL);
+    pthread_cond_init(&la->cond, NULL);
+
+    if (pthread_key_create(&la->key, error_log_ring_exit) != 0) 
+	{
+        memory_free(la, sizeof(log_async_t));
+
+        return DFS_ERROR;
+    }
+
+    log->async = la;
+
+    if (pthread_create(&la->tid, NULL, error_log_flusher, log) != 0) 
+	{
+        log->async = NULL;
+        pthread_key_delete(la->key);
+        memory_free(la, sizeof(log_async_t));
+
+        return DFS_ERROR;
+    }
+
+    return DFS_OK;
+}
+
+// drains the rings, later lines are written by their threads again.
+// the rings stay, a thread may still hold one
+void error_log_async_stop(log_t *log)
+{
+    log_async_t *la = log ? log->async : NULL;
+
+    if (!la || !la->running) 
+	{
+        return;
+    }
+
+    la->sync = DFS_TRUE;
+    la->running = DFS_FALSE;
+
+    pthread_cond_signal(&la->cond);
+    pthread_join(la->tid, NULL);
+}
+
+// from a signal handler: no more flusher, what is buffered is written
+// now and so are the lines that follow, the backtrace
+void error_log_async_crash(log_t *log)
+{
+    log_async_t *la = log ? log->async : NULL;
+
+    if (!la || la->sync) 
+	{
+        return;
+    }
+
+    la->crashed = DFS_TRUE;
+    la->sync = DFS_TRUE;
+    error_log_flush(la, log->file->fd);
+}
+
+// racy sums, for reporting only
+void error_log_async_stat(log_t *log, log_async_stat_t *stat)
+{
+    log_async_t *la = log ? log->async : NULL;
+    log_ring_t  *r = NULL;
+
+    memory_zero(stat, sizeof(log_async_stat_t));
+
+    if (!la) 
+	{
+        return;
+    }
+
+    for (r = __atomic_load_n(&la->rings, __ATOMIC_ACQUIRE); r; r = r->next) 
+	{
+        stat->lines += r->lines;
+        stat->dropped += r->dropped;
+        stat->blocked += r->blocked;
+    }
+
+    stat->bytes = la->bytes;
+    stat->writes = la->writes;
+    stat->rings = la->ring_n;
+}
@@ -19,6 +19,36 @@ enum
     DFS_LOG_DEBUG,
 };
 
+enum
+{
+    DFS_LOG_MODE_ASYNC = 1,
+    DFS_LOG_MODE_SYNC,
+};
+
+// what a thread does when its log ring is full
+enum
+{
+    DFS_LOG_OVERFLOW_DROP = 1,
+    DFS_LOG_OVERFLOW_BLOCK,
+};
+
+#define DFS_LOG_RING_SIZE      (256 * 1024) // bytes per logging thread
+#define DFS_LOG_RING_MIN       (16 * 1024)
+#define DFS_LOG_FLUSH_MS       20
+#define DFS_LOG_BLOCK_US       100
+
+typedef struct log_async_s log_async_t;
+
+typedef struct log_async_stat_s
+{
+    uint64_t lines;
+    uint64_t bytes;
+    uint64_t dropped;
+    uint64_t blocked;  // lines that waited for room
+    uint64_t writes;   // writev calls of the flusher
+    uint32_t rings;
+} log_async_stat_t;
+
 typedef string_t* (*log_time_ptr)(void);
 typedef string_t* (*log_level_ptr)(int level);
 
@@ -45,6 +75,7 @@ struct log_s
     log_flog_str_t log_flog;
     log_time_ptr   log_time_handler; // time ptr dfs_err_log_time
     log_level_ptr  log_level_handler; // log level
+    log_async_t   *async; // lines go to per thread rings when set
 };
 
 enum 
@@ -65,6 +96,10 @@ log_t *error_log_open(pool_t *pool, string_t name);
 int    error_log_close(log_t *log);
 int error_log_set_handle(log_t *log, log_time_ptr tm_handler, 
 	log_level_ptr lv_handler);
+int    error_log_async_start(log_t *log, size_t ring_size, int overflow);
+void   error_log_async_stop(log_t *log);
+void   error_log_async_crash(log_t *log);
+void   error_log_async_stat(log_t *log, log_async_stat_t *stat);
 
 #endif
 
@@ -0,0 +1,343 @@
+#include <pthread.h>
+
+#include "dfs_gf.h"
+#include "dfs_memory.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define GF_X86 1
+#endif
+
+typedef void (*gf_dot_pt)(const uint8_t *coef, uchar_t **src, int n,
+	uchar_t *dst, size_t len);
+
+static void gf_build(void);
+static void gf_dot_scalar(const uint8_t *coef, uchar_t **src, int n,
+	uchar_t *dst, size_t len);
+#ifdef GF_X86
+static void gf_dot_ssse3(const uint8_t *coef, uchar_t **src, int n,
+	uchar_t *dst, size_t len);
+static void gf_dot_avx2(const uint8_t *coef, uchar_t **src, int n,
+	uchar_t *dst, size_t len);
+#endif
+
+static pthread_once_t gf_once = PTHREAD_ONCE_INIT;
+static uint8_t        gf_exp[512];
+static uint8_t        gf_log[256];
+static uint8_t        gf_mul_tbl[256][256];
+// per constant, its products with 0..15 and with 0x00..0xf0
+static uint8_t        gf_nib_tbl[256][32] __attribute__((aligned(32)));
+static gf_dot_pt      gf_dot = gf_dot_scalar;
+static int            gf_kernel = DFS_GF_SCALAR;
+
+void dfs_gf_init(void)
+{
+    pthread_once(&gf_once, gf_build);
+}
+
+int dfs_gf_use(int kernel)
+{
+    dfs_gf_init();
+
+	switch (kernel)
+	{
+	case DFS_GF_SCALAR:
+		gf_dot = gf_dot_scalar;
+		break;
+
+#ifdef GF_X86
+	case DFS_GF_SSSE3:
+		if (!__builtin_cpu_supports("ssse3"))
+		{
+            return DFS_ERROR;
+		}
+
+		gf_dot = gf_dot_ssse3;
+		break;
+
+	case DFS_GF_AVX2:
+		if (!__builtin_cpu_supports("avx2"))
+		{
+            return DFS_ERROR;
+		}
+
+		gf_dot = gf_dot_avx2;
+		break;
+#endif
+
+	default:
+		return DFS_ERROR;
+	}
+
+	gf_kernel = kernel;
+
+	return DFS_OK;
+}
+
+const char *dfs_gf_kernel(void)
+{
+    static const char *names[] = { "scalar", "ssse3", "avx2" };
+
+	return names[gf_kernel];
+}
+
+uint8_t dfs_gf_mul(uint8_t a, uint8_t b)
+{
+    return gf_mul_tbl[a][b];
+}
+
+uint8_t dfs_gf_inv(uint8_t a)
+{
+    return a ? gf_exp[255 - gf_log[a]] : 0;
+}
+
+void dfs_gf_dot(const uint8_t *coef, uchar_t **src, int n, uchar_t *dst,
+	size_t len)
+{
+    if (n <= 0)
+	{
+        memory_zero(dst, len);
+
+		return;
+	}
+
+	gf_dot(coef, src, n, dst, len);
+}
+
+static void gf_build(void)
+{
+    uint32_t x = 1;
+	int      i = 0;
+	int      j = 0;
+
+	for (i = 0; i < 255; i++)
+	{
+	    gf_exp[i] = (uint8_t)x;
+		gf_log[x] = (uint8_t)i;
+
+		x <<= 1;
+		if (x & 0x100)
+		{
+            x ^= DFS_GF_POLY;
+		}
+	}
+
+	// no modulo on a sum of two logs
+	for (i = 255; i < 512; i++)
+	{
+        gf_exp[i] = gf_exp[i - 255];
+	}
+
+	for (i = 1; i < 256; i++)
+	{
+	    for (j = 1; j < 256; j++)
+		{
+            gf_mul_tbl[i][j] = gf_exp[gf_log[i] + gf_log[j]];
+		}
+	}
+
+	for (i = 0; i < 256; i++)
+	{
+	    for (j = 0; j < 16; j++)
+		{
+		    gf_nib_tbl[i][j] = gf_mul_tbl[i][j];
+            gf_nib_tbl[i][16 + j] = gf_mul_tbl[i][j << 4];
+		}
+	}
+
+#ifdef GF_X86
+	__builtin_cpu_init();
+
+	if (__builtin_cpu_supports("avx2"))
+	{
+	    gf_dot = gf_dot_avx2;
+		gf_kernel = DFS_GF_AVX2;
+	}
+	else if (__builtin_cpu_supports("ssse3"))
+	{
+	    gf_dot = gf_dot_ssse3;
+		gf_kernel = DFS_GF_SSSE3;
+	}
+#endif
+}
+
+static void gf_dot_scalar(const uint8_t *coef, uchar_t **src, int n,
+	uchar_t *dst, size_t len)
+{
+    const uint8_t *row = NULL;
+	const uchar_t *s = NULL;
+	size_t         j = 0;
+	int            i = 0;
+
+	row = gf_mul_tbl[coef[0]];
+	s = src[0];
+
+	for (j = 0; j < len; j++)
+	{
+        dst[j] = row[s[j]];
+	}
+
+	for (i = 1; i < n; i++)
+	{
+	    row = gf_mul_tbl[coef[i]];
+		s = src[i];
+
+		if (coef[i] == 0)
+		{
+            continue;
+		}
+
+		if (coef[i] == 1)
+		{
+		    for (j = 0; j < len; j++)
+			{
+                dst[j] ^= s[j];
+			}
+
+			continue;
+		}
+
+		for (j = 0; j < len; j++)
+		{
+            dst[j] ^= row[s[j]];
+		}
+	}
+}
+
+#ifdef GF_X86
+
+// the tail of a region the vectors do not cover
+static void gf_dot_tail(const uint8_t *coef, uchar_t **src, int n,
+	uchar_t *dst, size_t from, size_t len)
+{
+    uchar_t *s[DFS_GF_MAX_SRC];
+	int      i = 0;
+
+	if (from >= len)
+	{
+        return;
+	}
+
+	for (i = 0; i < n; i++)
+	{
+        s[i] = src[i] + from;
+	}
+
+	gf_dot_scalar(coef, s, n, dst + from, len - from);
+}
+
+__attribute__((target("ssse3")))
+static void gf_dot_ssse3(const uint8_t *coef, uchar_t **src, int n,
+	uchar_t *dst, size_t len)
+{
+    __m128i lo[DFS_GF_MAX_SRC];
+	__m128i hi[DFS_GF_MAX_SRC];
+	__m128i mask;
+	__m128i x;
+	__m128i a0;
+	__m128i a1;
+	size_t  off = 0;
+	int     i = 0;
+
+	if (n > DFS_GF_MAX_SRC)
+	{
+	    gf_dot_scalar(coef, src, n, dst, len);
+
+		return;
+	}
+
+	mask = _mm_set1_epi8(0x0f);
+
+	for (i = 0; i < n; i++)
+	{
+	    lo[i] = _mm_load_si128((const __m128i *)gf_nib_tbl[coef[i]]);
+		hi[i] = _mm_load_si128((const __m128i *)(gf_nib_tbl[coef[i]] + 16));
+	}
+
+	// two vectors in flight hide the latency of the shuffles
+	for (off = 0; off + 32 <= len; off += 32)
+	{
+	    a0 = _mm_setzero_si128();
+		a1 = _mm_setzero_si128();
+
+		for (i = 0; i < n; i++)
+		{
+		    x = _mm_loadu_si128((const __m128i *)(src[i] + off));
+			a0 = _mm_xor_si128(a0, _mm_xor_si128(
+				_mm_shuffle_epi8(lo[i], _mm_and_si128(x, mask)),
+				_mm_shuffle_epi8(hi[i],
+					_mm_and_si128(_mm_srli_epi64(x, 4), mask))));
+
+			x = _mm_loadu_si128((const __m128i *)(src[i] + off + 16));
+			a1 = _mm_xor_si128(a1, _mm_xor_si128(
+				_mm_shuffle_epi8(lo[i], _mm_and_si128(x, mask)),
+				_mm_shuffle_epi8(hi[i],
+					_mm_and_si128(_mm_srli_epi64(x, 4), mask))));
+		}
+
+		_mm_storeu_si128((__m128i *)(dst + off), a0);
+		_mm_storeu_si128((__m128i *)(dst + off + 16), a1);
+	}
+
+	gf_dot_tail(coef, src, n, dst, off, len);
+}
+
+__attribute__((target("avx2")))
+static void gf_dot_avx2(const uint8_t *coef, uchar_t **src, int n,
+	uchar_t *dst, size_t len)
+{
+    __m256i lo[DFS_GF_MAX_SRC];
+	__m256i hi[DFS_GF_MAX_SRC];
+	__m256i mask;
+	__m256i x;
+	__m256i a0;
+	__m256i a1;
+	size_t  off = 0;
+	int     i = 0;
+
+	if (n > DFS_GF_MAX_SRC)
+	{
+	    gf_dot_scalar(coef, src, n, dst, len);
+
+		return;
+	}
+
+	mask = _mm256_set1_epi8(0x0f);
+
+	// pshufb looks up within each 128 bit lane, both get the table
+	for (i = 0; i < n; i++)
+	{
+	    lo[i] = _mm256_broadcastsi128_si256(
+			_mm_load_si128((const __m128i *)gf_nib_tbl[coef[i]]));
+		hi[i] = _mm256_broadcastsi128_si256(
+			_mm_load_si128((const __m128i *)(gf_nib_tbl[coef[i]] + 16)));
+	}
+
+	for (off = 0; off + 64 <= len; off += 64)
+	{
+	    a0 = _mm256_setzero_si256();
+		a1 = _mm256_setzero_si256();
+
+		for (i = 0; i < n; i++)
+		{
+		    x = _mm256_loadu_si256((const __m256i *)(src[i] + off));
+			a0 = _mm256_xor_si256(a0, _mm256_xor_si256(
+				_mm256_shuffle_epi8(lo[i], _mm256_and_si256(x, mask)),
+				_mm256_shuffle_epi8(hi[i],
+					_mm256_and_si256(_mm256_srli_epi64(x, 4), mask))));
+
+			x = _mm256_loadu_si256((const __m256i *)(src[i] + off + 32));
+			a1 = _mm256_xor_si256(a1, _mm256_xor_si256(
+				_mm256_shuffle_epi8(lo[i], _mm256_and_si256(x, mask)),
+				_mm256_shuffle_epi8(hi[i],
+					_mm256_and_si256(_mm256_srli_epi64(x, 4), mask))));
+		}
+
+		_mm256_storeu_si256((__m256i *)(dst + off), a0);
+		_mm256_storeu_si256((__m256i *)(dst + off + 32), a1);
+	}
+
+	gf_dot_tail(coef, src, n, dst, off, len);
+}
+
+#endif
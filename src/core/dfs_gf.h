@@ -0,0 +1,31 @@
+#ifndef DFS_GF_H
+#define DFS_GF_H
+
+#include "dfs_types.h"
+
+// GF(2^8) over x^8 + x^4 + x^3 + x^2 + 1, the field of the usual
+// reed-solomon codes. a product with a constant c is a lookup of the
+// low and the high nibble of every byte in two 16 entry tables of c,
+// which pshufb does for 16 or 32 bytes at a time
+
+#define DFS_GF_POLY        0x11d
+#define DFS_GF_MAX_SRC     32 // sources of one dot product
+
+#define DFS_GF_SCALAR      0
+#define DFS_GF_SSSE3       1
+#define DFS_GF_AVX2        2
+
+// builds the tables and picks the widest kernel this cpu runs,
+// any thread may call it any number of times
+void        dfs_gf_init(void);
+// DFS_ERROR if the cpu can not run that kernel
+int         dfs_gf_use(int kernel);
+const char *dfs_gf_kernel(void);
+
+uint8_t     dfs_gf_mul(uint8_t a, uint8_t b);
+uint8_t     dfs_gf_inv(uint8_t a);
+// dst = coef[0] * src[0] + ... + coef[n - 1] * src[n - 1]
+void        dfs_gf_dot(const uint8_t *coef, uchar_t **src, int n,
+    uchar_t *dst, size_t len);
+
+#endif
@@ -0,0 +1,321 @@
+#include "dfs_lz.h"
+#include "dfs_memory.h"
+
+static inline uint32_t lz_read32(const uchar_t *p);
+static inline uint64_t lz_read64(const uchar_t *p);
+static inline uint32_t lz_hash(uint32_t v);
+static inline void lz_copy8(uchar_t *dst, const uchar_t *src);
+static size_t lz_count(const uchar_t *ip, const uchar_t *ref,
+	const uchar_t *limit);
+static uchar_t *lz_put_len(uchar_t *op, size_t len);
+
+size_t dfs_lz_compress(const uchar_t *src, size_t n, uchar_t *dst,
+	size_t cap)
+{
+    uint32_t       table[1 << DFS_LZ_HASH_LOG];
+	const uchar_t *ip = src;
+	const uchar_t *anchor = src;
+	const uchar_t *end = src + n;
+	const uchar_t *mflimit = NULL;
+	const uchar_t *mlimit = NULL;
+	const uchar_t *ref = NULL;
+	uchar_t       *op = dst;
+	uchar_t       *oend = dst + cap;
+	uchar_t       *token = NULL;
+	size_t         lits = 0;
+	size_t         mlen = 0;
+	size_t         step = 0;
+	uint32_t       h = 0;
+
+	if (n > DFS_MAX_UINT32_VALUE)
+	{
+        return 0;
+	}
+
+	if (n >= DFS_LZ_MFLIMIT + 1)
+	{
+	    memory_zero(table, sizeof(table));
+
+		mflimit = end - DFS_LZ_MFLIMIT;
+		mlimit = end - DFS_LZ_LAST_LITS;
+		ip++;
+
+		while (ip < mflimit)
+		{
+		    h = lz_hash(lz_read32(ip));
+			ref = src + table[h];
+			table[h] = (uint32_t)(ip - src);
+
+			if (ref >= ip || ip - ref > DFS_LZ_MAX_OFFSET
+				|| lz_read32(ref) != lz_read32(ip))
+			{
+			    // skip faster through data that does not match
+			    step = 1 + ((ip - anchor) >> 6);
+                ip += step;
+
+				continue;
+			}
+
+			while (ip > anchor && ref > src && ip[-1] == ref[-1])
+			{
+                ip--;
+				ref--;
+			}
+
+			mlen = DFS_LZ_MIN_MATCH + lz_count(ip + DFS_LZ_MIN_MATCH,
+				ref + DFS_LZ_MIN_MATCH, mlimit);
+			lits = ip - anchor;
+
+			if (op + 1 + lits + lits / 255 + 2 + mlen / 255 + 2 > oend)
+			{
+                return 0;
+			}
+
+			token = op++;
+			*token = (uchar_t)((lits < 15 ? lits : 15) << 4);
+			if (lits >= 15)
+			{
+                op = lz_put_len(op, lits - 15);
+			}
+
+			memory_memcpy(op, anchor, lits);
+			op += lits;
+
+			*op++ = (uchar_t)(ip - ref);
+			*op++ = (uchar_t)((ip - ref) >> 8);
+
+			*token |= (uchar_t)(mlen - DFS_LZ_MIN_MATCH < 15
+				? mlen - DFS_LZ_MIN_MATCH : 15);
+			if (mlen - DFS_LZ_MIN_MATCH >= 15)
+			{
+                op = lz_put_len(op, mlen - DFS_LZ_MIN_MATCH - 15);
+			}
+
+			ip += mlen;
+			anchor = ip;
+
+			// the bytes the match covered can start the next one
+			if (ip - 2 > src && ip < mflimit)
+			{
+                table[lz_hash(lz_read32(ip - 2))] = (uint32_t)(ip - 2 - src);
+			}
+		}
+	}
+
+	lits = end - anchor;
+	if (op + 1 + lits + lits / 255 + 1 > oend)
+	{
+        return 0;
+	}
+
+	token = op++;
+	*token = (uchar_t)((lits < 15 ? lits : 15) << 4);
+	if (lits >= 15)
+	{
+        op = lz_put_len(op, lits - 15);
+	}
+
+	memory_memcpy(op, anchor, lits);
+	op += lits;
+
+	return (size_t)(op - dst) < n ? (size_t)(op - dst) : 0;
+}
+
+// every length and offset is checked, a corrupt input never reads or
+// writes out of its buffers
+ssize_t dfs_lz_decompress(const uchar_t *src, size_t n, uchar_t *dst,
+	size_t cap)
+{
+    const uchar_t *ip = src;
+	const uchar_t *iend = src + n;
+	const uchar_t *ref = NULL;
+	uchar_t       *op = dst;
+	uchar_t       *oend = dst + cap;
+	uchar_t       *mend = NULL;
+	size_t         lits = 0;
+	size_t         mlen = 0;
+	size_t         off = 0;
+	uint32_t       token = 0;
+	uint32_t       b = 0;
+
+	while (ip < iend)
+	{
+	    token = *ip++;
+
+		lits = token >> 4;
+		if (lits == 15)
+		{
+            do
+			{
+			    if (ip >= iend)
+				{
+                    return -1;
+				}
+
+				b = *ip++;
+				lits += b;
+			} while (b == 255);
+		}
+
+		if (lits > (size_t)(iend - ip) || lits > (size_t)(oend - op))
+		{
+            return -1;
+		}
+
+		// short runs are copied whole words at a time, past their end
+		// as long as both buffers have room for it
+		if (lits <= 16 && iend - ip >= 16 && oend - op >= 16)
+		{
+		    lz_copy8(op, ip);
+			lz_copy8(op + 8, ip + 8);
+		}
+		else
+		{
+            memory_memcpy(op, ip, lits);
+		}
+
+		op += lits;
+		ip += lits;
+
+		// the last sequence has no match
+		if (ip == iend)
+		{
+            break;
+		}
+
+		if (iend - ip < 2)
+		{
+            return -1;
+		}
+
+		off = ip[0] | (ip[1] << 8);
+		ip += 2;
+
+		if (!off || off > (size_t)(op - dst))
+		{
+            return -1;
+		}
+
+		mlen = token & 15;
+		if (mlen == 15)
+		{
+            do
+			{
+			    if (ip >= iend)
+				{
+                    return -1;
+				}
+
+				b = *ip++;
+				mlen += b;
+			} while (b == 255);
+		}
+
+		mlen += DFS_LZ_MIN_MATCH;
+		if (mlen > (size_t)(oend - op))
+		{
+            return -1;
+		}
+
+		ref = op - off;
+
+		if (off >= 8 && (size_t)(oend - op) >= mlen + 8)
+		{
+		    // a word never reads what it writes at 8 bytes apart or more
+		    mend = op + mlen;
+
+            do
+			{
+			    lz_copy8(op, ref);
+				op += 8;
+				ref += 8;
+			} while (op < mend);
+
+			op = mend;
+		}
+		else if (off >= mlen)
+		{
+            memory_memcpy(op, ref, mlen);
+			op += mlen;
+		}
+		else
+		{
+		    // overlapping, a run repeats the last off bytes
+            while (mlen--)
+			{
+                *op++ = *ref++;
+			}
+		}
+	}
+
+	return op - dst;
+}
+
+static inline uint32_t lz_read32(const uchar_t *p)
+{
+    uint32_t v = 0;
+
+	memory_memcpy(&v, p, sizeof(v));
+
+	return v;
+}
+
+static inline uint64_t lz_read64(const uchar_t *p)
+{
+    uint64_t v = 0;
+
+	memory_memcpy(&v, p, sizeof(v));
+
+	return v;
+}
+
+static inline void lz_copy8(uchar_t *dst, const uchar_t *src)
+{
+    memory_memcpy(dst, src, 8);
+}
+
+static inline uint32_t lz_hash(uint32_t v)
+{
+    return (v * 2654435761U) >> (32 - DFS_LZ_HASH_LOG);
+}
+
+// bytes ip and ref have in common, up to limit
+static size_t lz_count(const uchar_t *ip, const uchar_t *ref,
+	const uchar_t *limit)
+{
+    const uchar_t *start = ip;
+	uint64_t       diff = 0;
+
+	while (ip + 8 <= limit)
+	{
+	    diff = lz_read64(ip) ^ lz_read64(ref);
+		if (diff)
+		{
+            return ip - start + (__builtin_ctzll(diff) >> 3);
+		}
+
+		ip += 8;
+		ref += 8;
+	}
+
+	while (ip < limit && *ip == *ref)
+	{
+        ip++;
+		ref++;
+	}
+
+	return ip - start;
+}
+
+static uchar_t *lz_put_len(uchar_t *op, size_t len)
+{
+    while (len >= 255)
+	{
+        *op++ = 255;
+		len -= 255;
+	}
+
+	*op++ = (uchar_t)len;
+
+	return op;
+}
@@ -0,0 +1,25 @@
+#ifndef DFS_LZ_H
+#define DFS_LZ_H
+
+#include "dfs_types.h"
+
+// lz77 in the lz4 block format: a token with the literal and match
+// lengths, the literals, a 2 byte offset. no entropy stage, so it
+// costs little cpu on either side
+
+#define DFS_LZ_HASH_LOG     12
+#define DFS_LZ_MIN_MATCH    4
+#define DFS_LZ_LAST_LITS    5   // the end of a block is always literals
+#define DFS_LZ_MFLIMIT      12  // no match starts closer to the end
+#define DFS_LZ_MAX_OFFSET   65535
+
+#define dfs_lz_bound(n)     ((n) + (n) / 255 + 16)
+
+// returns the compressed size, 0 if it would not come out smaller
+size_t  dfs_lz_compress(const uchar_t *src, size_t n, uchar_t *dst,
+    size_t cap);
+// returns the decompressed size, -1 on a corrupt or too large input
+ssize_t dfs_lz_decompress(const uchar_t *src, size_t n, uchar_t *dst,
+    size_t cap);
+
+#endif
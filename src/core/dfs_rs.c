@@ -0,0 +1,166 @@
+#include "dfs_rs.h"
+#include "dfs_gf.h"
+#include "dfs_memory.h"
+
+static int rs_invert(uint8_t a[][DFS_RS_MAX_UNITS], int n,
+	uint8_t inv[][DFS_RS_MAX_UNITS]);
+
+int dfs_rs_init(dfs_rs_t *rs, int k, int m)
+{
+    int i = 0;
+	int j = 0;
+
+	if (k < 1 || m < 0 || k + m > DFS_RS_MAX_UNITS)
+	{
+        return DFS_ERROR;
+	}
+
+	dfs_gf_init();
+
+	memory_zero(rs, sizeof(dfs_rs_t));
+	rs->k = k;
+	rs->m = m;
+
+	for (i = 0; i < k; i++)
+	{
+        rs->gen[i][i] = 1;
+	}
+
+	// 1 / (x_i + y_j), x_i = k + i and y_j = j never meet
+	for (i = 0; i < m; i++)
+	{
+	    for (j = 0; j < k; j++)
+		{
+            rs->gen[k + i][j] = dfs_gf_inv((uint8_t)((k + i) ^ j));
+		}
+	}
+
+	return DFS_OK;
+}
+
+void dfs_rs_encode(dfs_rs_t *rs, uchar_t **data, uchar_t **parity,
+	size_t len)
+{
+    int i = 0;
+
+	for (i = 0; i < rs->m; i++)
+	{
+        dfs_gf_dot(rs->gen[rs->k + i], data, rs->k, parity[i], len);
+	}
+}
+
+int dfs_rs_decode_coef(dfs_rs_t *rs, const int *have, int want,
+	uint8_t *coef)
+{
+    uint8_t a[DFS_RS_MAX_UNITS][DFS_RS_MAX_UNITS];
+	uint8_t inv[DFS_RS_MAX_UNITS][DFS_RS_MAX_UNITS];
+	int     i = 0;
+	int     j = 0;
+	int     l = 0;
+	uint8_t c = 0;
+
+	if (want < 0 || want >= rs->k + rs->m)
+	{
+        return DFS_ERROR;
+	}
+
+	for (i = 0; i < rs->k; i++)
+	{
+	    if (have[i] < 0 || have[i] >= rs->k + rs->m)
+		{
+            return DFS_ERROR;
+		}
+
+        memory_memcpy(a[i], rs->gen[have[i]], rs->k);
+	}
+
+	// a repeated unit leaves it singular
+	if (rs_invert(a, rs->k, inv) != DFS_OK)
+	{
+        return DFS_ERROR;
+	}
+
+	// data = inv * have, so unit want = gen[want] * inv * have
+	for (j = 0; j < rs->k; j++)
+	{
+	    c = 0;
+
+		for (l = 0; l < rs->k; l++)
+		{
+            c ^= dfs_gf_mul(rs->gen[want][l], inv[l][j]);
+		}
+
+		coef[j] = c;
+	}
+
+	return DFS_OK;
+}
+
+// gauss-jordan, a is destroyed
+static int rs_invert(uint8_t a[][DFS_RS_MAX_UNITS], int n,
+	uint8_t inv[][DFS_RS_MAX_UNITS])
+{
+    uint8_t t = 0;
+	uint8_t c = 0;
+	int     i = 0;
+	int     j = 0;
+	int     r = 0;
+
+	memory_zero(inv, sizeof(uint8_t) * DFS_RS_MAX_UNITS * n);
+
+	for (i = 0; i < n; i++)
+	{
+        inv[i][i] = 1;
+	}
+
+	for (i = 0; i < n; i++)
+	{
+	    for (r = i; r < n && !a[r][i]; r++)
+		{
+		}
+
+		if (r == n)
+		{
+            return DFS_ERROR;
+		}
+
+		if (r != i)
+		{
+		    for (j = 0; j < n; j++)
+			{
+			    t = a[i][j];
+				a[i][j] = a[r][j];
+				a[r][j] = t;
+
+				t = inv[i][j];
+				inv[i][j] = inv[r][j];
+				inv[r][j] = t;
+			}
+		}
+
+		c = dfs_gf_inv(a[i][i]);
+
+		for (j = 0; j < n; j++)
+		{
+		    a[i][j] = dfs_gf_mul(a[i][j], c);
+            inv[i][j] = dfs_gf_mul(inv[i][j], c);
+		}
+
+		for (r = 0; r < n; r++)
+		{
+		    c = a[r][i];
+			if (r == i || !c)
+			{
+                continue;
+			}
+
+			for (j = 0; j < n; j++)
+			{
+			    a[r][j] ^= dfs_gf_mul(a[i][j], c);
+                inv[r][j] ^= dfs_gf_mul(inv[i][j], c);
+			}
+		}
+	}
+
+	return DFS_OK;
+}
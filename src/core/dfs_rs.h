@@ -0,0 +1,28 @@
+#ifndef DFS_RS_H
+#define DFS_RS_H
+
+#include "dfs_types.h"
+
+// systematic reed-solomon over GF(2^8): k data units stored as they are
+// and m parity units, any k of the k + m give back the others. the
+// parity rows are a cauchy matrix, so every k rows of the generator
+// can be inverted
+
+#define DFS_RS_MAX_UNITS 16 // k + m
+
+typedef struct dfs_rs_s
+{
+    int     k;
+	int     m;
+	uint8_t gen[DFS_RS_MAX_UNITS][DFS_RS_MAX_UNITS]; // k + m rows of k
+} dfs_rs_t;
+
+int  dfs_rs_init(dfs_rs_t *rs, int k, int m);
+void dfs_rs_encode(dfs_rs_t *rs, uchar_t **data, uchar_t **parity,
+    size_t len);
+// the k coefficients that give unit want out of the units in have[],
+// for dfs_gf_dot over the same k units in the same order
+int  dfs_rs_decode_coef(dfs_rs_t *rs, const int *have, int want,
+    uint8_t *coef);
+
+#endif
@@ -244,3 +244,12 @@ int time_monthtoi(const char *s)
     return DFS_ERROR;
 }
 
+// for measuring, not affected by clock changes
+uint64_t time_monotonic_us(void)
+{
+    struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
@@ -46,6 +46,7 @@ void     time_localtime(time_t s, struct tm *tm);
 void     time_gmtime(time_t t, struct tm *tp);
 uchar_t *time_to_http_time(uchar_t *buf, time_t t);
 uchar_t *time_to_http_cookie_time(uchar_t *buf, time_t t);
+uint64_t time_monotonic_us(void);
 
 #endif
 
@@ -0,0 +1,895 @@
+#include "dn_blk_index.h"
+#include "dfs_memory.h"
+#include "dfs_error_log.h"
+#include "dn_cycle.h"
+
+#define BLK_INDEX_PROBE_REGIONS 8 // regions a lookup validates before it locks
+
+#define blk_slot_home(t, e)  (blk_index_hash((e)->ns_id, (e)->blk_id) & (t)->mask)
+#define blk_slot_dist(t, e, pos) (((pos) - blk_slot_home(t, e)) & (t)->mask)
+#define blk_slot_region(pos) ((pos) >> BLK_INDEX_REGION_SHIFT)
+#define blk_table_regions(t) (((t)->mask + 1) >> BLK_INDEX_REGION_SHIFT)
+
+#define blk_read_barrier()   __atomic_thread_fence(__ATOMIC_ACQUIRE)
+#define blk_write_barrier()  __atomic_thread_fence(__ATOMIC_RELEASE)
+
+// a reader publishes the global epoch it started in, a retired table
+// is freed once every busy reader started after it was retired
+typedef struct blk_epoch_slot_s
+{
+    volatile uint64_t epoch; // 0 while outside a lookup
+    volatile uint32_t used;
+    char              pad[52];
+} blk_epoch_slot_t;
+
+static blk_epoch_slot_t   g_blk_epochs[BLK_INDEX_EPOCH_SLOTS];
+static volatile uint64_t  g_blk_epoch = 1;
+static pthread_key_t      g_blk_epoch_key;
+static pthread_once_t     g_blk_epoch_once = PTHREAD_ONCE_INIT;
+
+static uint64_t blk_index_hash(long ns_id, long blk_id);
+static blk_table_t *blk_table_create(uint64_t cap);
+static void blk_table_destroy(blk_table_t *t);
+static void blk_table_seq_begin(blk_table_t *t, uint64_t from, uint64_t to);
+static void blk_table_seq_end(blk_table_t *t, uint64_t from, uint64_t to);
+static blk_entry_t *blk_table_find(blk_table_t *t, long ns_id, long blk_id);
+static int blk_table_lookup(blk_table_t *t, long ns_id, long blk_id,
+	blk_entry_t *out);
+static void blk_table_insert(blk_table_t *t, blk_entry_t *e);
+static void blk_table_remove(blk_table_t *t, blk_entry_t *s);
+static void blk_table_update(blk_table_t *t, blk_entry_t *s,
+	blk_entry_t *e);
+static blk_entry_t *blk_index_find(blk_index_t *idx, long ns_id,
+	long blk_id, blk_table_t **tp);
+static int blk_index_insert(blk_index_t *idx, blk_entry_t *e,
+	blk_entry_t *prev);
+static int blk_index_grow(blk_index_t *idx);
+static void blk_index_migrate(blk_index_t *idx, uint64_t n);
+static void blk_index_retire(blk_index_t *idx, blk_table_t *t);
+static void blk_index_reclaim(blk_index_t *idx);
+static int blk_index_remove(blk_index_t *idx, long ns_id, long blk_id,
+	int check_gen, uint8_t gen, blk_entry_t *out);
+static void blk_epoch_key_create(void);
+static void blk_epoch_slot_free(void *arg);
+static blk_epoch_slot_t *blk_epoch_enter(void);
+
+static uint64_t blk_index_hash(long ns_id, long blk_id)
+{
+    uint64_t z = (uint64_t)blk_id ^ ((uint64_t)ns_id * 0x9e3779b97f4a7c15ULL);
+
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+
+	return z ^ (z >> 31);
+}
+
+static blk_table_t *blk_table_create(uint64_t cap)
+{
+    blk_table_t *t = NULL;
+
+	t = (blk_table_t *)memory_calloc(sizeof(blk_table_t));
+	if (!t)
+	{
+        return NULL;
+	}
+
+	// calloc of a large table is backed by lazily zeroed pages
+	t->slots = (blk_entry_t *)calloc(cap, sizeof(blk_entry_t));
+	t->seqs = (volatile uint32_t *)calloc(cap >> BLK_INDEX_REGION_SHIFT,
+		sizeof(uint32_t));
+	if (!t->slots || !t->seqs)
+	{
+	    free(t->slots);
+		free((void *)t->seqs);
+	    memory_free(t, sizeof(blk_table_t));
+
+        return NULL;
+	}
+
+	t->mask = cap - 1;
+
+	return t;
+}
+
+static void blk_table_destroy(blk_table_t *t)
+{
+    if (!t)
+	{
+        return;
+	}
+
+	memory_free((void *)t->seqs,
+		blk_table_regions(t) * sizeof(uint32_t));
+	memory_free(t->slots, (t->mask + 1) * sizeof(blk_entry_t));
+	memory_free(t, sizeof(blk_table_t));
+}
+
+// makes the regions of slots from..to odd, the range may wrap
+static void blk_table_seq_begin(blk_table_t *t, uint64_t from, uint64_t to)
+{
+    uint64_t r = blk_slot_region(from);
+	uint64_t last = blk_slot_region(to);
+	uint64_t n = blk_table_regions(t);
+
+	for ( ;; )
+	{
+        t->seqs[r]++;
+
+		if (r == last)
+		{
+            break;
+		}
+
+		r = (r + 1) % n;
+	}
+
+	blk_write_barrier();
+}
+
+static void blk_table_seq_end(blk_table_t *t, uint64_t from, uint64_t to)
+{
+    uint64_t r = blk_slot_region(from);
+	uint64_t last = blk_slot_region(to);
+	uint64_t n = blk_table_regions(t);
+
+	blk_write_barrier();
+
+	for ( ;; )
+	{
+        t->seqs[r]++;
+
+		if (r == last)
+		{
+            break;
+		}
+
+		r = (r + 1) % n;
+	}
+}
+
+// stops at an empty slot or at a richer entry than the one searched,
+// moved entries keep their key so the probe chains of the old table hold
+static blk_entry_t *blk_table_find(blk_table_t *t, long ns_id, long blk_id)
+{
+    uint64_t     pos = blk_index_hash(ns_id, blk_id) & t->mask;
+	uint64_t     d = 0;
+	blk_entry_t *s = NULL;
+
+	for ( ;; )
+	{
+        s = &t->slots[pos];
+
+		if (!(s->flags & (BLK_ENTRY_USED | BLK_ENTRY_MOVED))
+			|| blk_slot_dist(t, s, pos) < d)
+		{
+            return NULL;
+		}
+
+		if ((s->flags & BLK_ENTRY_USED) && s->blk_id == blk_id
+			&& s->ns_id == ns_id)
+		{
+            return s;
+		}
+
+		pos = (pos + 1) & t->mask;
+		d++;
+	}
+}
+
+// the unlocked twin of blk_table_find, slots are copied out and only
+// trusted once the seqs of every region probed are unchanged.
+// DFS_AGAIN if a writer got in the way
+static int blk_table_lookup(blk_table_t *t, long ns_id, long blk_id,
+	blk_entry_t *out)
+{
+    uint64_t    pos = blk_index_hash(ns_id, blk_id) & t->mask;
+	uint64_t    d = 0;
+	uint64_t    region[BLK_INDEX_PROBE_REGIONS];
+	uint32_t    seq[BLK_INDEX_PROBE_REGIONS];
+	int         n = 0;
+	int         i = 0;
+	int         rs = DFS_ERROR;
+	blk_entry_t e;
+
+	for ( ;; )
+	{
+	    if (n == 0 || blk_slot_region(pos) != region[n - 1])
+		{
+		    if (n == BLK_INDEX_PROBE_REGIONS)
+			{
+                return DFS_DECLINED;
+			}
+
+		    region[n] = blk_slot_region(pos);
+            seq[n] = t->seqs[region[n]];
+			if (seq[n] & 1)
+			{
+                return DFS_AGAIN;
+			}
+
+			n++;
+			blk_read_barrier();
+		}
+
+        e = t->slots[pos];
+
+		if (!(e.flags & (BLK_ENTRY_USED | BLK_ENTRY_MOVED))
+			|| blk_slot_dist(t, &e, pos) < d)
+		{
+            break;
+		}
+
+		if ((e.flags & BLK_ENTRY_USED) && e.blk_id == blk_id
+			&& e.ns_id == ns_id)
+		{
+		    *out = e;
+			rs = DFS_OK;
+
+            break;
+		}
+
+		pos = (pos + 1) & t->mask;
+
+		// a torn read can not loop forever
+		if (++d > t->mask)
+		{
+            return DFS_AGAIN;
+		}
+	}
+
+	blk_read_barrier();
+
+	for (i = 0; i < n; i++)
+	{
+        if (t->seqs[region[i]] != seq[i])
+		{
+            return DFS_AGAIN;
+		}
+	}
+
+	return rs;
+}
+
+// e must not be in the table yet
+static void blk_table_insert(blk_table_t *t, blk_entry_t *e)
+{
+    blk_entry_t  cur = *e;
+	blk_entry_t  tmp;
+	blk_entry_t *s = NULL;
+	uint64_t     home = blk_slot_home(t, &cur);
+	uint64_t     pos = home;
+	uint64_t     end = home;
+	uint64_t     d = 0;
+	uint64_t     sd = 0;
+
+	cur.flags = (cur.flags & ~BLK_ENTRY_MOVED) | BLK_ENTRY_USED;
+
+	// every slot up to the first empty one may be shifted
+	while (t->slots[end].flags & BLK_ENTRY_USED)
+	{
+        end = (end + 1) & t->mask;
+	}
+
+	blk_table_seq_begin(t, home, end);
+
+	for ( ;; )
+	{
+        s = &t->slots[pos];
+
+		if (!(s->flags & BLK_ENTRY_USED))
+		{
+            *s = cur;
+			t->count++;
+
+			break;
+		}
+
+		// take from the rich
+		sd = blk_slot_dist(t, s, pos);
+		if (sd < d)
+		{
+            tmp = *s;
+			*s = cur;
+			cur = tmp;
+			d = sd;
+		}
+
+		pos = (pos + 1) & t->mask;
+		d++;
+	}
+
+	blk_table_seq_end(t, home, end);
+}
+
+// backward shift, no tombstones in the current table
+static void blk_table_remove(blk_table_t *t, blk_entry_t *s)
+{
+    uint64_t     from = s - t->slots;
+    uint64_t     pos = from;
+	uint64_t     end = from;
+	uint64_t     next = 0;
+	blk_entry_t *n = NULL;
+
+	for ( ;; )
+	{
+        next = (end + 1) & t->mask;
+		n = &t->slots[next];
+
+		if (!(n->flags & BLK_ENTRY_USED) || blk_slot_dist(t, n, next) == 0)
+		{
+            break;
+		}
+
+		end = next;
+	}
+
+	blk_table_seq_begin(t, from, end);
+
+	while (pos != end)
+	{
+	    next = (pos + 1) & t->mask;
+		t->slots[pos] = t->slots[next];
+		pos = next;
+	}
+
+	memory_zero(&t->slots[pos], sizeof(blk_entry_t));
+	t->count--;
+
+	blk_table_seq_end(t, from, end);
+}
+
+// rewrites one slot in place
+static void blk_table_update(blk_table_t *t, blk_entry_t *s,
+	blk_entry_t *e)
+{
+    uint64_t pos = s - t->slots;
+
+	blk_table_seq_begin(t, pos, pos);
+	*s = *e;
+	blk_table_seq_end(t, pos, pos);
+}
+
+int blk_index_init(blk_index_t *idx, uint64_t cap)
+{
+    uint64_t n = BLK_INDEX_REGION_SLOTS;
+
+	while (n < cap)
+	{
+        n <<= 1;
+	}
+
+	memory_zero(idx, sizeof(blk_index_t));
+
+	pthread_once(&g_blk_epoch_once, blk_epoch_key_create);
+
+	idx->cur = blk_table_create(n);
+	if (!idx->cur)
+	{
+	    dfs_log_error(dfs_cycle->error_log, DFS_LOG_ALERT, errno,
+			"create blk index of %uL slots err", n);
+
+        return DFS_ERROR;
+	}
+
+	pthread_mutex_init(&idx->wlock, NULL);
+
+	return DFS_OK;
+}
+
+// no lookup may be running any more
+void blk_index_release(blk_index_t *idx)
+{
+    blk_table_t *t = NULL;
+
+    blk_table_destroy(idx->old);
+	blk_table_destroy(idx->cur);
+	idx->old = NULL;
+	idx->cur = NULL;
+	idx->count = 0;
+
+	while (idx->retired)
+	{
+	    t = idx->retired;
+		idx->retired = t->next_retired;
+        blk_table_destroy(t);
+	}
+
+	pthread_mutex_destroy(&idx->wlock);
+}
+
+static void blk_epoch_key_create(void)
+{
+    pthread_key_create(&g_blk_epoch_key, blk_epoch_slot_free);
+}
+
+// a thread gives its epoch slot back when it exits
+static void blk_epoch_slot_free(void *arg)
+{
+    blk_epoch_slot_t *es = (blk_epoch_slot_t *)arg;
+
+	es->epoch = 0;
+	__sync_lock_release(&es->used);
+}
+
+// NULL if every slot is taken, the caller then locks
+static blk_epoch_slot_t *blk_epoch_enter(void)
+{
+    blk_epoch_slot_t *es = NULL;
+	int               i = 0;
+
+	es = (blk_epoch_slot_t *)pthread_getspecific(g_blk_epoch_key);
+	if (!es)
+	{
+        for (i = 0; i < BLK_INDEX_EPOCH_SLOTS; i++)
+		{
+            if (!g_blk_epochs[i].used
+				&& !__sync_lock_test_and_set(&g_blk_epochs[i].used, 1))
+			{
+                es = &g_blk_epochs[i];
+
+				break;
+			}
+		}
+
+		if (!es)
+		{
+            return NULL;
+		}
+
+		pthread_setspecific(g_blk_epoch_key, es);
+	}
+
+	es->epoch = g_blk_epoch;
+	// the epoch must be visible before any table pointer is loaded
+	__sync_synchronize();
+
+	return es;
+}
+
+// the old table first, a resize copies into cur before marking moved
+static blk_entry_t *blk_index_find(blk_index_t *idx, long ns_id,
+	long blk_id, blk_table_t **tp)
+{
+    blk_entry_t *s = NULL;
+
+	if (idx->old)
+	{
+        s = blk_table_find(idx->old, ns_id, blk_id);
+		if (s)
+		{
+		    *tp = idx->old;
+
+            return s;
+		}
+	}
+
+	*tp = idx->cur;
+
+	return blk_table_find(idx->cur, ns_id, blk_id);
+}
+
+static int blk_index_grow(blk_index_t *idx)
+{
+    blk_table_t *t = NULL;
+
+	// a resize must be done before the next one starts
+	if (idx->old)
+	{
+        blk_index_migrate(idx, idx->old->mask + 1);
+	}
+
+	t = blk_table_create((idx->cur->mask + 1) << 1);
+	if (!t)
+	{
+	    dfs_log_error(dfs_cycle->error_log, DFS_LOG_ALERT, errno,
+			"grow blk index to %uL slots err", (idx->cur->mask + 1) << 1);
+
+        return DFS_ERROR;
+	}
+
+	idx->tseq++;
+	blk_write_barrier();
+	idx->old = idx->cur;
+	idx->cur = t;
+	blk_write_barrier();
+	idx->tseq++;
+
+	idx->migrate_pos = 0;
+
+	dfs_log_error(dfs_cycle->error_log, DFS_LOG_INFO, 0,
+		"blk index grows to %uL slots, blks: %uL", t->mask + 1, idx->count);
+
+	return DFS_OK;
+}
+
+static void blk_index_migrate(blk_index_t *idx, uint64_t n)
+{
+    blk_table_t *old = idx->old;
+	blk_entry_t *s = NULL;
+	blk_entry_t  moved;
+
+	if (!old)
+	{
+        return;
+	}
+
+	memory_zero(&moved, sizeof(blk_entry_t));
+
+	while (n-- > 0 && idx->migrate_pos <= old->mask)
+	{
+        s = &old->slots[idx->migrate_pos++];
+
+		if (s->flags & BLK_ENTRY_USED)
+		{
+            blk_table_insert(idx->cur, s);
+
+			moved.blk_id = s->blk_id;
+			moved.ns_id = s->ns_id;
+			moved.flags = BLK_ENTRY_MOVED;
+			blk_table_update(old, s, &moved);
+			old->count--;
+		}
+	}
+
+	if (idx->migrate_pos > old->mask)
+	{
+	    idx->tseq++;
+		blk_write_barrier();
+	    idx->old = NULL;
+		blk_write_barrier();
+		idx->tseq++;
+
+        blk_index_retire(idx, old);
+	}
+}
+
+// lookups may still be probing t, it waits for them on the retired list
+static void blk_index_retire(blk_index_t *idx, blk_table_t *t)
+{
+    t->retire_epoch = __sync_fetch_and_add(&g_blk_epoch, 1);
+	t->next_retired = idx->retired;
+	idx->retired = t;
+
+	blk_index_reclaim(idx);
+}
+
+static void blk_index_reclaim(blk_index_t *idx)
+{
+    blk_table_t **tp = NULL;
+	blk_table_t  *t = NULL;
+	uint64_t      min = (uint64_t)-1;
+	uint64_t      e = 0;
+	int           i = 0;
+
+	if (!idx->retired)
+	{
+        return;
+	}
+
+	__sync_synchronize();
+
+	for (i = 0; i < BLK_INDEX_EPOCH_SLOTS; i++)
+	{
+        e = g_blk_epochs[i].epoch;
+		if (e && e < min)
+		{
+            min = e;
+		}
+	}
+
+	tp = &idx->retired;
+
+	while (*tp)
+	{
+	    t = *tp;
+
+		if (t->retire_epoch < min)
+		{
+		    *tp = t->next_retired;
+            blk_table_destroy(t);
+
+			continue;
+		}
+
+		tp = &t->next_retired;
+	}
+}
+
+static int blk_index_insert(blk_index_t *idx, blk_entry_t *e,
+	blk_entry_t *prev)
+{
+    blk_table_t *t = NULL;
+    blk_entry_t *s = NULL;
+	blk_entry_t  n;
+
+	blk_index_reclaim(idx);
+
+	s = blk_index_find(idx, e->ns_id, e->blk_id, &t);
+	if (s)
+	{
+	    if (prev)
+		{
+		    *prev = *s;
+			n = *s;
+            n.size = e->size;
+			n.vol = e->vol;
+			n.snap_slot = e->snap_slot;
+			n.flags = (e->flags & ~BLK_ENTRY_MOVED) | BLK_ENTRY_USED;
+			blk_table_update(t, s, &n);
+		}
+
+        return DFS_BUSY;
+	}
+
+	if (blk_index_full(idx->cur) && blk_index_grow(idx) != DFS_OK)
+	{
+        return DFS_ERROR;
+	}
+
+	blk_table_insert(idx->cur, e);
+	idx->count++;
+
+	blk_index_migrate(idx, BLK_INDEX_MIGRATE_STEP);
+
+	return DFS_OK;
+}
+
+// takes no lock unless the thread has no epoch slot or the probe is
+// unusually long, the entry is copied out
+int blk_index_get(blk_index_t *idx, long ns_id, long blk_id,
+	blk_entry_t *out)
+{
+    blk_epoch_slot_t *es = NULL;
+    blk_table_t      *old = NULL;
+	blk_table_t      *cur = NULL;
+	blk_table_t      *t = NULL;
+    blk_entry_t      *s = NULL;
+	uint32_t          tseq = 0;
+	int               rs = DFS_ERROR;
+
+	es = blk_epoch_enter();
+	if (!es)
+	{
+        goto locked;
+	}
+
+	for ( ;; )
+	{
+        tseq = idx->tseq;
+		if (tseq & 1)
+		{
+            continue;
+		}
+
+		blk_read_barrier();
+		old = idx->old;
+		cur = idx->cur;
+
+		rs = old ? blk_table_lookup(old, ns_id, blk_id, out) : DFS_ERROR;
+		if (rs == DFS_ERROR)
+		{
+            rs = blk_table_lookup(cur, ns_id, blk_id, out);
+		}
+
+		blk_read_barrier();
+
+		if (rs == DFS_DECLINED || (rs != DFS_AGAIN && idx->tseq == tseq))
+		{
+            break;
+		}
+	}
+
+	es->epoch = 0;
+
+	if (rs != DFS_DECLINED)
+	{
+        return rs;
+	}
+
+locked:
+	pthread_mutex_lock(&idx->wlock);
+
+	s = blk_index_find(idx, ns_id, blk_id, &t);
+	if (s)
+	{
+        *out = *s;
+	}
+
+	pthread_mutex_unlock(&idx->wlock);
+
+	return s ? DFS_OK : DFS_ERROR;
+}
+
+// DFS_BUSY if the blk is there already, it is replaced and the old
+// entry returned only if prev is given
+int blk_index_add(blk_index_t *idx, blk_entry_t *e, blk_entry_t *prev)
+{
+    int rs = DFS_OK;
+
+	pthread_mutex_lock(&idx->wlock);
+	rs = blk_index_insert(idx, e, prev);
+	pthread_mutex_unlock(&idx->wlock);
+
+	return rs;
+}
+
+// adds the absent ones under one lock, added[i] tells which
+int blk_index_add_batch(blk_index_t *idx, blk_entry_t *ents, int n,
+	uchar_t *added)
+{
+    int i = 0;
+	int rs = DFS_OK;
+
+	pthread_mutex_lock(&idx->wlock);
+
+	for (i = 0; i < n; i++)
+	{
+	    added[i] = DFS_FALSE;
+
+		if (rs == DFS_ERROR)
+		{
+            continue;
+		}
+
+        rs = blk_index_insert(idx, &ents[i], NULL);
+		if (rs == DFS_OK)
+		{
+            added[i] = DFS_TRUE;
+		}
+	}
+
+	pthread_mutex_unlock(&idx->wlock);
+
+	return rs == DFS_ERROR ? DFS_ERROR : DFS_OK;
+}
+
+static int blk_index_remove(blk_index_t *idx, long ns_id, long blk_id,
+	int check_gen, uint8_t gen, blk_entry_t *out)
+{
+    blk_table_t *t = NULL;
+	blk_entry_t *s = NULL;
+	blk_entry_t  moved;
+
+	blk_index_reclaim(idx);
+
+	s = blk_index_find(idx, ns_id, blk_id, &t);
+	if (!s || (check_gen && blk_entry_gen(s) == gen))
+	{
+        return DFS_ERROR;
+	}
+
+	if (out)
+	{
+        *out = *s;
+	}
+
+	if (t == idx->old)
+	{
+	    // keep the probe chains of the old table intact
+	    memory_zero(&moved, sizeof(blk_entry_t));
+		moved.blk_id = blk_id;
+		moved.ns_id = ns_id;
+		moved.flags = BLK_ENTRY_MOVED;
+        blk_table_update(t, s, &moved);
+		t->count--;
+	}
+	else
+	{
+        blk_table_remove(t, s);
+	}
+
+	idx->count--;
+
+	blk_index_migrate(idx, BLK_INDEX_MIGRATE_STEP);
+
+	return DFS_OK;
+}
+
+int blk_index_del(blk_index_t *idx, long ns_id, long blk_id,
+	blk_entry_t *out)
+{
+    int rs = DFS_OK;
+
+	pthread_mutex_lock(&idx->wlock);
+	rs = blk_index_remove(idx, ns_id, blk_id, DFS_FALSE, 0, out);
+	pthread_mutex_unlock(&idx->wlock);
+
+	return rs;
+}
+
+// only if the blk was not seen by scanner pass gen
+int blk_index_del_stale(blk_index_t *idx, long ns_id, long blk_id,
+	uint8_t gen, blk_entry_t *out)
+{
+    int rs = DFS_OK;
+
+	pthread_mutex_lock(&idx->wlock);
+	rs = blk_index_remove(idx, ns_id, blk_id, DFS_TRUE, gen, out);
+	pthread_mutex_unlock(&idx->wlock);
+
+	return rs;
+}
+
+int blk_index_mark(blk_index_t *idx, long ns_id, long blk_id,
+	uint8_t gen)
+{
+    blk_entry_t e;
+	uchar_t     found = DFS_FALSE;
+
+	e.ns_id = ns_id;
+	e.blk_id = blk_id;
+
+	blk_index_mark_batch(idx, &e, 1, gen, &found);
+
+	return found ? DFS_OK : DFS_ERROR;
+}
+
+// stamps the scanner pass on the blks that exist, found[i] tells which
+int blk_index_mark_batch(blk_index_t *idx, blk_entry_t *ents, int n,
+	uint8_t gen, uchar_t *found)
+{
+    blk_table_t *t = NULL;
+    blk_entry_t *s = NULL;
+	blk_entry_t  e;
+	int          i = 0;
+	int          hits = 0;
+
+	pthread_mutex_lock(&idx->wlock);
+
+	for (i = 0; i < n; i++)
+	{
+        s = blk_index_find(idx, ents[i].ns_id, ents[i].blk_id, &t);
+		found[i] = s != NULL;
+
+		if (s)
+		{
+		    e = *s;
+            e.flags = (e.flags & 0xff) | (gen << BLK_ENTRY_GEN_SHIFT);
+			blk_table_update(t, s, &e);
+			hits++;
+		}
+	}
+
+	pthread_mutex_unlock(&idx->wlock);
+
+	return hits;
+}
+
+// fn sees a copy of every live entry and must not call back into idx
+void blk_index_walk(blk_index_t *idx, blk_index_walk_pt fn, void *arg)
+{
+    blk_table_t *tables[2];
+	blk_entry_t  e;
+	uint64_t     i = 0;
+	int          t = 0;
+
+	pthread_mutex_lock(&idx->wlock);
+
+	tables[0] = idx->old;
+	tables[1] = idx->cur;
+
+	for (t = 0; t < 2; t++)
+	{
+        if (!tables[t])
+		{
+            continue;
+		}
+
+		for (i = 0; i <= tables[t]->mask; i++)
+		{
+            if (tables[t]->slots[i].flags & BLK_ENTRY_USED)
+			{
+			    e = tables[t]->slots[i];
+                fn(&e, arg);
+			}
+		}
+	}
+
+	pthread_mutex_unlock(&idx->wlock);
+}
+
+uint64_t blk_index_count(blk_index_t *idx)
+{
+    return idx->count;
+}
+
@@ -0,0 +1,79 @@
+#ifndef DN_BLK_INDEX_H
+#define DN_BLK_INDEX_H
+
+#include "dfs_types.h"
+
+#define BLK_INDEX_INIT_CAP      (1 << 20)
+#define BLK_INDEX_MIGRATE_STEP  256 // old slots moved per write while resizing
+#define BLK_INDEX_REGION_SHIFT  6   // one seqlock per 64 slots
+#define BLK_INDEX_REGION_SLOTS  (1 << BLK_INDEX_REGION_SHIFT)
+#define BLK_INDEX_EPOCH_SLOTS   256 // reader threads tracked for reclamation
+
+// a table grows once it is 7/8 full
+#define blk_index_full(t)  ((t)->count + 1 > ((t)->mask + 1) - (((t)->mask + 1) >> 3))
+
+#define BLK_ENTRY_USED      0x0001
+#define BLK_ENTRY_MOVED     0x0002 // left behind in the old table by a resize
+#define BLK_ENTRY_ZIP       0x0004 // stored compressed, size is the logical one
+#define BLK_ENTRY_GEN_SHIFT 8      // high byte holds the last scanner pass
+
+#define blk_entry_gen(e)    ((uint8_t)((e)->flags >> BLK_ENTRY_GEN_SHIFT))
+
+// the path of a blk is derived from ns_id, blk_id and vol
+typedef struct blk_entry_s
+{
+    int64_t  blk_id;
+    int64_t  ns_id;
+    int64_t  size;
+    uint16_t vol;
+    uint16_t flags;
+    uint32_t snap_slot;
+} blk_entry_t;
+
+// robin hood open addressing, capacity is a power of two.
+// a writer keeps the seq of every region it touches odd until it is
+// done, readers retry when a region they probed changed under them
+typedef struct blk_table_s
+{
+    blk_entry_t        *slots;
+    volatile uint32_t  *seqs;
+    uint64_t            mask;
+    uint64_t            count;
+    uint64_t            retire_epoch;
+    struct blk_table_s *next_retired;
+} blk_table_t;
+
+// lookups take no lock, writers are serialized by wlock
+typedef struct blk_index_s
+{
+    blk_table_t * volatile  cur;
+    blk_table_t * volatile  old;         // drained into cur while resizing
+    volatile uint32_t       tseq;        // odd while cur or old is switched
+    uint64_t                migrate_pos; // next old slot to move
+    uint64_t                count;
+    blk_table_t            *retired;     // freed once no reader can see them
+    pthread_mutex_t         wlock;
+} blk_index_t;
+
+typedef void (*blk_index_walk_pt)(blk_entry_t *e, void *arg);
+
+int  blk_index_init(blk_index_t *idx, uint64_t cap);
+void blk_index_release(blk_index_t *idx);
+int  blk_index_get(blk_index_t *idx, long ns_id, long blk_id,
+	blk_entry_t *out);
+int  blk_index_add(blk_index_t *idx, blk_entry_t *e, blk_entry_t *prev);
+int  blk_index_add_batch(blk_index_t *idx, blk_entry_t *ents, int n,
+	uchar_t *added);
+int  blk_index_del(blk_index_t *idx, long ns_id, long blk_id,
+	blk_entry_t *out);
+int  blk_index_del_stale(blk_index_t *idx, long ns_id, long blk_id,
+	uint8_t gen, blk_entry_t *out);
+int  blk_index_mark(blk_index_t *idx, long ns_id, long blk_id,
+	uint8_t gen);
+int  blk_index_mark_batch(blk_index_t *idx, blk_entry_t *ents, int n,
+	uint8_t gen, uchar_t *found);
+void blk_index_walk(blk_index_t *idx, blk_index_walk_pt fn, void *arg);
+uint64_t blk_index_count(blk_index_t *idx);
+
+#endif
+
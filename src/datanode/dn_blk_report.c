@@ -0,0 +1,310 @@
+#include <sys/time.h>
+#include "dn_blk_report.h"
+#include "dn_data_storage.h"
+#include "dfs_memory.h"
+#include "dfs_error_log.h"
+#include "dn_cycle.h"
+
+#define BLK_REPORT_VARINT_MAX  10
+
+// one report thread per volume, it sorts and encodes what the walk
+// collected for it
+typedef struct blk_report_vol_s
+{
+    int               vol;
+	long              ns_id;
+	uint32_t          gen;
+	int64_t           after; // ids up to here were acked already
+	blk_report_rec_t *recs;
+	int               n;
+	int               cap;
+	queue_t           chunks;
+	pthread_t         tid;
+	int               rs;
+} blk_report_vol_t;
+
+typedef struct blk_report_walk_s
+{
+    long              ns_id;
+	int               from; // first volume still to report
+	blk_report_vol_t *vols;
+	int               nvols;
+	int               rs;
+} blk_report_walk_t;
+
+static int blk_report_put_varint(uchar_t *p, uint64_t v);
+static int blk_report_rec_cmp(const void *a, const void *b);
+static void blk_report_collect(blk_entry_t *e, void *arg);
+static void *blk_report_vol_encode(void *arg);
+
+static int blk_report_put_varint(uchar_t *p, uint64_t v)
+{
+    int n = 0;
+
+	while (v >= 0x80)
+	{
+        p[n++] = (uchar_t)(v | 0x80);
+		v >>= 7;
+	}
+
+	p[n++] = (uchar_t)v;
+
+	return n;
+}
+
+static int blk_report_rec_cmp(const void *a, const void *b)
+{
+    int64_t x = ((blk_report_rec_t *)a)->id;
+	int64_t y = ((blk_report_rec_t *)b)->id;
+
+	return x < y ? -1 : x > y;
+}
+
+// runs under the index lock, only appends
+static void blk_report_collect(blk_entry_t *e, void *arg)
+{
+    blk_report_walk_t *w = (blk_report_walk_t *)arg;
+	blk_report_vol_t  *v = NULL;
+	blk_report_rec_t  *recs = NULL;
+	int                cap = 0;
+
+	if (e->ns_id != w->ns_id || e->vol < w->from || e->vol >= w->nvols)
+	{
+        return;
+	}
+
+	v = &w->vols[e->vol];
+
+	if (e->blk_id <= v->after)
+	{
+        return;
+	}
+
+	if (v->n == v->cap)
+	{
+	    cap = v->cap ? v->cap << 1 : BLK_REPORT_REC_INIT;
+        recs = (blk_report_rec_t *)realloc(v->recs,
+			cap * sizeof(blk_report_rec_t));
+		if (!recs)
+		{
+		    w->rs = DFS_ERROR;
+
+            return;
+		}
+
+		v->recs = recs;
+		v->cap = cap;
+	}
+
+	v->recs[v->n].id = e->blk_id;
+	v->recs[v->n].size = e->size;
+	v->n++;
+}
+
+void blk_report_sort(blk_report_rec_t *recs, int n)
+{
+    qsort(recs, n, sizeof(blk_report_rec_t), blk_report_rec_cmp);
+}
+
+static void *blk_report_vol_encode(void *arg)
+{
+    blk_report_vol_t *v = (blk_report_vol_t *)arg;
+
+	blk_report_sort(v->recs, v->n);
+
+	v->rs = blk_report_encode(v->recs, v->n, v->ns_id, v->vol, v->gen,
+		BLK_REPORT_FULL, &v->chunks);
+
+	return NULL;
+}
+
+// recs sorted by id, at least one chunk is queued even if n is 0
+int blk_report_encode(blk_report_rec_t *recs, int n, long ns_id, int vol,
+	uint32_t vol_gen, uint32_t flags, queue_t *chunks)
+{
+    blk_report_chunk_t *c = NULL;
+	blk_report_chunk_t *shrunk = NULL;
+	uchar_t            *data = NULL;
+	uchar_t            *p = NULL;
+	uint64_t            prev = 0;
+	int                 i = 0;
+
+	do
+	{
+        c = (blk_report_chunk_t *)malloc(sizeof(blk_report_chunk_t)
+			+ BLK_REPORT_CHUNK_MAX);
+		if (!c)
+		{
+		    dfs_log_error(dfs_cycle->error_log, DFS_LOG_ALERT, errno,
+				"malloc blk report chunk err");
+
+            return DFS_ERROR;
+		}
+
+		memory_zero(c, sizeof(blk_report_chunk_t));
+		c->hdr.ns_id = ns_id;
+		c->hdr.vol = vol;
+		c->hdr.vol_gen = vol_gen;
+		c->hdr.flags = flags;
+		c->hdr.base = i < n ? recs[i].id : 0;
+
+		data = blk_report_chunk_data(c);
+		p = data;
+		prev = (uint64_t)c->hdr.base;
+
+		while (i < n
+			&& p - data <= BLK_REPORT_CHUNK_MAX - 2 * BLK_REPORT_VARINT_MAX)
+		{
+            p += blk_report_put_varint(p, (uint64_t)recs[i].id - prev);
+			p += blk_report_put_varint(p, (uint64_t)recs[i].size);
+
+			prev = (uint64_t)recs[i].id;
+			c->last = recs[i].id;
+			c->hdr.count++;
+			i++;
+		}
+
+		c->len = p - data;
+
+		if (i == n && (flags & BLK_REPORT_FULL))
+		{
+            c->hdr.flags |= BLK_REPORT_VOL_END;
+		}
+
+		shrunk = (blk_report_chunk_t *)realloc(c,
+			sizeof(blk_report_chunk_t) + c->len);
+		if (shrunk)
+		{
+            c = shrunk;
+		}
+
+		queue_insert_tail(chunks, &c->me);
+	} while (i < n);
+
+	return DFS_OK;
+}
+
+void blk_report_free(queue_t *chunks)
+{
+    queue_t *q = NULL;
+
+	while (!queue_empty(chunks))
+	{
+	    q = queue_head(chunks);
+		queue_remove(q);
+        free(queue_data(q, blk_report_chunk_t, me));
+	}
+}
+
+// the blks of cur->ns_id from the cursor on, one walk of the index
+// and one encoding thread per volume
+int blk_report_build(blk_report_cursor_t *cur, queue_t *chunks)
+{
+    blk_report_walk_t w;
+	blk_report_vol_t *v = NULL;
+	struct timeval    start;
+	struct timeval    end;
+	uint64_t          blks = 0;
+	int               rs = DFS_OK;
+	int               i = 0;
+
+	gettimeofday(&start, NULL);
+
+	memory_zero(&w, sizeof(w));
+	w.ns_id = cur->ns_id;
+	w.from = cur->vol;
+	w.nvols = block_volume_num();
+
+	w.vols = (blk_report_vol_t *)memory_calloc(w.nvols
+		* sizeof(blk_report_vol_t));
+	if (!w.vols)
+	{
+	    dfs_log_error(dfs_cycle->error_log, DFS_LOG_ALERT, errno,
+			"calloc blk report vols err");
+
+        return DFS_ERROR;
+	}
+
+	for (i = 0; i < w.nvols; i++)
+	{
+	    v = &w.vols[i];
+        v->vol = i;
+		v->ns_id = cur->ns_id;
+		v->gen = block_volume_gen(i);
+		v->after = INT64_MIN;
+		queue_init(&v->chunks);
+
+		if (i == cur->vol && v->gen == cur->vol_gen)
+		{
+            v->after = cur->last;
+		}
+	}
+
+	block_object_walk(blk_report_collect, &w);
+
+	if (w.rs != DFS_OK)
+	{
+        rs = DFS_ERROR;
+
+		goto out;
+	}
+
+	for (i = w.from; i < w.nvols; i++)
+	{
+	    v = &w.vols[i];
+
+        if (pthread_create(&v->tid, NULL, blk_report_vol_encode, v)
+			!= DFS_OK)
+		{
+		    v->tid = 0;
+            blk_report_vol_encode(v);
+		}
+	}
+
+	for (i = w.from; i < w.nvols; i++)
+	{
+	    v = &w.vols[i];
+
+        if (v->tid)
+		{
+            pthread_join(v->tid, NULL);
+		}
+
+		if (v->rs != DFS_OK)
+		{
+            rs = DFS_ERROR;
+		}
+
+		blks += v->n;
+	}
+
+	gettimeofday(&end, NULL);
+
+	dfs_log_error(dfs_cycle->error_log, DFS_LOG_INFO, 0,
+		"blk report of ns %l built from vol %d, blks: %uL, cost: %l ms",
+		cur->ns_id, cur->vol, blks,
+		(long)((end.tv_sec - start.tv_sec) * 1000
+		+ (end.tv_usec - start.tv_usec) / 1000));
+
+out:
+	for (i = 0; i < w.nvols; i++)
+	{
+	    v = &w.vols[i];
+
+		if (rs == DFS_OK && !queue_empty(&v->chunks))
+		{
+            queue_add_queue(chunks, &v->chunks);
+		}
+		else
+		{
+            blk_report_free(&v->chunks);
+		}
+
+		free(v->recs);
+	}
+
+	memory_free(w.vols, w.nvols * sizeof(blk_report_vol_t));
+
+	return rs;
+}
+
@@ -0,0 +1,63 @@
+#ifndef DN_BLK_REPORT_H
+#define DN_BLK_REPORT_H
+
+#include "dfs_types.h"
+#include "dfs_queue.h"
+#include "dfs_task_cmd.h"
+
+#define BLK_REPORT_REC_INIT    4096
+#define BLK_REPORT_INCR_LIMIT  (1 << 20) // buffered events before a full report
+#define BLK_REPORT_INCR_SCAN   4096      // recent events checked for a reversal
+
+// one encoded chunk, the header and the varints are sent as they are
+typedef struct blk_report_chunk_s
+{
+    queue_t          me;
+	int64_t          last; // last blk id of the chunk
+	int              len;  // varint bytes after hdr
+	blk_report_hdr_t hdr;
+} blk_report_chunk_t;
+
+#define blk_report_chunk_data(c)  ((uchar_t *)(&(c)->hdr + 1))
+
+// where an interrupted full report resumes, chunks up to last of vol
+// were acked by the namenode
+typedef struct blk_report_cursor_s
+{
+    uint64_t report_id; // 0 if no full report is in flight
+	int64_t  ns_id;
+	uint32_t seq;       // of the next chunk
+	int      vol;
+	int64_t  last;
+	uint32_t vol_gen;   // a volume changed meanwhile is sent again
+} blk_report_cursor_t;
+
+typedef struct blk_report_rec_s
+{
+    int64_t id;
+	int64_t size;
+} blk_report_rec_t;
+
+// received and deleted blks of one namenode, sent as one increment
+// per window. a blk is only in one of the lists, the later event wins
+typedef struct blk_report_incr_s
+{
+    pthread_mutex_t   lock;
+	blk_report_rec_t *recv;
+	int               recv_n;
+	int               recv_cap;
+	blk_report_rec_t *del;
+	int               del_n;
+	int               del_cap;
+	uint64_t          first_ms; // arrival of the oldest buffered event
+	int               overflow; // events were dropped
+} blk_report_incr_t;
+
+int  blk_report_build(blk_report_cursor_t *cur, queue_t *chunks);
+void blk_report_sort(blk_report_rec_t *recs, int n);
+int  blk_report_encode(blk_report_rec_t *recs, int n, long ns_id, int vol,
+	uint32_t vol_gen, uint32_t flags, queue_t *chunks);
+void blk_report_free(queue_t *chunks);
+
+#endif
+
@@ -0,0 +1,388 @@
+#include "dn_blk_snapshot.h"
+#include "dfs_memory.h"
+#include "dn_cycle.h"
+#include "dfs_error_log.h"
+
+#define BLK_SNAP_HDR_SIZE  4096
+#define BLK_SNAP_MAP_SIZE(cap) \
+	(BLK_SNAP_HDR_SIZE + (size_t)(cap) * sizeof(blk_snap_rec_t))
+
+static uint32_t snap_checksum(const void *data, size_t len);
+static uint32_t snap_header_checksum(blk_snap_header_t *hdr);
+static uint16_t snap_rec_checksum(blk_snap_rec_t *rec);
+static int snap_map(blk_snap_t *snap, uint64_t capacity);
+static int snap_reset(blk_snap_t *snap);
+static int snap_grow(blk_snap_t *snap);
+static int snap_push_free(blk_snap_t *snap, uint32_t slot);
+static void snap_commit(blk_snap_t *snap);
+
+// fnv-1a, good enough to catch torn or stale records
+static uint32_t snap_checksum(const void *data, size_t len)
+{
+    const uchar_t *p = (const uchar_t *)data;
+    uint32_t       h = 2166136261U;
+
+    while (len--)
+	{
+        h ^= *p++;
+        h *= 16777619U;
+    }
+
+    return h;
+}
+
+static uint32_t snap_header_checksum(blk_snap_header_t *hdr)
+{
+    return snap_checksum(hdr, offsetof(blk_snap_header_t, checksum));
+}
+
+static uint16_t snap_rec_checksum(blk_snap_rec_t *rec)
+{
+    uint32_t h = snap_checksum(rec, offsetof(blk_snap_rec_t, checksum));
+
+	return (uint16_t)(h ^ (h >> 16));
+}
+
+// open or create the snapshot file of one volume
+int blk_snapshot_open(blk_snap_t *snap, int vol, char *dir)
+{
+    struct stat sb;
+
+    memory_zero(snap, sizeof(blk_snap_t));
+    snap->vol = vol;
+	snap->fd = -1;
+    pthread_mutex_init(&snap->lock, NULL);
+
+    snprintf(snap->path, sizeof(snap->path), "%s/%s", dir, BLK_SNAP_FILE);
+
+    snap->fd = open(snap->path, O_RDWR | O_CREAT, 0664);
+	if (snap->fd < 0)
+	{
+        dfs_log_error(dfs_cycle->error_log, DFS_LOG_ERROR, errno,
+			"open %s err", snap->path);
+
+		return DFS_ERROR;
+	}
+
+	if (fstat(snap->fd, &sb) != DFS_OK)
+	{
+        dfs_log_error(dfs_cycle->error_log, DFS_LOG_ERROR, errno,
+			"fstat %s err", snap->path);
+
+		return DFS_ERROR;
+	}
+
+	if ((size_t)sb.st_size < BLK_SNAP_MAP_SIZE(0))
+	{
+        return snap_reset(snap);
+	}
+
+	return snap_map(snap, (sb.st_size - BLK_SNAP_HDR_SIZE)
+		/ sizeof(blk_snap_rec_t));
+}
+
+static int snap_map(blk_snap_t *snap, uint64_t capacity)
+{
+    size_t  size = BLK_SNAP_MAP_SIZE(capacity);
+	void   *addr = NULL;
+
+	if (snap->hdr)
+	{
+        munmap(snap->hdr, snap->map_size);
+		snap->hdr = NULL;
+		snap->recs = NULL;
+	}
+
+    addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, snap->fd, 0);
+	if (addr == MAP_FAILED)
+	{
+        dfs_log_error(dfs_cycle->error_log, DFS_LOG_ERROR, errno,
+			"mmap %s err, size: %uz", snap->path, size);
+
+		return DFS_ERROR;
+	}
+
+	snap->hdr = (blk_snap_header_t *)addr;
+	snap->recs = (blk_snap_rec_t *)((char *)addr + BLK_SNAP_HDR_SIZE);
+	snap->map_size = size;
+
+	return DFS_OK;
+}
+
+// drop whatever is on disk and start an empty snapshot
+static int snap_reset(blk_snap_t *snap)
+{
+    if (ftruncate(snap->fd, 0) != DFS_OK
+		|| ftruncate(snap->fd, BLK_SNAP_MAP_SIZE(BLK_SNAP_INIT_RECS)) != DFS_OK)
+	{
+        dfs_log_error(dfs_cycle->error_log, DFS_LOG_ERROR, errno,
+			"ftruncate %s err", snap->path);
+
+		return DFS_ERROR;
+	}
+
+	if (snap_map(snap, BLK_SNAP_INIT_RECS) != DFS_OK)
+	{
+        return DFS_ERROR;
+	}
+
+	snap->hdr->magic = BLK_SNAP_MAGIC;
+	snap->hdr->version = BLK_SNAP_VERSION;
+	snap->hdr->rec_size = sizeof(blk_snap_rec_t);
+	snap->hdr->journal_seq = 0;
+	snap->hdr->capacity = BLK_SNAP_INIT_RECS;
+	snap->hdr->used = 0;
+	snap->hdr->count = 0;
+	snap->hdr->checksum = snap_header_checksum(snap->hdr);
+
+	snap->free_n = 0;
+
+	return DFS_OK;
+}
+
+static int snap_grow(blk_snap_t *snap)
+{
+    uint64_t capacity = snap->hdr->capacity << 1;
+
+	if (ftruncate(snap->fd, BLK_SNAP_MAP_SIZE(capacity)) != DFS_OK)
+	{
+        dfs_log_error(dfs_cycle->error_log, DFS_LOG_ERROR, errno,
+			"ftruncate %s err", snap->path);
+
+		return DFS_ERROR;
+	}
+
+	if (snap_map(snap, capacity) != DFS_OK)
+	{
+        return DFS_ERROR;
+	}
+
+	snap->hdr->capacity = capacity;
+	snap->hdr->checksum = snap_header_checksum(snap->hdr);
+
+	return DFS_OK;
+}
+
+static int snap_push_free(blk_snap_t *snap, uint32_t slot)
+{
+    uint32_t *slots = NULL;
+	uint64_t  cap = 0;
+
+    if (snap->free_n == snap->free_cap)
+	{
+	    cap = snap->free_cap ? snap->free_cap << 1 : 1024;
+        slots = (uint32_t *)memory_realloc(snap->free_slots,
+			cap * sizeof(uint32_t));
+		if (!slots)
+		{
+            return DFS_ERROR;
+		}
+
+		snap->free_slots = slots;
+		snap->free_cap = cap;
+	}
+
+	snap->free_slots[snap->free_n++] = slot;
+
+	return DFS_OK;
+}
+
+// the header and the records are separate pages of the mapping, after a
+// crash they may have reached the disk in any order. a torn record fails
+// its checksum and one ahead of the header seq is dropped, a stale one
+// is left to the first reconcile pass
+static void snap_commit(blk_snap_t *snap)
+{
+    snap->hdr->checksum = snap_header_checksum(snap->hdr);
+}
+
+// map the file and hand every committed record to restore(),
+// an untrusted file is reset and rebuilt by the reconcile scan.
+// the records are only hints: the dir states they seed are not valid
+// yet, so the first pass reads every leaf dir, adds what the snapshot
+// missed and purges what is no longer on disk
+int blk_snapshot_load(blk_snap_t *snap, blk_snap_restore_pt restore)
+{
+    blk_snap_header_t *hdr = snap->hdr;
+	blk_snap_rec_t    *rec = NULL;
+	uint64_t           i = 0;
+	uint64_t           count = 0;
+	uint32_t           seq = 0;
+
+	if (hdr->magic != BLK_SNAP_MAGIC
+		|| hdr->version != BLK_SNAP_VERSION
+		|| hdr->rec_size != sizeof(blk_snap_rec_t)
+		|| hdr->checksum != snap_header_checksum(hdr)
+		|| hdr->used > hdr->capacity
+		|| BLK_SNAP_MAP_SIZE(hdr->capacity) > snap->map_size)
+	{
+	    dfs_log_error(dfs_cycle->error_log, DFS_LOG_WARN, 0,
+			"snapshot %s is not trusted, rebuild it by scan", snap->path);
+
+        return snap_reset(snap);
+	}
+
+	seq = (uint32_t)hdr->journal_seq;
+	snap->free_n = 0;
+
+	for (i = 0; i < hdr->used; i++)
+	{
+        rec = &snap->recs[i];
+
+		if ((rec->state != BLK_SNAP_REC_LIVE
+			&& rec->state != BLK_SNAP_REC_LIVE_ZIP)
+			|| rec->checksum != snap_rec_checksum(rec)
+			|| (uint32_t)(seq - rec->seq) > (DFS_MAX_UINT32_VALUE >> 1))
+		{
+		    rec->state = BLK_SNAP_REC_FREE;
+            snap_push_free(snap, (uint32_t)i);
+
+			continue;
+		}
+
+		if (restore(snap->vol, rec->ns_id, rec->blk_id, rec->size,
+			rec->state == BLK_SNAP_REC_LIVE_ZIP, (uint32_t)i) != DFS_OK)
+		{
+		    rec->state = BLK_SNAP_REC_FREE;
+			rec->checksum = snap_rec_checksum(rec);
+            snap_push_free(snap, (uint32_t)i);
+
+			continue;
+		}
+
+		count++;
+	}
+
+	hdr->count = count;
+	snap_commit(snap);
+
+	dfs_log_error(dfs_cycle->error_log, DFS_LOG_INFO, 0,
+		"snapshot %s loaded, blks: %uL, seq: %uL", snap->path, count,
+		hdr->journal_seq);
+
+	return DFS_OK;
+}
+
+int blk_snapshot_add(blk_snap_t *snap, long ns_id, long blk_id,
+	long size, int zip, uint32_t *slot)
+{
+    blk_snap_rec_t *rec = NULL;
+	uint32_t        i = 0;
+
+	*slot = BLK_SNAP_INVALID_SLOT;
+
+	if (!snap->hdr)
+	{
+        return DFS_ERROR;
+	}
+
+    pthread_mutex_lock(&snap->lock);
+
+	if (snap->free_n > 0)
+	{
+        i = snap->free_slots[--snap->free_n];
+	}
+	else
+	{
+        if (snap->hdr->used == snap->hdr->capacity
+			&& snap_grow(snap) != DFS_OK)
+		{
+            pthread_mutex_unlock(&snap->lock);
+
+			return DFS_ERROR;
+		}
+
+		i = (uint32_t)snap->hdr->used++;
+	}
+
+	rec = &snap->recs[i];
+	rec->ns_id = ns_id;
+	rec->blk_id = blk_id;
+	rec->size = size;
+	rec->seq = (uint32_t)(snap->hdr->journal_seq + 1);
+	rec->state = zip ? BLK_SNAP_REC_LIVE_ZIP : BLK_SNAP_REC_LIVE;
+	rec->checksum = snap_rec_checksum(rec);
+
+	snap->hdr->journal_seq++;
+	snap->hdr->count++;
+	snap_commit(snap);
+
+	pthread_mutex_unlock(&snap->lock);
+
+	*slot = i;
+
+	return DFS_OK;
+}
+
+int blk_snapshot_del(blk_snap_t *snap, uint32_t slot)
+{
+    blk_snap_rec_t *rec = NULL;
+
+	if (!snap->hdr || slot == BLK_SNAP_INVALID_SLOT)
+	{
+        return DFS_ERROR;
+	}
+
+	pthread_mutex_lock(&snap->lock);
+
+	if (slot >= snap->hdr->used)
+	{
+        pthread_mutex_unlock(&snap->lock);
+
+		return DFS_ERROR;
+	}
+
+	rec = &snap->recs[slot];
+	rec->seq = (uint32_t)(snap->hdr->journal_seq + 1);
+	rec->state = BLK_SNAP_REC_FREE;
+	rec->checksum = snap_rec_checksum(rec);
+
+	snap->hdr->journal_seq++;
+	snap->hdr->count--;
+	snap_commit(snap);
+
+	snap_push_free(snap, slot);
+
+	pthread_mutex_unlock(&snap->lock);
+
+	return DFS_OK;
+}
+
+// called by the scanner between passes
+void blk_snapshot_sync(blk_snap_t *snap)
+{
+    if (!snap->hdr)
+	{
+        return;
+	}
+
+	pthread_mutex_lock(&snap->lock);
+    msync(snap->hdr, snap->map_size, MS_ASYNC);
+	pthread_mutex_unlock(&snap->lock);
+}
+
+void blk_snapshot_close(blk_snap_t *snap)
+{
+    if (snap->hdr)
+	{
+	    msync(snap->hdr, snap->map_size, MS_SYNC);
+        munmap(snap->hdr, snap->map_size);
+		snap->hdr = NULL;
+		snap->recs = NULL;
+	}
+
+	if (snap->fd >= 0)
+	{
+        close(snap->fd);
+		snap->fd = -1;
+	}
+
+	if (snap->free_slots)
+	{
+        free(snap->free_slots);
+		snap->free_slots = NULL;
+	}
+
+	pthread_mutex_destroy(&snap->lock);
+}
+
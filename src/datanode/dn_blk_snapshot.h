@@ -0,0 +1,71 @@
+#ifndef DN_BLK_SNAPSHOT_H
+#define DN_BLK_SNAPSHOT_H
+
+#include "dfs_types.h"
+
+#define BLK_SNAP_FILE          "blk_index.snap"
+#define BLK_SNAP_MAGIC         0x44425349 // "DBSI"
+#define BLK_SNAP_VERSION       1
+#define BLK_SNAP_INIT_RECS     65536
+#define BLK_SNAP_PATH_LEN      256
+#define BLK_SNAP_INVALID_SLOT  ((uint32_t)-1)
+
+enum
+{
+    BLK_SNAP_REC_FREE = 0,
+    BLK_SNAP_REC_LIVE,
+    BLK_SNAP_REC_LIVE_ZIP // live, the blk file is compressed
+};
+
+// file layout: one header page followed by fixed size records
+typedef struct blk_snap_header_s
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t rec_size;
+    uint32_t reserved;
+    uint64_t journal_seq; // bumped on every add and del
+    uint64_t capacity;    // record slots in the file
+    uint64_t used;        // high water mark of record slots
+    uint64_t count;       // live records
+    uint32_t checksum;    // of the fields above
+    uint32_t pad;
+} blk_snap_header_t;
+
+typedef struct blk_snap_rec_s
+{
+    int64_t  ns_id;
+    int64_t  blk_id;
+    int64_t  size;
+    uint32_t seq;      // low bits of journal_seq when written
+    uint16_t state;    // BLK_SNAP_REC_FREE or one of the live ones
+    uint16_t checksum; // of the fields above
+} blk_snap_rec_t;
+
+typedef struct blk_snap_s
+{
+    int                vol;
+    int                fd;
+    char               path[BLK_SNAP_PATH_LEN];
+    blk_snap_header_t *hdr;
+    blk_snap_rec_t    *recs;
+    size_t             map_size;
+    uint32_t          *free_slots; // stack of reusable record slots
+    uint64_t           free_n;
+    uint64_t           free_cap;
+    pthread_mutex_t    lock;
+} blk_snap_t;
+
+typedef int (*blk_snap_restore_pt)(int vol, long ns_id, long blk_id,
+	long size, int zip, uint32_t slot);
+
+int  blk_snapshot_open(blk_snap_t *snap, int vol, char *dir);
+int  blk_snapshot_load(blk_snap_t *snap, blk_snap_restore_pt restore);
+int  blk_snapshot_add(blk_snap_t *snap, long ns_id, long blk_id,
+	long size, int zip, uint32_t *slot);
+int  blk_snapshot_del(blk_snap_t *snap, uint32_t slot);
+void blk_snapshot_sync(blk_snap_t *snap);
+void blk_snapshot_close(blk_snap_t *snap);
+
+#endif
+
@@ -3,6 +3,7 @@
 #include "dfs_array.h"
 #include "dn_cycle.h"
 #include "dn_conf.h"
+#include "dn_stats.h"
 
 #define ALLOW    1
 #define DENY     2
@@ -68,6 +69,72 @@ static conf_option_t conf_server_option[] =
 	{ string_make("block_report_interval"), conf_parse_int,
         OPE_EQUAL, offsetof(conf_server_t, block_report_interval) },
 
+	{ string_make("block_scan_inotify"), conf_parse_nn_macro,
+        OPE_EQUAL, offsetof(conf_server_t, block_scan_inotify) },
+
+	{ string_make("block_scan_full_interval"), conf_parse_int,
+        OPE_EQUAL, offsetof(conf_server_t, block_scan_full_interval) },
+
+	{ string_make("incr_report_interval"), conf_parse_int,
+        OPE_EQUAL, offsetof(conf_server_t, incr_report_interval) },
+
+	{ string_make("incr_report_batch"), conf_parse_int,
+        OPE_EQUAL, offsetof(conf_server_t, incr_report_batch) },
+
+	{ string_make("vol_choosing_policy"), conf_parse_nn_macro,
+        OPE_EQUAL, offsetof(conf_server_t, vol_choosing_policy) },
+
+	{ string_make("vol_reserved_space"), conf_parse_bytes_size,
+        OPE_EQUAL, offsetof(conf_server_t, vol_reserved_space) },
+
+	{ string_make("metrics_log_interval"), conf_parse_int,
+        OPE_EQUAL, offsetof(conf_server_t, metrics_log_interval) },
+
+	{ string_make("stats_file"), conf_parse_string,
+        OPE_EQUAL, offsetof(conf_server_t, stats_file) },
+
+	{ string_make("trace_ring_size"), conf_parse_int,
+        OPE_EQUAL, offsetof(conf_server_t, trace_ring_size) },
+
+	{ string_make("slow_request_ms"), conf_parse_int,
+        OPE_EQUAL, offsetof(conf_server_t, slow_request_ms) },
+
+	{ string_make("trace_file"), conf_parse_string,
+        OPE_EQUAL, offsetof(conf_server_t, trace_file) },
+
+	{ string_make("log_mode"), conf_parse_nn_macro,
+        OPE_EQUAL, offsetof(conf_server_t, log_mode) },
+
+	{ string_make("log_overflow"), conf_parse_nn_macro,
+        OPE_EQUAL, offsetof(conf_server_t, log_overflow) },
+
+	{ string_make("log_buffer_size"), conf_parse_bytes_size,
+        OPE_EQUAL, offsetof(conf_server_t, log_buffer_size) },
+
+	{ string_make("readahead"), conf_parse_nn_macro,
+        OPE_EQUAL, offsetof(conf_server_t, readahead) },
+
+	{ string_make("readahead_max"), conf_parse_bytes_size,
+        OPE_EQUAL, offsetof(conf_server_t, readahead_max) },
+
+	{ string_make("fd_cache_size"), conf_parse_int,
+        OPE_EQUAL, offsetof(conf_server_t, fd_cache_size) },
+
+	{ string_make("sendfile_slice"), conf_parse_bytes_size,
+        OPE_EQUAL, offsetof(conf_server_t, sendfile_slice) },
+
+	{ string_make("send_lowat"), conf_parse_bytes_size,
+        OPE_EQUAL, offsetof(conf_server_t, send_lowat) },
+
+	{ string_make("read_io"), conf_parse_nn_macro,
+        OPE_EQUAL, offsetof(conf_server_t, read_io) },
+
+	{ string_make("read_pipe_depth"), conf_parse_int,
+        OPE_EQUAL, offsetof(conf_server_t, read_pipe_depth) },
+
+	{ string_make("compress_dirs"), conf_parse_string,
+        OPE_EQUAL, offsetof(conf_server_t, compress_dirs) },
+
     { string_null, NULL, OPE_EQUAL, 0 }    
 };
 
@@ -101,6 +168,30 @@ static conf_macro_t conf_macro[] =
     { string_make("LOG_INFO"), DFS_LOG_INFO },
 
     { string_make("LOG_DEBUG"), DFS_LOG_DEBUG },
+
+    { string_make("SPACE"), VOL_POLICY_SPACE },
+
+    { string_make("INFLIGHT"), VOL_POLICY_INFLIGHT },
+
+    { string_make("ROUND_ROBIN"), VOL_POLICY_RR },
+
+    { string_make("ASYNC"), DFS_LOG_MODE_ASYNC },
+
+    { string_make("SYNC"), DFS_LOG_MODE_SYNC },
+
+    { string_make("DROP"), DFS_LOG_OVERFLOW_DROP },
+
+    { string_make("BLOCK"), DFS_LOG_OVERFLOW_BLOCK },
+
+    { string_make("ADAPTIVE"), DN_RA_ADAPTIVE },
+
+    { string_make("KERNEL"), DN_RA_KERNEL },
+
+    { string_make("SENDFILE"), DN_READ_SENDFILE },
+
+    { string_make("BUFFERED"), DN_READ_BUFFERED },
+
+    { string_make("DIRECT"), DN_READ_DIRECT },
     
     { string_null, 0 }
 };
@@ -129,14 +220,35 @@ static void *conf_server_init(pool_t *pool)
     return sconf;
 }
 
+// var is the conf_variable_t of the object, not the conf itself
 static int conf_server_make_default(void *var)
 {
-    conf_server_t *sconf = (conf_server_t *)var;
+    conf_server_t *sconf = (conf_server_t *)((conf_variable_t *)var)->conf;
     
     set_def_string(&sconf->pid_file,            PID_FILE);
     set_def_int(sconf->recv_buff_len, 		    DEF_RBUFF_LEN);
     set_def_int(sconf->send_buff_len, 		    DEF_SBUFF_LEN);
     set_def_int(sconf->max_tqueue_len, 		    DEF_MMAX_TQUEUE_LEN);
+    set_def_int(sconf->incr_report_interval,    DEF_INCR_REPORT_INTERVAL);
+    set_def_int(sconf->incr_report_batch,       DEF_INCR_REPORT_BATCH);
+    set_def_int(sconf->block_scan_full_interval, DEF_BLOCK_SCAN_FULL_INTERVAL);
+    set_def_int(sconf->vol_choosing_policy,     VOL_POLICY_SPACE);
+    set_def_int(sconf->vol_reserved_space,      DEF_VOL_RESERVED);
+    set_def_int(sconf->metrics_log_interval,    DEF_METRICS_LOG_INTERVAL);
+    set_def_string(&sconf->stats_file,          DEF_STATS_FILE);
+    set_def_int(sconf->trace_ring_size,         DEF_TRACE_RING_SIZE);
+    set_def_int(sconf->slow_request_ms,         DEF_SLOW_REQUEST_MS);
+    set_def_string(&sconf->trace_file,          DEF_TRACE_FILE);
+    set_def_int(sconf->log_mode,                DFS_LOG_MODE_ASYNC);
+    set_def_int(sconf->log_overflow,            DFS_LOG_OVERFLOW_DROP);
+    set_def_int(sconf->log_buffer_size,         DFS_LOG_RING_SIZE);
+    set_def_int(sconf->readahead,               DN_RA_ADAPTIVE);
+    set_def_int(sconf->readahead_max,           DEF_READAHEAD_MAX);
+    set_def_int(sconf->fd_cache_size,           DEF_FD_CACHE_SIZE);
+    set_def_int(sconf->sendfile_slice,          DEF_SENDFILE_SLICE);
+    set_def_int(sconf->send_lowat,              DEF_SEND_LOWAT);
+    set_def_int(sconf->read_io,                 DN_READ_SENDFILE);
+    set_def_int(sconf->read_pipe_depth,         DEF_READ_PIPE_DEPTH);
 	
     return DFS_OK;
 }
@@ -4,6 +4,12 @@
 #include "dfs_types.h"
 #include "dfs_array.h"
 #include "dfs_conf.h"
+#include "dn_vol_policy.h"
+#include "dn_metrics.h"
+#include "dn_trace.h"
+#include "dn_readahead.h"
+#include "dn_fd_cache.h"
+#include "dn_read_pipe.h"
 
 typedef struct conf_server_s conf_server_t;
 
@@ -25,6 +31,28 @@ struct conf_server_s
     string_t data_dir;
 	uint32_t heartbeat_interval;
 	uint32_t block_report_interval;
+	uint32_t block_scan_inotify;
+	uint32_t block_scan_full_interval; // s, 0 for never
+	uint32_t incr_report_interval; // ms
+	uint32_t incr_report_batch;
+	uint32_t vol_choosing_policy;
+	uint64_t vol_reserved_space;
+	uint32_t metrics_log_interval; // s
+	string_t stats_file;
+	uint32_t trace_ring_size; // records per worker thread
+	uint32_t slow_request_ms;
+	string_t trace_file;
+	uint32_t log_mode;        // async or sync
+	uint32_t log_overflow;    // drop or block when a ring is full
+	uint64_t log_buffer_size; // ring bytes per logging thread
+	uint32_t readahead;       // adaptive or kernel
+	uint64_t readahead_max;   // window of a sequential stream
+	uint32_t fd_cache_size;   // open blks kept per worker process
+	uint64_t sendfile_slice;  // bytes a faio thread sends per turn
+	uint64_t send_lowat;      // TCP_NOTSENT_LOWAT of a read conn
+	uint32_t read_io;         // sendfile, buffered or direct
+	uint32_t read_pipe_depth; // fio buffers a buffered read runs ahead
+	string_t compress_dirs;   // data_dirs whose new blks are compressed
 };
 
 conf_object_t *get_dn_conf_object(void);
@@ -32,6 +60,11 @@ conf_object_t *get_dn_conf_object(void);
 #define DEF_RBUFF_LEN          64 * 1024
 #define DEF_SBUFF_LEN          64 * 1024
 #define DEF_MMAX_TQUEUE_LEN    1000
+#define DEF_INCR_REPORT_INTERVAL  500
+#define DEF_INCR_REPORT_BATCH     1000
+#define DEF_BLOCK_SCAN_FULL_INTERVAL  (24 * 3600)
+#define DEF_SENDFILE_SLICE     (2 * 1024 * 1024)
+#define DEF_SEND_LOWAT         (512 * 1024)
 
 #define set_def_string(key, value) do { \
     if (!(key)->len) { \
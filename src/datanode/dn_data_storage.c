@@ -1,50 +1,81 @@
 #include "dn_data_storage.h"
 #include "dfs_types.h"
-#include "dfs_math.h"
 #include "dfs_memory.h"
-#include "dfs_commpool.h"
-#include "dfs_mblks.h"
 #include "dn_conf.h"
 #include "dn_time.h"
 #include "dn_process.h"
 #include "dn_ns_service.h"
-
-#define BLK_NUM_IN_DN 100000
+#include "dn_fd_cache.h"
+#include "cfs_zblk.h"
+#include "dfs_gf.h"
+#include <sys/syscall.h>
+#include <sys/inotify.h>
+#include <poll.h>
 
 uint32_t blk_scanner_running = DFS_TRUE;
 
 static queue_t g_storage_dir_q;
 static int     g_storage_dir_n = 0;
+static vol_stat_t **g_vol_stats = NULL; // indexed by vol
 static char    g_last_version[56] = "";
+static volatile uint32_t g_scan_gen = 0;
+
+static blk_index_t g_blk_index;
 
-static blk_cache_mgmt_t *g_dn_bcm = NULL;
+// inotify watches of the leaf dirs, indexed by wd
+static int                g_scan_ifd = -1;
+static blk_scan_watch_t  *g_scan_watches = NULL;
+static int                g_scan_watches_n = 0;
+static pthread_mutex_t    g_scan_watch_lock = PTHREAD_MUTEX_INITIALIZER;
 
 static int init_storage_dirs(cycle_t *cycle);
+static int dir_compressed(string_t *dirs, char *dir);
 static int create_storage_dirs(cycle_t *cycle);
 static int check_version(char *path);
 static int check_namespace(char *path, int64_t namespaceID);
 static int create_storage_subdirs(char *path);
-static blk_cache_mgmt_t *blk_cache_mgmt_new_init();
-static blk_cache_mgmt_t *blk_cache_mgmt_create(size_t index_num);
-static int blk_mem_mgmt_create(blk_cache_mem_t *mem_mgmt, 
-	size_t index_num);
-static struct mem_mblks *blk_mblks_create(blk_cache_mem_t *mem_mgmt, 
-	size_t count);
-static void *allocator_malloc(void *priv, size_t mem_size);
-static void allocator_free(void *priv, void *mem_addr);
-static void blk_mem_mgmt_destroy(blk_cache_mem_t *mem_mgmt);
-static void blk_cache_mgmt_release(blk_cache_mgmt_t *bcm);
-static int uint64_cmp(const void *s1, const void *s2, size_t sz);
-static size_t req_hash(const void *data, size_t data_size, 
-	size_t hashtable_size);
-static int get_disk_id(long block_id, char *path);
-static int recv_blk_report(dn_request_t *r);
-static int scan_current_dir(char *dir);
+static void block_info_fill(blk_entry_t *e, storage_dir_t *sd, 
+	block_info_t *blk);
+static void block_entry_size(char *path, struct stat *sb, blk_entry_t *e);
+static int choose_disk_id(dn_request_t *r, char *path);
+static storage_dir_t *get_storage_dir(int vol);
+static void get_block_dir(char *dir, long ns_id, long blk_id, char *path);
+static void get_block_path(char *dir, long ns_id, long blk_id, char *path);
+static uint64_t blk_digest(long blk_id);
+static blk_dir_state_t *get_dir_state(storage_dir_t *sd, long ns_id, 
+	int idx, int create);
+static void dir_state_index(int vol, long ns_id, long blk_id, int add);
+static int dir_state_in_sync(storage_dir_t *sd, long ns_id, long blk_id, 
+	char *dir);
+static void dir_state_refresh(storage_dir_t *sd, long ns_id, long blk_id, 
+	char *dir);
+static int load_blk_snapshots();
+static void close_blk_snapshots();
+static void sync_blk_snapshots();
+static int block_object_restore(int vol, long ns_id, long blk_id, 
+	long size, int zip, uint32_t slot);
+static void block_object_purge(uint32_t scan_gen);
+static void block_object_purge_check(blk_entry_t *e, void *arg);
+static int recv_blk_report(storage_dir_t *sd, long ns_id, long blk_id, 
+	long size, int zip);
+static void *scan_volume(void *arg);
+static int scan_grow(blk_scan_t *scan);
+static void scan_release(blk_scan_t *scan);
+static int scan_current_dir(blk_scan_t *scan, char *dir);
 static void get_namespace_id(char *src, char *id);
-static int scan_namespace_dir(char *dir, long namespace_id);
-static int scan_subdir(char *dir, long namespace_id);
-static int scan_subdir_subdir(char *dir, long namespace_id);
-static void get_blk_id(char *src, char *id);
+static int scan_namespace_dir(blk_scan_t *scan, char *dir, long namespace_id);
+static int scan_subdir(blk_scan_t *scan, char *dir, long namespace_id, 
+	int sub);
+static int scan_subdir_subdir(blk_scan_t *scan, char *dir, 
+	long namespace_id, int idx);
+static int scan_inotify_init();
+static void scan_inotify_release();
+static void scan_inotify_watch(storage_dir_t *sd, long ns_id, 
+	blk_dir_state_t *st, char *dir);
+static void scan_inotify_handle();
+static void scan_wait(int secs);
+static void block_object_add_batch(blk_scan_t *scan, char *dir, 
+	long ns_id, int n);
 
 // 主进程
 //数据节点master初始化，pool and cfs
@@ -89,23 +120,35 @@ int dn_data_storage_worker_init(cycle_t *cycle)
 	{
         return DFS_ERROR;
     }
-    // blk cache management
-	g_dn_bcm = blk_cache_mgmt_new_init();
-    if (!g_dn_bcm) 
+
+	// the GF(2^8) kernel of the ec groups, the widest this cpu runs
+	dfs_gf_init();
+	dfs_log_error(dfs_cycle->error_log, DFS_LOG_INFO, 0, 
+		"ec gf kernel: %s", dfs_gf_kernel());
+
+    // blk index, grows online
+	if (blk_index_init(&g_blk_index, BLK_INDEX_INIT_CAP) != DFS_OK) 
 	{
         return DFS_ERROR;
     }
 
     // init blk report queue
 	blk_report_queue_init();
+
+    // trust the persisted index, the scanner only reconciles afterwards
+	if (load_blk_snapshots() != DFS_OK) 
+	{
+        return DFS_ERROR;
+	}
 	
     return DFS_OK;
 }
 
 int dn_data_storage_worker_release(cycle_t *cycle)
 {
-    blk_cache_mgmt_release(g_dn_bcm);
-	g_dn_bcm = NULL;
+    close_blk_snapshots();
+	
+    blk_index_release(&g_blk_index);
 
 	blk_report_queue_release();
 	
@@ -164,18 +207,68 @@ static int init_storage_dirs(cycle_t *cycle)
 		}
 
         sd->id = i;
+		sd->compress = dir_compressed(&sconf->compress_dirs, (char *)token);
 		string_xxsprintf((uchar_t *)dir, "%s/current", token);
 		strcpy(sd->current, dir);
+		queue_init(&sd->ns_states);
+		pthread_mutex_init(&sd->state_lock, NULL);
+		sd->report_gen = 0;
+		memory_zero(&sd->stat, sizeof(vol_stat_t));
+		sd->stat.id = i;
+		sd->stat.path = sd->current;
 		queue_insert_tail(&g_storage_dir_q, &sd->me);
 		g_storage_dir_n++;
     }
 
+	g_vol_stats = (vol_stat_t **)pool_alloc(cycle->pool, 
+		g_storage_dir_n * sizeof(vol_stat_t *));
+	if (!g_vol_stats) 
+	{
+        dfs_log_error(dfs_cycle->error_log, DFS_LOG_ERROR, errno, 
+			"pool_alloc err");
+
+		return DFS_ERROR;
+	}
+
+	for (int i = 0; i < g_storage_dir_n; i++) 
+	{
+        g_vol_stats[i] = &get_storage_dir(i)->stat;
+	}
+
     return DFS_OK;
 }
 
+// dirs is a comma separated list of data_dir entries
+static int dir_compressed(string_t *dirs, char *dir)
+{
+    uchar_t *p = dirs->data;
+	uchar_t *end = dirs->data + dirs->len;
+	uchar_t *next = NULL;
+	size_t   len = strlen(dir);
+
+	while (p && p < end)
+	{
+	    next = memchr(p, ',', end - p);
+		if (!next)
+		{
+            next = end;
+		}
+
+		if ((size_t)(next - p) == len && !memcmp(p, dir, len))
+		{
+            return DFS_TRUE;
+		}
+
+		p = next + 1;
+	}
+
+	return DFS_FALSE;
+}
+
 // create storage dirs
 static int create_storage_dirs(cycle_t *cycle)
 {
+    conf_server_t *sconf = (conf_server_t *)cycle->sconf;
 	queue_t *head = &g_storage_dir_q;
 	queue_t *entry = queue_next(head);
 
@@ -196,7 +289,11 @@ static int create_storage_dirs(cycle_t *cycle)
 	            return DFS_ERROR;
 	        }
 	    }
+
+		vol_stat_refresh(&sd->stat, DFS_TRUE);
     }
+
+	vol_policy_init(sconf->vol_choosing_policy, sconf->vol_reserved_space);
 	
     return DFS_OK;
 }
@@ -449,254 +546,341 @@ static int create_storage_subdirs(char *path)
     return DFS_OK;
 }
 
-// mgmt is management
-static blk_cache_mgmt_t *blk_cache_mgmt_new_init()
+static void block_info_fill(blk_entry_t *e, storage_dir_t *sd, 
+	block_info_t *blk)
 {
-    size_t index_num = dfs_math_find_prime(BLK_NUM_IN_DN);  //blk num
+    blk->id = e->blk_id;
+	blk->size = e->size;
+	blk->ns_id = e->ns_id;
+	blk->vol = e->vol;
+	blk->snap_slot = e->snap_slot;
+	blk->zip = (e->flags & BLK_ENTRY_ZIP) != 0;
+	get_block_path(sd->current, e->ns_id, e->blk_id, blk->path);
+}
 
-    blk_cache_mgmt_t *bcm = blk_cache_mgmt_create(index_num);
-    if (!bcm) 
-	{
-        return NULL;
-    }
+// a compressed blk found on disk counts with its logical length
+static void block_entry_size(char *path, struct stat *sb, blk_entry_t *e)
+{
+    uint64_t size = 0;
 
-    pthread_rwlock_init(&bcm->cache_rwlock, NULL);
+	e->size = sb->st_size;
 
-    return bcm;
+	if ((uint64_t)sb->st_size >= cfs_zblk_data_off(0) 
+		&& cfs_zblk_probe(path, &size) == DFS_OK) 
+	{
+	    e->size = size;
+        e->flags |= BLK_ENTRY_ZIP;
+	}
 }
 
-// mgmt is management // create meme management
-static blk_cache_mgmt_t *blk_cache_mgmt_create(size_t index_num)
+// 去 index 里面找到对应 id 的blk info, copied out to blk
+int block_object_get(long ns_id, long id, block_info_t *blk)
 {
-    blk_cache_mgmt_t *bcm = (blk_cache_mgmt_t *)memory_alloc(sizeof(*bcm));
-    if (!bcm) 
-	{
-        goto err_out;
-    }
-    
-    if (blk_mem_mgmt_create(&bcm->mem_mgmt, index_num) != DFS_OK) 
-	{
-        goto err_mem_mgmt;
-    }
+    blk_entry_t    e;
+	storage_dir_t *sd = NULL;
 
-    bcm->blk_htable = dfs_hashtable_create(uint64_cmp, index_num, 
-		req_hash, bcm->mem_mgmt.allocator);
-    if (!bcm->blk_htable) 
+	if (blk_index_get(&g_blk_index, ns_id, id, &e) != DFS_OK) 
 	{
-        goto err_htable;
-    }
+        return DFS_ERROR;
+	}
 
-    return bcm;
+	sd = get_storage_dir(e.vol);
+	if (!sd) 
+	{
+        return DFS_ERROR;
+	}
 
-err_htable:
-    blk_mem_mgmt_destroy(&bcm->mem_mgmt);
+	block_info_fill(&e, sd, blk);
 	
-err_mem_mgmt:
-    memory_free(bcm, sizeof(*bcm));
-
-err_out:
-    return NULL;
+    return DFS_OK;
 }
 
-
-//create mem management 
-static int blk_mem_mgmt_create(blk_cache_mem_t *mem_mgmt, 
-	size_t index_num)
+// 更新 index 和 g_blk_report
+int block_object_add(char *path, int vol, long ns_id, long blk_id)
 {
-    assert(mem_mgmt);
-
-    size_t mem_size = BLK_POOL_SIZE(index_num);
-
-    mem_mgmt->mem = memory_calloc(mem_size);
-    if (!mem_mgmt->mem) 
+    blk_entry_t    e;
+	block_info_t   blk;
+	storage_dir_t *sd = NULL;
+	struct stat    sb;
+	int            rs = DFS_OK;
+	
+	if (blk_index_mark(&g_blk_index, ns_id, blk_id, 
+		(uint8_t)g_scan_gen) == DFS_OK) 
 	{
-        goto err_mem;
-    }
-
-    mem_mgmt->mem_size = mem_size;
+	    // check diff
+        return DFS_OK;
+	}
 
-	mpool_mgmt_param_t param;
-    param.mem_addr = mem_mgmt->mem;
-    param.mem_size = mem_size;
-    // allocator
-    // allocator.init => create pool
-    mem_mgmt->allocator = dfs_mem_allocator_new_init(
-		DFS_MEM_ALLOCATOR_TYPE_COMMPOOL, &param);
-    if (!mem_mgmt->allocator) 
+	sd = get_storage_dir(vol);
+	if (!sd || stat(path, &sb) != DFS_OK) 
 	{
-        goto err_allocator;
-    }
+        return DFS_ERROR;
+	}
 
-    // 创建index 个blk info t的块
-    mem_mgmt->free_mblks = blk_mblks_create(mem_mgmt, index_num);
-    if (!mem_mgmt->free_mblks) 
+	memory_zero(&e, sizeof(e));
+	e.blk_id = blk_id;
+	e.ns_id = ns_id;
+	e.vol = vol;
+	e.flags = (uint8_t)g_scan_gen << BLK_ENTRY_GEN_SHIFT;
+	block_entry_size(path, &sb, &e);
+	blk_snapshot_add(&sd->snap, ns_id, blk_id, e.size, 
+		(e.flags & BLK_ENTRY_ZIP) != 0, &e.snap_slot);
+
+	rs = blk_index_add(&g_blk_index, &e, NULL);
+	if (rs != DFS_OK) 
 	{
-        goto err_mblks;
-    }
+	    // DFS_BUSY: added by a write meanwhile
+        blk_snapshot_del(&sd->snap, e.snap_slot);
 
-    return DFS_OK;
+		return rs == DFS_BUSY ? DFS_OK : DFS_ERROR;
+	}
 
-err_mblks:
-    dfs_mem_allocator_delete(mem_mgmt->allocator);
-	
-err_allocator:
-    memory_free(mem_mgmt->mem, mem_mgmt->mem_size);
+	dir_state_index(vol, ns_id, blk_id, DFS_TRUE);
+
+    // 不在index里的向nn上报
+    block_info_fill(&e, sd, &blk);
+    notify_blk_report(&blk);
 	
-err_mem:
-    return DFS_ERROR;
+    return DFS_OK;
 }
 
-static struct mem_mblks *blk_mblks_create(blk_cache_mem_t *mem_mgmt, 
-	size_t count)
+// fn runs under the index lock and must not call back into it
+void block_object_walk(blk_index_walk_pt fn, void *arg)
 {
-    assert(mem_mgmt);
-	
-    mem_mblks_param_t mblk_param;
-    mblk_param.mem_alloc = allocator_malloc;
-    mblk_param.mem_free = allocator_free;
-    mblk_param.priv = mem_mgmt->allocator;
-
-    // mem_mblks_new = > mem_mblks_new_fn
-    // 初始化新的 mem mblks
-    return mem_mblks_new_fn(sizeof(block_info_t), count, &mblk_param);
+    blk_index_walk(&g_blk_index, fn, arg);
 }
 
-// 调用参数 allocator 的 alloc 分配mem size 大小的内存
-static void *allocator_malloc(void *priv, size_t mem_size)
+int block_volume_num()
 {
-    if (!priv) 
-	{
-        return NULL;
-    }
-
-	dfs_mem_allocator_t *allocator = (dfs_mem_allocator_t *)priv;
-	
-    return allocator->alloc(allocator, mem_size, NULL);
+    return g_storage_dir_n;
 }
 
-static void allocator_free(void *priv, void *mem_addr)
+uint64_t block_object_count()
 {
-    if (!priv || !mem_addr) 
-	{
-        return;
-    }
-
-    dfs_mem_allocator_t *allocator = (dfs_mem_allocator_t *)priv;
-    allocator->free(allocator, mem_addr, NULL);
+    return blk_index_count(&g_blk_index);
 }
 
-static void blk_mem_mgmt_destroy(blk_cache_mem_t *mem_mgmt)
+uint32_t block_volume_gen(int vol)
 {
-    mem_mblks_destroy(mem_mgmt->free_mblks); 
-    dfs_mem_allocator_delete(mem_mgmt->allocator);
-    memory_free(mem_mgmt->mem, mem_mgmt->mem_size);
+    storage_dir_t *sd = get_storage_dir(vol);
+
+	return sd ? sd->report_gen : 0;
 }
 
-static void blk_cache_mgmt_release(blk_cache_mgmt_t *bcm)
+int block_object_del(long ns_id, long blk_id)
 {
-    assert(bcm);
+    blk_entry_t    e;
+	storage_dir_t *sd = NULL;
+	char           dir[PATH_LEN] = "";
+	char           path[PATH_LEN] = "";
+	int            in_sync = DFS_FALSE;
+
+	if (blk_index_get(&g_blk_index, ns_id, blk_id, &e) != DFS_OK) 
+	{
+        return DFS_ERROR;
+	}
 
-	pthread_rwlock_destroy(&bcm->cache_rwlock);
+	sd = get_storage_dir(e.vol);
+	if (!sd) 
+	{
+        return DFS_ERROR;
+	}
+	
+	get_block_dir(sd->current, ns_id, blk_id, dir);
+	get_block_path(sd->current, ns_id, blk_id, path);
+	in_sync = dir_state_in_sync(sd, ns_id, blk_id, dir);
 
-    blk_mem_mgmt_destroy(&bcm->mem_mgmt);
-    memory_free(bcm, sizeof(*bcm));
-}
+	unlink(path);
+	dn_fd_cache_invalidate(ns_id, blk_id);
 
-static int uint64_cmp(const void *s1, const void *s2, size_t sz)
-{
-    return *(uint64_t *)s1 == *(uint64_t *)s2 ? DFS_FALSE : DFS_TRUE; 
+	if (in_sync) 
+	{
+        dir_state_refresh(sd, ns_id, blk_id, dir);
+	}
+
+	if (blk_index_del(&g_blk_index, ns_id, blk_id, &e) == DFS_OK) 
+	{
+        blk_snapshot_del(&sd->snap, e.snap_slot);
+		dir_state_index(e.vol, ns_id, blk_id, DFS_FALSE);
+		notify_nn_deletedblock(ns_id, blk_id);
+	}
+    
+    return DFS_OK;
 }
 
-// 取余
-static size_t req_hash(const void *data, size_t data_size, 
-	size_t hashtable_size)
+// restore one snapshot record without touching the block file
+static int block_object_restore(int vol, long ns_id, long blk_id, 
+	long size, int zip, uint32_t slot)
 {
-    uint64_t u = *(uint64_t *)data;
-	
-    return u % hashtable_size;
+    blk_entry_t    e;
+	storage_dir_t *sd = NULL;
+
+	sd = get_storage_dir(vol);
+	if (!sd) 
+	{
+        return DFS_ERROR;
+	}
+
+	memory_zero(&e, sizeof(e));
+	e.blk_id = blk_id;
+	e.ns_id = ns_id;
+	e.size = size;
+	e.vol = vol;
+	e.flags = zip ? BLK_ENTRY_ZIP : 0;
+	e.snap_slot = slot;
+
+	if (blk_index_add(&g_blk_index, &e, NULL) != DFS_OK) 
+	{
+        return DFS_ERROR;
+	}
+
+	dir_state_index(vol, ns_id, blk_id, DFS_TRUE);
+
+	return DFS_OK;
 }
 
-// 去hash table 里面找到对应 id 的blk info
-block_info_t *block_object_get(long id)
+// collects the blks a complete pass did not see in a dir it checked
+// blk by blk, or in a dir that is gone
+static void block_object_purge_check(blk_entry_t *e, void *arg)
 {
-    pthread_rwlock_rdlock(&g_dn_bcm->cache_rwlock); //读锁定读写锁
+    blk_purge_t     *purge = (blk_purge_t *)arg;
+	storage_dir_t   *sd = NULL;
+	blk_dir_state_t *st = NULL;
+	blk_entry_t     *ents = NULL;
+	int              trusted = DFS_FALSE;
+	uint64_t         cap = 0;
+
+	if (blk_entry_gen(e) == (uint8_t)purge->gen) 
+	{
+        return;
+	}
+
+	sd = get_storage_dir(e->vol);
+	if (sd) 
+	{
+	    pthread_mutex_lock(&sd->state_lock);
+		st = get_dir_state(sd, e->ns_id, blk_dir_idx(e->blk_id), DFS_FALSE);
+		trusted = st && st->seen_gen == purge->gen 
+			&& st->scan_gen != purge->gen;
+		pthread_mutex_unlock(&sd->state_lock);
+	}
 
-	block_info_t *blk = (block_info_t *)dfs_hashtable_lookup(g_dn_bcm->blk_htable, 
-		&id, sizeof(id));
+	if (trusted) 
+	{
+        return;
+	}
 
-	pthread_rwlock_unlock(&g_dn_bcm->cache_rwlock);
-	
-    return blk;
+	if (purge->n == purge->cap) 
+	{
+	    cap = purge->cap ? purge->cap << 1 : 1024;
+        ents = (blk_entry_t *)memory_realloc(purge->ents, 
+			cap * sizeof(blk_entry_t));
+		if (!ents) 
+		{
+            return;
+		}
+
+		purge->ents = ents;
+		purge->cap = cap;
+	}
+
+	purge->ents[purge->n++] = *e;
 }
 
-// 更新 hashtable 和 g_blk_report
-// 数据节点每次初始化就需要重建一次hash table
-int block_object_add(char *path, long ns_id, long blk_id)
+// drop the blks that a complete scanner pass did not find on disk
+static void block_object_purge(uint32_t scan_gen)
 {
-    block_info_t *blk = NULL;
-    // 去hash table 里面找到对应 id 的blk info
-	blk = block_object_get(blk_id);
-	if (blk) 
+    blk_purge_t    purge;
+	blk_entry_t    e;
+	storage_dir_t *sd = NULL;
+	uint64_t       i = 0;
+	int            n = 0;
+
+	memory_zero(&purge, sizeof(purge));
+	purge.gen = scan_gen;
+
+	blk_index_walk(&g_blk_index, block_object_purge_check, &purge);
+
+	for (i = 0; i < purge.n; i++) 
 	{
-	    // check diff
-        return DFS_OK;
-	}
+	    // skip the ones a write brought back meanwhile
+        if (blk_index_del_stale(&g_blk_index, purge.ents[i].ns_id, 
+			purge.ents[i].blk_id, (uint8_t)scan_gen, &e) != DFS_OK) 
+		{
+            continue;
+		}
 
-	struct stat sb;
-	stat(path, &sb);
-	long blk_sz = sb.st_size;
+		sd = get_storage_dir(e.vol);
+		if (sd) 
+		{
+            blk_snapshot_del(&sd->snap, e.snap_slot);
+		}
+
+		dir_state_index(e.vol, e.ns_id, e.blk_id, DFS_FALSE);
+		dn_fd_cache_invalidate(e.ns_id, e.blk_id);
+		notify_nn_deletedblock(e.ns_id, e.blk_id);
+		n++;
+	}
 
-	pthread_rwlock_wrlock(&g_dn_bcm->cache_rwlock); // 写锁定？
+	memory_free(purge.ents, purge.cap * sizeof(blk_entry_t));
 
-	// 从之前初始化的 gbcm缓存中分配一个blk
-	blk = (block_info_t *)mem_get0(g_dn_bcm->mem_mgmt.free_mblks);
-	if (!blk)
+	if (n > 0) 
 	{
-	    dfs_log_error(dfs_cycle->error_log, DFS_LOG_ALERT, 0, "mem_get0 err");
+	    dfs_log_error(dfs_cycle->error_log, DFS_LOG_INFO, 0, 
+			"reconcile dropped %d missing blks", n);
 	}
+}
 
-	queue_init(&blk->me);
-	
-    blk->id = blk_id;
-	blk->size = blk_sz;
-	strcpy(blk->path, path);
+static int load_blk_snapshots()
+{
+    queue_t *head = &g_storage_dir_q;
+	queue_t *entry = queue_next(head);
 
-	blk->ln.key = &blk->id;
-    blk->ln.len = sizeof(blk->id);
-    blk->ln.next = NULL;
+	while (head != entry) 
+	{
+        storage_dir_t *sd = queue_data(entry, storage_dir_t, me);
 
-	dfs_hashtable_join(g_dn_bcm->blk_htable, &blk->ln);
+		entry = queue_next(entry);
 
-	pthread_rwlock_unlock(&g_dn_bcm->cache_rwlock);
+		if (blk_snapshot_open(&sd->snap, sd->id, sd->current) != DFS_OK
+			|| blk_snapshot_load(&sd->snap, block_object_restore) != DFS_OK)
+		{
+		    // fall back to a full scan of this volume
+		    blk_snapshot_close(&sd->snap);
+		}
+	}
 
-    // blk info插入 g_blk_report
-    // 不在hashtable里的向nn上报
-    notify_blk_report(blk);
-	
-    return DFS_OK;
+	return DFS_OK;
 }
 
-int block_object_del(long blk_id)
+static void close_blk_snapshots()
 {
-    block_info_t *blk = NULL;
+    queue_t *head = &g_storage_dir_q;
+	queue_t *entry = queue_next(head);
 
-	blk = block_object_get(blk_id);
-	if (!blk) 
+	while (head != entry) 
 	{
-        return DFS_ERROR;
+        storage_dir_t *sd = queue_data(entry, storage_dir_t, me);
+
+		entry = queue_next(entry);
+
+		blk_snapshot_close(&sd->snap);
 	}
+}
 
-	unlink(blk->path);
-	
-	pthread_rwlock_wrlock(&g_dn_bcm->cache_rwlock);
+static void sync_blk_snapshots()
+{
+    queue_t *head = &g_storage_dir_q;
+	queue_t *entry = queue_next(head);
 
-    dfs_hashtable_remove_link(g_dn_bcm->blk_htable, &blk->ln);
+	while (head != entry) 
+	{
+        storage_dir_t *sd = queue_data(entry, storage_dir_t, me);
 
-	mem_put(blk);
+		entry = queue_next(entry);
 
-	pthread_rwlock_unlock(&g_dn_bcm->cache_rwlock);
-    
-    return DFS_OK;
+		blk_snapshot_sync(&sd->snap);
+	}
 }
 
 int block_read(dn_request_t *r, file_io_t *fio)
@@ -736,7 +920,11 @@ int get_block_temp_path(dn_request_t *r)
     char tmpDir[PATH_LEN] = "";
 	char curDir[PATH_LEN] = "";
 
-	get_disk_id(r->header.block_id, curDir);
+	if (choose_disk_id(r, curDir) == DFS_ERROR) 
+	{
+        return DFS_ERROR;
+	}
+
 	sprintf(tmpDir, "%s/NS-%ld/blocksBeingWritten/blk_%ld", 
 		curDir, r->header.namespace_id, r->header.block_id);
 	
@@ -754,143 +942,851 @@ int get_block_temp_path(dn_request_t *r)
 
 int write_block_done(dn_request_t *r)
 {
-    char curDir[PATH_LEN] = "";
-	char blkDir[PATH_LEN] = "";
-	int  suddir_id = 0;
-	int  suddir_id2 = 0;
+    return block_object_commit((char *)r->path, r->vol, 
+		r->header.namespace_id, r->header.block_id, r->header.len, r->zip);
+}
+
+// moves a written blk out of blocksBeingWritten and indexes it, path
+// is then the final one
+int block_object_commit(char *path, int vol, long ns_id, long blk_id, 
+	long size, int zip)
+{
+    char           curDir[PATH_LEN] = "";
+	char           blkDir[PATH_LEN] = "";
+	char           dir[PATH_LEN] = "";
+	storage_dir_t *sd = NULL;
+	int            in_sync = DFS_FALSE;
+
+	sd = get_storage_dir(vol);
+	if (!sd) 
+	{
+        return DFS_ERROR;
+	}
 
-	suddir_id = r->header.block_id % SUBDIR_LEN;
-	suddir_id2 = (r->header.block_id % 1000) % SUBDIR_LEN;
+	strcpy(curDir, sd->current);
+	get_block_path(curDir, ns_id, blk_id, blkDir);
 
-	get_disk_id(r->header.block_id, curDir);
-	sprintf(blkDir, "%s/NS-%ld/current/subdir%d/subdir%d/blk_%ld", 
-		curDir, r->header.namespace_id, suddir_id, suddir_id2, 
-		r->header.block_id);
+	// our own rename must not make the scanner read the dir again
+	get_block_dir(curDir, ns_id, blk_id, dir);
+	in_sync = dir_state_in_sync(sd, ns_id, blk_id, dir);
 
 	// 调用rename快速移动文件，但是rename不能跨分区跨磁盘
-	if (rename((char *)r->path, blkDir) != DFS_OK) 
+	if (rename(path, blkDir) != DFS_OK) 
 	{
         dfs_log_error(dfs_cycle->error_log, DFS_LOG_ERROR, errno, 
-			"rename %s to %s err", r->path, blkDir);
+			"rename %s to %s err", path, blkDir);
 		
         return DFS_ERROR;
 	}
 
-	strcpy((char *)r->path, blkDir);
+	// readers of a rewritten blk must not keep the old file
+	dn_fd_cache_invalidate(ns_id, blk_id);
+
+	if (in_sync) 
+	{
+        dir_state_refresh(sd, ns_id, blk_id, dir);
+	}
+
+	strcpy(path, blkDir);
 	    
-    return recv_blk_report(r);
+    return recv_blk_report(sd, ns_id, blk_id, size, zip);
 }
 
-static int get_disk_id(long block_id, char *path)
+// picks the storage dir for a blk being written and holds its length
+// there. a rewritten blk stays where it is
+static int choose_disk_id(dn_request_t *r, char *path)
 {
-    queue_t *head = NULL;
-	queue_t *entry = NULL;
-	int      disk_id = 0;
+    blk_entry_t    e;
+	storage_dir_t *sd = NULL;
+	uint64_t       len = 0;
+	int            vol = DFS_ERROR;
 
-	disk_id = block_id % g_storage_dir_n;
-
-	head = &g_storage_dir_q;
-	entry = queue_next(head);
-
-	while (head != entry) 
+	if (r->vol >= 0) 
 	{
-        storage_dir_t *sd = queue_data(entry, storage_dir_t, me);
+        block_volume_release(r);
+	}
 
-		entry = queue_next(entry);
+	len = r->header.len > 0 ? (uint64_t)r->header.len : 0;
 
-		if (sd->id == disk_id) 
+	if (blk_index_get(&g_blk_index, r->header.namespace_id, 
+		r->header.block_id, &e) == DFS_OK && e.vol < g_storage_dir_n) 
+	{
+	    vol = e.vol;
+        vol_stat_hold(g_vol_stats[vol], len);
+	}
+	else 
+	{
+        vol = vol_choose(g_vol_stats, g_storage_dir_n, len);
+		if (vol == DFS_ERROR) 
 		{
-		    strcpy(path, sd->current);
-			
-            break;
+            return DFS_ERROR;
 		}
 	}
 
-	return DFS_OK;
+	r->vol = vol;
+	r->vol_held = len;
+
+	sd = get_storage_dir(vol);
+	strcpy(path, sd->current);
+
+	return vol;
 }
 
-static int recv_blk_report(dn_request_t *r)
+// internal blk of an ec group, put on the next volume after near with
+// room for it so the group spreads over the disks. len is held there,
+// returns the volume
+int get_unit_temp_path(long ns_id, long blk_id, uint64_t len, int near, 
+	char *path)
 {
-    block_info_t *blk = NULL;
-		
-    pthread_rwlock_wrlock(&g_dn_bcm->cache_rwlock);
+    blk_entry_t    e;
+	storage_dir_t *sd = NULL;
+	int            vol = DFS_ERROR;
+	int            i = 0;
 
-	blk = (block_info_t *)mem_get0(g_dn_bcm->mem_mgmt.free_mblks);
-	if (!blk)
+	if (blk_index_get(&g_blk_index, ns_id, blk_id, &e) == DFS_OK 
+		&& e.vol < g_storage_dir_n) 
 	{
-	    dfs_log_error(dfs_cycle->error_log, DFS_LOG_ALERT, 0, "mem_get0 err");
+	    vol = e.vol;
 	}
+	else if (near >= 0) 
+	{
+	    for (i = 1; i <= g_storage_dir_n; i++) 
+		{
+		    vol_stat_refresh(g_vol_stats[(near + i) % g_storage_dir_n], 
+				DFS_FALSE);
+			
+            if (vol_stat_room(g_vol_stats[(near + i) % g_storage_dir_n]) 
+				>= len) 
+			{
+                vol = (near + i) % g_storage_dir_n;
 
-	queue_init(&blk->me);
-	
-    blk->id = r->header.block_id;
-	blk->size = r->header.len;
-	strcpy(blk->path, (const char *)r->path);
-
-	blk->ln.key = &blk->id;
-    blk->ln.len = sizeof(blk->id);
-    blk->ln.next = NULL;
+				break;
+			}
+		}
+	}
 
-	dfs_hashtable_join(g_dn_bcm->blk_htable, &blk->ln);
+	if (vol >= 0) 
+	{
+        vol_stat_hold(g_vol_stats[vol], len);
+	}
+	else 
+	{
+	    vol = vol_choose(g_vol_stats, g_storage_dir_n, len);
+		if (vol == DFS_ERROR) 
+		{
+            return DFS_ERROR;
+		}
+	}
 
-	pthread_rwlock_unlock(&g_dn_bcm->cache_rwlock);
+	sd = get_storage_dir(vol);
+	sprintf(path, "%s/NS-%ld/blocksBeingWritten/blk_%ld", sd->current, 
+		ns_id, blk_id);
 
-	// 提示name node 收到 blk
-    notify_nn_receivedblock(blk);
-    
-    return DFS_OK;
+	return vol;
 }
 
-// scanner线程
-void *blk_scanner_start(void *arg)
+int block_volume_compress(int vol)
 {
-	conf_server_t *sconf = NULL;
-	int            blk_report_interval = 0;
-	unsigned long  last_blk_report = 0;
-
-	sconf = (conf_server_t *)dfs_cycle->sconf;
-    blk_report_interval = sconf->block_report_interval;
+    storage_dir_t *sd = get_storage_dir(vol);
 
-	//struct timeval now;
-	//gettimeofday(&now, NULL);
-	//unsigned long diff = now.tv_sec * 1000 + now.tv_usec / 1000;
-
-	//last_blk_report = diff;
+	return sd ? sd->compress : DFS_FALSE;
+}
 
-	while (blk_scanner_running)  // 默认 true
+vol_stat_t *block_volume_stat(int vol)
+{
+    if (vol < 0 || vol >= g_storage_dir_n) 
 	{
-        //gettimeofday(&now, NULL);
-	    //diff = (now.tv_sec * 1000 + now.tv_usec / 1000) - last_blk_report;
+        return NULL;
+	}
 
-		//if (diff >= blk_report_interval) 
-		//{
-        //
-		//}
+	return g_vol_stats[vol];
+}
 
-		// scan dir
-		queue_t *head = &g_storage_dir_q;
-		queue_t *entry = queue_next(head);
+void block_volume_release(dn_request_t *r)
+{
+    vol_stat_t *v = block_volume_stat(r->vol);
 
-		while (head != entry) 
-		{
-            storage_dir_t *sd = queue_data(entry, storage_dir_t, me);
+	if (v) 
+	{
+        vol_stat_unhold(v, r->vol_held);
+	}
 
-			entry = queue_next(entry);
+	r->vol = -1;
+	r->vol_held = 0;
+}
 
-			scan_current_dir(sd->current);
-		}
+static storage_dir_t *get_storage_dir(int vol)
+{
+    queue_t *head = &g_storage_dir_q;
+	queue_t *entry = queue_next(head);
 
-		sleep(blk_report_interval);
+	while (head != entry) 
+	{
+        storage_dir_t *sd = queue_data(entry, storage_dir_t, me);
+
+		entry = queue_next(entry);
+
+		if (sd->id == vol) 
+		{
+            return sd;
+		}
+	}
+
+	return NULL;
+}
+
+// the final place of a blk is derived from its id only
+static void get_block_dir(char *dir, long ns_id, long blk_id, char *path)
+{
+    int suddir_id = blk_id % SUBDIR_LEN;
+	int suddir_id2 = (blk_id % 1000) % SUBDIR_LEN;
+
+	sprintf(path, "%s/NS-%ld/current/subdir%d/subdir%d", 
+		dir, ns_id, suddir_id, suddir_id2);
+}
+
+static void get_block_path(char *dir, long ns_id, long blk_id, char *path)
+{
+    char blk_dir[PATH_LEN] = "";
+
+	get_block_dir(dir, ns_id, blk_id, blk_dir);
+	sprintf(path, "%s/blk_%ld", blk_dir, blk_id);
+}
+
+// splitmix64 finalizer, spreads sequential ids over all bits
+static uint64_t blk_digest(long blk_id)
+{
+    uint64_t z = (uint64_t)blk_id + 0x9e3779b97f4a7c15ULL;
+
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+
+	return z ^ (z >> 31);
+}
+
+// state_lock must be held
+static blk_dir_state_t *get_dir_state(storage_dir_t *sd, long ns_id, 
+	int idx, int create)
+{
+    queue_t        *head = &sd->ns_states;
+	queue_t        *entry = queue_next(head);
+	blk_ns_state_t *ns = NULL;
+	int             i = 0;
+
+	while (head != entry) 
+	{
+        ns = queue_data(entry, blk_ns_state_t, me);
+
+		entry = queue_next(entry);
+
+		if (ns->ns_id == ns_id) 
+		{
+            return &ns->dirs[idx];
+		}
+	}
+
+	if (!create) 
+	{
+        return NULL;
+	}
+
+	ns = (blk_ns_state_t *)memory_calloc(sizeof(blk_ns_state_t));
+	if (!ns) 
+	{
+        return NULL;
+	}
+
+	ns->ns_id = ns_id;
+
+	for (i = 0; i < BLK_SCAN_LEAF_DIRS; i++) 
+	{
+        ns->dirs[i].wd = -1;
+	}
+
+	queue_insert_tail(head, &ns->me);
+
+	return &ns->dirs[idx];
+}
+
+// keeps the per dir digest in step with the index, called after it changed
+static void dir_state_index(int vol, long ns_id, long blk_id, int add)
+{
+    storage_dir_t   *sd = NULL;
+	blk_dir_state_t *st = NULL;
+
+	sd = get_storage_dir(vol);
+	if (!sd) 
+	{
+        return;
+	}
+
+	__sync_fetch_and_add(&sd->report_gen, 1);
+
+	pthread_mutex_lock(&sd->state_lock);
+
+	st = get_dir_state(sd, ns_id, blk_dir_idx(blk_id), DFS_TRUE);
+	if (st) 
+	{
+        st->digest ^= blk_digest(blk_id);
+		st->count += add ? 1 : -1;
+	}
+
+	pthread_mutex_unlock(&sd->state_lock);
+}
+
+// whether the dir is unchanged since the scanner or we last looked
+static int dir_state_in_sync(storage_dir_t *sd, long ns_id, long blk_id, 
+	char *dir)
+{
+    struct stat      sb;
+	blk_dir_state_t *st = NULL;
+	int              rs = DFS_FALSE;
+
+	if (stat(dir, &sb) != DFS_OK) 
+	{
+        return DFS_FALSE;
+	}
+
+	pthread_mutex_lock(&sd->state_lock);
+
+	st = get_dir_state(sd, ns_id, blk_dir_idx(blk_id), DFS_FALSE);
+	if (st && st->valid && st->ino == sb.st_ino 
+		&& st->mtime_sec == sb.st_mtim.tv_sec 
+		&& st->mtime_nsec == sb.st_mtim.tv_nsec) 
+	{
+        rs = DFS_TRUE;
+	}
+
+	pthread_mutex_unlock(&sd->state_lock);
+
+	return rs;
+}
+
+static void dir_state_refresh(storage_dir_t *sd, long ns_id, long blk_id, 
+	char *dir)
+{
+    struct stat      sb;
+	blk_dir_state_t *st = NULL;
+
+	if (stat(dir, &sb) != DFS_OK) 
+	{
+        return;
+	}
+
+	pthread_mutex_lock(&sd->state_lock);
+
+	st = get_dir_state(sd, ns_id, blk_dir_idx(blk_id), DFS_FALSE);
+	if (st) 
+	{
+	    st->ino = sb.st_ino;
+        st->mtime_sec = sb.st_mtim.tv_sec;
+		st->mtime_nsec = sb.st_mtim.tv_nsec;
+	}
+
+	pthread_mutex_unlock(&sd->state_lock);
+}
+
+static int recv_blk_report(storage_dir_t *sd, long ns_id, long blk_id, 
+	long size, int zip)
+{
+    blk_entry_t    e;
+	blk_entry_t    prev;
+	block_info_t   blk;
+	int            rs = DFS_OK;
+
+	memory_zero(&e, sizeof(e));
+	e.blk_id = blk_id;
+	e.ns_id = ns_id;
+	e.size = size;
+	e.vol = sd->id;
+	e.flags = (uint8_t)g_scan_gen << BLK_ENTRY_GEN_SHIFT 
+		| (zip ? BLK_ENTRY_ZIP : 0);
+	blk_snapshot_add(&sd->snap, e.ns_id, e.blk_id, e.size, zip, 
+		&e.snap_slot);
+
+	// a rewritten blk replaces the old entry
+	rs = blk_index_add(&g_blk_index, &e, &prev);
+	if (rs == DFS_OK) 
+	{
+        dir_state_index(e.vol, e.ns_id, e.blk_id, DFS_TRUE);
+	}
+	else if (rs == DFS_BUSY) 
+	{
+        blk_snapshot_del(&sd->snap, prev.snap_slot);
+	}
+	else 
+	{
+	    blk_snapshot_del(&sd->snap, e.snap_slot);
+		
+        return DFS_ERROR;
+	}
+
+	// 提示name node 收到 blk
+	block_info_fill(&e, sd, &blk);
+    notify_nn_receivedblock(&blk);
+    
+    return DFS_OK;
+}
+
+// scanner线程
+// the index is already complete from the snapshots, every pass only
+// reconciles it against what is really on disk, one thread per volume
+void *blk_scanner_start(void *arg)
+{
+	conf_server_t *sconf = NULL;
+	int            blk_report_interval = 0;
+	int            complete = DFS_TRUE;
+	blk_scan_t    *scans = NULL;
+	int            i = 0;
+	int            n = 0;
+	int            full = DFS_FALSE;
+	time_t         last_full = 0;
+
+	sconf = (conf_server_t *)dfs_cycle->sconf;
+    blk_report_interval = sconf->block_report_interval;
+
+	if (sconf->block_scan_inotify && scan_inotify_init() != DFS_OK) 
+	{
+	    dfs_log_error(dfs_cycle->error_log, DFS_LOG_WARN, 0, 
+			"inotify is off, out-of-band changes rely on dir mtime");
+	}
+
+	scans = (blk_scan_t *)memory_calloc(g_storage_dir_n * sizeof(blk_scan_t));
+	if (!scans) 
+	{
+        dfs_log_error(dfs_cycle->error_log, DFS_LOG_ALERT, errno, 
+			"calloc blk scans err");
+
+		return NULL;
+	}
+
+	queue_t *head = &g_storage_dir_q;
+	queue_t *entry = queue_next(head);
+
+	while (head != entry && n < g_storage_dir_n) 
+	{
+        scans[n++].sd = queue_data(entry, storage_dir_t, me);
+		entry = queue_next(entry);
+	}
+
+	// the dirs restored from the snapshots are listed by the first pass
+	last_full = time(NULL);
+
+	while (blk_scanner_running)  // 默认 true
+	{
+	    int64_t start = dfs_current_msec;
+		uint64_t found = 0;
+		uint64_t skipped = 0;
+		uint64_t fresh = 0;
+		
+	    g_scan_gen++;
+		complete = DFS_TRUE;
+
+		// now and then a missed event or a coarse mtime can't hide a dir
+		full = sconf->block_scan_full_interval 
+			&& time(NULL) - last_full >= sconf->block_scan_full_interval;
+		if (full) 
+		{
+            last_full = time(NULL);
+		}
+		
+		for (i = 0; i < n; i++) 
+		{
+		    scans[i].rs = DFS_ERROR;
+			scans[i].full = full;
+			
+            if (pthread_create(&scans[i].tid, NULL, &scan_volume, 
+				&scans[i]) != DFS_OK) 
+			{
+                dfs_log_error(dfs_cycle->error_log, DFS_LOG_ERROR, errno, 
+			        "create scan thread of %s err", scans[i].sd->current);
+				
+				scans[i].tid = 0;
+			}
+		}
+
+		for (i = 0; i < n; i++) 
+		{
+            if (scans[i].tid) 
+			{
+                pthread_join(scans[i].tid, NULL);
+			}
+
+			if (scans[i].rs != DFS_OK) 
+			{
+                complete = DFS_FALSE;
+			}
+
+			found += scans[i].found;
+			skipped += scans[i].skipped;
+			fresh += scans[i].fresh;
+		}
+
+		if (complete) 
+		{
+            block_object_purge(g_scan_gen);
+		}
+
+		sync_blk_snapshots();
+
+		// the namenode learns about blks found out of band in one go
+		if (fresh > 0) 
+		{
+            notify_blk_full_report();
+		}
+
+		dfs_log_error(dfs_cycle->error_log, DFS_LOG_INFO, 0, 
+			"scan %d volumes done%s, blks read: %uL, new: %uL, "
+			"dirs skipped: %uL, cost: %l ms", n, full ? " (full)" : "", 
+			found, fresh, skipped, (long)(dfs_current_msec - start));
+
+		scan_wait(blk_report_interval);
+	}
+
+	scan_inotify_release();
+
+	for (i = 0; i < n; i++) 
+	{
+        scan_release(&scans[i]);
 	}
+
+	memory_free(scans, g_storage_dir_n * sizeof(blk_scan_t));
 	
     return NULL;
 }
 
-static int scan_current_dir(char *dir)
+static int scan_inotify_init()
+{
+    g_scan_ifd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (g_scan_ifd < 0) 
+	{
+	    dfs_log_error(dfs_cycle->error_log, DFS_LOG_ERROR, errno, 
+			"inotify_init1 err");
+		
+        return DFS_ERROR;
+	}
+
+	return DFS_OK;
+}
+
+static void scan_inotify_release()
+{
+    if (g_scan_ifd >= 0) 
+	{
+        close(g_scan_ifd);
+		g_scan_ifd = -1;
+	}
+
+	pthread_mutex_lock(&g_scan_watch_lock);
+
+	if (g_scan_watches) 
+	{
+        memory_free(g_scan_watches, 
+			g_scan_watches_n * sizeof(blk_scan_watch_t));
+		g_scan_watches = NULL;
+		g_scan_watches_n = 0;
+	}
+
+	pthread_mutex_unlock(&g_scan_watch_lock);
+}
+
+static void scan_inotify_watch(storage_dir_t *sd, long ns_id, 
+	blk_dir_state_t *st, char *dir)
+{
+    int               wd = -1;
+	int               n = 0;
+	blk_scan_watch_t *watches = NULL;
+
+	if (g_scan_ifd < 0 || st->wd >= 0) 
+	{
+        return;
+	}
+
+	wd = inotify_add_watch(g_scan_ifd, dir, IN_CREATE | IN_DELETE 
+		| IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF 
+		| IN_ONLYDIR);
+	// out of watches most likely, tried again every pass but told once
+	if (wd < 0) 
+	{
+	    if (!st->unwatched) 
+		{
+		    dfs_log_error(dfs_cycle->error_log, DFS_LOG_WARN, errno, 
+			    "inotify_add_watch %s err, listed every pass", dir);
+		}
+
+		pthread_mutex_lock(&sd->state_lock);
+		st->unwatched = DFS_TRUE;
+		pthread_mutex_unlock(&sd->state_lock);
+		
+        return;
+	}
+
+	pthread_mutex_lock(&g_scan_watch_lock);
+
+	if (wd >= g_scan_watches_n) 
+	{
+	    n = g_scan_watches_n ? g_scan_watches_n << 1 : 1024;
+		n = n > wd ? n : wd + 1;
+        watches = (blk_scan_watch_t *)memory_realloc(g_scan_watches, 
+			n * sizeof(blk_scan_watch_t));
+		if (!watches) 
+		{
+		    pthread_mutex_unlock(&g_scan_watch_lock);
+			inotify_rm_watch(g_scan_ifd, wd);
+			
+            return;
+		}
+
+		memory_zero(watches + g_scan_watches_n, 
+			(n - g_scan_watches_n) * sizeof(blk_scan_watch_t));
+		g_scan_watches = watches;
+		g_scan_watches_n = n;
+	}
+
+	g_scan_watches[wd].sd = sd;
+	g_scan_watches[wd].ns_id = ns_id;
+	g_scan_watches[wd].st = st;
+
+	pthread_mutex_unlock(&g_scan_watch_lock);
+
+	pthread_mutex_lock(&sd->state_lock);
+	st->wd = wd;
+	st->unwatched = DFS_FALSE;
+	pthread_mutex_unlock(&sd->state_lock);
+}
+
+// an event in a leaf dir makes the next pass read it again,
+// unless it only reflects a change the index already has
+static void scan_inotify_handle()
+{
+    char                        buf[64 * 1024] 
+		__attribute__((aligned(__alignof__(struct inotify_event))));
+	const struct inotify_event *ev = NULL;
+	ssize_t                     len = 0;
+	char                       *p = NULL;
+	blk_scan_watch_t            w;
+	blk_entry_t                 e;
+	int                         known = DFS_FALSE;
+	queue_t                    *head = NULL;
+	queue_t                    *entry = NULL;
+	queue_t                    *nentry = NULL;
+	int                         i = 0;
+
+	for ( ;; ) 
+	{
+        len = read(g_scan_ifd, buf, sizeof(buf));
+		if (len <= 0) 
+		{
+            return;
+		}
+
+		for (p = buf; p < buf + len; p += sizeof(*ev) + ev->len) 
+		{
+            ev = (const struct inotify_event *)p;
+
+			if (ev->mask & IN_Q_OVERFLOW) 
+			{
+			    // lost events, do not trust any dir
+                head = &g_storage_dir_q;
+				
+				for (entry = queue_next(head); entry != head; 
+					entry = queue_next(entry)) 
+				{
+                    storage_dir_t *sd = queue_data(entry, storage_dir_t, me);
+
+					pthread_mutex_lock(&sd->state_lock);
+
+					for (nentry = queue_next(&sd->ns_states); 
+						nentry != &sd->ns_states; nentry = queue_next(nentry)) 
+					{
+                        blk_ns_state_t *ns = queue_data(nentry, 
+							blk_ns_state_t, me);
+
+						for (i = 0; i < BLK_SCAN_LEAF_DIRS; i++) 
+						{
+                            ns->dirs[i].valid = DFS_FALSE;
+						}
+					}
+
+					pthread_mutex_unlock(&sd->state_lock);
+				}
+
+				continue;
+			}
+
+			pthread_mutex_lock(&g_scan_watch_lock);
+			
+			if (ev->wd < 0 || ev->wd >= g_scan_watches_n 
+				|| !g_scan_watches[ev->wd].st) 
+			{
+			    pthread_mutex_unlock(&g_scan_watch_lock);
+				
+                continue;
+			}
+
+			w = g_scan_watches[ev->wd];
+
+			if (ev->mask & IN_IGNORED) 
+			{
+                g_scan_watches[ev->wd].st = NULL;
+			}
+
+			pthread_mutex_unlock(&g_scan_watch_lock);
+
+			if (ev->len > 0 && strncmp(ev->name, "blk_", 4) == 0 
+				&& !(ev->mask & (IN_DELETE_SELF | IN_MOVE_SELF))) 
+			{
+                known = blk_index_get(&g_blk_index, w.ns_id, 
+					atol(ev->name + 4), &e) == DFS_OK;
+
+				if ((known && (ev->mask & (IN_CREATE | IN_MOVED_TO))) 
+					|| (!known && (ev->mask & (IN_DELETE | IN_MOVED_FROM)))) 
+				{
+                    continue;
+				}
+			}
+
+			pthread_mutex_lock(&w.sd->state_lock);
+
+			w.st->valid = DFS_FALSE;
+			
+			if (ev->mask & IN_IGNORED) 
+			{
+                w.st->wd = -1;
+			}
+
+			pthread_mutex_unlock(&w.sd->state_lock);
+		}
+	}
+}
+
+// sleep between passes, draining inotify events meanwhile
+static void scan_wait(int secs)
+{
+    struct pollfd pfd;
+	time_t        end = time(NULL) + secs;
+	time_t        now = 0;
+
+	if (g_scan_ifd < 0) 
+	{
+        sleep(secs);
+
+		return;
+	}
+
+	pfd.fd = g_scan_ifd;
+	pfd.events = POLLIN;
+
+	while (blk_scanner_running && (now = time(NULL)) < end) 
+	{
+        if (poll(&pfd, 1, (end - now) * 1000) > 0) 
+		{
+            scan_inotify_handle();
+		}
+	}
+}
+
+// statvfs off the event loops, often enough that the loops always find
+// the cached values fresh
+void *vol_stat_refresher_start(void *arg)
+{
+    int i = 0;
+
+	while (blk_scanner_running) 
+	{
+        for (i = 0; i < g_storage_dir_n; i++) 
+		{
+            vol_stat_refresh(g_vol_stats[i], DFS_TRUE);
+		}
+
+		usleep(VOL_STATFS_CACHE_MS * 1000 / 2);
+	}
+
+	return NULL;
+}
+
+static void *scan_volume(void *arg)
+{
+    blk_scan_t *scan = (blk_scan_t *)arg;
+
+	scan->found = 0;
+	scan->skipped = 0;
+	scan->fresh = 0;
+
+	if (!scan->dbuf) 
+	{
+        scan->dbuf = (char *)memory_alloc(BLK_SCAN_DENTS_BUF);
+		if (!scan->dbuf || scan_grow(scan) != DFS_OK) 
+		{
+            dfs_log_error(dfs_cycle->error_log, DFS_LOG_ALERT, errno, 
+			    "alloc scan buffers of %s err", scan->sd->current);
+
+			return NULL;
+		}
+	}
+
+	scan->rs = scan_current_dir(scan, scan->sd->current);
+
+	return NULL;
+}
+
+static int scan_grow(blk_scan_t *scan)
+{
+    int         cap = scan->dents_cap ? scan->dents_cap << 1 
+		: BLK_SCAN_DENTS_MIN;
+	eio_dirent *dents = NULL;
+	long       *ids = NULL;
+
+	dents = (eio_dirent *)memory_realloc(scan->dents, 
+		cap * sizeof(eio_dirent));
+	if (!dents) 
+	{
+        return DFS_ERROR;
+	}
+
+	scan->dents = dents;
+
+	ids = (long *)memory_realloc(scan->ids, cap * sizeof(long));
+	if (!ids) 
+	{
+        return DFS_ERROR;
+	}
+
+	scan->ids = ids;
+	scan->dents_cap = cap;
+
+	return DFS_OK;
+}
+
+static void scan_release(blk_scan_t *scan)
+{
+    if (scan->dbuf) 
+	{
+        memory_free(scan->dbuf, BLK_SCAN_DENTS_BUF);
+		scan->dbuf = NULL;
+	}
+
+	if (scan->dents) 
+	{
+        memory_free(scan->dents, scan->dents_cap * sizeof(eio_dirent));
+		scan->dents = NULL;
+	}
+
+	if (scan->ids) 
+	{
+        memory_free(scan->ids, scan->dents_cap * sizeof(long));
+		scan->ids = NULL;
+	}
+
+	scan->dents_cap = 0;
+}
+
+static int scan_current_dir(blk_scan_t *scan, char *dir)
 {
     char           root[PATH_LEN] = "";
 	DIR           *p_dir = NULL;
 	struct dirent *ent = NULL;
+	int            rs = DFS_OK;
 	
 	p_dir = opendir(dir);
 	if (NULL == p_dir) 
@@ -913,13 +1809,16 @@ static int scan_current_dir(char *dir)
 			get_namespace_id(ent->d_name, namespace_id);
 
             sprintf(root, "%s/%s/current", dir, ent->d_name);
-			scan_namespace_dir(root, atol(namespace_id));
+			if (scan_namespace_dir(scan, root, atol(namespace_id)) != DFS_OK) 
+			{
+                rs = DFS_ERROR;
+			}
 		}
 	}
 
 	closedir(p_dir);
 	
-    return DFS_OK;
+    return rs;
 }
 
 static void get_namespace_id(char *src, char *id)
@@ -932,11 +1831,12 @@ static void get_namespace_id(char *src, char *id)
 	}
 }
 
-    static int scan_namespace_dir(char *dir, long namespace_id)
+static int scan_namespace_dir(blk_scan_t *scan, char *dir, long namespace_id)
 {
     char           root[PATH_LEN] = "";
 	DIR           *p_dir = NULL;
 	struct dirent *ent = NULL;
+	int            rs = DFS_OK;
 	
 	p_dir = opendir(dir);
 	if (NULL == p_dir) 
@@ -956,20 +1856,28 @@ static void get_namespace_id(char *src, char *id)
 		else if (0 == strncmp(ent->d_name, "subdir", 6)) 
 		{
             sprintf(root, "%s/%s", dir, ent->d_name);
-            scan_subdir(root, namespace_id);
+            if (scan_subdir(scan, root, namespace_id, 
+				atoi(ent->d_name + 6)) != DFS_OK) 
+			{
+                rs = DFS_ERROR;
+			}
 		}
 	}
 
 	closedir(p_dir);
 	
-    return DFS_OK;
+    return rs;
 }
 
-static int scan_subdir(char *dir, long namespace_id)
+static int scan_subdir(blk_scan_t *scan, char *dir, long namespace_id, 
+	int sub)
 {
     char           root[PATH_LEN] = "";
 	DIR           *p_dir = NULL;
 	struct dirent *ent = NULL;
+	int            rs = DFS_OK;
+	int            sub2 = 0;
+	int            idx = 0;
 	
 	p_dir = opendir(dir);
 	if (NULL == p_dir) 
@@ -989,56 +1897,251 @@ static int scan_subdir(char *dir, long namespace_id)
 		else if (0 == strncmp(ent->d_name, "subdir", 6)) 
 		{
 		    sprintf(root, "%s/%s", dir, ent->d_name);
-            scan_subdir_subdir(root, namespace_id);
+
+			// dirs outside the layout are read on every pass
+			sub2 = atoi(ent->d_name + 6);
+			idx = (sub >= 0 && sub < SUBDIR_LEN && sub2 >= 0 
+				&& sub2 < SUBDIR_LEN) ? sub * SUBDIR_LEN + sub2 : -1;
+			
+            if (scan_subdir_subdir(scan, root, namespace_id, idx) != DFS_OK) 
+			{
+                rs = DFS_ERROR;
+			}
 		}
 	}
 
 	closedir(p_dir);
 	
-    return DFS_OK;
+    return rs;
 }
 
-static int scan_subdir_subdir(char *dir, long namespace_id)
+// the leaf dirs hold the blks, read them with large getdents64 calls
+// and look at the files in inode order.
+// a dir whose ino and mtime did not move since the last pass is skipped,
+// one whose listing matches the digest of the index is not stat()ed
+static int scan_subdir_subdir(blk_scan_t *scan, char *dir, 
+	long namespace_id, int idx)
 {
-    char           path[PATH_LEN] = "";
-	DIR           *p_dir = NULL;
-	struct dirent *ent = NULL;
+    int                fd = -1;
+	long               nread = 0;
+	long               off = 0;
+	int                n = 0;
+	int                i = 0;
+	int                batch_n = 0;
+	linux_dirent64_t  *de = NULL;
+	storage_dir_t     *sd = scan->sd;
+	blk_dir_state_t   *st = NULL;
+	struct stat        sb;
+	uint64_t           digest = 0;
+	int                match = DFS_FALSE;
+	uint32_t           gen = g_scan_gen;
+
+	if (idx >= 0) 
+	{
+	    if (stat(dir, &sb) != DFS_OK) 
+		{
+		    dfs_log_error(dfs_cycle->error_log, DFS_LOG_ERROR, errno, 
+			    "stat %s err", dir);
+			
+            return DFS_ERROR;
+		}
+		
+        pthread_mutex_lock(&sd->state_lock);
+
+		st = get_dir_state(sd, namespace_id, idx, DFS_TRUE);
+		if (st && st->valid && !st->unwatched && !scan->full 
+			&& st->ino == sb.st_ino 
+			&& st->mtime_sec == sb.st_mtim.tv_sec 
+			&& st->mtime_nsec == sb.st_mtim.tv_nsec) 
+		{
+            st->seen_gen = gen;
+			match = DFS_TRUE;
+		}
+
+		pthread_mutex_unlock(&sd->state_lock);
+
+		if (match) 
+		{
+		    scan->skipped++;
+			
+            return DFS_OK;
+		}
+	}
 	
-	p_dir = opendir(dir);
-	if (NULL == p_dir) 
+	fd = open(dir, O_RDONLY | O_DIRECTORY);
+	if (fd < 0) 
 	{
 	    dfs_log_error(dfs_cycle->error_log, DFS_LOG_ERROR, errno, 
-			"opendir %s err", dir);
+			"open dir %s err", dir);
 		
         return DFS_ERROR;
 	}
 
-	while (NULL != (ent = readdir(p_dir))) 
+	for ( ;; ) 
 	{
-	    // 如果是常规文件，
-        if (DT_REG == ent->d_type && 0 == strncmp(ent->d_name, "blk_", 4))
+        nread = syscall(SYS_getdents64, fd, scan->dbuf, BLK_SCAN_DENTS_BUF);
+		if (nread < 0) 
 		{
-	        char blk_id[16] = "";
-			get_blk_id(ent->d_name, blk_id);
+		    dfs_log_error(dfs_cycle->error_log, DFS_LOG_ERROR, errno, 
+			    "getdents64 %s err", dir);
+			
+            close(fd);
 
-			sprintf(path, "%s/%s", dir, ent->d_name);
-            // 更新 hashtable 和 g_blk_report
-			block_object_add(path, namespace_id, atol(blk_id));
+			return DFS_ERROR;
+		}
+
+		if (nread == 0) 
+		{
+            break;
+		}
+
+		for (off = 0; off < nread; off += de->d_reclen) 
+		{
+            de = (linux_dirent64_t *)(scan->dbuf + off);
+
+			if ((de->d_type != DT_REG && de->d_type != DT_UNKNOWN)
+				|| strncmp(de->d_name, "blk_", 4) != 0) 
+			{
+                continue;
+			}
+
+			if (n == scan->dents_cap && scan_grow(scan) != DFS_OK) 
+			{
+			    close(fd);
+				
+                return DFS_ERROR;
+			}
+
+			scan->ids[n] = atol(de->d_name + 4);
+			scan->dents[n].nameofs = n;
+			scan->dents[n].namelen = 0;
+			scan->dents[n].type = EIO_DT_REG;
+			scan->dents[n].inode = de->d_ino;
+			digest ^= blk_digest(scan->ids[n]);
+			n++;
 		}
 	}
 
-	closedir(p_dir);
+	close(fd);
+
+	scan->found += n;
+
+	if (st) 
+	{
+        pthread_mutex_lock(&sd->state_lock);
+
+		match = st->digest == digest && st->count == (uint32_t)n;
+
+		// the listing is checked against the index from now on
+		st->seen_gen = gen;
+		st->scan_gen = match ? st->scan_gen : gen;
+		st->valid = DFS_TRUE;
+		st->ino = sb.st_ino;
+		st->mtime_sec = sb.st_mtim.tv_sec;
+		st->mtime_nsec = sb.st_mtim.tv_nsec;
+
+		pthread_mutex_unlock(&sd->state_lock);
+
+		scan_inotify_watch(sd, namespace_id, st, dir);
+
+		if (match) 
+		{
+		    scan->skipped++;
+			
+            return DFS_OK;
+		}
+	}
+
+	eio_dent_sort_inode(scan->dents, n);
+
+	for (i = 0; i < n; i++) 
+	{
+        scan->batch[batch_n].blk_id = scan->ids[scan->dents[i].nameofs];
+		scan->batch[batch_n].ns_id = namespace_id;
+		batch_n++;
+
+		if (batch_n == BLK_SCAN_BATCH) 
+		{
+            block_object_add_batch(scan, dir, namespace_id, batch_n);
+			batch_n = 0;
+		}
+	}
+
+	if (batch_n > 0) 
+	{
+        block_object_add_batch(scan, dir, namespace_id, batch_n);
+	}
 	
     return DFS_OK;
 }
 
-static void get_blk_id(char *src, char *id)
+// known blks are only marked, the new ones are stat()ed in the given
+// order and inserted under one lock acquisition
+static void block_object_add_batch(blk_scan_t *scan, char *dir, 
+	long ns_id, int n)
 {
-    char *pTemp = src + 4;
+    char           path[PATH_LEN] = "";
+	struct stat    sb;
+	blk_entry_t   *ents = scan->batch;
+	storage_dir_t *sd = scan->sd;
+	int            i = 0;
+	int            nnew = 0;
+	int64_t        blk_id = 0;
+	uint8_t        gen = (uint8_t)g_scan_gen;
+
+	if (blk_index_mark_batch(&g_blk_index, ents, n, gen, scan->found_in) 
+		== n) 
+	{
+        return;
+	}
 
-    while (*pTemp != '\0') 
+	// compact the unknown ones to the front, keeping the inode order
+	for (i = 0; i < n; i++) 
 	{
-        *id++ = *pTemp++;
+        if (scan->found_in[i]) 
+		{
+            continue;
+		}
+
+		sprintf(path, "%s/blk_%ld", dir, (long)ents[i].blk_id);
+		if (stat(path, &sb) != DFS_OK) 
+		{
+		    // gone since the dir was read
+			continue;
+		}
+
+		// ents[nnew] may be ents[i] itself
+		blk_id = ents[i].blk_id;
+		memory_zero(&ents[nnew], sizeof(blk_entry_t));
+		ents[nnew].blk_id = blk_id;
+		ents[nnew].ns_id = ns_id;
+		ents[nnew].vol = sd->id;
+		ents[nnew].flags = gen << BLK_ENTRY_GEN_SHIFT;
+		block_entry_size(path, &sb, &ents[nnew]);
+		blk_snapshot_add(&sd->snap, ns_id, ents[nnew].blk_id, 
+			ents[nnew].size, (ents[nnew].flags & BLK_ENTRY_ZIP) != 0, 
+			&ents[nnew].snap_slot);
+		nnew++;
 	}
-}
 
+	if (blk_index_add_batch(&g_blk_index, ents, nnew, scan->added) 
+		!= DFS_OK) 
+	{
+        dfs_log_error(dfs_cycle->error_log, DFS_LOG_ALERT, 0, 
+			"add blks of %s to index err", dir);
+	}
+
+	for (i = 0; i < nnew; i++) 
+	{
+	    // raced with a write that finished meanwhile
+	    if (!scan->added[i]) 
+		{
+            blk_snapshot_del(&sd->snap, ents[i].snap_slot);
+
+			continue;
+		}
+
+		dir_state_index(sd->id, ns_id, ents[i].blk_id, DFS_TRUE);
+		scan->fresh++;
+	}
+}
@@ -6,53 +6,113 @@
 #include "dn_thread.h"
 #include "dn_request.h"
 #include "cfs_fio.h"
+#include "cfs_eio.h"
+#include "dn_blk_snapshot.h"
+#include "dn_blk_index.h"
+#include "dn_vol_policy.h"
 
 #define PATH_LEN 256
 #define SUBDIR_LEN 64
 
-#define HASH_BUF_PER_SZ sizeof(void *) 
-#define DFS_ALIGNMENT sizeof(uint64_t)
-#define BLK_STORE_SIZE (size_t)(dfs_align_ptr(sizeof(block_info_t), DFS_ALIGNMENT))
-#define BLK_STORE_BUF_PER_SZ (BLK_STORE_SIZE + sizeof(void *))
+#define BLK_SCAN_DENTS_BUF (1024 * 1024) // getdents64 buffer per volume
+#define BLK_SCAN_DENTS_MIN 1024
+#define BLK_SCAN_BATCH     512 // blks inserted per lock acquisition
 
-#define BLK_POOL_REMAIN_MEM (10 * 1024)
+#define BLK_SCAN_LEAF_DIRS (SUBDIR_LEN * SUBDIR_LEN)
 
-#define BLK_HASH_BUF(count)  (count * HASH_BUF_PER_SZ)
-#define BLK_STORE_BUF(count) (count * BLK_STORE_BUF_PER_SZ)
+// subdirN/subdirM of a blk as one index
+#define blk_dir_idx(blk_id) \
+	(((blk_id) % SUBDIR_LEN) * SUBDIR_LEN + ((blk_id) % 1000) % SUBDIR_LEN)
 
-#define BLK_POOL_SIZE(count) (BLK_HASH_BUF(count) \
-        + BLK_STORE_BUF(count) + BLK_POOL_REMAIN_MEM) 
+// what the scanner knows about one subdirN/subdirM
+typedef struct blk_dir_state_s
+{
+    uint64_t digest;   // xor of blk_digest() of the indexed blks
+	uint32_t count;    // indexed blks
+	uint32_t seen_gen; // last pass that visited the dir
+	uint32_t scan_gen; // last pass that checked its blks one by one
+	int      valid;    // ino and mtime below match the index
+	int      wd;       // inotify watch, -1 if none
+	int      unwatched; // inotify_add_watch failed, listed every pass
+	ino_t    ino;
+	long     mtime_sec;
+	long     mtime_nsec;
+} blk_dir_state_t;
+
+typedef struct blk_ns_state_s
+{
+    queue_t         me;
+	long            ns_id;
+	blk_dir_state_t dirs[BLK_SCAN_LEAF_DIRS];
+} blk_ns_state_t;
 
 typedef struct storage_dir_s 
 {
     queue_t me; //prev , next
-    int     id;
-	char    current[PATH_LEN];
+    int         id;
+	char        current[PATH_LEN];
+	blk_snap_t  snap; // persistent index snapshot of this volume
+	queue_t         ns_states; // blk_ns_state_t
+	pthread_mutex_t state_lock;
+	volatile uint32_t report_gen; // bumped by every add and del
+	vol_stat_t      stat;
+	int             compress; // new blks are written compressed
 } storage_dir_t;
 
+typedef struct blk_scan_watch_s
+{
+    storage_dir_t   *sd;
+	long             ns_id;
+	blk_dir_state_t *st;
+} blk_scan_watch_t;
+
+// copy of an index entry handed to callers, path derived from it
 typedef struct block_info_s
 {
-    dfs_hashtable_link_t ln;
-    queue_t              me;//
-    long                 id; // blk id
-	long                 size; // length
-	char                 path[PATH_LEN]; // store path
+    long     id; // blk id
+	long     size; // length
+	long     ns_id;
+	int      vol; // storage dir id
+	uint32_t snap_slot; // record slot in the volume snapshot
+	int      zip; // stored compressed, size is still the logical one
+	char     path[PATH_LEN]; // store path
 } block_info_t;
 
-typedef struct blk_cache_mem_s 
+typedef struct blk_purge_s
 {
-    void                *mem;  // mem addr
-    size_t               mem_size; // BLK_POOL_SIZE
-    dfs_mem_allocator_t *allocator;
-    struct mem_mblks    *free_mblks;
-} blk_cache_mem_t;
+    uint32_t     gen;
+	blk_entry_t *ents;
+	uint64_t     n;
+	uint64_t     cap;
+} blk_purge_t;
 
-typedef struct blk_cache_mgmt_s 
+typedef struct linux_dirent64_s
+{
+    uint64_t       d_ino;
+	int64_t        d_off;
+	unsigned short d_reclen;
+	unsigned char  d_type;
+	char           d_name[];
+} linux_dirent64_t;
+
+// per volume state of the scanner, one thread each
+typedef struct blk_scan_s
 {
-    dfs_hashtable_t  *blk_htable;
-    pthread_rwlock_t  cache_rwlock;
-    blk_cache_mem_t   mem_mgmt;
-} blk_cache_mgmt_t;
+    storage_dir_t  *sd;
+	pthread_t       tid;
+	char           *dbuf;
+	eio_dirent     *dents;
+	long           *ids; // indexed by dents[i].nameofs
+	int             dents_cap;
+	blk_entry_t     batch[BLK_SCAN_BATCH];
+	uchar_t         found_in[BLK_SCAN_BATCH];
+	uchar_t         added[BLK_SCAN_BATCH];
+	uint64_t        found;
+	uint64_t        skipped; // leaf dirs trusted without reading blks
+	uint64_t        fresh;   // blks new to the index
+	int             full;    // list every leaf dir, trust none
+	int             rs;
+} blk_scan_t;
 
 int dn_data_storage_master_init(cycle_t *cycle);
 int dn_data_storage_worker_init(cycle_t *cycle);
@@ -61,9 +121,16 @@ int dn_data_storage_thread_init(dfs_thread_t *thread);
 
 int setup_ns_storage(dfs_thread_t *thread);
 
-block_info_t *block_object_get(long id);
-int block_object_add(char *path, long ns_id, long blk_id);
-int block_object_del(long blk_id);
+int block_object_get(long ns_id, long id, block_info_t *blk);
+int block_object_add(char *path, int vol, long ns_id, long blk_id);
+int block_object_del(long ns_id, long blk_id);
+void block_object_walk(blk_index_walk_pt fn, void *arg);
+int block_volume_num();
+uint32_t block_volume_gen(int vol);
+uint64_t block_object_count();
+vol_stat_t *block_volume_stat(int vol);
+int block_volume_compress(int vol);
+void block_volume_release(dn_request_t *r);
 int block_read(dn_request_t *r, file_io_t *fio);
 
 void io_lock(volatile uint64_t *lock);
@@ -72,8 +139,13 @@ int io_lock_zero(volatile uint64_t *lock);
 
 int get_block_temp_path(dn_request_t *r);
 int write_block_done(dn_request_t *r);
+int get_unit_temp_path(long ns_id, long blk_id, uint64_t len, int near, 
+	char *path);
+int block_object_commit(char *path, int vol, long ns_id, long blk_id, 
+	long size, int zip);
 
 void *blk_scanner_start(void *arg);
+void *vol_stat_refresher_start(void *arg);
 
 #endif
 
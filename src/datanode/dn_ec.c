@@ -0,0 +1,1393 @@
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "dn_ec.h"
+#include "dn_request.h"
+#include "dn_thread.h"
+#include "dn_metrics.h"
+#include "dfs_gf.h"
+#include "dfs_epoll.h"
+#include "dfs_event_timer.h"
+#include "dfs_memory.h"
+#include "dfs_error_log.h"
+#include "cfs.h"
+
+static void ec_read_header(dn_request_t *r);
+static int  ec_open(dn_request_t *r);
+static int  ec_unit_open(dn_request_t *r, int index, int near);
+static int  ec_forward_open(dn_request_t *r, int index);
+static void ec_recv(dn_request_t *r);
+static uint64_t ec_row_len(dn_ec_t *ec, int index);
+static ssize_t ec_write_stripe(file_io_t *fio);
+static int  ec_stripe_done(void *data, void *task);
+static void ec_forward(dn_request_t *r);
+static void ec_forward_check(dn_request_t *r);
+static int  ec_rebuild_start(dn_request_t *r);
+static void ec_rebuild_check(dn_request_t *r);
+static void ec_abort(dn_request_t *r, uint32_t err);
+static ssize_t ec_rebuild_round(file_io_t *fio);
+static int  ec_rebuild_done(void *data, void *task);
+static int  ec_peer_next(dn_request_t *r, dn_ec_peer_t *p);
+static int  ec_peer_connect(dn_request_t *r, dn_ec_peer_t *p,
+	ec_peer_t *h);
+static void ec_peer_handler(event_t *ev);
+static int  ec_peer_run(dn_ec_peer_t *p);
+static int  ec_peer_step(dn_ec_peer_t *p);
+static ssize_t ec_peer_io(dn_ec_peer_t *p, uchar_t *buf, size_t len,
+	int out);
+static void ec_peer_close(dn_ec_peer_t *p);
+static int  ec_submit(dn_request_t *r, file_io_work_pt work,
+	file_io_handler_pt h, uint64_t need);
+static int  ec_commit(dn_request_t *r);
+static void ec_fail(dn_request_t *r, uint32_t err);
+static void ec_block_reading(dn_request_t *r);
+static void ec_block_writing(dn_request_t *r);
+static int  ec_pwrite(int fd, uchar_t *buf, size_t len, off_t offset);
+
+void dn_ec_start(dn_request_t *r, dn_ec_done_pt done)
+{
+    dn_ec_t *ec = NULL;
+	int      i = 0;
+
+	ec = (dn_ec_t *)pool_calloc(r->pool, sizeof(dn_ec_t));
+	if (!ec)
+	{
+	    dfs_log_error(dfs_cycle->error_log, DFS_LOG_ALERT, 0,
+			"pool_calloc failed");
+
+        done(r, DN_STATUS_INTERNAL_SERVER_ERROR);
+
+		return;
+	}
+
+	for (i = 0; i < EC_MAX_UNITS; i++)
+	{
+	    ec->units[i].vol = -1;
+		ec->units[i].fd = -1;
+	}
+
+	ec->done = done;
+	r->ec = ec;
+	r->read_event_handler = ec_read_header;
+
+	ec_read_header(r);
+}
+
+// only between the faio tasks, nothing may be in flight
+void dn_ec_release(dn_request_t *r)
+{
+    dn_ec_t *ec = r->ec;
+	int      i = 0;
+
+	if (!ec)
+	{
+        return;
+	}
+
+	for (i = 0; i < ec->nunits; i++)
+	{
+	    if (ec->units[i].fd >= 0)
+		{
+            cfs_close((cfs_t *)dfs_cycle->cfs, ec->units[i].fd);
+			ec->units[i].fd = -1;
+		}
+
+		// a blk not committed is of no use to anyone
+		if (ec->units[i].vol >= 0)
+		{
+		    unlink(ec->units[i].path);
+            vol_stat_unhold(block_volume_stat(ec->units[i].vol),
+				ec->units[i].len);
+			ec->units[i].vol = -1;
+		}
+	}
+
+	for (i = 0; i < EC_MAX_UNITS; i++)
+	{
+        ec_peer_close(&ec->peers[i]);
+	}
+
+	r->ec = NULL;
+}
+
+int dn_ec_close_deferred(dn_request_t *r, uint32_t err)
+{
+    dn_ec_t *ec = r->ec;
+
+	if (!ec || !ec->busy)
+	{
+        return DFS_FALSE;
+	}
+
+	if (!ec->err)
+	{
+        ec->err = err ? err : DN_REQUEST_ERROR_CONN;
+	}
+
+	return DFS_TRUE;
+}
+
+// data unit i holds cells i, i + k, ... of the group, a parity unit is
+// as long as the first data unit
+uint64_t dn_ec_unit_len(int k, uint64_t cell, uint64_t len, int i)
+{
+    uint64_t stripe = (uint64_t)k * cell;
+	uint64_t rest = len % stripe;
+
+	if (i >= k)
+	{
+        i = 0;
+	}
+
+	rest = rest > (uint64_t)i * cell ? rest - (uint64_t)i * cell : 0;
+
+	return len / stripe * cell + (rest < cell ? rest : cell);
+}
+
+void dn_ec_process(dn_request_t *r, dn_ec_done_pt done)
+{
+    dn_ec_t *ec = r->ec;
+	int      i = 0;
+
+	ec->done = done;
+	r->write_event_handler = ec_block_writing;
+
+	if (r->header.op_type == OP_EC_RECONSTRUCT)
+	{
+	    if (ec_rebuild_start(r) != DFS_OK)
+		{
+            ec_fail(r, DN_REQUEST_ERROR_IO_FAILED);
+		}
+
+		return;
+	}
+
+	ec->stripe = (uchar_t *)pool_memalign(r->pool,
+		(ec->rs.k + ec->rs.m) * ec->cell, 64);
+	if (!ec->stripe)
+	{
+	    dfs_log_error(dfs_cycle->error_log, DFS_LOG_ALERT, 0,
+			"pool_memalign failed");
+
+        ec_fail(r, DN_STATUS_INTERNAL_SERVER_ERROR);
+
+		return;
+	}
+
+	for (i = 0; i < ec->npeers; i++)
+	{
+        ec->peers[i].buf = ec->stripe + ec->peers[i].index * ec->cell;
+	}
+
+	if (r->done >= r->header.len)
+	{
+	    // an empty group, the blks are there all the same
+	    ec_forward(r);
+
+		return;
+	}
+
+	r->read_event_handler = ec_recv;
+	dn_trace_stage(r, DN_TRACE_RECV, 0);
+
+	ec_recv(r);
+}
+
+static void ec_read_header(dn_request_t *r)
+{
+    dn_ec_t *ec = r->ec;
+	conn_t  *c = NULL;
+	event_t *rev = NULL;
+	ssize_t  rs = 0;
+
+	c = r->conn;
+	rev = c->read;
+
+	if (rev->timedout)
+	{
+	    dfs_log_debug(dfs_cycle->error_log, DFS_LOG_DEBUG, 0,
+			"ec header, rev timeout, conn_fd: %d", c->fd);
+
+        ec->done(r, DN_REQUEST_ERROR_TIMEOUT);
+
+		return;
+	}
+
+	if (rev->timer_set)
+	{
+        event_timer_del(c->ev_timer, rev);
+	}
+
+	while (ec->hdr_got < sizeof(ec_transfer_header_t))
+	{
+	    rs = c->recv(c, (uchar_t *)&ec->hdr + ec->hdr_got,
+			sizeof(ec_transfer_header_t) - ec->hdr_got);
+		if (rs > 0)
+		{
+		    ec->hdr_got += rs;
+
+            continue;
+		}
+
+		if (rs == DFS_AGAIN)
+		{
+		    rev->ready = DFS_FALSE;
+            event_timer_add(c->ev_timer, rev, CONN_TIME_OUT);
+
+			return;
+		}
+
+		dfs_log_debug(dfs_cycle->error_log, DFS_LOG_DEBUG, errno,
+			"read ec header err, conn_fd: %d", c->fd);
+
+		ec->done(r, DN_REQUEST_ERROR_READ_REQUEST);
+
+		return;
+	}
+
+	r->read_event_handler = ec_block_reading;
+
+	if (ec_open(r) != DFS_OK)
+	{
+        ec->done(r, DN_REQUEST_ERROR_READ_REQUEST);
+
+		return;
+	}
+
+	ec->done(r, DN_REQUEST_ERROR_NONE);
+}
+
+static int ec_open(dn_request_t *r)
+{
+    dn_ec_t              *ec = r->ec;
+	ec_transfer_header_t *h = &ec->hdr;
+	int                   near = -1;
+	int                   i = 0;
+
+	if (h->data_units < 1 || h->parity_units < 1
+		|| h->data_units + h->parity_units > EC_MAX_UNITS
+		|| h->cell_size <= 0 || h->cell_size > DN_EC_CELL_MAX
+		|| h->cell_size % DN_EC_CELL_ALIGN
+		|| r->header.block_id % EC_MAX_UNITS || r->header.len < 0
+		|| (r->header.op_type == OP_EC_RECONSTRUCT
+		&& (h->index < 0 || h->index >= h->data_units + h->parity_units)))
+	{
+	    dfs_log_error(dfs_cycle->error_log, DFS_LOG_ERROR, 0,
+			"bad ec group %l, RS(%d, %d), cell: %d, index: %d",
+			r->header.block_id, h->data_units, h->parity_units,
+			h->cell_size, h->index);
+
+        return DFS_ERROR;
+	}
+
+	if (dfs_rs_init(&ec->rs, h->data_units, h->parity_units) != DFS_OK)
+	{
+        return DFS_ERROR;
+	}
+
+	ec->cell = h->cell_size;
+
+	if (r->header.op_type == OP_EC_RECONSTRUCT)
+	{
+        return ec_unit_open(r, h->index, -1);
+	}
+
+	// one after the other over the volumes, a lost disk costs the
+	// group as few blks as it can
+	for (i = 0; i < ec->rs.k + ec->rs.m; i++)
+	{
+	    if (h->peers[i].ip)
+		{
+		    if (ec_forward_open(r, i) != DFS_OK)
+			{
+                return DFS_ERROR;
+			}
+
+            continue;
+		}
+
+	    if (ec_unit_open(r, i, near) != DFS_OK)
+		{
+            return DFS_ERROR;
+		}
+
+		near = ec->units[ec->nunits - 1].vol;
+	}
+
+	return DFS_OK;
+}
+
+static int ec_unit_open(dn_request_t *r, int index, int near)
+{
+    dn_ec_t      *ec = r->ec;
+	dn_ec_unit_t *u = NULL;
+
+	u = &ec->units[ec->nunits];
+	u->index = index;
+	u->blk_id = r->header.block_id + index;
+	u->len = dn_ec_unit_len(ec->rs.k, ec->cell, r->header.len, index);
+
+	u->vol = get_unit_temp_path(r->header.namespace_id, u->blk_id, u->len,
+		near, u->path);
+	if (u->vol < 0)
+	{
+	    u->vol = -1;
+
+        return DFS_ERROR;
+	}
+
+	ec->nunits++;
+
+	u->fd = cfs_open((cfs_t *)dfs_cycle->cfs, (uchar_t *)u->path,
+		O_CREAT | O_WRONLY | O_TRUNC, dfs_cycle->error_log);
+	if (u->fd < 0)
+	{
+	    dfs_log_error(dfs_cycle->error_log, DFS_LOG_FATAL, errno,
+			"open file %s err", u->path);
+
+		u->fd = -1;
+
+        return DFS_ERROR;
+	}
+
+	return DFS_OK;
+}
+
+// the unit is written on its datanode as a plain blk, there is no other
+// place to fall back on
+static int ec_forward_open(dn_request_t *r, int index)
+{
+    dn_ec_t      *ec = r->ec;
+	dn_ec_peer_t *p = NULL;
+
+	p = &ec->peers[ec->npeers++];
+	p->r = r;
+	p->out = DFS_TRUE;
+	p->index = index;
+	p->blk_id = r->header.block_id + index;
+	p->len = dn_ec_unit_len(ec->rs.k, ec->cell, r->header.len, index);
+
+	memory_zero(&p->req, sizeof(p->req));
+	p->req.op_type = OP_WRITE_BLOCK;
+	p->req.namespace_id = r->header.namespace_id;
+	p->req.block_id = p->blk_id;
+	p->req.generation_stamp = r->header.generation_stamp;
+	p->req.len = p->len;
+
+	if (ec_peer_connect(r, p, &ec->hdr.peers[index]) != DFS_OK)
+	{
+        return DFS_ERROR;
+	}
+
+	return ec_peer_run(p);
+}
+
+// a stripe at a time, k cells straight off the socket
+static void ec_recv(dn_request_t *r)
+{
+    dn_ec_t  *ec = r->ec;
+	conn_t   *c = NULL;
+	event_t  *rev = NULL;
+	uint64_t  want = 0;
+	ssize_t   rs = 0;
+
+	c = r->conn;
+	rev = c->read;
+
+	if (rev->timedout)
+	{
+	    dfs_log_debug(dfs_cycle->error_log, DFS_LOG_DEBUG, 0,
+			"rev timeout, conn_fd: %d", c->fd);
+
+        ec_fail(r, DN_REQUEST_ERROR_CONN);
+
+		return;
+	}
+
+	if (rev->timer_set)
+	{
+        event_timer_del(c->ev_timer, rev);
+	}
+
+	want = r->header.len - r->done;
+	if (want > ec->rs.k * ec->cell)
+	{
+        want = ec->rs.k * ec->cell;
+	}
+
+	while (ec->got < want)
+	{
+	    rs = c->recv(c, ec->stripe + ec->got, want - ec->got);
+		if (rs > 0)
+		{
+		    ec->got += rs;
+
+            continue;
+		}
+
+		if (rs == 0)
+		{
+		    dfs_log_debug(dfs_cycle->error_log, DFS_LOG_DEBUG, 0,
+				"client is closed, conn_fd: %d", c->fd);
+
+            ec_fail(r, DN_REQUEST_ERROR_CONN);
+
+			return;
+		}
+
+		if (rs == DFS_AGAIN)
+		{
+		    rev->ready = DFS_FALSE;
+
+		    if (event_handle_read(c->ev_base, rev, 0) == DFS_ERROR)
+			{
+			    dfs_log_error(dfs_cycle->error_log, DFS_LOG_ALERT, 0,
+					"add read event failed");
+
+                ec_fail(r, DN_REQUEST_ERROR_CONN);
+
+				return;
+			}
+
+            event_timer_add(c->ev_timer, rev, CONN_TIME_OUT);
+
+			return;
+		}
+
+		dfs_log_debug(dfs_cycle->error_log, DFS_LOG_DEBUG, errno,
+			"net err, conn_fd: %d", c->fd);
+
+		ec_fail(r, DN_REQUEST_ERROR_CONN);
+
+		return;
+	}
+
+	r->read_event_handler = ec_block_reading;
+
+	if (ec_submit(r, ec_write_stripe, ec_stripe_done, ec->got) != DFS_OK)
+	{
+        ec_fail(r, DN_STATUS_INTERNAL_SERVER_ERROR);
+	}
+}
+
+// of the stripe received, the part unit index holds
+static uint64_t ec_row_len(dn_ec_t *ec, int index)
+{
+    uint64_t len = 0;
+
+	if (index >= ec->rs.k)
+	{
+        return ec->got < ec->cell ? ec->got : ec->cell;
+	}
+
+	len = ec->got > index * ec->cell ? ec->got - index * ec->cell : 0;
+
+	return len < ec->cell ? len : ec->cell;
+}
+
+// faio thread. the parity of a short last stripe is that of its data
+// padded with zeros, as long as its first cell
+static ssize_t ec_write_stripe(file_io_t *fio)
+{
+    dn_request_t *r = (dn_request_t *)fio->data;
+	dn_ec_t      *ec = r->ec;
+	uchar_t      *data[EC_MAX_UNITS];
+	uchar_t      *parity[EC_MAX_UNITS];
+	dn_ec_unit_t *u = NULL;
+	uint64_t      cell = ec->cell;
+	uint64_t      plen = 0;
+	uint64_t      len = 0;
+	int           k = ec->rs.k;
+	int           i = 0;
+
+	plen = ec->got < cell ? ec->got : cell;
+
+	if (ec->got < k * cell)
+	{
+        memory_zero(ec->stripe + ec->got, k * cell - ec->got);
+	}
+
+	for (i = 0; i < k + ec->rs.m; i++)
+	{
+	    if (i < k)
+		{
+            data[i] = ec->stripe + i * cell;
+		}
+		else
+		{
+            parity[i - k] = ec->stripe + i * cell;
+		}
+	}
+
+	dfs_rs_encode(&ec->rs, data, parity, plen);
+
+	for (i = 0; i < ec->nunits; i++)
+	{
+	    u = &ec->units[i];
+		len = ec_row_len(ec, u->index);
+
+		if (len && ec_pwrite(u->fd, ec->stripe + u->index * cell, len,
+			ec->row * cell) != DFS_OK)
+		{
+            return DFS_ERROR;
+		}
+	}
+
+	return ec->got;
+}
+
+static int ec_stripe_done(void *data, void *task)
+{
+    dn_request_t *r = (dn_request_t *)data;
+	dn_ec_t      *ec = r->ec;
+	file_io_t    *fio = (file_io_t *)task;
+	dn_metrics_t *m = NULL;
+	uint64_t      stored = 0;
+	uint64_t      local = 0;
+	int           i = 0;
+
+	ec->busy = DFS_FALSE;
+
+	m = dn_metrics_local();
+	dn_metrics_record_fio(m, fio, DFS_FALSE);
+
+	if (ec->err)
+	{
+	    ec->done(r, ec->err);
+
+        return DFS_OK;
+	}
+
+	if (fio->faio_ret < 0 || (uint64_t)fio->faio_ret != ec->got)
+	{
+	    dfs_log_error(dfs_cycle->error_log, DFS_LOG_ALERT,
+			fio->faio_ret < 0 ? fio->faio_task.err.sys : 0,
+			"write ec group %l stripe %uL failed", r->header.block_id,
+			ec->row);
+
+        ec->done(r, DN_STATUS_INTERNAL_SERVER_ERROR);
+
+		return DFS_OK;
+	}
+
+	stored = ec->got + ec->rs.m * (ec->got < ec->cell ? ec->got : ec->cell);
+
+	for (i = 0; i < ec->nunits; i++)
+	{
+        local += ec_row_len(ec, ec->units[i].index);
+	}
+
+	if (m)
+	{
+	    m->bytes_written += local;
+		m->ec_logical += ec->got;
+        m->ec_stored += stored;
+	}
+
+	// the forwarded units take the stripe from the row on
+	ec->off = ec->row * ec->cell;
+	ec->round = ec->cell;
+
+	r->done += ec->got;
+	ec->got = 0;
+	ec->row++;
+
+	ec_forward(r);
+
+	return DFS_OK;
+}
+
+// the encoded stripe goes out to the units placed elsewhere, the next
+// one is received into it after
+static void ec_forward(dn_request_t *r)
+{
+    dn_ec_t *ec = r->ec;
+	int      i = 0;
+
+	ec->fwd = DFS_TRUE;
+
+	for (i = 0; i < ec->npeers; i++)
+	{
+	    if (ec_peer_run(&ec->peers[i]) != DFS_OK)
+		{
+		    ec_abort(r, DN_REQUEST_ERROR_IO_FAILED);
+
+            return;
+		}
+	}
+
+	ec_forward_check(r);
+}
+
+// the group is committed once every peer has its done response in
+static void ec_forward_check(dn_request_t *r)
+{
+    dn_ec_t      *ec = r->ec;
+	dn_ec_peer_t *p = NULL;
+	uint64_t      end = 0;
+	int           last = 0;
+	int           i = 0;
+
+	if (!ec->fwd)
+	{
+        return;
+	}
+
+	last = r->done >= r->header.len;
+
+	for (i = 0; i < ec->npeers; i++)
+	{
+	    p = &ec->peers[i];
+		end = ec->off + ec->round < p->len ? ec->off + ec->round : p->len;
+
+		if (p->state < DN_EC_PEER_DATA || p->pos < end
+			|| (last && p->state != DN_EC_PEER_DONE))
+		{
+            return;
+		}
+	}
+
+	ec->fwd = DFS_FALSE;
+
+	if (!last)
+	{
+	    r->read_event_handler = ec_recv;
+		dn_trace_stage(r, DN_TRACE_RECV, 0);
+
+		ec_recv(r);
+
+        return;
+	}
+
+	if (ec_commit(r) != DFS_OK)
+	{
+	    ec->done(r, DN_STATUS_INTERNAL_SERVER_ERROR);
+
+        return;
+	}
+
+	ec->done(r, DN_REQUEST_ERROR_NONE);
+}
+
+// k peers stream their blks over the event loop, faio only decodes and
+// writes a round once all of it is in
+static int ec_rebuild_start(dn_request_t *r)
+{
+    dn_ec_t      *ec = r->ec;
+	dn_ec_unit_t *u = &ec->units[0];
+	int           n = 0;
+	int           i = 0;
+
+	// the client has nothing more to send, a hangup shows at the done
+	// response and not while a round is out
+	r->read_event_handler = ec_block_reading;
+
+	for (i = 0; i < ec->rs.k + ec->rs.m; i++)
+	{
+	    if (i != u->index && ec->hdr.peers[i].ip)
+		{
+            n++;
+		}
+	}
+
+	if (n < ec->rs.k)
+	{
+	    dfs_log_error(dfs_cycle->error_log, DFS_LOG_ERROR, 0,
+			"ec group %l: %d of %d blks to rebuild %d from",
+			r->header.block_id, n, ec->rs.k, u->index);
+
+        return DFS_ERROR;
+	}
+
+	if (!u->len)
+	{
+	    if (ec_commit(r) != DFS_OK)
+		{
+            return DFS_ERROR;
+		}
+
+		ec->done(r, DN_REQUEST_ERROR_NONE);
+
+		return DFS_OK;
+	}
+
+	for (i = 0; i < ec->rs.k; i++)
+	{
+	    ec->peers[i].r = r;
+		ec->peers[i].buf = (uchar_t *)pool_memalign(r->pool, DN_EC_ROUND,
+			64);
+		if (!ec->peers[i].buf)
+		{
+            return DFS_ERROR;
+		}
+	}
+
+	ec->out = (uchar_t *)pool_memalign(r->pool, DN_EC_ROUND, 64);
+	if (!ec->out)
+	{
+        return DFS_ERROR;
+	}
+
+	ec->npeers = ec->rs.k;
+	ec->off = 0;
+	ec->round = u->len < DN_EC_ROUND ? u->len : DN_EC_ROUND;
+
+	for (i = 0; i < ec->rs.k; i++)
+	{
+	    if (ec_peer_next(r, &ec->peers[i]) != DFS_OK
+			|| ec_peer_run(&ec->peers[i]) != DFS_OK)
+		{
+            return DFS_ERROR;
+		}
+	}
+
+	ec_rebuild_check(r);
+
+	return DFS_OK;
+}
+
+// once every peer has its part of the round in, it goes to faio
+static void ec_rebuild_check(dn_request_t *r)
+{
+    dn_ec_t      *ec = r->ec;
+	dn_ec_peer_t *p = NULL;
+	int           have[EC_MAX_UNITS];
+	uint64_t      end = 0;
+	int           last = 0;
+	int           i = 0;
+
+	if (ec->busy)
+	{
+        return;
+	}
+
+	last = ec->off + ec->round == ec->units[0].len;
+
+	for (i = 0; i < ec->rs.k; i++)
+	{
+	    p = &ec->peers[i];
+		end = ec->off + ec->round < p->len ? ec->off + ec->round : p->len;
+
+		// the last round waits for the done responses too
+		if (p->state < DN_EC_PEER_DATA || p->pos < end
+			|| (last && p->state != DN_EC_PEER_DONE))
+		{
+            return;
+		}
+	}
+
+	for (i = 0; i < ec->rs.k; i++)
+	{
+	    p = &ec->peers[i];
+		have[i] = p->index;
+
+		// past its end a short data blk counts as zeros
+		end = p->len > ec->off ? p->len - ec->off : 0;
+		if (end < ec->round)
+		{
+            memory_zero(p->buf + end, ec->round - end);
+		}
+	}
+
+	// the peers may have changed since the last round
+	if (dfs_rs_decode_coef(&ec->rs, have, ec->units[0].index, ec->coef)
+		!= DFS_OK || ec_submit(r, ec_rebuild_round, ec_rebuild_done,
+		ec->round) != DFS_OK)
+	{
+        ec_abort(r, DN_STATUS_INTERNAL_SERVER_ERROR);
+	}
+}
+
+// a round out at faio still holds the request
+static void ec_abort(dn_request_t *r, uint32_t err)
+{
+    dn_ec_t *ec = r->ec;
+	int      i = 0;
+
+	for (i = 0; i < EC_MAX_UNITS; i++)
+	{
+        ec_peer_close(&ec->peers[i]);
+	}
+
+	ec_fail(r, err);
+}
+
+// faio thread, the round is in the buffers of the peers
+static ssize_t ec_rebuild_round(file_io_t *fio)
+{
+    dn_request_t *r = (dn_request_t *)fio->data;
+	dn_ec_t      *ec = r->ec;
+	uchar_t      *src[EC_MAX_UNITS];
+	int           i = 0;
+
+	for (i = 0; i < ec->rs.k; i++)
+	{
+        src[i] = ec->peers[i].buf;
+	}
+
+	dfs_gf_dot(ec->coef, src, ec->rs.k, ec->out, fio->need);
+
+	if (ec_pwrite(ec->units[0].fd, ec->out, fio->need, ec->off) != DFS_OK)
+	{
+        return DFS_ERROR;
+	}
+
+	return fio->need;
+}
+
+static int ec_rebuild_done(void *data, void *task)
+{
+    dn_request_t *r = (dn_request_t *)data;
+	dn_ec_t      *ec = r->ec;
+	dn_ec_unit_t *u = &ec->units[0];
+	file_io_t    *fio = (file_io_t *)task;
+	dn_metrics_t *m = NULL;
+	uint64_t      left = 0;
+	int           i = 0;
+
+	ec->busy = DFS_FALSE;
+
+	m = dn_metrics_local();
+	dn_metrics_record_fio(m, fio, DFS_FALSE);
+
+	if (ec->err)
+	{
+	    ec->done(r, ec->err);
+
+        return DFS_OK;
+	}
+
+	if (fio->faio_ret < 0 || (uint64_t)fio->faio_ret != fio->need)
+	{
+	    dfs_log_error(dfs_cycle->error_log, DFS_LOG_ALERT,
+			fio->faio_ret < 0 ? fio->faio_task.err.sys : 0,
+			"rebuild blk %l at %uL failed", u->blk_id, ec->off);
+
+        ec_abort(r, DN_REQUEST_ERROR_IO_FAILED);
+
+		return DFS_OK;
+	}
+
+	ec->off += fio->need;
+
+	if (m)
+	{
+	    m->bytes_written += fio->need;
+        m->ec_rebuilt += fio->need;
+	}
+
+	left = u->len - ec->off;
+	if (!left)
+	{
+	    if (ec_commit(r) != DFS_OK)
+		{
+		    ec->done(r, DN_STATUS_INTERNAL_SERVER_ERROR);
+
+            return DFS_OK;
+		}
+
+		ec->done(r, DN_REQUEST_ERROR_NONE);
+
+		return DFS_OK;
+	}
+
+	ec->round = left < DN_EC_ROUND ? left : DN_EC_ROUND;
+
+	// what the peers sent meanwhile waits in their sockets
+	for (i = 0; i < ec->rs.k; i++)
+	{
+	    if (ec_peer_run(&ec->peers[i]) != DFS_OK)
+		{
+		    ec_abort(r, DN_REQUEST_ERROR_IO_FAILED);
+
+            return DFS_OK;
+		}
+	}
+
+	ec_rebuild_check(r);
+
+	return DFS_OK;
+}
+
+// p takes the next unit the request names, from the round being filled
+// on, a round out at faio is not asked for again
+static int ec_peer_next(dn_request_t *r, dn_ec_peer_t *p)
+{
+    dn_ec_t      *ec = r->ec;
+	dn_ec_unit_t *u = &ec->units[0];
+
+	for ( ;; )
+	{
+	    while (ec->next < ec->rs.k + ec->rs.m
+			&& (ec->next == u->index || !ec->hdr.peers[ec->next].ip))
+		{
+            ec->next++;
+		}
+
+		if (ec->next == ec->rs.k + ec->rs.m)
+		{
+		    dfs_log_error(dfs_cycle->error_log, DFS_LOG_ERROR, 0,
+				"ec group %l: no blk left to rebuild %d from",
+				r->header.block_id, u->index);
+
+            return DFS_ERROR;
+		}
+
+		p->index = ec->next++;
+		p->blk_id = r->header.block_id + p->index;
+		p->len = dn_ec_unit_len(ec->rs.k, ec->cell, r->header.len, p->index);
+		// the rest of a longer blk is of no use
+		p->len = p->len < u->len ? p->len : u->len;
+		p->pos = ec->off + (ec->busy ? ec->round : 0);
+		p->io = 0;
+
+		// nothing left of it but zeros
+		if (p->pos >= p->len)
+		{
+		    p->state = DN_EC_PEER_DONE;
+
+            return DFS_OK;
+		}
+
+		memory_zero(&p->req, sizeof(p->req));
+		p->req.op_type = OP_READ_BLOCK;
+		p->req.namespace_id = r->header.namespace_id;
+		p->req.block_id = p->blk_id;
+		p->req.generation_stamp = r->header.generation_stamp;
+		p->req.start_offset = p->pos;
+		p->req.len = p->len - p->pos;
+
+		if (ec_peer_connect(r, p, &ec->hdr.peers[p->index]) == DFS_OK)
+		{
+            return DFS_OK;
+		}
+	}
+}
+
+// p->req goes out once connected
+static int ec_peer_connect(dn_request_t *r, dn_ec_peer_t *p, ec_peer_t *h)
+{
+    conn_t *c = NULL;
+	int     rs = DFS_OK;
+
+	memory_zero(&p->addr, sizeof(p->addr));
+	p->addr.sin_family = AF_INET;
+	p->addr.sin_addr.s_addr = h->ip;
+	p->addr.sin_port = h->port;
+
+	c = conn_pool_get_connection(&get_local_thread()->conn_pool);
+	if (!c)
+	{
+	    dfs_log_error(dfs_cycle->error_log, DFS_LOG_ALERT, 0,
+			"get connection for blk %l failed", p->blk_id);
+
+        return DFS_ERROR;
+	}
+
+	conn_set_default(c, DFS_INVALID_FILE);
+	c->conn_data = p;
+	c->ev_base = r->conn->ev_base;
+	c->ev_timer = r->conn->ev_timer;
+	c->log = dfs_cycle->error_log;
+	c->read->handler = ec_peer_handler;
+	c->write->handler = ec_peer_handler;
+
+	p->c = c;
+	p->pc.connection = c;
+	p->pc.sockaddr = (struct sockaddr *)&p->addr;
+	p->pc.socklen = sizeof(p->addr);
+	p->state = DN_EC_PEER_CONNECT;
+
+	rs = conn_connect_peer(&p->pc, c->ev_base);
+	if (rs == DFS_AGAIN)
+	{
+	    event_timer_add(c->ev_timer, c->read, DN_EC_CONNECT_TIMEOUT);
+
+        return DFS_OK;
+	}
+
+	if (rs == DFS_OK)
+	{
+        return DFS_OK;
+	}
+
+	dfs_log_error(dfs_cycle->error_log, DFS_LOG_ERROR, errno,
+		"connect(%s: %d) for blk %l err", inet_ntoa(p->addr.sin_addr),
+		ntohs(p->addr.sin_port), p->blk_id);
+
+	ec_peer_close(p);
+
+	return DFS_ERROR;
+}
+
+static void ec_peer_handler(event_t *ev)
+{
+    conn_t       *c = (conn_t *)ev->data;
+	dn_ec_peer_t *p = (dn_ec_peer_t *)c->conn_data;
+	dn_request_t *r = p->r;
+
+	if (ec_peer_run(p) != DFS_OK)
+	{
+	    ec_abort(r, DN_REQUEST_ERROR_IO_FAILED);
+
+        return;
+	}
+
+	if (p->out)
+	{
+	    ec_forward_check(r);
+
+        return;
+	}
+
+	ec_rebuild_check(r);
+}
+
+// as far as p goes for now, for a rebuild the next unit takes over a
+// failed one
+static int ec_peer_run(dn_ec_peer_t *p)
+{
+    for ( ;; )
+	{
+	    if (ec_peer_step(p) != DFS_ERROR)
+		{
+            return DFS_OK;
+		}
+
+		dfs_log_error(dfs_cycle->error_log, DFS_LOG_ERROR, errno,
+			"%s blk %l at %s: %d err, state: %d",
+			p->out ? "forward" : "read", p->blk_id,
+			inet_ntoa(p->addr.sin_addr), ntohs(p->addr.sin_port), p->state);
+
+		ec_peer_close(p);
+
+		if (p->out || ec_peer_next(p->r, p) != DFS_OK)
+		{
+            return DFS_ERROR;
+		}
+	}
+}
+
+static int ec_peer_step(dn_ec_peer_t *p)
+{
+    dn_ec_t   *ec = p->r->ec;
+	conn_t    *c = p->c;
+	uint64_t   end = 0;
+	ssize_t    rs = 0;
+	int        err = 0;
+	socklen_t  len = sizeof(err);
+
+	if (c && c->read->timedout)
+	{
+	    errno = ETIMEDOUT;
+
+        return DFS_ERROR;
+	}
+
+	for ( ;; )
+	{
+	    switch (p->state)
+		{
+		case DN_EC_PEER_CONNECT:
+			if (!c->write->ready)
+			{
+                return DFS_AGAIN;
+			}
+
+			if (getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0)
+			{
+                err = errno;
+			}
+
+			if (err)
+			{
+			    errno = err;
+
+                return DFS_ERROR;
+			}
+
+			if (c->read->timer_set)
+			{
+                event_timer_del(c->ev_timer, c->read);
+			}
+
+			conn_tcp_nodelay(c->fd);
+			p->state = DN_EC_PEER_SEND;
+
+			break;
+
+		case DN_EC_PEER_SEND:
+			while (p->io < sizeof(p->req))
+			{
+			    rs = ec_peer_io(p, (uchar_t *)&p->req + p->io,
+					sizeof(p->req) - p->io, DFS_TRUE);
+				if (rs < 0)
+				{
+                    return rs;
+				}
+
+				p->io += rs;
+			}
+
+			p->io = 0;
+			p->state = DN_EC_PEER_HEAD;
+
+			break;
+
+		case DN_EC_PEER_HEAD:
+		case DN_EC_PEER_TAIL:
+			while (p->io < sizeof(p->rsp))
+			{
+			    rs = ec_peer_io(p, (uchar_t *)&p->rsp + p->io,
+					sizeof(p->rsp) - p->io, DFS_FALSE);
+				if (rs < 0)
+				{
+                    return rs;
+				}
+
+				p->io += rs;
+			}
+
+			p->io = 0;
+
+			if (p->rsp.op_status != OP_STATUS_SUCCESS)
+			{
+			    errno = EPROTO;
+
+                return DFS_ERROR;
+			}
+
+			if (p->state == DN_EC_PEER_TAIL)
+			{
+			    ec_peer_close(p);
+				p->state = DN_EC_PEER_DONE;
+
+                return DFS_OK;
+			}
+
+			p->state = DN_EC_PEER_DATA;
+
+			break;
+
+		case DN_EC_PEER_DATA:
+			// buf is faio's until the round is written, a stripe goes
+			// out once it is encoded
+			if (p->out ? !ec->fwd : ec->busy)
+			{
+                return DFS_OK;
+			}
+
+			end = ec->off + ec->round < p->len ? ec->off + ec->round : p->len;
+
+			while (p->pos < end)
+			{
+			    rs = ec_peer_io(p, p->buf + (p->pos - ec->off), end - p->pos,
+					p->out);
+				if (rs < 0)
+				{
+                    return rs;
+				}
+
+				p->pos += rs;
+			}
+
+			if (p->pos < p->len)
+			{
+                return DFS_OK;
+			}
+
+			p->state = DN_EC_PEER_TAIL;
+
+			break;
+
+		default:
+			return DFS_OK;
+		}
+	}
+}
+
+// DFS_AGAIN once the socket is drained or full, a stall past the
+// timeout fails the peer
+static ssize_t ec_peer_io(dn_ec_peer_t *p, uchar_t *buf, size_t len,
+	int out)
+{
+    conn_t  *c = p->c;
+	ssize_t  rs = 0;
+
+	rs = out ? c->send(c, buf, len) : c->recv(c, buf, len);
+	if (rs > 0)
+	{
+	    if (c->read->timer_set)
+		{
+            event_timer_del(c->ev_timer, c->read);
+		}
+
+        return rs;
+	}
+
+	if (rs == DFS_AGAIN)
+	{
+	    if (out)
+		{
+            c->write->ready = DFS_FALSE;
+		}
+		else
+		{
+            c->read->ready = DFS_FALSE;
+		}
+
+		event_timer_add(c->ev_timer, c->read, DN_EC_PEER_TIMEOUT);
+
+        return DFS_AGAIN;
+	}
+
+	if (rs == 0)
+	{
+        errno = ECONNRESET;
+	}
+
+	return DFS_ERROR;
+}
+
+static void ec_peer_close(dn_ec_peer_t *p)
+{
+    if (!p->c)
+	{
+        return;
+	}
+
+	conn_release(p->c);
+	conn_pool_free_connection(&get_local_thread()->conn_pool, p->c);
+	p->c = NULL;
+}
+
+static int ec_submit(dn_request_t *r, file_io_work_pt work,
+	file_io_handler_pt h, uint64_t need)
+{
+    dn_ec_t   *ec = r->ec;
+	file_io_t *fio = r->fio;
+
+	fio->work = work;
+	fio->event = AIO_WRITE_EV;
+	fio->need = need;
+	fio->data = r;
+	fio->h = h;
+	fio->io_event = &get_local_thread()->io_events;
+	fio->faio_noty = &get_local_thread()->faio_notify;
+	fio->faio_ret = DFS_ERROR;
+
+	dn_trace_stage(r, DN_TRACE_FAIO_QUEUE, need);
+
+	if (cfs_write((cfs_t *)dfs_cycle->cfs, fio, dfs_cycle->error_log)
+		!= DFS_OK)
+	{
+	    dfs_log_error(dfs_cycle->error_log, DFS_LOG_ALERT, 0,
+			"submit ec task failed, conn_fd: %d", r->conn->fd);
+
+        return DFS_ERROR;
+	}
+
+	ec->busy = DFS_TRUE;
+
+	return DFS_OK;
+}
+
+static int ec_commit(dn_request_t *r)
+{
+    dn_ec_t      *ec = r->ec;
+	dn_ec_unit_t *u = NULL;
+	int           i = 0;
+
+	dn_trace_stage(r, DN_TRACE_FINALIZE, 0);
+
+	for (i = 0; i < ec->nunits; i++)
+	{
+	    u = &ec->units[i];
+
+		cfs_close((cfs_t *)dfs_cycle->cfs, u->fd);
+		u->fd = -1;
+
+		if (block_object_commit(u->path, u->vol, r->header.namespace_id,
+			u->blk_id, u->len, DFS_FALSE) != DFS_OK)
+		{
+            return DFS_ERROR;
+		}
+
+		vol_stat_unhold(block_volume_stat(u->vol), u->len);
+		u->vol = -1;
+	}
+
+	return DFS_OK;
+}
+
+// the request outlives the faio task it has out
+static void ec_fail(dn_request_t *r, uint32_t err)
+{
+    dn_ec_t *ec = r->ec;
+
+	if (ec->busy)
+	{
+	    if (!ec->err)
+		{
+            ec->err = err;
+		}
+
+        return;
+	}
+
+	ec->done(r, err);
+}
+
+static void ec_block_reading(dn_request_t *r)
+{
+    conn_t *c = r->conn;
+
+	if (event_delete(c->ev_base, c->read, EVENT_READ_EVENT,
+		EVENT_CLEAR_EVENT) == DFS_ERROR)
+	{
+	    dfs_log_error(dfs_cycle->error_log, DFS_LOG_ALERT, 0,
+			"del read event failed");
+
+        ec_fail(r, DN_REQUEST_ERROR_CONN);
+	}
+}
+
+static void ec_block_writing(dn_request_t *r)
+{
+    conn_t *c = r->conn;
+
+	if (epoll_del_event(c->ev_base, c->write, EVENT_WRITE_EVENT,
+		EVENT_CLEAR_EVENT) == DFS_ERROR)
+	{
+	    dfs_log_error(dfs_cycle->error_log, DFS_LOG_ALERT, 0,
+			"del write event failed");
+
+        ec_fail(r, DN_REQUEST_ERROR_CONN);
+	}
+}
+
+static int ec_pwrite(int fd, uchar_t *buf, size_t len, off_t offset)
+{
+    ssize_t rs = 0;
+
+	while (len)
+	{
+	    rs = pwrite(fd, buf, len, offset);
+		if (rs < 0 && errno == EINTR)
+		{
+            continue;
+		}
+
+		if (rs <= 0)
+		{
+            return DFS_ERROR;
+		}
+
+		buf += rs;
+		len -= rs;
+		offset += rs;
+	}
+
+	return DFS_OK;
+}
@@ -0,0 +1,99 @@
+#ifndef DN_EC_H
+#define DN_EC_H
+
+#include <netinet/in.h>
+
+#include "dfs_types.h"
+#include "dfs_conn.h"
+#include "dfs_rs.h"
+#include "dfs_task_cmd.h"
+#include "dn_data_storage.h"
+
+#define DN_EC_CELL_ALIGN    1024
+#define DN_EC_CELL_MAX      (4 * 1024 * 1024)
+#define DN_EC_ROUND            (1024 * 1024) // of a lost blk per faio run
+#define DN_EC_CONNECT_TIMEOUT  3000  // ms, then the next unit is asked
+#define DN_EC_PEER_TIMEOUT     10000 // ms a peer may stall mid stream
+
+#define DN_EC_PEER_CONNECT  0
+#define DN_EC_PEER_SEND     1 // the OP_READ_BLOCK header
+#define DN_EC_PEER_HEAD     2 // its response
+#define DN_EC_PEER_DATA     3
+#define DN_EC_PEER_TAIL     4 // the done response after the data
+#define DN_EC_PEER_DONE     5
+
+struct dn_request_s;
+
+typedef void (*dn_ec_done_pt)(struct dn_request_s *r, uint32_t err);
+
+// an internal blk written here
+typedef struct dn_ec_unit_s
+{
+    int       index; // in the group
+	long      blk_id;
+	uint64_t  len;
+	int       vol;   // held on, -1 once committed
+	int       fd;    // temp file
+	char      path[PATH_LEN];
+} dn_ec_unit_t;
+
+// an internal blk streamed off a peer for a rebuild, or to the datanode
+// it is placed on for a group write, on a conn of the worker's event loop
+typedef struct dn_ec_peer_s
+{
+    struct dn_request_s        *r;
+	conn_t                     *c;
+	conn_peer_t                 pc;
+	struct sockaddr_in          addr;
+	int                         index; // in the group
+	int                         out;   // sent with OP_WRITE_BLOCK
+	int                         state;
+	long                        blk_id;
+	uint64_t                    len;   // needed, no longer than the lost blk
+	uint64_t                    pos;   // of the blk received
+	uint64_t                    got;   // of the round in buf
+	uint32_t                    io;    // of the header or a response
+	data_transfer_header_t      req;
+	data_transfer_header_rsp_t  rsp;
+	uchar_t                    *buf;   // its part of the round or stripe
+} dn_ec_peer_t;
+
+// an ec group request, OP_EC_WRITE_GROUP stripes the data it receives
+// over k data and m parity blks, writing those placed here and
+// forwarding the others to their datanodes a stripe at a time,
+// OP_EC_RECONSTRUCT rebuilds one lost blk out of k others on peers,
+// falling back on the next unit the request names when a peer fails
+typedef struct dn_ec_s
+{
+    ec_transfer_header_t hdr;
+	uint32_t             hdr_got;
+	dn_ec_done_pt        done;
+	dfs_rs_t             rs;
+	uint64_t             cell;
+	dn_ec_unit_t         units[EC_MAX_UNITS]; // written here
+	int                  nunits;
+	int                  busy; // a faio task is out
+	uint32_t             err;  // failed while busy
+	uchar_t             *stripe; // k data cells, then m parity cells
+	uint64_t             got;    // of the stripe received
+	uint64_t             row;    // stripes written
+	dn_ec_peer_t         peers[EC_MAX_UNITS]; // read or forwarded
+	int                  npeers;
+	int                  next;   // unit to ask when a peer fails
+	int                  fwd;    // the stripe is encoded, out to peers
+	uint8_t              coef[EC_MAX_UNITS];
+	uchar_t             *out;
+	uint64_t             off;    // of the lost blk, the round starts here
+	uint64_t             round;
+} dn_ec_t;
+
+// reads the ec header and opens the blks to write
+void dn_ec_start(struct dn_request_s *r, dn_ec_done_pt done);
+// after the header response, through the last blk committed
+void dn_ec_process(struct dn_request_s *r, dn_ec_done_pt done);
+void dn_ec_release(struct dn_request_s *r);
+// DFS_TRUE while a faio round is out, it closes r itself once back
+int  dn_ec_close_deferred(struct dn_request_s *r, uint32_t err);
+uint64_t dn_ec_unit_len(int k, uint64_t cell, uint64_t len, int i);
+
+#endif
@@ -26,3 +26,30 @@ int dn_error_log_release(cycle_t *cycle)
     return error_log_release(cycle->error_log);
 }
 
+// the flusher is a thread, it is started after the fork
+int dn_error_log_worker_init(cycle_t *cycle)
+{
+    conf_server_t *sconf = (conf_server_t *)cycle->sconf;
+
+    if (sconf->log_mode != DFS_LOG_MODE_ASYNC) 
+	{
+        return DFS_OK;
+    }
+
+    if (error_log_async_start(cycle->error_log, sconf->log_buffer_size,
+        sconf->log_overflow) != DFS_OK) 
+    {
+        dfs_log_error(cycle->error_log, DFS_LOG_WARN, errno,
+            "async log start err, logging synchronously");
+    }
+
+    return DFS_OK;
+}
+
+int dn_error_log_worker_release(cycle_t *cycle)
+{
+    error_log_async_stop(cycle->error_log);
+
+    return DFS_OK;
+}
+
@@ -5,6 +5,8 @@
 
 int dn_error_log_init(cycle_t *cycle);
 int dn_error_log_release(cycle_t *cycle);
+int dn_error_log_worker_init(cycle_t *cycle);
+int dn_error_log_worker_release(cycle_t *cycle);
 
 #endif
 
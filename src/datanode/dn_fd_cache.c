@@ -0,0 +1,521 @@
+#include "dn_fd_cache.h"
+#include "dn_data_storage.h"
+#include "dn_conf.h"
+#include "dfs_memory.h"
+#include "dfs_error_log.h"
+#include <fcntl.h>
+
+// blks and their dirs, one lock per shard. a reader holds a ref on its
+// blk for the whole request, only idle fds are evicted or closed
+static dn_fd_shard_t *g_fd_blks = NULL;
+static dn_fd_shard_t *g_fd_dirs = NULL;
+
+static int  shards_init(dn_fd_shard_t **shards, uint32_t max);
+static void shards_release(dn_fd_shard_t **shards);
+static uint64_t fd_hash(long ns_id, long id);
+static dn_fd_shard_t *shard_of(dn_fd_shard_t *shards, long ns_id, long id,
+	uint32_t *hash);
+static dn_fd_ent_t *shard_find(dn_fd_shard_t *sh, uint32_t hash,
+	long ns_id, long id);
+static void shard_unlink(dn_fd_shard_t *sh, dn_fd_ent_t *ent,
+	uint32_t hash);
+static void shard_evict(dn_fd_shard_t *sh);
+static dn_fd_ent_t *table_get(dn_fd_shard_t *shards, long ns_id, long id,
+	block_info_t *blk);
+static void table_put(dn_fd_shard_t *shards, dn_fd_ent_t *ent);
+static void table_invalidate(dn_fd_shard_t *shards, long ns_id, long id);
+static int  blk_open(block_info_t *blk);
+static int  dir_open(block_info_t *blk);
+static void ent_free(dn_fd_ent_t *ent);
+
+#define dir_key(blk) (((long)(blk)->vol << 32) | blk_dir_idx((blk)->id))
+
+int dn_fd_cache_worker_init(cycle_t *cycle)
+{
+    conf_server_t *sconf = (conf_server_t *)cycle->sconf;
+
+	if (shards_init(&g_fd_blks, sconf->fd_cache_size) != DFS_OK
+		|| shards_init(&g_fd_dirs, sconf->fd_cache_size) != DFS_OK)
+	{
+	    dfs_log_error(cycle->error_log, DFS_LOG_ALERT, errno,
+			"init fd cache err");
+
+        return DFS_ERROR;
+	}
+
+	return DFS_OK;
+}
+
+int dn_fd_cache_worker_release(cycle_t *cycle)
+{
+    shards_release(&g_fd_blks);
+	shards_release(&g_fd_dirs);
+
+	return DFS_OK;
+}
+
+// an fd of the blk with a ref held, NULL if it can't be opened
+dn_fd_ent_t *dn_fd_cache_get(block_info_t *blk)
+{
+    dn_fd_ent_t *ent = NULL;
+	int          fd = -1;
+
+    if (g_fd_blks)
+	{
+        return table_get(g_fd_blks, blk->ns_id, blk->id, blk);
+	}
+
+	// not a worker process, nothing to share
+	fd = blk_open(blk);
+	if (fd < 0)
+	{
+        return NULL;
+	}
+
+	ent = (dn_fd_ent_t *)memory_calloc(sizeof(dn_fd_ent_t));
+	if (!ent)
+	{
+	    close(fd);
+
+        return NULL;
+	}
+
+	ent->fd = fd;
+	ent->refs = 1;
+
+	return ent;
+}
+
+void dn_fd_cache_put(dn_fd_ent_t *ent)
+{
+    if (g_fd_blks)
+	{
+        table_put(g_fd_blks, ent);
+
+		return;
+	}
+
+	ent_free(ent);
+}
+
+// the blk was deleted or replaced, readers holding the old fd finish
+// with it and the next get opens the file again
+void dn_fd_cache_invalidate(long ns_id, long blk_id)
+{
+    if (g_fd_blks)
+	{
+        table_invalidate(g_fd_blks, ns_id, blk_id);
+	}
+}
+
+// another request holds the blk open besides the caller's own ref
+int dn_fd_cache_shared(dn_fd_ent_t *ent)
+{
+    dn_fd_shard_t *sh = NULL;
+	uint32_t       hash = 0;
+	int            shared = DFS_FALSE;
+
+	if (!g_fd_blks)
+	{
+        return DFS_FALSE;
+	}
+
+	sh = shard_of(g_fd_blks, ent->ns_id, ent->id, &hash);
+
+	pthread_mutex_lock(&sh->lock);
+	shared = ent->refs > 1;
+	pthread_mutex_unlock(&sh->lock);
+
+	return shared;
+}
+
+void dn_fd_cache_stat(dn_fd_cache_stat_t *st)
+{
+    dn_fd_shard_t *sh = NULL;
+	int            i = 0;
+
+	memory_zero(st, sizeof(dn_fd_cache_stat_t));
+
+	for (i = 0; g_fd_blks && i < DN_FD_SHARDS; i++)
+	{
+	    sh = &g_fd_blks[i];
+
+		pthread_mutex_lock(&sh->lock);
+		st->n += sh->n;
+		st->hits += sh->hits;
+		st->misses += sh->misses;
+		st->evicted += sh->evicted;
+		pthread_mutex_unlock(&sh->lock);
+
+		pthread_mutex_lock(&g_fd_dirs[i].lock);
+		st->dirs += g_fd_dirs[i].n;
+		pthread_mutex_unlock(&g_fd_dirs[i].lock);
+	}
+}
+
+static int shards_init(dn_fd_shard_t **shards, uint32_t max)
+{
+    dn_fd_shard_t *sh = NULL;
+	uint32_t       per = 0;
+	uint32_t       size = 1;
+	int            i = 0;
+
+	per = (max + DN_FD_SHARDS - 1) / DN_FD_SHARDS;
+	while (size < per)
+	{
+        size <<= 1;
+	}
+
+	*shards = (dn_fd_shard_t *)memory_calloc(sizeof(dn_fd_shard_t)
+		* DN_FD_SHARDS);
+	if (!*shards)
+	{
+        return DFS_ERROR;
+	}
+
+	for (i = 0; i < DN_FD_SHARDS; i++)
+	{
+	    sh = &(*shards)[i];
+
+		sh->buckets = (dn_fd_ent_t **)memory_calloc(sizeof(dn_fd_ent_t *)
+			* size);
+		if (!sh->buckets)
+		{
+            return DFS_ERROR;
+		}
+
+		pthread_mutex_init(&sh->lock, NULL);
+		queue_init(&sh->lru);
+		sh->mask = size - 1;
+		sh->max = per;
+	}
+
+	return DFS_OK;
+}
+
+// the threads are gone by now, refs don't matter any more
+static void shards_release(dn_fd_shard_t **shards)
+{
+    dn_fd_shard_t *sh = NULL;
+	dn_fd_ent_t   *ent = NULL;
+	queue_t       *q = NULL;
+	int            i = 0;
+
+	if (!*shards)
+	{
+        return;
+	}
+
+	for (i = 0; i < DN_FD_SHARDS; i++)
+	{
+	    sh = &(*shards)[i];
+		if (!sh->buckets)
+		{
+            continue;
+		}
+
+		while (!queue_empty(&sh->lru))
+		{
+		    q = queue_head(&sh->lru);
+			queue_remove(q);
+
+			ent = queue_data(q, dn_fd_ent_t, lru);
+			ent_free(ent);
+		}
+
+		memory_free(sh->buckets, sizeof(dn_fd_ent_t *) * (sh->mask + 1));
+		pthread_mutex_destroy(&sh->lock);
+	}
+
+	memory_free(*shards, sizeof(dn_fd_shard_t) * DN_FD_SHARDS);
+	*shards = NULL;
+}
+
+// splitmix64 finalizer, the high half picks the shard
+static uint64_t fd_hash(long ns_id, long id)
+{
+    uint64_t z = (uint64_t)id ^ ((uint64_t)ns_id << 40);
+
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+
+	return z ^ (z >> 31);
+}
+
+static dn_fd_shard_t *shard_of(dn_fd_shard_t *shards, long ns_id, long id,
+	uint32_t *hash)
+{
+    uint64_t z = fd_hash(ns_id, id);
+
+	*hash = (uint32_t)z;
+
+	return &shards[(z >> 32) % DN_FD_SHARDS];
+}
+
+// the lock of sh must be held from here down
+static dn_fd_ent_t *shard_find(dn_fd_shard_t *sh, uint32_t hash,
+	long ns_id, long id)
+{
+    dn_fd_ent_t *ent = NULL;
+
+	for (ent = sh->buckets[hash & sh->mask]; ent; ent = ent->next)
+	{
+        if (ent->id == id && ent->ns_id == ns_id)
+		{
+            return ent;
+		}
+	}
+
+	return NULL;
+}
+
+static void shard_unlink(dn_fd_shard_t *sh, dn_fd_ent_t *ent,
+	uint32_t hash)
+{
+    dn_fd_ent_t **pp = &sh->buckets[hash & sh->mask];
+
+	while (*pp && *pp != ent)
+	{
+        pp = &(*pp)->next;
+	}
+
+	if (*pp)
+	{
+        *pp = ent->next;
+	}
+
+	queue_remove(&ent->lru);
+	ent->cached = DFS_FALSE;
+	sh->n--;
+}
+
+// from the cold end, fds in use stay
+static void shard_evict(dn_fd_shard_t *sh)
+{
+    dn_fd_ent_t *ent = NULL;
+	queue_t     *q = NULL;
+	queue_t     *prev = NULL;
+	uint32_t     hash = 0;
+
+	q = queue_tail(&sh->lru);
+
+	while (sh->n > sh->max && q != queue_sentinel(&sh->lru))
+	{
+	    prev = queue_prev(q);
+		ent = queue_data(q, dn_fd_ent_t, lru);
+
+		if (!ent->refs)
+		{
+		    hash = (uint32_t)fd_hash(ent->ns_id, ent->id);
+            shard_unlink(sh, ent, hash);
+			ent_free(ent);
+			sh->evicted++;
+		}
+
+		q = prev;
+	}
+}
+
+static dn_fd_ent_t *table_get(dn_fd_shard_t *shards, long ns_id, long id,
+	block_info_t *blk)
+{
+    dn_fd_shard_t *sh = NULL;
+	dn_fd_ent_t   *ent = NULL;
+	dn_fd_ent_t   *old = NULL;
+	uint32_t       hash = 0;
+	uint64_t       gen = 0;
+	int            fd = -1;
+
+	sh = shard_of(shards, ns_id, id, &hash);
+
+	pthread_mutex_lock(&sh->lock);
+
+	ent = shard_find(sh, hash, ns_id, id);
+	if (ent)
+	{
+	    ent->refs++;
+		queue_remove(&ent->lru);
+		queue_insert_head(&sh->lru, &ent->lru);
+		sh->hits++;
+
+		pthread_mutex_unlock(&sh->lock);
+
+		return ent;
+	}
+
+	sh->misses++;
+	gen = sh->gen;
+
+	pthread_mutex_unlock(&sh->lock);
+
+	fd = shards == g_fd_dirs ? dir_open(blk) : blk_open(blk);
+	if (fd < 0)
+	{
+        return NULL;
+	}
+
+	ent = (dn_fd_ent_t *)memory_calloc(sizeof(dn_fd_ent_t));
+	if (!ent)
+	{
+	    close(fd);
+
+        return NULL;
+	}
+
+	ent->ns_id = ns_id;
+	ent->id = id;
+	ent->fd = fd;
+	ent->refs = 1;
+
+	pthread_mutex_lock(&sh->lock);
+
+	old = shard_find(sh, hash, ns_id, id);
+	if (old)
+	{
+	    // another miss of the same blk was quicker
+	    old->refs++;
+
+		pthread_mutex_unlock(&sh->lock);
+
+		ent_free(ent);
+
+		return old;
+	}
+
+	// opened before an invalidation, may be the old file
+	if (sh->gen == gen)
+	{
+	    ent->next = sh->buckets[hash & sh->mask];
+		sh->buckets[hash & sh->mask] = ent;
+		queue_insert_head(&sh->lru, &ent->lru);
+		ent->cached = DFS_TRUE;
+		sh->n++;
+
+		shard_evict(sh);
+	}
+
+	pthread_mutex_unlock(&sh->lock);
+
+	return ent;
+}
+
+static void table_put(dn_fd_shard_t *shards, dn_fd_ent_t *ent)
+{
+    dn_fd_shard_t *sh = NULL;
+	uint32_t       hash = 0;
+	int            last = DFS_FALSE;
+
+	sh = shard_of(shards, ent->ns_id, ent->id, &hash);
+
+	pthread_mutex_lock(&sh->lock);
+
+	ent->refs--;
+	last = !ent->refs && !ent->cached;
+
+	pthread_mutex_unlock(&sh->lock);
+
+	if (last)
+	{
+        ent_free(ent);
+	}
+}
+
+static void table_invalidate(dn_fd_shard_t *shards, long ns_id, long id)
+{
+    dn_fd_shard_t *sh = NULL;
+	dn_fd_ent_t   *ent = NULL;
+	uint32_t       hash = 0;
+	int            last = DFS_FALSE;
+
+	sh = shard_of(shards, ns_id, id, &hash);
+
+	pthread_mutex_lock(&sh->lock);
+
+	sh->gen++;
+
+	ent = shard_find(sh, hash, ns_id, id);
+	if (ent)
+	{
+	    shard_unlink(sh, ent, hash);
+		last = !ent->refs;
+	}
+
+	pthread_mutex_unlock(&sh->lock);
+
+	if (last)
+	{
+        ent_free(ent);
+	}
+}
+
+// relative to the cached dir, no walk of the whole path
+static int blk_open(block_info_t *blk)
+{
+    conf_server_t *sconf = (conf_server_t *)dfs_cycle->sconf;
+    dn_fd_ent_t   *dir = NULL;
+	char          *name = NULL;
+	int            fd = -1;
+	int            err = 0;
+	int            flags = O_RDONLY;
+
+	// only ever read by the pipe then, past the page cache
+	if (sconf->read_io == DN_READ_DIRECT)
+	{
+        flags |= O_DIRECT;
+	}
+
+	name = strrchr(blk->path, '/');
+	if (name && g_fd_dirs)
+	{
+	    dir = table_get(g_fd_dirs, blk->ns_id, dir_key(blk), blk);
+		if (dir)
+		{
+		    fd = openat(dir->fd, name + 1, flags);
+			err = errno;
+
+			table_put(g_fd_dirs, dir);
+
+			if (fd >= 0 || err != ENOENT)
+			{
+                return fd;
+			}
+		}
+	}
+
+	fd = open(blk->path, flags);
+
+	// the dir was replaced under the cached one
+	if (fd >= 0 && dir)
+	{
+        table_invalidate(g_fd_dirs, blk->ns_id, dir_key(blk));
+	}
+
+	return fd;
+}
+
+static int dir_open(block_info_t *blk)
+{
+    char  dir[PATH_LEN];
+	char *name = NULL;
+
+	name = strrchr(blk->path, '/');
+	if (!name || name - blk->path >= PATH_LEN)
+	{
+        return -1;
+	}
+
+	memory_memcpy(dir, blk->path, name - blk->path);
+	dir[name - blk->path] = '\0';
+
+	return open(dir, O_PATH | O_DIRECTORY);
+}
+
+static void ent_free(dn_fd_ent_t *ent)
+{
+    if (ent->fd >= 0)
+	{
+        close(ent->fd);
+	}
+
+	memory_free(ent, sizeof(dn_fd_ent_t));
+}
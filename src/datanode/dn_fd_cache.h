@@ -0,0 +1,58 @@
+#ifndef DN_FD_CACHE_H
+#define DN_FD_CACHE_H
+
+#include "dn_cycle.h"
+#include "dfs_queue.h"
+#include <pthread.h>
+
+// an open blk, or an O_PATH dir the blks are opened relative to
+typedef struct dn_fd_ent_s dn_fd_ent_t;
+
+struct dn_fd_ent_s
+{
+    dn_fd_ent_t *next;  // hash chain
+	queue_t      lru;
+	long         ns_id;
+	long         id;    // blk id, or vol << 32 | dir idx
+	int          fd;
+	uint32_t     refs;
+	int          cached; // in the table, else closed by the last put
+};
+
+typedef struct dn_fd_shard_s
+{
+    pthread_mutex_t  lock;
+	dn_fd_ent_t    **buckets;
+	uint32_t         mask;
+	uint32_t         n;
+	uint32_t         max;
+	uint64_t         gen;  // bumped by every invalidation
+	queue_t          lru;  // most recent first
+	uint64_t         hits;
+	uint64_t         misses;
+	uint64_t         evicted;
+} dn_fd_shard_t;
+
+typedef struct dn_fd_cache_stat_s
+{
+    uint64_t n;
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t evicted;
+	uint64_t dirs;
+} dn_fd_cache_stat_t;
+
+struct block_info_s;
+
+int  dn_fd_cache_worker_init(cycle_t *cycle);
+int  dn_fd_cache_worker_release(cycle_t *cycle);
+dn_fd_ent_t *dn_fd_cache_get(struct block_info_s *blk);
+void dn_fd_cache_put(dn_fd_ent_t *ent);
+void dn_fd_cache_invalidate(long ns_id, long blk_id);
+int  dn_fd_cache_shared(dn_fd_ent_t *ent);
+void dn_fd_cache_stat(dn_fd_cache_stat_t *st);
+
+#define DN_FD_SHARDS        16
+#define DEF_FD_CACHE_SIZE   4096 // open blks, the dir fds get as many
+
+#endif
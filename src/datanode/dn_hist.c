@@ -0,0 +1,135 @@
+#include <string.h>
+#include "dn_hist.h"
+
+static int hist_bucket(uint64_t v);
+static uint64_t hist_value(int b);
+
+static int hist_bucket(uint64_t v)
+{
+    int e = 0;
+
+	if (v < METRICS_SUB_N)
+	{
+        return (int)v;
+	}
+
+	e = 63 - __builtin_clzll(v);
+	if (e > METRICS_EXP_MAX)
+	{
+        return METRICS_BUCKETS - 1;
+	}
+
+	return (e - METRICS_SUB_BITS + 1) * METRICS_SUB_N
+		+ (int)((v >> (e - METRICS_SUB_BITS)) & (METRICS_SUB_N - 1));
+}
+
+// the middle of the bucket
+static uint64_t hist_value(int b)
+{
+    int g = b / METRICS_SUB_N;
+	int sub = b % METRICS_SUB_N;
+
+	if (!g)
+	{
+        return sub;
+	}
+
+	return ((uint64_t)(METRICS_SUB_N + sub) << (g - 1))
+		+ ((1ULL << (g - 1)) >> 1);
+}
+
+void dn_hist_add(dn_hist_t *h, uint64_t v)
+{
+    h->counts[hist_bucket(v)]++;
+	h->n++;
+	h->sum += v;
+
+	if (v > h->max)
+	{
+        h->max = v;
+	}
+}
+
+void dn_hist_merge(dn_hist_t *dst, dn_hist_t *src)
+{
+    int i = 0;
+
+	if (!src->n)
+	{
+        return;
+	}
+
+	for (i = 0; i < METRICS_BUCKETS; i++)
+	{
+        dst->counts[i] += src->counts[i];
+	}
+
+	dst->n += src->n;
+	dst->sum += src->sum;
+
+	if (src->max > dst->max)
+	{
+        dst->max = src->max;
+	}
+}
+
+uint64_t dn_hist_percentile(dn_hist_t *h, double p)
+{
+    uint64_t want = 0;
+	uint64_t seen = 0;
+	uint64_t v = 0;
+	int      i = 0;
+
+	if (!h->n)
+	{
+        return 0;
+	}
+
+	want = (uint64_t)(p * h->n + 0.5);
+	if (want < 1)
+	{
+        want = 1;
+	}
+
+	for (i = 0; i < METRICS_BUCKETS; i++)
+	{
+	    seen += h->counts[i];
+
+		if (seen >= want)
+		{
+		    v = hist_value(i);
+
+            return v < h->max ? v : h->max;
+		}
+	}
+
+	return h->max;
+}
+
+// what was added between two snapshots of the same histogram. max is
+// not kept per bucket, the top bucket stands in for it
+void dn_hist_sub(dn_hist_t *dst, dn_hist_t *now, dn_hist_t *before)
+{
+    int i = 0;
+
+	memset(dst, 0, sizeof(dn_hist_t));
+
+	for (i = 0; i < METRICS_BUCKETS; i++)
+	{
+	    if (now->counts[i] <= before->counts[i])
+		{
+            continue;
+		}
+
+        dst->counts[i] = now->counts[i] - before->counts[i];
+		dst->n += dst->counts[i];
+		dst->max = hist_value(i);
+	}
+
+	dst->sum = now->sum > before->sum ? now->sum - before->sum : 0;
+
+	if (dst->max > now->max)
+	{
+        dst->max = now->max;
+	}
+}
@@ -0,0 +1,29 @@
+#ifndef DN_HIST_H
+#define DN_HIST_H
+
+#include <stdint.h>
+
+// log linear buckets, 2^METRICS_SUB_BITS per power of two, so every
+// value is off by less than 1/16. values in us, up to 2^METRICS_EXP_MAX.
+// no dependencies, dfsstat links it too
+#define METRICS_SUB_BITS   4
+#define METRICS_SUB_N      (1 << METRICS_SUB_BITS)
+#define METRICS_EXP_MAX    40
+#define METRICS_BUCKETS    ((METRICS_EXP_MAX - METRICS_SUB_BITS + 2) \
+	* METRICS_SUB_N)
+
+typedef struct dn_hist_s
+{
+    uint64_t n;
+	uint64_t sum;
+	uint64_t max;
+	uint64_t counts[METRICS_BUCKETS];
+} dn_hist_t;
+
+void dn_hist_add(dn_hist_t *h, uint64_t v);
+void dn_hist_merge(dn_hist_t *dst, dn_hist_t *src);
+void dn_hist_sub(dn_hist_t *dst, dn_hist_t *now, dn_hist_t *before);
+uint64_t dn_hist_percentile(dn_hist_t *h, double p);
+
+#endif
+
@@ -0,0 +1,251 @@
+#include "dn_metrics.h"
+#include "dn_thread.h"
+#include "dn_conf.h"
+#include "dn_time.h"
+#include "dfs_lock.h"
+#include "dfs_memory.h"
+#include "dfs_error_log.h"
+#include "dn_fd_cache.h"
+
+extern dfs_thread_t *woker_threads;
+extern int           woker_num;
+
+static volatile rb_msec_t g_metrics_logged = 0;
+
+static char *op_names[DN_OP_N] = { "read", "write", "faio wait",
+	"faio service", "sendfile", "finalize" };
+
+static void hist_log(char *name, int vol, dn_hist_t *h);
+
+int dn_metrics_thread_init(dfs_thread_t *thread)
+{
+    thread->metrics = (dn_metrics_t *)memory_calloc(sizeof(dn_metrics_t));
+	if (!thread->metrics)
+	{
+	    dfs_log_error(dfs_cycle->error_log, DFS_LOG_ALERT, errno,
+			"calloc metrics err");
+
+        return DFS_ERROR;
+	}
+
+	return DFS_OK;
+}
+
+// NULL outside the worker threads
+dn_metrics_t *dn_metrics_local()
+{
+    dfs_thread_t *thread = get_local_thread();
+
+	return thread ? thread->metrics : NULL;
+}
+
+void dn_metrics_record(dn_metrics_t *m, int op, uint64_t us)
+{
+    if (m)
+	{
+        dn_hist_add(&m->ops[op], us);
+	}
+}
+
+void dn_metrics_record_vol(dn_metrics_t *m, int vol, int op, uint64_t us)
+{
+    if (m && vol >= 0 && vol < METRICS_VOLS_MAX)
+	{
+        dn_hist_add(&m->vols[vol][op], us);
+	}
+}
+
+// the stamps of a completed faio task
+void dn_metrics_record_fio(dn_metrics_t *m, file_io_t *fio, int sendfile)
+{
+    if (!m || !fio->submit_us || fio->start_us < fio->submit_us
+		|| fio->end_us < fio->start_us)
+	{
+        return;
+	}
+
+	dn_hist_add(&m->ops[DN_OP_FAIO_WAIT], fio->start_us - fio->submit_us);
+	dn_hist_add(&m->ops[DN_OP_FAIO_SERVICE], fio->end_us - fio->start_us);
+
+	if (sendfile)
+	{
+        dn_hist_add(&m->ops[DN_OP_SENDFILE], fio->end_us - fio->submit_us);
+	}
+}
+
+void dn_metrics_error(dn_metrics_t *m, int op, uint32_t err)
+{
+    if (m)
+	{
+        m->errors[op][err < METRICS_ERRORS ? err : METRICS_ERRORS - 1]++;
+	}
+}
+
+// sum of every worker thread, the counters move meanwhile
+int dn_metrics_aggregate(dn_metrics_t *out)
+{
+    dn_metrics_t *m = NULL;
+	int           i = 0;
+	int           j = 0;
+	int           k = 0;
+
+	memory_zero(out, sizeof(dn_metrics_t));
+
+	for (i = 0; i < woker_num; i++)
+	{
+	    m = woker_threads[i].metrics;
+		if (!m)
+		{
+            continue;
+		}
+
+		for (j = 0; j < DN_OP_N; j++)
+		{
+            dn_hist_merge(&out->ops[j], &m->ops[j]);
+
+			for (k = 0; k < METRICS_ERRORS; k++)
+			{
+                out->errors[j][k] += m->errors[j][k];
+			}
+		}
+
+		for (j = 0; j < METRICS_VOLS_MAX; j++)
+		{
+		    for (k = 0; k < DN_VOL_OP_N; k++)
+			{
+                dn_hist_merge(&out->vols[j][k], &m->vols[j][k]);
+			}
+		}
+
+		out->bytes_read += m->bytes_read;
+		out->bytes_written += m->bytes_written;
+		out->reads_inline += m->reads_inline;
+		out->reads_offloaded += m->reads_offloaded;
+		out->reads_piped += m->reads_piped;
+		out->ra_hinted += m->ra_hinted;
+		out->ra_dropped += m->ra_dropped;
+		out->zip_logical += m->zip_logical;
+		out->zip_stored += m->zip_stored;
+		out->ec_logical += m->ec_logical;
+		out->ec_stored += m->ec_stored;
+		out->ec_rebuilt += m->ec_rebuilt;
+	}
+
+	return DFS_OK;
+}
+
+static void hist_log(char *name, int vol, dn_hist_t *h)
+{
+    if (!h->n)
+	{
+        return;
+	}
+
+	dfs_log_error(dfs_cycle->error_log, DFS_LOG_INFO, 0,
+		"metrics %s vol %d: n %uL, avg %uL us, p50 %uL, p99 %uL, "
+		"p999 %uL, max %uL", name, vol, h->n, h->sum / h->n,
+		dn_hist_percentile(h, 0.5), dn_hist_percentile(h, 0.99),
+		dn_hist_percentile(h, 0.999), h->max);
+}
+
+void dn_metrics_log()
+{
+    dn_metrics_t       *all = NULL;
+	log_async_stat_t    log_st;
+	dn_fd_cache_stat_t  fd_st;
+	uint64_t            errs = 0;
+	int                 i = 0;
+	int                 j = 0;
+
+	all = (dn_metrics_t *)memory_alloc(sizeof(dn_metrics_t));
+	if (!all)
+	{
+        return;
+	}
+
+	dn_metrics_aggregate(all);
+
+	for (i = 0; i < DN_OP_N; i++)
+	{
+        hist_log(op_names[i], -1, &all->ops[i]);
+
+		for (j = 1; j < METRICS_ERRORS; j++)
+		{
+            errs += all->errors[i][j];
+		}
+	}
+
+	for (i = 0; i < METRICS_VOLS_MAX; i++)
+	{
+        hist_log(op_names[DN_OP_READ], i, &all->vols[i][DN_VOL_READ]);
+		hist_log(op_names[DN_OP_WRITE], i, &all->vols[i][DN_VOL_WRITE]);
+	}
+
+	dfs_log_error(dfs_cycle->error_log, DFS_LOG_INFO, 0,
+		"metrics bytes read: %uL, written: %uL, errors: %uL",
+		all->bytes_read, all->bytes_written, errs);
+
+	if (all->zip_logical)
+	{
+        dfs_log_error(dfs_cycle->error_log, DFS_LOG_INFO, 0,
+			"metrics compressed blks: %uL bytes in %uL on disk",
+			all->zip_logical, all->zip_stored);
+	}
+
+	if (all->ec_logical || all->ec_rebuilt)
+	{
+        dfs_log_error(dfs_cycle->error_log, DFS_LOG_INFO, 0,
+			"metrics ec groups: %uL bytes in %uL on disk, rebuilt: %uL",
+			all->ec_logical, all->ec_stored, all->ec_rebuilt);
+	}
+
+	dfs_log_error(dfs_cycle->error_log, DFS_LOG_INFO, 0,
+		"metrics reads inline: %uL, offloaded: %uL, piped: %uL, "
+		"readahead: %uL, dropped behind: %uL", all->reads_inline,
+		all->reads_offloaded, all->reads_piped, all->ra_hinted,
+		all->ra_dropped);
+
+	dn_fd_cache_stat(&fd_st);
+
+	dfs_log_error(dfs_cycle->error_log, DFS_LOG_INFO, 0,
+		"metrics fd cache open: %uL, dirs: %uL, hits: %uL, misses: %uL, "
+		"evicted: %uL", fd_st.n, fd_st.dirs, fd_st.hits, fd_st.misses,
+		fd_st.evicted);
+
+	if (dfs_cycle->error_log->async)
+	{
+	    error_log_async_stat(dfs_cycle->error_log, &log_st);
+
+	    dfs_log_error(dfs_cycle->error_log, DFS_LOG_INFO, 0,
+			"metrics log lines: %uL, bytes: %uL, writes: %uL, dropped: %uL, "
+			"blocked: %uL, rings: %ud", log_st.lines, log_st.bytes,
+			log_st.writes, log_st.dropped, log_st.blocked, log_st.rings);
+	}
+
+	memory_free(all, sizeof(dn_metrics_t));
+}
+
+// logs once per metrics_log_interval whoever calls it
+void dn_metrics_tick()
+{
+    conf_server_t *sconf = (conf_server_t *)dfs_cycle->sconf;
+	rb_msec_t      last = g_metrics_logged;
+	rb_msec_t      now = dfs_current_msec;
+
+	if (!sconf->metrics_log_interval
+		|| now - last < (rb_msec_t)sconf->metrics_log_interval * 1000)
+	{
+        return;
+	}
+
+	if (!CAS(&g_metrics_logged, last, now))
+	{
+        return;
+	}
+
+	if (last)
+	{
+        dn_metrics_log();
+	}
+}
+
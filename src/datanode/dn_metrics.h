@@ -0,0 +1,64 @@
+#ifndef DN_METRICS_H
+#define DN_METRICS_H
+
+#include "dfs_types.h"
+#include "cfs_fio.h"
+#include "dn_hist.h"
+
+#define METRICS_VOLS_MAX   32
+#define METRICS_ERRORS     16 // dn_request_error_t, the last one for others
+
+enum
+{
+    DN_OP_READ = 0,     // whole read request
+	DN_OP_WRITE,        // whole write request
+	DN_OP_FAIO_WAIT,    // queued until a faio thread picked it up
+	DN_OP_FAIO_SERVICE, // pread, pwrite or sendfile itself
+	DN_OP_SENDFILE,     // cfs_sendfile_chain until completion
+	DN_OP_FINALIZE,     // rename and index of a written blk
+	DN_OP_N
+};
+
+enum
+{
+    DN_VOL_READ = 0,
+	DN_VOL_WRITE,
+	DN_VOL_OP_N
+};
+
+// written by its own thread only, readers sum all of them
+typedef struct dn_metrics_s
+{
+    dn_hist_t ops[DN_OP_N];
+	dn_hist_t vols[METRICS_VOLS_MAX][DN_VOL_OP_N];
+	uint64_t  bytes_read;
+	uint64_t  bytes_written;
+	uint64_t  reads_inline;    // served from the page cache by the loop
+	uint64_t  reads_offloaded; // needed a faio thread
+	uint64_t  reads_piped;     // pread ahead into fio buffers, writev out
+	uint64_t  ra_hinted;       // WILLNEED bytes
+	uint64_t  ra_dropped;      // DONTNEED bytes behind cold scans
+	uint64_t  zip_logical;     // bytes of blks written compressed
+	uint64_t  zip_stored;      // what they take on disk
+	uint64_t  ec_logical;      // bytes striped over ec groups
+	uint64_t  ec_stored;       // their data and parity blks
+	uint64_t  ec_rebuilt;      // bytes of lost ec blks rebuilt
+	uint64_t  errors[DN_OP_N][METRICS_ERRORS];
+} dn_metrics_t;
+
+struct dfs_thread_s;
+
+int  dn_metrics_thread_init(struct dfs_thread_s *thread);
+dn_metrics_t *dn_metrics_local();
+void dn_metrics_tick();
+void dn_metrics_record(dn_metrics_t *m, int op, uint64_t us);
+void dn_metrics_record_vol(dn_metrics_t *m, int vol, int op, uint64_t us);
+void dn_metrics_record_fio(dn_metrics_t *m, file_io_t *fio, int sendfile);
+void dn_metrics_error(dn_metrics_t *m, int op, uint32_t err);
+int  dn_metrics_aggregate(dn_metrics_t *out);
+void dn_metrics_log();
+
+#define DEF_METRICS_LOG_INTERVAL  60 // s
+
+#endif
+
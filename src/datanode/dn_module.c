@@ -1,6 +1,10 @@
 #include "dn_module.h"
 #include "dn_error_log.h"
 #include "dn_data_storage.h"
+#include "dn_stats.h"
+#include "dn_trace.h"
+#include "dn_readahead.h"
+#include "dn_fd_cache.h"
 
 static int dfs_mod_max = 0;
 /*
@@ -26,8 +30,8 @@ dfs_module_t dfs_modules[] =
         NULL,
         dn_error_log_init,
         dn_error_log_release,
-        NULL,
-        NULL,
+        dn_error_log_worker_init,
+        dn_error_log_worker_release,
         NULL,
         NULL
     },
@@ -45,6 +49,71 @@ dfs_module_t dfs_modules[] =
         NULL
     },
 
+	{
+        string_make("metrics"),
+        0,
+        PROCESS_MOD_INIT,
+        NULL,
+        NULL,
+        NULL,
+        NULL,
+        NULL,
+        dn_metrics_thread_init,
+        NULL
+    },
+
+	{
+        string_make("stats"),
+        0,
+        PROCESS_MOD_INIT,
+        NULL,
+        dn_stats_master_init,
+        dn_stats_master_release,
+        NULL,
+        NULL,
+        dn_stats_thread_init,
+        NULL
+    },
+
+	{
+        string_make("trace"),
+        0,
+        PROCESS_MOD_INIT,
+        NULL,
+        NULL,
+        NULL,
+        NULL,
+        NULL,
+        dn_trace_thread_init,
+        dn_trace_thread_release
+    },
+
+	{
+        string_make("readahead"),
+        0,
+        PROCESS_MOD_INIT,
+        NULL,
+        NULL,
+        NULL,
+        dn_readahead_worker_init,
+        dn_readahead_worker_release,
+        NULL,
+        NULL
+    },
+
+	{
+        string_make("fd_cache"),
+        0,
+        PROCESS_MOD_INIT,
+        NULL,
+        NULL,
+        NULL,
+        dn_fd_cache_worker_init,
+        dn_fd_cache_worker_release,
+        NULL,
+        NULL
+    },
+
     {string_null, 0, 0, NULL, NULL, NULL, NULL, NULL, NULL, NULL}
 };
 
@@ -0,0 +1,661 @@
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include "dn_ns_client.h"
+#include "dfs_memory.h"
+#include "dfs_epoll.h"
+#include "dfs_sysio.h"
+#include "dn_cycle.h"
+#include "dn_time.h"
+
+static void ns_lane_read_handler(event_t *ev);
+static void ns_lane_write_handler(event_t *ev);
+static void ns_lane_timer_handler(event_t *ev);
+static int  ns_lane_connected(ns_lane_t *lane);
+static int  ns_lane_flush(ns_lane_t *lane);
+static int  ns_lane_recv(ns_lane_t *lane);
+static int  ns_lane_parse(ns_lane_t *lane);
+static int  ns_lane_dispatch(ns_lane_t *lane, char *frame, int len);
+static int  ns_lane_reserve(ns_lane_t *lane, int size);
+static void ns_lane_drop(queue_t *q);
+static rb_msec_t ns_lane_backoff(ns_lane_t *lane);
+
+int ns_lane_init(ns_lane_t *lane, int id, char *ip, int port, int inflight,
+	event_base_t *ev_base, event_timer_t *ev_timer, void *data)
+{
+    memory_zero(lane, sizeof(ns_lane_t));
+	lane->id = id;
+	lane->state = NS_LANE_IDLE;
+	lane->inflight = inflight;
+	lane->ev_base = ev_base;
+	lane->ev_timer = ev_timer;
+	lane->data = data;
+	lane->seed = (unsigned int)(time(NULL) ^ (uintptr_t)lane);
+
+	lane->addr.sin_family = AF_INET;
+	lane->addr.sin_port = htons(port);
+	lane->addr.sin_addr.s_addr = inet_addr(ip);
+
+	lane->timer_ev.data = lane;
+	lane->timer_ev.handler = ns_lane_timer_handler;
+
+	queue_init(&lane->out);
+	queue_init(&lane->wait);
+
+	// kept for the life of the lane, every connection bumps its instance
+	// so stale epoll events of a closed one are skipped
+	lane->c = conn_get_from_mem(DFS_INVALID_FILE);
+	if (!lane->c)
+	{
+	    dfs_log_error(dfs_cycle->error_log, DFS_LOG_FATAL, errno,
+			"conn_get_from_mem err");
+
+        return DFS_ERROR;
+	}
+
+	lane->peer.connection = lane->c;
+	lane->peer.sockaddr = (struct sockaddr *)&lane->addr;
+	lane->peer.socklen = sizeof(lane->addr);
+
+	lane->rbuf = (char *)malloc(NS_RBUF_INIT);
+	if (!lane->rbuf)
+	{
+	    dfs_log_error(dfs_cycle->error_log, DFS_LOG_FATAL, errno,
+			"malloc err, size: %d", NS_RBUF_INIT);
+
+        return DFS_ERROR;
+	}
+
+	lane->rsize = NS_RBUF_INIT;
+
+	return DFS_OK;
+}
+
+void ns_lane_release(ns_lane_t *lane)
+{
+    lane->on_down = NULL;
+	ns_lane_close(lane, DFS_FALSE);
+
+	if (lane->c)
+	{
+        conn_free_mem(lane->c);
+		lane->c = NULL;
+	}
+
+	free(lane->rbuf);
+	lane->rbuf = NULL;
+	lane->rsize = 0;
+}
+
+int ns_lane_connect(ns_lane_t *lane)
+{
+    conn_t *c = lane->c;
+	int     rs = DFS_OK;
+
+	if (lane->state != NS_LANE_IDLE)
+	{
+        return DFS_OK;
+	}
+
+	event_timer_del(lane->ev_timer, &lane->timer_ev);
+
+	conn_set_default(c, DFS_INVALID_FILE);
+	c->conn_data = lane;
+	c->ev_base = lane->ev_base;
+	c->log = dfs_cycle->error_log;
+	c->read->handler = ns_lane_read_handler;
+	c->write->handler = ns_lane_write_handler;
+
+	rs = conn_connect_peer(&lane->peer, lane->ev_base);
+	if (rs == DFS_ERROR)
+	{
+	    dfs_log_error(dfs_cycle->error_log, DFS_LOG_ERROR, errno,
+			"connect(%s: %d) err, lane: %d", inet_ntoa(lane->addr.sin_addr),
+			ntohs(lane->addr.sin_port), lane->id);
+
+		ns_lane_close(lane, DFS_TRUE);
+
+        return DFS_ERROR;
+	}
+
+	lane->state = NS_LANE_CONNECTING;
+
+	if (rs == DFS_OK)
+	{
+        return ns_lane_connected(lane);
+	}
+
+	event_timer_add(lane->ev_timer, &lane->timer_ev, NS_CONNECT_TIMEOUT);
+
+	return DFS_OK;
+}
+
+// drops whatever was in flight, the owner resends what still matters
+void ns_lane_close(ns_lane_t *lane, int retry)
+{
+    int       up = lane->state == NS_LANE_UP;
+	rb_msec_t delay = 0;
+
+	if (lane->c && lane->c->fd != DFS_INVALID_FILE)
+	{
+        conn_close(lane->c);
+	}
+
+	ns_lane_drop(&lane->out);
+	ns_lane_drop(&lane->wait);
+	lane->out_n = 0;
+	lane->wait_n = 0;
+	lane->rlen = 0;
+	lane->state = NS_LANE_IDLE;
+
+	event_timer_del(lane->ev_timer, &lane->timer_ev);
+
+	if (retry)
+	{
+	    delay = ns_lane_backoff(lane);
+        event_timer_add(lane->ev_timer, &lane->timer_ev, delay);
+
+		dfs_log_error(dfs_cycle->error_log, DFS_LOG_WARN, 0,
+			"namenode %s:%d lane %d closed, retry in %ul ms",
+			inet_ntoa(lane->addr.sin_addr), ntohs(lane->addr.sin_port),
+			lane->id, (unsigned long)delay);
+	}
+
+	if (up && lane->on_down)
+	{
+        lane->on_down(lane);
+	}
+}
+
+// urgent requests go ahead of everything not started yet and are
+// written even when the window is full
+int ns_lane_post(ns_lane_t *lane, ns_rpc_t *rpc)
+{
+    queue_t  *head = NULL;
+	ns_rpc_t *first = NULL;
+
+    if (lane->state != NS_LANE_UP)
+	{
+        ns_rpc_free(rpc);
+
+		return DFS_ERROR;
+	}
+
+	rpc->seq = ++lane->seq;
+	rpc->start = dfs_current_msec;
+	task_frame_set_seq(rpc->buf, rpc->seq);
+
+	if (rpc->flags & NS_RPC_URGENT)
+	{
+	    head = queue_head(&lane->out);
+		first = queue_data(head, ns_rpc_t, me);
+
+        if (!queue_empty(&lane->out) && first->sent > 0)
+		{
+            queue_insert_after(head, &rpc->me);
+		}
+		else
+		{
+            queue_insert_head(&lane->out, &rpc->me);
+		}
+	}
+	else
+	{
+        queue_insert_tail(&lane->out, &rpc->me);
+	}
+
+	lane->out_n++;
+
+	if (ns_lane_flush(lane) == DFS_ERROR)
+	{
+        ns_lane_close(lane, DFS_TRUE);
+
+		return DFS_ERROR;
+	}
+
+	return DFS_OK;
+}
+
+// requests that may still be posted without queueing behind the window
+int ns_lane_room(ns_lane_t *lane)
+{
+    int room = lane->inflight - lane->wait_n - lane->out_n;
+
+    if (lane->state != NS_LANE_UP)
+	{
+        return 0;
+	}
+
+	return room > 0 ? room : 0;
+}
+
+// post time of the oldest unanswered request, 0 if there is none
+rb_msec_t ns_lane_oldest(ns_lane_t *lane)
+{
+    ns_rpc_t  *rpc = NULL;
+    rb_msec_t  oldest = 0;
+
+	if (!queue_empty(&lane->wait))
+	{
+	    rpc = queue_data(queue_head(&lane->wait), ns_rpc_t, me);
+        oldest = rpc->start;
+	}
+
+	if (!queue_empty(&lane->out))
+	{
+	    rpc = queue_data(queue_head(&lane->out), ns_rpc_t, me);
+
+        if (!oldest || rpc->start < oldest)
+		{
+            oldest = rpc->start;
+		}
+	}
+
+	return oldest;
+}
+
+ns_rpc_t *ns_rpc_new(int ver, cmd_t cmd, void *body, int len, 
+	ns_rpc_done_pt done)
+{
+    ns_rpc_t *rpc = NULL;
+	task_t    out_t;
+	int       size = 0;
+
+	memory_zero(&out_t, sizeof(task_t));
+	out_t.cmd = cmd;
+	strcpy(out_t.key, dfs_cycle->listening_ip);
+	out_t.data_len = len;
+	out_t.data = body;
+
+	size = task_encode_size(&out_t, ver);
+
+	rpc = (ns_rpc_t *)malloc(sizeof(ns_rpc_t) + size);
+	if (!rpc)
+	{
+	    dfs_log_error(dfs_cycle->error_log, DFS_LOG_ALERT, errno,
+			"malloc err, size: %d", size);
+
+        return NULL;
+	}
+
+	memory_zero(rpc, sizeof(ns_rpc_t));
+	rpc->cmd = cmd;
+	rpc->done = done;
+	rpc->buf = (char *)(rpc + 1);
+	rpc->len = task_encode2str_ver(&out_t, ver, rpc->buf, size);
+
+	return rpc;
+}
+
+void ns_rpc_free(ns_rpc_t *rpc)
+{
+    free(rpc->data);
+	free(rpc);
+}
+
+static void ns_lane_drop(queue_t *q)
+{
+    queue_t *e = NULL;
+
+	while (!queue_empty(q))
+	{
+	    e = queue_head(q);
+		queue_remove(e);
+        ns_rpc_free(queue_data(e, ns_rpc_t, me));
+	}
+}
+
+// half of the delay is random, so a restarted namenode is not hit by
+// every datanode at once
+static rb_msec_t ns_lane_backoff(ns_lane_t *lane)
+{
+    rb_msec_t delay = NS_RECONNECT_BASE;
+	int       i = 0;
+
+	for (i = 0; i < lane->fails && delay < NS_RECONNECT_MAX; i++)
+	{
+        delay <<= 1;
+	}
+
+	if (delay > NS_RECONNECT_MAX)
+	{
+        delay = NS_RECONNECT_MAX;
+	}
+
+	lane->fails++;
+
+	return delay / 2 + rand_r(&lane->seed) % (delay / 2 + 1);
+}
+
+static void ns_lane_timer_handler(event_t *ev)
+{
+    ns_lane_t *lane = (ns_lane_t *)ev->data;
+
+	ev->timedout = 0;
+
+	if (lane->state == NS_LANE_CONNECTING)
+	{
+	    dfs_log_error(dfs_cycle->error_log, DFS_LOG_ERROR, 0,
+			"connect(%s: %d) timed out, lane: %d",
+			inet_ntoa(lane->addr.sin_addr), ntohs(lane->addr.sin_port),
+			lane->id);
+
+        ns_lane_close(lane, DFS_TRUE);
+
+		return;
+	}
+
+	ns_lane_connect(lane);
+}
+
+static int ns_lane_connected(ns_lane_t *lane)
+{
+    int       err = 0;
+	socklen_t len = sizeof(err);
+
+	if (getsockopt(lane->c->fd, SOL_SOCKET, SO_ERROR, &err, &len) != DFS_OK)
+	{
+        err = errno;
+	}
+
+	if (err)
+	{
+	    dfs_log_error(dfs_cycle->error_log, DFS_LOG_ERROR, err,
+			"connect(%s: %d) err, lane: %d", inet_ntoa(lane->addr.sin_addr),
+			ntohs(lane->addr.sin_port), lane->id);
+
+        ns_lane_close(lane, DFS_TRUE);
+
+		return DFS_ERROR;
+	}
+
+	event_timer_del(lane->ev_timer, &lane->timer_ev);
+	conn_tcp_nodelay(lane->c->fd);
+
+	lane->state = NS_LANE_UP;
+
+	if (lane->on_up)
+	{
+        lane->on_up(lane);
+	}
+
+	return DFS_OK;
+}
+
+static void ns_lane_write_handler(event_t *ev)
+{
+    conn_t    *c = (conn_t *)ev->data;
+	ns_lane_t *lane = (ns_lane_t *)c->conn_data;
+
+	if (lane->state == NS_LANE_CONNECTING)
+	{
+	    // the owner already flushed what on_up posted
+        ns_lane_connected(lane);
+
+		return;
+	}
+
+	if (lane->state == NS_LANE_UP && ns_lane_flush(lane) == DFS_ERROR)
+	{
+        ns_lane_close(lane, DFS_TRUE);
+	}
+}
+
+static void ns_lane_read_handler(event_t *ev)
+{
+    conn_t    *c = (conn_t *)ev->data;
+	ns_lane_t *lane = (ns_lane_t *)c->conn_data;
+
+	if (lane->state == NS_LANE_CONNECTING
+		&& ns_lane_connected(lane) != DFS_OK)
+	{
+        return;
+	}
+
+	if (lane->state == NS_LANE_UP && ns_lane_recv(lane) == DFS_ERROR)
+	{
+        ns_lane_close(lane, DFS_TRUE);
+	}
+}
+
+// edge triggered, writes until the socket is full or the window closes
+static int ns_lane_flush(ns_lane_t *lane)
+{
+    conn_t   *c = lane->c;
+	ns_rpc_t *rpc = NULL;
+	queue_t  *q = NULL;
+	ssize_t   n = 0;
+
+	while (!queue_empty(&lane->out))
+	{
+	    q = queue_head(&lane->out);
+		rpc = queue_data(q, ns_rpc_t, me);
+
+		if (!rpc->sent && !(rpc->flags & NS_RPC_URGENT)
+			&& lane->wait_n >= lane->inflight)
+		{
+            break;
+		}
+
+		n = c->send(c, (uchar_t *)rpc->buf + rpc->sent, rpc->len - rpc->sent);
+		if (n == DFS_AGAIN)
+		{
+            return DFS_AGAIN;
+		}
+
+		if (n <= 0)
+		{
+		    dfs_log_error(dfs_cycle->error_log, DFS_LOG_ERROR, errno,
+				"send err, lane: %d, cmd: %d", lane->id, rpc->cmd);
+
+            return DFS_ERROR;
+		}
+
+		rpc->sent += n;
+
+		if (rpc->sent < rpc->len)
+		{
+            continue;
+		}
+
+		queue_remove(q);
+		lane->out_n--;
+		queue_insert_tail(&lane->wait, q);
+		lane->wait_n++;
+	}
+
+	return DFS_OK;
+}
+
+static int ns_lane_recv(ns_lane_t *lane)
+{
+    conn_t  *c = lane->c;
+	ssize_t  n = 0;
+
+	for ( ;; )
+	{
+	    if (lane->rlen == lane->rsize
+			&& ns_lane_reserve(lane, lane->rsize << 1) != DFS_OK)
+		{
+            return DFS_ERROR;
+		}
+
+        n = c->recv(c, (uchar_t *)lane->rbuf + lane->rlen,
+			lane->rsize - lane->rlen);
+		if (n == DFS_AGAIN)
+		{
+            return DFS_OK;
+		}
+
+		if (n == 0)
+		{
+		    dfs_log_error(dfs_cycle->error_log, DFS_LOG_WARN, 0,
+				"closed by namenode, lane: %d", lane->id);
+
+            return DFS_ERROR;
+		}
+
+		if (n < 0)
+		{
+            return DFS_ERROR;
+		}
+
+		lane->rlen += n;
+
+		if (ns_lane_parse(lane) != DFS_OK)
+		{
+            return DFS_ERROR;
+		}
+
+		if (lane->state != NS_LANE_UP)
+		{
+		    // closed by a response handler
+            return DFS_OK;
+		}
+	}
+}
+
+// hands every complete frame to its request, a partial one stays
+// in the buffer until the rest arrives
+static int ns_lane_parse(ns_lane_t *lane)
+{
+    int pos = 0;
+	int len = 0;
+
+	while (lane->rlen - pos >= (int)sizeof(int))
+	{
+        memcpy(&len, lane->rbuf + pos, sizeof(int));
+
+		if (len < TASK_V2_HDR_LEN || len > NS_FRAME_MAX)
+		{
+		    dfs_log_error(dfs_cycle->error_log, DFS_LOG_ERROR, 0,
+				"bad frame, len: %d, lane: %d", len, lane->id);
+
+            return DFS_ERROR;
+		}
+
+		if (lane->rlen - pos < len)
+		{
+            break;
+		}
+
+		if (ns_lane_dispatch(lane, lane->rbuf + pos, len) != DFS_OK)
+		{
+            return DFS_ERROR;
+		}
+
+		if (lane->state != NS_LANE_UP)
+		{
+            return DFS_OK;
+		}
+
+		pos += len;
+		len = 0;
+	}
+
+	if (pos > 0)
+	{
+	    memmove(lane->rbuf, lane->rbuf + pos, lane->rlen - pos);
+        lane->rlen -= pos;
+	}
+
+	return len > lane->rsize ? ns_lane_reserve(lane, len) : DFS_OK;
+}
+
+static int ns_lane_dispatch(ns_lane_t *lane, char *frame, int len)
+{
+    ns_rpc_t *rpc = NULL;
+	ns_rpc_t *r = NULL;
+	queue_t  *q = NULL;
+	task_t    in_t;
+	int       rs = DFS_OK;
+
+	// either version, whatever was negotiated
+	if (task_decodefstr_any(frame, len, &in_t) != len)
+	{
+	    dfs_log_error(dfs_cycle->error_log, DFS_LOG_ERROR, 0,
+			"bad frame, len: %d, lane: %d", len, lane->id);
+
+        return DFS_ERROR;
+	}
+
+	if (queue_empty(&lane->wait))
+	{
+	    dfs_log_error(dfs_cycle->error_log, DFS_LOG_ERROR, 0,
+			"unexpected response, cmd: %d, lane: %d", in_t.cmd, lane->id);
+
+        return DFS_ERROR;
+	}
+
+	// answered in order, the seq is only trusted when it matches
+	rpc = queue_data(queue_head(&lane->wait), ns_rpc_t, me);
+
+	if (rpc->seq != in_t.seq)
+	{
+        for (q = queue_head(&lane->wait); q != queue_sentinel(&lane->wait);
+			q = queue_next(q))
+		{
+		    r = queue_data(q, ns_rpc_t, me);
+
+		    if (r->seq == in_t.seq)
+			{
+			    rpc = r;
+
+                break;
+			}
+		}
+	}
+
+	queue_remove(&rpc->me);
+	lane->wait_n--;
+	lane->fails = 0;
+
+	if (rpc->done)
+	{
+        rs = rpc->done(lane, rpc, &in_t);
+	}
+
+	ns_rpc_free(rpc);
+
+	if (rs != DFS_OK)
+	{
+        return DFS_ERROR;
+	}
+
+	// the window has room again
+	if (lane->state == NS_LANE_UP && ns_lane_flush(lane) == DFS_ERROR)
+	{
+        return DFS_ERROR;
+	}
+
+	return DFS_OK;
+}
+
+static int ns_lane_reserve(ns_lane_t *lane, int size)
+{
+    char *buf = NULL;
+
+	if (size > NS_FRAME_MAX)
+	{
+        size = NS_FRAME_MAX;
+	}
+
+	if (size <= lane->rsize)
+	{
+        return DFS_OK;
+	}
+
+	buf = (char *)realloc(lane->rbuf, size);
+	if (!buf)
+	{
+	    dfs_log_error(dfs_cycle->error_log, DFS_LOG_ALERT, errno,
+			"realloc err, size: %d", size);
+
+        return DFS_ERROR;
+	}
+
+	lane->rbuf = buf;
+	lane->rsize = size;
+
+	return DFS_OK;
+}
+
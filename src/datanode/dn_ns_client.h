@@ -0,0 +1,98 @@
+#ifndef DN_NS_CLIENT_H
+#define DN_NS_CLIENT_H
+
+#include <netinet/in.h>
+#include "dfs_types.h"
+#include "dfs_queue.h"
+#include "dfs_conn.h"
+#include "dfs_event.h"
+#include "dfs_event_timer.h"
+#include "dfs_task.h"
+
+#define NS_LANE_CTRL  0 // register, heartbeats and increments
+#define NS_LANE_BULK  1 // full report chunks
+#define NS_LANE_N     2
+
+#define NS_LANE_CTRL_INFLIGHT  8
+#define NS_LANE_BULK_INFLIGHT  4
+
+#define NS_FRAME_MAX           (64 * 1024 * 1024)
+#define NS_RBUF_INIT           4096
+#define NS_CONNECT_TIMEOUT     5000  // ms
+#define NS_RECONNECT_BASE      500   // ms, doubled on every failure
+#define NS_RECONNECT_MAX       30000 // ms
+
+#define NS_RPC_URGENT          0x01 // jumps the queue and the window
+
+enum
+{
+    NS_LANE_IDLE = 0,
+	NS_LANE_CONNECTING,
+	NS_LANE_UP
+};
+
+typedef struct ns_lane_s ns_lane_t;
+typedef struct ns_rpc_s  ns_rpc_t;
+
+// in is the decoded response, its data points into the lane buffer.
+// an error closes the lane
+typedef int  (*ns_rpc_done_pt)(ns_lane_t *lane, ns_rpc_t *rpc, task_t *in);
+typedef void (*ns_lane_state_pt)(ns_lane_t *lane);
+
+// one request, encoded once and kept until its response arrives
+struct ns_rpc_s
+{
+    queue_t         me;
+	uint32_t        seq;
+	cmd_t           cmd;
+	int             flags;
+	ns_rpc_done_pt  done;
+	void           *data;  // free()d with the rpc
+	rb_msec_t       start;
+	int             len;
+	int             sent;
+	char           *buf;
+};
+
+// one connection to the namenode, requests are pipelined up to
+// inflight and answered in order
+struct ns_lane_s
+{
+    int               id;
+	int               state;
+	conn_t           *c;
+	struct sockaddr_in addr;
+	conn_peer_t       peer;
+	event_base_t     *ev_base;
+	event_timer_t    *ev_timer;
+	event_t           timer_ev; // connect timeout or reconnect backoff
+	int               fails;
+	unsigned int      seed;
+	uint32_t          seq;
+	queue_t           out;      // not fully written yet
+	int               out_n;
+	queue_t           wait;     // written, waiting for a response
+	int               wait_n;
+	int               inflight;
+	char             *rbuf;
+	int               rsize;
+	int               rlen;
+	ns_lane_state_pt  on_up;
+	ns_lane_state_pt  on_down;
+	void             *data;
+};
+
+int  ns_lane_init(ns_lane_t *lane, int id, char *ip, int port, int inflight,
+	event_base_t *ev_base, event_timer_t *ev_timer, void *data);
+void ns_lane_release(ns_lane_t *lane);
+int  ns_lane_connect(ns_lane_t *lane);
+void ns_lane_close(ns_lane_t *lane, int retry);
+int  ns_lane_post(ns_lane_t *lane, ns_rpc_t *rpc);
+int  ns_lane_room(ns_lane_t *lane);
+rb_msec_t ns_lane_oldest(ns_lane_t *lane);
+ns_rpc_t *ns_rpc_new(int ver, cmd_t cmd, void *body, int len, 
+	ns_rpc_done_pt done);
+void ns_rpc_free(ns_rpc_t *rpc);
+
+#endif
+
@@ -1,5 +1,3 @@
-#include <arpa/inet.h>
-#include <sys/socket.h>
 #include <sys/time.h>
 #include "dn_ns_service.h"
 #include "dfs_types.h"
@@ -7,527 +5,950 @@
 #include "dn_cycle.h"
 #include "dn_time.h"
 #include "dn_conf.h"
+#include "dfs_memory.h"
+#include "dn_data_storage.h"
+
+#define NS_SERVICE_EVENTS     16
+#define NS_RPC_TIMEOUT_BEATS  3  // heartbeats an rpc may stay unanswered
+#define NS_REPORT_THREADS_MAX 16
+
+static volatile uint32_t g_full_report_req = 0;
+
+extern dfs_thread_t *woker_threads;
+extern int           woker_num;
+
+// every namenode thread gets its own copy of the blk events
+static dfs_thread_t *g_report_threads[NS_REPORT_THREADS_MAX];
+static int           g_report_threads_n = 0;
+
+static int dn_register(dfs_thread_t *thread);
+static int dn_register_done(ns_lane_t *lane, ns_rpc_t *rpc, task_t *in);
+static void ctrl_lane_up(ns_lane_t *lane);
+static void ctrl_lane_down(ns_lane_t *lane);
+static void bulk_lane_up(ns_lane_t *lane);
+static void bulk_lane_down(ns_lane_t *lane);
+static rb_msec_t heartbeat_ms();
+static void heartbeat_timer_handler(event_t *ev);
+static int send_heartbeat(dfs_thread_t *thread);
+static int heartbeat_stats(char **buf);
+static int heartbeat_done(ns_lane_t *lane, ns_rpc_t *rpc, task_t *in);
+static void incr_report_wake(void *data);
+static void incr_report_timer_handler(event_t *ev);
+static int incr_block_report(dfs_thread_t *thread);
+static int send_incr_block_report(dfs_thread_t *thread, cmd_t cmd, 
+	blk_report_rec_t *recs, int n);
+static int incr_report_done(ns_lane_t *lane, ns_rpc_t *rpc, task_t *in);
+static int full_block_report(dfs_thread_t *thread);
+static int full_report_done(ns_lane_t *lane, ns_rpc_t *rpc, task_t *in);
+static int delete_blks(long ns_id, char *p, int len);
+static uint64_t report_now_ms();
+static int report_incr_drop(blk_report_rec_t *recs, int *n, long blk_id);
+static int report_incr_push(blk_report_rec_t **recs, int *n, int *cap, 
+	long blk_id, long size);
+static void report_incr_add(long ns_id, long blk_id, long size, int del);
+
+// the namenode thread runs its own event loop: a control lane for
+// register, heartbeats and increments, a bulk lane for full reports
+int ns_service_init(dfs_thread_t *thread)
+{
+    ns_srv_info_t *ns = &thread->ns_info;
+	int            inflight = 0;
+	int            i = 0;
+
+    thread->event_base.nevents = NS_SERVICE_EVENTS;
+	
+    if (thread_event_init(thread) != DFS_OK) 
+	{
+        return DFS_ERROR;
+    }
 
-#define BUF_SZ 4096
+	thread->event_base.time_update = time_update;
 
-unsigned long g_last_heartbeat = 0;
+	if (notice_init(&thread->event_base, &ns->notice, incr_report_wake, 
+		thread) != DFS_OK) 
+	{
+	    dfs_log_error(dfs_cycle->error_log, DFS_LOG_FATAL, 0, 
+			"notice_init err");
+		
+        return DFS_ERROR;
+	}
+
+	for (i = 0; i < NS_LANE_N; i++) 
+	{
+	    inflight = i == NS_LANE_CTRL 
+			? NS_LANE_CTRL_INFLIGHT : NS_LANE_BULK_INFLIGHT;
+		
+        if (ns_lane_init(&ns->lanes[i], i, ns->ip, ns->port, inflight, 
+			&thread->event_base, &thread->event_timer, thread) != DFS_OK) 
+		{
+            return DFS_ERROR;
+		}
+	}
+
+	ns->lanes[NS_LANE_CTRL].on_up = ctrl_lane_up;
+	ns->lanes[NS_LANE_CTRL].on_down = ctrl_lane_down;
+	ns->lanes[NS_LANE_BULK].on_up = bulk_lane_up;
+	ns->lanes[NS_LANE_BULK].on_down = bulk_lane_down;
+
+	ns->namespaceID = -1;
+	ns->wire_ver = TASK_V1;
+	ns->hb_ev.data = thread;
+	ns->hb_ev.handler = heartbeat_timer_handler;
+	ns->flush_ev.data = thread;
+	ns->flush_ev.handler = incr_report_timer_handler;
+	queue_init(&ns->report_chunks);
+
+	return DFS_OK;
+}
 
-typedef struct recv_blk_report_s
+// 连接上 namenode, everything else follows from the callbacks
+void ns_service_start(dfs_thread_t *thread)
 {
-    queue_t         que;
-	int             num;
-	pthread_mutex_t lock;
-	pthread_cond_t  cond;
-} recv_blk_report_t;
+    ns_lane_connect(&thread->ns_info.lanes[NS_LANE_CTRL]);
+}
 
-typedef struct blk_report_s
+void ns_service_stop(dfs_thread_t *thread)
 {
-    queue_t         que;
-	int             num;
-	pthread_mutex_t lock;
-	pthread_cond_t  cond;
-} blk_report_t;
+    ns_srv_info_t *ns = &thread->ns_info;
+
+	ns_lane_release(&ns->lanes[NS_LANE_BULK]);
+	ns_lane_release(&ns->lanes[NS_LANE_CTRL]);
 
-recv_blk_report_t g_recv_blk_report;
-blk_report_t      g_blk_report;
+	event_timer_del(&thread->event_timer, &ns->hb_ev);
+	event_timer_del(&thread->event_timer, &ns->flush_ev);
+	blk_report_free(&ns->report_chunks);
+}
 
-static int ns_srv_init(char* ip, int port);
-static int send_heartbeat(int sockfd);
-static int receivedblock_report(int sockfd);
-static int wait_to_work(int second);
-static int block_report(int sockfd);
-static int delete_blks(char *p, int len);
+static void ctrl_lane_up(ns_lane_t *lane)
+{
+    dn_register((dfs_thread_t *)lane->data);
+}
 
-// 连接上 namenode 注册datanode
-// 获取 namespaceid
-int dn_register(dfs_thread_t *thread)
+// 注册datanode, 获取 namespaceid
+static int dn_register(dfs_thread_t *thread)
 {
-    int sockfd = ns_srv_init(thread->ns_info.ip, thread->ns_info.port);
-	if (sockfd < 0) 
+    task_wire_hello_t  hello;
+    ns_rpc_t          *rpc = NULL;
+
+	// sent as v1, an old namenode just ignores the hello
+	hello.magic = TASK_WIRE_HELLO_MAGIC;
+	hello.min_ver = TASK_V1;
+	hello.max_ver = TASK_WIRE_MAX;
+
+	thread->ns_info.wire_ver = TASK_V1;
+
+    rpc = ns_rpc_new(TASK_V1, DN_REGISTER, &hello, sizeof(hello), 
+		dn_register_done);
+	if (!rpc) 
 	{
-	    return DFS_ERROR;
+	    ns_lane_close(&thread->ns_info.lanes[NS_LANE_CTRL], DFS_TRUE);
+		
+        return DFS_ERROR;
 	}
 
-	task_t out_t;
-	bzero(&out_t, sizeof(task_t));
-	out_t.cmd = DN_REGISTER;
-	strcpy(out_t.key, dfs_cycle->listening_ip); // bind for cli ip
+	rpc->flags = NS_RPC_URGENT;
 
-	char sBuf[BUF_SZ] = "";
-	int sLen = task_encode2str(&out_t, sBuf, sizeof(sBuf));
-	int ws = write(sockfd, sBuf, sLen);
-	if (ws != sLen) 
+	return ns_lane_post(&thread->ns_info.lanes[NS_LANE_CTRL], rpc);
+}
+
+static int dn_register_done(ns_lane_t *lane, ns_rpc_t *rpc, task_t *in)
+{
+    dfs_thread_t      *thread = (dfs_thread_t *)lane->data;
+	ns_srv_info_t     *ns = &thread->ns_info;
+	blk_report_incr_t *incr = &ns->incr_report;
+	task_wire_hello_t  hello;
+
+    if (in->ret != DFS_OK) 
 	{
-	    dfs_log_error(dfs_cycle->error_log, DFS_LOG_FATAL, errno, 
-			"write err, ws: %d, sLen: %d", ws, sLen);
-		
-	    close(sockfd);
+		dfs_log_error(dfs_cycle->error_log, DFS_LOG_FATAL, 0, 
+			"dn_register err, ret: %d", in->ret);
 		
         return DFS_ERROR;
 	}
+	
+	if (in->data_len >= (int)sizeof(int64_t)) 
+	{
+	    memcpy(&ns->namespaceID, in->data, sizeof(int64_t));
+	}
 
-	int pLen = 0;
-	int rLen = recv(sockfd, &pLen, sizeof(int), MSG_PEEK);
-	if (rLen < 0) 
+	// a namenode that knows v2 tells which version to speak from now on
+	if (in->data_len >= (int)(sizeof(int64_t) + sizeof(task_wire_hello_t))) 
 	{
-	    dfs_log_error(dfs_cycle->error_log, DFS_LOG_FATAL, errno,
-			"recv err, rLen: %d", rLen);
-		
-	    close(sockfd);
+	    memcpy(&hello, (char *)in->data + sizeof(int64_t), sizeof(hello));
+
+		if (hello.magic == TASK_WIRE_HELLO_MAGIC 
+			&& hello.max_ver >= TASK_V1 && hello.max_ver <= TASK_WIRE_MAX) 
+		{
+            ns->wire_ver = hello.max_ver;
+		}
+	}
+
+	// 检查 version namespace id ，创建子文件夹
+	setup_ns_storage(thread);
+
+	// every (re)connection starts with a full report, it covers
+	// whatever was buffered while the namenode was away
+	ns->report_full = DFS_TRUE;
+	ns->registered = DFS_TRUE;
+
+	pthread_mutex_lock(&incr->lock);
+	incr->recv_n = 0;
+	incr->del_n = 0;
+	incr->overflow = DFS_FALSE;
+	pthread_mutex_unlock(&incr->lock);
+
+	event_timer_add(&thread->event_timer, &ns->hb_ev, heartbeat_ms());
+
+	dfs_log_error(dfs_cycle->error_log, DFS_LOG_INFO, 0,
+		"registered to namenode %s:%d, ns: %l, wire v%d", ns->ip, ns->port, 
+		(long)ns->namespaceID, ns->wire_ver);
+
+	ns_lane_connect(&ns->lanes[NS_LANE_BULK]);
+
+	return DFS_OK;
+}
+
+static void ctrl_lane_down(ns_lane_t *lane)
+{
+    dfs_thread_t  *thread = (dfs_thread_t *)lane->data;
+	ns_srv_info_t *ns = &thread->ns_info;
+
+	ns->registered = DFS_FALSE;
+	ns->namespaceID = -1;
+	ns->wire_ver = TASK_V1;
+
+	event_timer_del(&thread->event_timer, &ns->hb_ev);
+	event_timer_del(&thread->event_timer, &ns->flush_ev);
+
+	// the bulk lane comes back after the next register
+	ns_lane_close(&ns->lanes[NS_LANE_BULK], DFS_FALSE);
+}
+
+static void bulk_lane_up(ns_lane_t *lane)
+{
+    full_block_report((dfs_thread_t *)lane->data);
+}
+
+static void bulk_lane_down(ns_lane_t *lane)
+{
+    dfs_thread_t *thread = (dfs_thread_t *)lane->data;
+
+	// the cursor lets the next connection resume the report
+	blk_report_free(&thread->ns_info.report_chunks);
+}
+
+static rb_msec_t heartbeat_ms()
+{
+    conf_server_t *sconf = (conf_server_t *)dfs_cycle->sconf;
+
+	return sconf->heartbeat_interval > 0 
+		? (rb_msec_t)sconf->heartbeat_interval * 1000 : 1000;
+}
+
+// a lane whose oldest rpc is unanswered for a few beats is reconnected,
+// the bulk lane never holds up the heartbeat
+static void heartbeat_timer_handler(event_t *ev)
+{
+    dfs_thread_t  *thread = (dfs_thread_t *)ev->data;
+	ns_srv_info_t *ns = &thread->ns_info;
+	rb_msec_t      interval = heartbeat_ms();
+	rb_msec_t      oldest = 0;
+	int            i = 0;
+
+	ev->timedout = 0;
+
+	if (!ns->registered) 
+	{
+        return;
+	}
+
+	for (i = NS_LANE_N - 1; i >= 0; i--) 
+	{
+	    oldest = ns_lane_oldest(&ns->lanes[i]);
 		
+        if (oldest && dfs_current_msec - oldest 
+			> interval * NS_RPC_TIMEOUT_BEATS) 
+		{
+		    dfs_log_error(dfs_cycle->error_log, DFS_LOG_ERROR, 0, 
+				"namenode %s:%d not answering on lane %d for %ul ms", 
+				ns->ip, ns->port, i, 
+				(unsigned long)(dfs_current_msec - oldest));
+			
+            ns_lane_close(&ns->lanes[i], DFS_TRUE);
+		}
+	}
+
+	if (!ns->registered) 
+	{
+        return;
+	}
+
+	// a beat that could not be queued is retried on the next one,
+	// only a control lane that went down with it stops the timer
+	if (send_heartbeat(thread) != DFS_OK && !ns->registered) 
+	{
+        return;
+	}
+
+	// picks up full report requests
+	full_block_report(thread);
+
+	dn_metrics_tick();
+
+	event_timer_add(&thread->event_timer, &ns->hb_ev, interval);
+}
+
+static int send_heartbeat(dfs_thread_t *thread)
+{
+    ns_rpc_t *rpc = NULL;
+	char     *stats = NULL;
+	int       len = 0;
+
+	len = heartbeat_stats(&stats);
+	if (len < 0) 
+	{
         return DFS_ERROR;
 	}
 
-	char *pNext = (char *)malloc(pLen);
-	if (NULL == pNext) 
+	rpc = ns_rpc_new(thread->ns_info.wire_ver, DN_HEARTBEAT, stats, len, 
+		heartbeat_done);
+	free(stats);
+
+	if (!rpc) 
 	{
-	    dfs_log_error(dfs_cycle->error_log, DFS_LOG_FATAL, errno, 
-			"malloc err, pLen: %d", pLen);
-		
-	    close(sockfd);
-		
         return DFS_ERROR;
 	}
 
-	rLen = read(sockfd, pNext, pLen);
-	if (rLen < 0) 
+	rpc->flags = NS_RPC_URGENT;
+
+	return ns_lane_post(&thread->ns_info.lanes[NS_LANE_CTRL], rpc);
+}
+
+// capacity and load for the namenode to place blks by, read from the
+// counters the volumes and the worker threads keep anyway. the space is
+// the cached statvfs, the refresher thread keeps it fresh
+static int heartbeat_stats(char **buf)
+{
+    dn_stats_hdr_t *hdr = NULL;
+	dn_vol_stats_t *vs = NULL;
+	vol_stat_t     *v = NULL;
+	fio_manager_t  *mgr = NULL;
+	uint64_t        lat = 0;
+	int             lat_n = 0;
+	int             vol_n = 0;
+	int             len = 0;
+	int             i = 0;
+
+	vol_n = block_volume_num();
+	len = sizeof(dn_stats_hdr_t) + vol_n * sizeof(dn_vol_stats_t);
+
+	hdr = (dn_stats_hdr_t *)calloc(1, len);
+	if (!hdr) 
 	{
-	    dfs_log_error(dfs_cycle->error_log, DFS_LOG_FATAL, errno, 
-			"read err, rLen: %d", rLen);
-		
-	    close(sockfd);
+	    dfs_log_error(dfs_cycle->error_log, DFS_LOG_ALERT, errno, 
+			"calloc heartbeat stats err");
 
-		free(pNext);
-		pNext = NULL;
-		
         return DFS_ERROR;
 	}
-	
-	task_t in_t;
-	bzero(&in_t, sizeof(task_t));
-	task_decodefstr(pNext, rLen, &in_t);
 
-    if (in_t.ret != DFS_OK) 
+	hdr->version = DN_STATS_VERSION;
+	hdr->vol_n = vol_n;
+	vs = (dn_vol_stats_t *)(hdr + 1);
+
+	for (i = 0; i < vol_n; i++) 
 	{
-		dfs_log_error(dfs_cycle->error_log, DFS_LOG_FATAL, 0, 
-			"dn_register err, ret: %d", in_t.ret);
-		
-	    close(sockfd);
+	    v = block_volume_stat(i);
+
+        vs[i].capacity = v->total;
+		vs[i].used = v->total > v->avail ? v->total - v->avail : 0;
+		vs[i].remaining = vol_stat_room(v);
+		vs[i].io_errors = v->io_errors;
+		vs[i].xceivers = v->active;
+		vs[i].io_pending = v->io_pending;
+		vs[i].io_lat_us = v->io_lat_us;
+
+		if (v->failed) 
+		{
+		    vs[i].flags |= DN_VOL_FAILED;
+            hdr->failed_vols++;
+
+			continue;
+		}
+
+		hdr->capacity += vs[i].capacity;
+		hdr->used += vs[i].used;
+		hdr->remaining += vs[i].remaining;
+		hdr->xceivers += vs[i].xceivers;
+		hdr->io_pending += vs[i].io_pending;
+
+		if (vs[i].io_lat_us) 
+		{
+		    lat += vs[i].io_lat_us;
+            lat_n++;
+		}
+	}
+
+	hdr->io_lat_us = lat_n ? lat / lat_n : 0;
+
+	// racy reads, a heartbeat may be off by a request or two
+	for (i = 0; i < woker_num; i++) 
+	{
+	    mgr = &woker_threads[i].fio_mgr;
+        hdr->fio_busy += mgr->busy;
+		hdr->fio_free += mgr->nelts > mgr->busy ? mgr->nelts - mgr->busy : 0;
+	}
 
-		free(pNext);
-		pNext = NULL;
+	*buf = (char *)hdr;
+
+	return len;
+}
+
+static int heartbeat_done(ns_lane_t *lane, ns_rpc_t *rpc, task_t *in)
+{
+    dfs_thread_t *thread = (dfs_thread_t *)lane->data;
+
+    if (in->ret != DFS_OK) 
+	{
+	    dfs_log_error(dfs_cycle->error_log, DFS_LOG_FATAL, 0, 
+			"send_heartbeat err, ret: %d", in->ret);
 		
         return DFS_ERROR;
-	}
-	else if (NULL != in_t.data && in_t.data_len > 0) 
+	} 
+	
+	if (in->data_len > 0) 
 	{
-	    thread->ns_info.namespaceID = *(int64_t *)in_t.data;
+	    delete_blks(thread->ns_info.namespaceID, (char *)in->data, 
+			in->data_len);
 	}
 
-	thread->ns_info.sockfd = sockfd;
+	dfs_log_error(dfs_cycle->error_log, DFS_LOG_INFO, 0,
+		"send_heartbeat ok, ret: %d, cost: %ul ms", in->ret, 
+		(unsigned long)(dfs_current_msec - rpc->start));
+	
+    return DFS_OK;
+}
+
+static uint64_t report_now_ms()
+{
+    struct timeval now;
+
+	gettimeofday(&now, NULL);
+
+	return (uint64_t)now.tv_sec * 1000 + now.tv_usec / 1000;
+}
 
-	free(pNext);
-	pNext = NULL;
+// 初始化 blk report queue
+int blk_report_queue_init()
+{
+    g_report_threads_n = 0;
 	
     return DFS_OK;
 }
 
-// socket 链接 namenode 返回 sockfd
-static int ns_srv_init(char* ip, int port)
+int blk_report_queue_release()
 {
-	int sockfd = socket(AF_INET, SOCK_STREAM, 0);
-	if (-1 == sockfd) 
+    blk_report_incr_t *incr = NULL;
+    int                i = 0;
+
+	for (i = 0; i < g_report_threads_n; i++) 
 	{
-	    dfs_log_error(dfs_cycle->error_log, DFS_LOG_FATAL, errno, 
-			"socket() err");
+	    incr = &g_report_threads[i]->ns_info.incr_report;
 		
-	    return DFS_ERROR;
+        pthread_mutex_destroy(&incr->lock);
+		free(incr->recv);
+		free(incr->del);
+		memory_zero(incr, sizeof(blk_report_incr_t));
 	}
 
-	int reuse = 1;
-	setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+	g_report_threads_n = 0;
+	
+    return DFS_OK;
+}
 
-	struct sockaddr_in servaddr;
-	bzero(&servaddr, sizeof(servaddr));
-	servaddr.sin_family = AF_INET;
-	servaddr.sin_port = htons(port);
-	servaddr.sin_addr.s_addr = inet_addr(ip);
+// called for each namenode thread after ns_service_init, before it starts
+int blk_report_queue_register(dfs_thread_t *thread)
+{
+    blk_report_incr_t *incr = &thread->ns_info.incr_report;
 
-	int iRet = connect(sockfd, (struct sockaddr*)&servaddr, sizeof(servaddr));
-	if (iRet < 0) 
+    if (g_report_threads_n == NS_REPORT_THREADS_MAX) 
 	{
-	    dfs_log_error(dfs_cycle->error_log, DFS_LOG_FATAL, errno, 
-			"connect(%s: %d) err", ip, port);
+	    dfs_log_error(dfs_cycle->error_log, DFS_LOG_FATAL, 0, 
+			"too many namenodes, max: %d", NS_REPORT_THREADS_MAX);
 		
-	    return DFS_ERROR;
+        return DFS_ERROR;
 	}
 
-	return sockfd;
+	memory_zero(incr, sizeof(blk_report_incr_t));
+	pthread_mutex_init(&incr->lock, NULL);
+
+	g_report_threads[g_report_threads_n++] = thread;
+
+	return DFS_OK;
 }
 
-// namenode 上报 receivedblock_report、 block_report
-int offer_service(dfs_thread_t *thread)
+// drops a pending event of blk_id, only the recent ones are looked at
+static int report_incr_drop(blk_report_rec_t *recs, int *n, long blk_id)
 {
-    conf_server_t *sconf = (conf_server_t *)dfs_cycle->sconf;
-    int heartbeat_interval = sconf->heartbeat_interval; // 心跳间隔
-	int block_report_interval = sconf->block_report_interval; // default is 3
+    int i = 0;
+	int end = *n > BLK_REPORT_INCR_SCAN ? *n - BLK_REPORT_INCR_SCAN : 0;
 
-    struct timeval now;
-	gettimeofday(&now, NULL);
-	unsigned long now_time = now.tv_sec + now.tv_usec / (1000 * 1000);
-	unsigned long diff = 0; // 当前时间 - 上一次heartbeat的时间
-		
-    while (thread->running) 
+	for (i = *n - 1; i >= end; i--) 
 	{
-	    if (diff >= heartbeat_interval) 
+        if (recs[i].id == blk_id) 
 		{
-		    g_last_heartbeat = now_time;
+		    recs[i] = recs[--*n];
 			
-		    if (send_heartbeat(thread->ns_info.sockfd) != DFS_OK)
-			{
-			    goto out;
-			}
+            return DFS_TRUE;
 		}
+	}
 
-		// 提示name node 收到 blk
-		// 从 cli 接收完成之后上报
-        if (g_recv_blk_report.num > 0) // 接收的？send receivedblock_report
+	return DFS_FALSE;
+}
+
+static int report_incr_push(blk_report_rec_t **recs, int *n, int *cap, 
+	long blk_id, long size)
+{
+    blk_report_rec_t *r = NULL;
+	int               c = 0;
+
+    if (*n == *cap) 
+	{
+	    c = *cap ? *cap << 1 : BLK_REPORT_REC_INIT;
+        r = (blk_report_rec_t *)realloc(*recs, c * sizeof(blk_report_rec_t));
+		if (!r) 
 		{
-            if (receivedblock_report(thread->ns_info.sockfd) != DFS_OK) 
-		    {
-                goto out;
-		    }
+            return DFS_ERROR;
 		}
 
-        // 从scanner 那里扫描到，不在hashtable里的上报
-		if (g_blk_report.num > 0)  // 上报的？
+		*recs = r;
+		*cap = c;
+	}
+
+	(*recs)[*n].id = blk_id;
+	(*recs)[*n].size = size;
+	(*n)++;
+
+	return DFS_OK;
+}
+
+// buffers the event for every namenode of the namespace
+static void report_incr_add(long ns_id, long blk_id, long size, int del)
+{
+    conf_server_t     *sconf = (conf_server_t *)dfs_cycle->sconf;
+    blk_report_incr_t *incr = NULL;
+	int                n = 0;
+	int                rs = DFS_OK;
+	int                wake = DFS_FALSE;
+	int                i = 0;
+
+	for (i = 0; i < g_report_threads_n; i++) 
+	{
+	    if (g_report_threads[i]->ns_info.namespaceID != ns_id) 
 		{
-            if (block_report(thread->ns_info.sockfd) != DFS_OK) 
-		    {
-                goto out;
-		    }
+            continue;
 		}
 		
-        int ptime = heartbeat_interval - (int)diff;
-		int wtime = ptime > 0 ? ptime : heartbeat_interval; // wait time
-		// wait wtime
-		if (wtime > 0 && g_recv_blk_report.num == 0 && g_blk_report.num == 0) 
+	    incr = &g_report_threads[i]->ns_info.incr_report;
+
+		pthread_mutex_lock(&incr->lock);
+
+		n = incr->recv_n + incr->del_n;
+		rs = DFS_OK;
+
+		if (n >= BLK_REPORT_INCR_LIMIT) 
+		{
+            incr->overflow = DFS_TRUE;
+		}
+		else if (del) 
+		{
+		    report_incr_drop(incr->recv, &incr->recv_n, blk_id);
+            rs = report_incr_push(&incr->del, &incr->del_n, &incr->del_cap, 
+				blk_id, size);
+		}
+		else 
+		{
+		    report_incr_drop(incr->del, &incr->del_n, blk_id);
+            rs = report_incr_push(&incr->recv, &incr->recv_n, 
+				&incr->recv_cap, blk_id, size);
+		}
+
+		if (rs != DFS_OK) 
+		{
+            incr->overflow = DFS_TRUE;
+		}
+
+		if (n == 0) 
 		{
-		    g_last_heartbeat = now_time;
-			// 阻塞并等待
-	        wait_to_work(wtime);
+            incr->first_ms = report_now_ms();
 		}
 
-		gettimeofday(&now, NULL);
-		now_time = (now.tv_sec + now.tv_usec / (1000 * 1000)); // seconds
-	    diff = now_time - g_last_heartbeat;
+		wake = n == 0 || n + 1 >= (int)sconf->incr_report_batch 
+			|| incr->overflow;
+
+		pthread_mutex_unlock(&incr->lock);
+
+		// wake the thread to arm the window or to flush a full batch
+		if (wake) 
+		{
+            notice_wake_up(&g_report_threads[i]->ns_info.notice);
+		}
 	}
+}
 
-out:
-	close(thread->ns_info.sockfd);
-	thread->ns_info.sockfd = -1;
-	thread->ns_info.namespaceID = -1;
+// 提示name node 收到 blk
+int notify_nn_receivedblock(block_info_t *blk)
+{
+    report_incr_add(blk->ns_id, blk->id, blk->size, DFS_FALSE);
 	
-    return DFS_ERROR;
+    return DFS_OK;
 }
 
-static int send_heartbeat(int sockfd)
+int notify_nn_deletedblock(long ns_id, long blk_id)
 {
-    task_t out_t;
-	bzero(&out_t, sizeof(task_t));
-	out_t.cmd = DN_HEARTBEAT;
-	strcpy(out_t.key, dfs_cycle->listening_ip); // 上报自己的ip
+    report_incr_add(ns_id, blk_id, 0, DFS_TRUE);
+	
+    return DFS_OK;
+}
 
-	char sBuf[BUF_SZ] = "";
-	int sLen = task_encode2str(&out_t, sBuf, sizeof(sBuf));
-	int ws = write(sockfd, sBuf, sLen);
-	if (ws != sLen) 
-	{
-	    dfs_log_error(dfs_cycle->error_log, DFS_LOG_FATAL, errno, 
-			"write err, ws: %d, sLen: %d", ws, sLen);
+static void incr_report_wake(void *data)
+{
+    incr_block_report((dfs_thread_t *)data);
+}
 
-        return DFS_ERROR;
-	}
+static void incr_report_timer_handler(event_t *ev)
+{
+    ev->timedout = 0;
+	
+    incr_block_report((dfs_thread_t *)ev->data);
+}
 
-	int pLen = 0;
-	int rLen = recv(sockfd, &pLen, sizeof(int), MSG_PEEK);
-	if (rLen < 0) 
+// sends the buffered events once the window closed or the batch is full
+static int incr_block_report(dfs_thread_t *thread)
+{
+    conf_server_t     *sconf = (conf_server_t *)dfs_cycle->sconf;
+	ns_srv_info_t     *ns = &thread->ns_info;
+    blk_report_incr_t *incr = &ns->incr_report;
+	blk_report_rec_t  *recv = NULL;
+	blk_report_rec_t  *del = NULL;
+	uint64_t           now = 0;
+	uint64_t           due = 0;
+	int                recv_n = 0;
+	int                del_n = 0;
+	int                n = 0;
+	int                rs = DFS_OK;
+
+	if (!ns->registered) 
 	{
-	    dfs_log_error(dfs_cycle->error_log, DFS_LOG_FATAL, errno,
-			"read err, rLen: %d", rLen);
-		
-        return DFS_ERROR;
+	    // dropped by the next register, the full report covers them
+        return DFS_OK;
 	}
 
-	char *pNext = (char *)malloc(pLen);
-	if (NULL == pNext) 
+	pthread_mutex_lock(&incr->lock);
+
+	n = incr->recv_n + incr->del_n;
+
+	if (incr->overflow) 
 	{
-		dfs_log_error(dfs_cycle->error_log, DFS_LOG_FATAL, errno,
-			"malloc err, pLen: %d", pLen);
-		
-        return DFS_ERROR;
+	    // lost events, the namenode gets the whole picture instead
+	    ns->report_full = DFS_TRUE;
+		incr->overflow = DFS_FALSE;
+		incr->recv_n = 0;
+		incr->del_n = 0;
+		n = 0;
 	}
 
-	rLen = read(sockfd, pNext, pLen);
-	if (rLen < 0) 
+	now = report_now_ms();
+	due = incr->first_ms + sconf->incr_report_interval;
+
+	if (n == 0 || (n < (int)sconf->incr_report_batch && now < due)) 
 	{
-	    dfs_log_error(dfs_cycle->error_log, DFS_LOG_FATAL, errno,
-			"read err, rLen: %d", rLen);
+	    pthread_mutex_unlock(&incr->lock);
 
-		free(pNext);
-		pNext = NULL;
+		if (n > 0) 
+		{
+            event_timer_add(&thread->event_timer, &ns->flush_ev, due - now);
+		}
 		
-        return DFS_ERROR;
+        return ns->report_full ? full_block_report(thread) : DFS_OK;
 	}
 
-	task_t in_t;
-	bzero(&in_t, sizeof(task_t));
-	task_decodefstr(pNext, rLen, &in_t);
+	recv = incr->recv;
+	recv_n = incr->recv_n;
+	del = incr->del;
+	del_n = incr->del_n;
+	
+	incr->recv = NULL;
+	incr->recv_n = 0;
+	incr->recv_cap = 0;
+	incr->del = NULL;
+	incr->del_n = 0;
+	incr->del_cap = 0;
+
+	pthread_mutex_unlock(&incr->lock);
 
-    if (in_t.ret != DFS_OK) 
+	event_timer_del(&thread->event_timer, &ns->flush_ev);
+
+	if (recv_n > 0) 
 	{
-	    dfs_log_error(dfs_cycle->error_log, DFS_LOG_FATAL, 0, 
-			"send_heartbeat err, ret: %d", in_t.ret);
+        rs = send_incr_block_report(thread, DN_RECV_BLK_REPORT, recv, recv_n);
+	}
 
-		free(pNext);
-		pNext = NULL;
-		
-        return DFS_ERROR;
-	} 
-	else if (NULL != in_t.data && in_t.data_len > 0) 
+	if (rs == DFS_OK && del_n > 0) 
 	{
-	    delete_blks((char *)in_t.data, in_t.data_len);
+        rs = send_incr_block_report(thread, DN_DEL_BLK_REPORT, del, del_n);
 	}
 
-	dfs_log_error(dfs_cycle->error_log, DFS_LOG_INFO, 0,
-		"send_heartbeat ok, ret: %d", in_t.ret);
+	free(recv);
+	free(del);
 
-	free(pNext);
-	pNext = NULL;
-	
-    return DFS_OK;
+	return rs;
 }
 
-//
-static int receivedblock_report(int sockfd)
+// sorted and delta encoded like a full report, as vol -1
+static int send_incr_block_report(dfs_thread_t *thread, cmd_t cmd, 
+	blk_report_rec_t *recs, int n)
 {
-    queue_t           *cur = NULL;
-	block_info_t      *blk = NULL;
-	report_blk_info_t  rbi;
-
-	pthread_mutex_lock(&g_recv_blk_report.lock);
-    
-	cur = queue_head(&g_recv_blk_report.que);
-    queue_remove(cur);
-    blk = queue_data(cur, block_info_t, me);
-	g_recv_blk_report.num--;
-    
-    pthread_mutex_unlock(&g_recv_blk_report.lock);
-	
-    task_t out_t;
-	bzero(&out_t, sizeof(task_t));
-	out_t.cmd = DN_RECV_BLK_REPORT;
-	strcpy(out_t.key, dfs_cycle->listening_ip);
+    blk_report_chunk_t *c = NULL;
+	ns_rpc_t           *rpc = NULL;
+    queue_t            *q = NULL;
+	queue_t             chunks;
+	int                 rs = DFS_OK;
 
-	memset(&rbi, 0x00, sizeof(report_blk_info_t));
-	rbi.blk_id = blk->id;
-	rbi.blk_sz = blk->size;
-	strcpy(rbi.dn_ip, dfs_cycle->listening_ip);
+	queue_init(&chunks);
+	blk_report_sort(recs, n);
 
-	out_t.data_len = sizeof(report_blk_info_t);
-	out_t.data = &rbi;
+	if (blk_report_encode(recs, n, thread->ns_info.namespaceID, -1, 0, 0, 
+		&chunks) != DFS_OK) 
+	{
+	    // the next full report makes up for it
+	    thread->ns_info.report_full = DFS_TRUE;
+		
+		blk_report_free(&chunks);
+		
+		return DFS_OK;
+	}
 
-	char sBuf[BUF_SZ] = "";
-	int sLen = task_encode2str(&out_t, sBuf, sizeof(sBuf));
-	int ws = write(sockfd, sBuf, sLen);
-	if (ws != sLen) 
+	while (!queue_empty(&chunks)) 
 	{
-	    dfs_log_error(dfs_cycle->error_log, DFS_LOG_FATAL, errno, 
-			"write err, ws: %d, sLen: %d", ws, sLen);
+	    q = queue_head(&chunks);
+		queue_remove(q);
+		c = queue_data(q, blk_report_chunk_t, me);
 
-        return DFS_ERROR;
+		rpc = ns_rpc_new(thread->ns_info.wire_ver, cmd, &c->hdr, 
+			sizeof(blk_report_hdr_t) + c->len, incr_report_done);
+		free(c);
+
+		if (!rpc) 
+		{
+		    thread->ns_info.report_full = DFS_TRUE;
+			
+            break;
+		}
+
+		rs = ns_lane_post(&thread->ns_info.lanes[NS_LANE_CTRL], rpc);
+		if (rs != DFS_OK) 
+		{
+            break;
+		}
 	}
 
-	char rBuf[BUF_SZ] = "";
-	int rLen = read(sockfd, rBuf, sizeof(rBuf));
-	if (rLen < 0) 
+	blk_report_free(&chunks);
+
+	if (rs == DFS_OK) 
 	{
-	    dfs_log_error(dfs_cycle->error_log, DFS_LOG_FATAL, errno,
-			"read err, rLen: %d", rLen);
-		
-        return DFS_ERROR;
+	    dfs_log_error(dfs_cycle->error_log, DFS_LOG_INFO, 0, 
+		    "%s posted, blks: %d", cmd == DN_RECV_BLK_REPORT 
+		    ? "receivedblock_report" : "deletedblock_report", n);
 	}
 	
-	task_t in_t;
-	bzero(&in_t, sizeof(task_t));
-	task_decodefstr(rBuf, rLen, &in_t);
+    return rs;
+}
 
-    if (in_t.ret != DFS_OK) 
+static int incr_report_done(ns_lane_t *lane, ns_rpc_t *rpc, task_t *in)
+{
+    if (in->ret != DFS_OK) 
 	{
 	    dfs_log_error(dfs_cycle->error_log, DFS_LOG_FATAL, 0, 
-			"receivedblock_report err, ret: %d", in_t.ret);
+			"%s err, ret: %d", rpc->cmd == DN_RECV_BLK_REPORT 
+		    ? "receivedblock_report" : "deletedblock_report", in->ret);
 		
         return DFS_ERROR;
 	}
 
-	dfs_log_error(dfs_cycle->error_log, DFS_LOG_INFO, 0, 
-		"receivedblock_report ok, ret: %d", in_t.ret);
-	
-    return DFS_OK;
+	return DFS_OK;
 }
 
-static int wait_to_work(int second)
+// a full report is built once and its chunks are pipelined on the bulk
+// lane, the cursor only moves on acks so an interrupted report resumes
+// from the last acked chunk
+static int full_block_report(dfs_thread_t *thread)
 {
-    struct timespec timer;
-	struct timeval now;
-	gettimeofday(&now, NULL);
-	timer.tv_sec = now.tv_sec + second;
-	timer.tv_nsec = now.tv_usec * 1000;
-
-	pthread_mutex_lock(&g_recv_blk_report.lock);
-    
-    while (g_recv_blk_report.num == 0) 
-	{   
-        int rs = pthread_cond_timedwait(&g_recv_blk_report.cond, 
-			&g_recv_blk_report.lock, &timer); 
-		if (rs == ETIMEDOUT) 
+    ns_srv_info_t       *ns = &thread->ns_info;
+    ns_lane_t           *lane = &ns->lanes[NS_LANE_BULK];
+    blk_report_cursor_t *cur = &ns->report_cursor;
+    blk_report_cursor_t *next = NULL;
+	blk_report_chunk_t  *c = NULL;
+	ns_rpc_t            *rpc = NULL;
+	queue_t             *chunks = &ns->report_chunks;
+	queue_t             *q = NULL;
+	uint32_t             req = g_full_report_req;
+	struct timeval       now;
+
+	if (!ns->registered || lane->state != NS_LANE_UP) 
+	{
+        return DFS_OK;
+	}
+
+	if (queue_empty(chunks)) 
+	{
+	    // the last chunks are not acked yet
+	    if (lane->wait_n + lane->out_n > 0) 
 		{
-            break;
+            return DFS_OK;
+		}
+		
+	    // a report of another namespace can not be resumed
+	    if (cur->report_id && cur->ns_id != ns->namespaceID) 
+		{
+            memory_zero(cur, sizeof(blk_report_cursor_t));
 		}
-    }
-    
-	pthread_mutex_unlock(&g_recv_blk_report.lock);
-	
-    return DFS_OK;
-}
-
-// 初始化 blk report queue
-int blk_report_queue_init()
-{
-    queue_init(&g_recv_blk_report.que);
-	g_recv_blk_report.num = 0;
 
-	pthread_mutex_init(&g_recv_blk_report.lock, NULL);
-	pthread_cond_init(&g_recv_blk_report.cond, NULL);
+		if (!cur->report_id) 
+		{
+		    if (!ns->report_full && ns->report_req == req) 
+			{
+                return DFS_OK;
+			}
 
-	queue_init(&g_blk_report.que);
-	g_blk_report.num = 0;
+			gettimeofday(&now, NULL);
 
-	pthread_mutex_init(&g_blk_report.lock, NULL);
-	pthread_cond_init(&g_blk_report.cond, NULL);
-	
-    return DFS_OK;
-}
+            memory_zero(cur, sizeof(blk_report_cursor_t));
+			cur->report_id = now.tv_sec * 1000 + now.tv_usec / 1000;
+			cur->ns_id = ns->namespaceID;
+			cur->last = INT64_MIN;
+		}
 
-int blk_report_queue_release()
-{
-    pthread_mutex_destroy(&g_recv_blk_report.lock);
-	pthread_cond_destroy(&g_recv_blk_report.cond);
-	g_recv_blk_report.num = 0;
+		ns->report_full = DFS_FALSE;
+		ns->report_req = req;
+		ns->report_seq = cur->seq;
 
-	pthread_mutex_destroy(&g_blk_report.lock);
-	pthread_cond_destroy(&g_blk_report.cond);
-	g_blk_report.num = 0;
-	
-    return DFS_OK;
-}
+		if (blk_report_build(cur, chunks) != DFS_OK) 
+		{
+		    // tried again on the next heartbeat
+		    blk_report_free(chunks);
+			
+            return DFS_OK;
+		}
 
-// 提示name node 收到 blk
-int notify_nn_receivedblock(block_info_t *blk)
-{
-    pthread_mutex_lock(&g_recv_blk_report.lock);
-    
-    queue_insert_tail(&g_recv_blk_report.que, &blk->me);
-	g_recv_blk_report.num++;
+		if (queue_empty(chunks)) 
+		{
+		    cur->report_id = 0;
+			
+            return DFS_OK;
+		}
+	}
 
-	pthread_cond_signal(&g_recv_blk_report.cond);
-    
-    pthread_mutex_unlock(&g_recv_blk_report.lock);
-	
-    return DFS_OK;
-}
+	while (!queue_empty(chunks) && ns_lane_room(lane) > 0) 
+	{
+	    q = queue_head(chunks);
+		queue_remove(q);
+		c = queue_data(q, blk_report_chunk_t, me);
+		
+		c->hdr.report_id = cur->report_id;
+		c->hdr.seq = ns->report_seq++;
 
-static int block_report(int sockfd)
-{
-    queue_t           *cur = NULL;
-	block_info_t      *blk = NULL;
-	report_blk_info_t  rbi;
+		if (queue_empty(chunks)) 
+		{
+            c->hdr.flags |= BLK_REPORT_END;
+		}
 
-	pthread_mutex_lock(&g_blk_report.lock);
-    
-	cur = queue_head(&g_blk_report.que);
-    queue_remove(cur);
-    blk = queue_data(cur, block_info_t, me);
-	g_blk_report.num--;
-    
-    pthread_mutex_unlock(&g_blk_report.lock);
-	
-    task_t out_t;
-	bzero(&out_t, sizeof(task_t));
-	out_t.cmd = DN_BLK_REPORT;
-	strcpy(out_t.key, dfs_cycle->listening_ip);
+		// where the cursor is once this chunk is acked
+		next = (blk_report_cursor_t *)malloc(sizeof(blk_report_cursor_t));
+		rpc = next ? ns_rpc_new(ns->wire_ver, DN_BLK_REPORT_BULK, &c->hdr, 
+			sizeof(blk_report_hdr_t) + c->len, full_report_done) : NULL;
+		if (!rpc) 
+		{
+		    free(next);
+			free(c);
+			blk_report_free(chunks);
+			
+            return DFS_OK;
+		}
 
-	memset(&rbi, 0x00, sizeof(report_blk_info_t));
-	rbi.blk_id = blk->id;
-	rbi.blk_sz = blk->size;
-	strcpy(rbi.dn_ip, dfs_cycle->listening_ip);
+		next->report_id = c->hdr.flags & BLK_REPORT_END ? 0 : cur->report_id;
+		next->ns_id = cur->ns_id;
+		next->seq = c->hdr.seq + 1;
 
-	out_t.data_len = sizeof(report_blk_info_t);
-	out_t.data = &rbi;
+		if (c->hdr.flags & BLK_REPORT_VOL_END) 
+		{
+		    next->vol = c->hdr.vol + 1;
+			next->last = INT64_MIN;
+			next->vol_gen = 0;
+		}
+		else 
+		{
+		    next->vol = c->hdr.vol;
+			next->last = c->last;
+			next->vol_gen = c->hdr.vol_gen;
+		}
 
-	char sBuf[BUF_SZ] = "";
-	int sLen = task_encode2str(&out_t, sBuf, sizeof(sBuf));
-	int ws = write(sockfd, sBuf, sLen);
-	if (ws != sLen) 
-	{
-	    dfs_log_error(dfs_cycle->error_log, DFS_LOG_FATAL, errno, 
-			"write err, ws: %d, sLen: %d", ws, sLen);
+		rpc->data = next;
+		free(c);
 
-        return DFS_ERROR;
+		if (ns_lane_post(lane, rpc) != DFS_OK) 
+		{
+            return DFS_ERROR;
+		}
 	}
 
-	char rBuf[BUF_SZ] = "";
-	int rLen = read(sockfd, rBuf, sizeof(rBuf));
-	if (rLen < 0) 
+	return DFS_OK;
+}
+
+static int full_report_done(ns_lane_t *lane, ns_rpc_t *rpc, task_t *in)
+{
+    dfs_thread_t        *thread = (dfs_thread_t *)lane->data;
+    blk_report_cursor_t *cur = &thread->ns_info.report_cursor;
+    blk_report_cursor_t *next = (blk_report_cursor_t *)rpc->data;
+
+    if (in->ret != DFS_OK) 
 	{
-	    dfs_log_error(dfs_cycle->error_log, DFS_LOG_FATAL, errno,
-			"read err, rLen: %d", rLen);
+	    dfs_log_error(dfs_cycle->error_log, DFS_LOG_FATAL, 0, 
+			"block_report err, ret: %d, seq: %ud", in->ret, next->seq - 1);
 		
         return DFS_ERROR;
 	}
-	
-	task_t in_t;
-	bzero(&in_t, sizeof(task_t));
-	task_decodefstr(rBuf, rLen, &in_t);
 
-    if (in_t.ret != DFS_OK) 
+	if (!next->report_id) 
 	{
-	    dfs_log_error(dfs_cycle->error_log, DFS_LOG_FATAL, 0, 
-			"block_report err, ret: %d", in_t.ret);
-		
-        return DFS_ERROR;
+	    dfs_log_error(dfs_cycle->error_log, DFS_LOG_INFO, 0, 
+			"full block report %uL of ns %l done, chunks: %ud", 
+			cur->report_id, (long)cur->ns_id, next->seq);
 	}
 
-	dfs_log_error(dfs_cycle->error_log, DFS_LOG_INFO, 0, 
-		"block_report ok, ret: %d", in_t.ret);
-	
-    return DFS_OK;
+	*cur = *next;
+
+	// a post that failed has closed the lane already, the report resumes
+	// from the cursor once the lane is back
+	full_block_report(thread);
+
+	return DFS_OK;
 }
 
-// blk info插入 g_blk_report
+// a blk found out of band is reported as received
 int notify_blk_report(block_info_t *blk)
 {
-    pthread_mutex_lock(&g_blk_report.lock);
-    
-    queue_insert_tail(&g_blk_report.que, &blk->me);
-	g_blk_report.num++;
-    
-    pthread_mutex_unlock(&g_blk_report.lock);
+    report_incr_add(blk->ns_id, blk->id, blk->size, DFS_FALSE);
 	
     return DFS_OK;
 }
 
-static int delete_blks(char *p, int len)
+// every namenode thread sends a full report once it gets to it
+void notify_blk_full_report()
+{
+    __sync_fetch_and_add(&g_full_report_req, 1);
+}
+
+static int delete_blks(long ns_id, char *p, int len)
 {
     uint64_t blk_id = 0;
 	int      pLen = sizeof(uint64_t);
@@ -536,7 +957,7 @@ static int delete_blks(char *p, int len)
 	{
         memcpy(&blk_id, p, pLen);
 
-		block_object_del(blk_id);
+		block_object_del(ns_id, blk_id);
 
 		p += pLen;
 		len -= pLen;
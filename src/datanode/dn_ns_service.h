@@ -4,12 +4,15 @@
 #include "dn_thread.h"
 #include "dn_data_storage.h"
 
-int dn_register(dfs_thread_t *thread);
-int offer_service(dfs_thread_t *thread);
+int  ns_service_init(dfs_thread_t *thread);
+void ns_service_start(dfs_thread_t *thread);
+void ns_service_stop(dfs_thread_t *thread);
 int blk_report_queue_init();
 int blk_report_queue_release();
+int blk_report_queue_register(dfs_thread_t *thread);
 int notify_nn_receivedblock(block_info_t *blk);
+int notify_nn_deletedblock(long ns_id, long blk_id);
 int notify_blk_report(block_info_t *blk);
+void notify_blk_full_report();
 
 #endif
-
@@ -35,6 +35,7 @@ static int      process_old_alived = DFS_FALSE;
 dfs_thread_t   *main_thread = NULL;
 
 static int process_reap_workers(cycle_t *cycle);
+static void process_notify_workers_trace();
 
 int process_check_running(cycle_t *cycle)
 {
@@ -416,6 +417,25 @@ void process_notify_workers_backup()
     return;
 }
 
+// a signal rather than the channel, workers sleep in their main thread
+static void process_notify_workers_trace()
+{
+    int idx = 0;
+
+    for (idx = 0; idx < process_last; idx++) 
+	{
+        if (processes[idx].pid == DFS_INVALID_PID) 
+		{
+            continue;
+        }
+
+        if (kill(processes[idx].pid, SIGNAL_TRACE) == DFS_ERROR) 
+		{
+            dfs_log_error(dfs_cycle->error_log, DFS_LOG_WARN, errno,
+                "kill(%P, %d) failed", processes[idx].pid, SIGNAL_TRACE);
+        }
+    }
+}
 
 // process_spawn 上面的进程生成？ worker_processer //from dn_worker_process.c
 int process_start_workers(cycle_t *cycle)
@@ -623,6 +643,12 @@ void process_master_cycle(cycle_t *cycle, int argc, char **argv)
                 process_notify_workers_backup();
                 process_doing &= ~PROCESS_DOING_BACKUP;
             }
+
+            if (process_doing & PROCESS_DOING_TRACE) 
+			{
+                process_notify_workers_trace();
+                process_doing &= ~PROCESS_DOING_TRACE;
+            }
         }
     }
 	
@@ -44,6 +44,7 @@ enum
     PROCESS_DOING_TEST_STORE    = 0x0200,
     PROCESS_DOING_REOPEN        = 0x0400,
     PROCESS_DOING_BACKUP        = 0X0800,
+    PROCESS_DOING_TRACE         = 0x1000,
 };
 
 enum 
@@ -0,0 +1,511 @@
+#include "dn_read_pipe.h"
+#include "dn_request.h"
+#include "dn_thread.h"
+#include "dn_conf.h"
+#include "dn_metrics.h"
+#include "dfs_event_timer.h"
+#include "dfs_time.h"
+#include "dfs_memory.h"
+#include "dfs_error_log.h"
+#include "cfs.h"
+#include "cfs_zblk.h"
+
+static int  pipe_fill(dn_request_t *r);
+static int  pipe_read_complete(void *data, void *task);
+static void pipe_send(dn_request_t *r);
+static void pipe_write_handler(dn_request_t *r);
+static void pipe_check_hangup(dn_request_t *r);
+static void pipe_read_timeout(event_t *ev);
+static void pipe_muted(dn_request_t *r);
+static void pipe_fail(dn_request_t *r, uint32_t err);
+static void pipe_adapt(dn_read_pipe_t *p);
+static uint64_t ewma(uint64_t avg, uint64_t sample);
+
+// r->fio is the first slot, the rest come from the thread's fio manager
+void dn_read_pipe_start(dn_request_t *r, dn_read_pipe_done_pt done)
+{
+    conf_server_t  *sconf = (conf_server_t *)dfs_cycle->sconf;
+	dfs_thread_t   *thread = NULL;
+	dn_read_pipe_t *p = NULL;
+	file_io_t      *fio = NULL;
+	uint32_t        max = 0;
+
+	thread = get_local_thread();
+
+	// a read has to cover a whole chunk or the pipe never moves
+	if ((uint64_t)(r->fio->b->end - r->fio->b->start)
+		< (uint64_t)(r->zip ? CFS_ZBLK_CHUNK : DN_PIPE_ALIGN))
+	{
+	    dfs_log_error(dfs_cycle->error_log, DFS_LOG_ALERT, 0,
+			"fio buffer of %uz is short of a read chunk",
+			(size_t)(r->fio->b->end - r->fio->b->start));
+
+        done(r, DN_STATUS_INTERNAL_SERVER_ERROR);
+
+		return;
+	}
+
+	p = (dn_read_pipe_t *)pool_calloc(r->pool, sizeof(dn_read_pipe_t));
+	if (!p)
+	{
+	    dfs_log_error(dfs_cycle->error_log, DFS_LOG_ALERT, 0,
+			"pool_calloc failed");
+
+        done(r, DN_STATUS_INTERNAL_SERVER_ERROR);
+
+		return;
+	}
+
+	p->done = done;
+	p->timer.handler = pipe_read_timeout;
+	p->timer.data = r;
+	p->slots[0].fio = r->fio;
+	p->nslots = 1;
+	r->pipe = p;
+
+	max = sconf->read_pipe_depth < DN_PIPE_DEPTH_MAX_N
+		? sconf->read_pipe_depth : DN_PIPE_DEPTH_MAX_N;
+
+	// short of fios the pipe is just shorter
+	while (p->nslots < max)
+	{
+	    fio = cfs_fio_manager_alloc(&thread->fio_mgr);
+		if (!fio)
+		{
+            break;
+		}
+
+		p->slots[p->nslots++].fio = fio;
+	}
+
+	p->depth = p->nslots < DN_PIPE_DEPTH_INIT ? p->nslots : DN_PIPE_DEPTH_INIT;
+	// a compressed blk is read and decompressed a chunk at a time
+	p->align = r->zip ? CFS_ZBLK_CHUNK : DN_PIPE_ALIGN;
+	p->start = r->header.start_offset;
+	p->end = p->start + r->header.len;
+	p->next = p->start & ~((uint64_t)p->align - 1);
+
+	r->write_event_handler = pipe_write_handler;
+	r->read_event_handler = pipe_check_hangup;
+
+	if (pipe_fill(r) != DFS_OK)
+	{
+        pipe_fail(r, DN_REQUEST_ERROR_IO_FAILED);
+
+		return;
+	}
+
+	pipe_send(r);
+}
+
+// no read may be in flight, the fios go back before the request is freed
+void dn_read_pipe_release(dn_request_t *r)
+{
+    dn_read_pipe_t *p = r->pipe;
+	dfs_thread_t   *thread = NULL;
+	uint32_t        i = 0;
+
+	if (!p)
+	{
+        return;
+	}
+
+	thread = get_local_thread();
+
+	if (p->timer.timer_set)
+	{
+        event_timer_del(r->conn->ev_timer, &p->timer);
+	}
+
+	for (i = 1; i < p->nslots; i++)
+	{
+        cfs_fio_manager_free(p->slots[i].fio, &thread->fio_mgr);
+	}
+
+	p->nslots = 0;
+	r->pipe = NULL;
+}
+
+int dn_read_pipe_close_deferred(dn_request_t *r, uint32_t err)
+{
+    dn_read_pipe_t *p = r->pipe;
+
+	if (!p || !p->reading)
+	{
+        return DFS_FALSE;
+	}
+
+	pipe_fail(r, err ? err : DN_REQUEST_ERROR_CONN);
+
+	return DFS_TRUE;
+}
+
+static int pipe_fill(dn_request_t *r)
+{
+    dn_read_pipe_t *p = r->pipe;
+	dn_read_slot_t *s = NULL;
+	file_io_t      *fio = NULL;
+	uint64_t        end = 0;
+	uint64_t        len = 0;
+
+	// whole aligned blocks, the one at the end of the blk reads short
+	end = (p->end + p->align - 1) & ~((uint64_t)p->align - 1);
+
+	while (!p->err && p->busy < p->depth && p->next < p->end)
+	{
+	    s = &p->slots[p->tail];
+		fio = s->fio;
+
+		len = (fio->b->end - fio->b->start) & ~((uint64_t)p->align - 1);
+		if (len > end - p->next)
+		{
+            len = end - p->next;
+		}
+
+		fio->fd = r->store_fd;
+		fio->offset = p->next;
+		fio->need = len;
+		fio->b->pos = fio->b->last = fio->b->start;
+		fio->event = AIO_READ_EV;
+		fio->zip = r->zip;
+		fio->data = r;
+		fio->h = pipe_read_complete;
+		fio->io_event = &get_local_thread()->io_events;
+		fio->faio_noty = &get_local_thread()->faio_notify;
+		fio->faio_ret = DFS_ERROR;
+
+		if (cfs_read((cfs_t *)dfs_cycle->cfs, fio, dfs_cycle->error_log)
+			!= DFS_OK)
+		{
+		    dfs_log_error(dfs_cycle->error_log, DFS_LOG_ALERT, 0,
+				"submit blk read failed, conn_fd: %d", r->conn->fd);
+
+			return DFS_ERROR;
+		}
+
+		s->state = DN_SLOT_READING;
+		p->next += len;
+		p->tail = (p->tail + 1) % p->nslots;
+		p->busy++;
+		p->reading++;
+	}
+
+	if (p->reading && !p->timer.timer_set)
+	{
+        event_timer_add(r->conn->ev_timer, &p->timer, DN_PIPE_READ_TIMEOUT);
+	}
+
+	return DFS_OK;
+}
+
+static int pipe_read_complete(void *data, void *task)
+{
+    dn_request_t   *r = NULL;
+	dn_read_pipe_t *p = NULL;
+	dn_read_slot_t *s = NULL;
+	file_io_t      *fio = NULL;
+	uint64_t        off = 0;
+	uint64_t        want = 0;
+	uint32_t        i = 0;
+
+	r = (dn_request_t *)data;
+	fio = (file_io_t *)task;
+	p = r->pipe;
+
+	for (i = 0; i < p->nslots; i++)
+	{
+	    if (p->slots[i].fio == fio)
+		{
+            s = &p->slots[i];
+
+			break;
+		}
+	}
+
+	p->reading--;
+
+	// the rest get the full timeout from here
+	if (p->timer.timer_set)
+	{
+        event_timer_del(r->conn->ev_timer, &p->timer);
+	}
+
+	if (p->reading)
+	{
+        event_timer_add(r->conn->ev_timer, &p->timer, DN_PIPE_READ_TIMEOUT);
+	}
+
+	dn_metrics_record_fio(dn_metrics_local(), fio, DFS_FALSE);
+
+	if (fio->submit_us && fio->end_us > fio->submit_us)
+	{
+        p->disk_us = ewma(p->disk_us, fio->end_us - fio->submit_us);
+	}
+
+	off = (uint64_t)fio->offset;
+	want = (p->end < off + fio->need ? p->end : off + fio->need) - off;
+
+	if (!s || p->err || fio->faio_ret < 0
+		|| (uint64_t)(fio->b->last - fio->b->start) < want)
+	{
+	    if (!p->err)
+		{
+            dfs_log_error(dfs_cycle->error_log, DFS_LOG_ALERT, 
+				fio->faio_ret < 0 ? fio->faio_task.err.sys : 0,
+				"read blk at %uL failed, got %d of %uL", (uint64_t)fio->offset,
+				fio->faio_ret, want);
+		}
+
+        pipe_fail(r, DN_REQUEST_ERROR_IO_FAILED);
+
+		return DFS_OK;
+	}
+
+	// only the range asked for goes out
+	fio->b->pos = fio->b->start + (p->start > off ? p->start - off : 0);
+	fio->b->last = fio->b->start + want;
+	s->state = DN_SLOT_READY;
+
+	pipe_send(r);
+
+	return DFS_OK;
+}
+
+static void pipe_send(dn_request_t *r)
+{
+    dn_read_pipe_t *p = r->pipe;
+	dn_read_slot_t *s = NULL;
+	dn_read_slot_t *prev = NULL;
+	conn_t         *c = NULL;
+	chain_t        *out = NULL;
+	uint64_t        now = 0;
+	uint32_t        i = 0;
+	uint32_t        n = 0;
+
+	c = r->conn;
+
+	if (p->err)
+	{
+        return;
+	}
+
+	// the ready run from head goes out in one writev
+	for (i = 0, n = p->head; i < p->busy; i++, n = (n + 1) % p->nslots)
+	{
+	    s = &p->slots[n];
+		if (s->state != DN_SLOT_READY)
+		{
+            break;
+		}
+
+		s->cl.buf = s->fio->b;
+		s->cl.next = NULL;
+
+		if (prev)
+		{
+            prev->cl.next = &s->cl;
+		}
+		else
+		{
+            out = &s->cl;
+		}
+
+		prev = s;
+	}
+
+	if (out)
+	{
+	    if (!p->head_us)
+		{
+            p->head_us = time_monotonic_us();
+		}
+
+	    while (c->write->ready && out)
+		{
+            out = c->send_chain(c, out, 0); // sysio_writev_chain
+
+			if (out == DFS_CHAIN_ERROR)
+			{
+			    dfs_log_debug(dfs_cycle->error_log, DFS_LOG_DEBUG, errno,
+					"send blk data failed, conn_fd: %d", c->fd);
+
+                pipe_fail(r, DN_REQUEST_ERROR_CONN);
+
+				return;
+			}
+		}
+
+		// the slots fully out take the next reads
+		for (n = 0; p->busy && p->slots[p->head].state == DN_SLOT_READY
+			&& !buffer_size(p->slots[p->head].fio->b); n++)
+		{
+		    p->slots[p->head].state = DN_SLOT_FREE;
+			p->head = (p->head + 1) % p->nslots;
+			p->busy--;
+		}
+
+		if (n)
+		{
+		    now = time_monotonic_us();
+            p->net_us = ewma(p->net_us, (now - p->head_us) / n);
+			p->head_us = p->busy && p->slots[p->head].state == DN_SLOT_READY
+				? now : 0;
+
+			pipe_adapt(p);
+
+			if (pipe_fill(r) != DFS_OK)
+			{
+                pipe_fail(r, DN_REQUEST_ERROR_IO_FAILED);
+
+				return;
+			}
+		}
+	}
+
+	if (!p->busy && p->next >= p->end)
+	{
+	    if (c->write->timer_set)
+		{
+            event_timer_del(c->ev_timer, c->write);
+		}
+
+		p->done(r, DN_REQUEST_ERROR_NONE);
+
+		return;
+	}
+
+	// the socket is full, else the disk wakes us up
+	if (out && !c->write->ready)
+	{
+	    if (event_handle_write(c->ev_base, c->write, 0) == DFS_ERROR)
+		{
+		    dfs_log_error(dfs_cycle->error_log, DFS_LOG_ALERT, 0,
+				"add write event failed");
+
+            pipe_fail(r, DN_REQUEST_ERROR_CONN);
+
+			return;
+		}
+
+		if (!c->write->timer_set)
+		{
+            event_timer_add(c->ev_timer, c->write, CONN_TIME_OUT);
+		}
+	}
+}
+
+static void pipe_write_handler(dn_request_t *r)
+{
+    conn_t  *c = NULL;
+	event_t *wev = NULL;
+
+	c = r->conn;
+	wev = c->write;
+
+	if (wev->timedout)
+	{
+	    dfs_log_debug(dfs_cycle->error_log, DFS_LOG_DEBUG, 0,
+			"wev timeout, conn_fd: %d", c->fd);
+
+        pipe_fail(r, DN_REQUEST_ERROR_CONN);
+
+		return;
+	}
+
+	if (wev->timer_set)
+	{
+        event_timer_del(c->ev_timer, wev);
+	}
+
+	pipe_send(r);
+}
+
+// the client is gone, the reads in flight still have to come back
+static void pipe_check_hangup(dn_request_t *r)
+{
+    conn_t  *c = r->conn;
+	char     buf[1] = "";
+	ssize_t  rs = 0;
+
+	rs = recv(c->fd, buf, 1, MSG_PEEK);
+	if (rs > 0 || (rs < 0 && (errno == DFS_EAGAIN || errno == DFS_EINTR)))
+	{
+        return;
+	}
+
+	dfs_log_debug(dfs_cycle->error_log, DFS_LOG_DEBUG, errno,
+		"client is closed, conn_fd: %d", c->fd);
+
+	pipe_fail(r, DN_REQUEST_ERROR_CONN);
+}
+
+// faio still holds the request, the client is let go
+static void pipe_read_timeout(event_t *ev)
+{
+    dn_request_t   *r = (dn_request_t *)ev->data;
+	dn_read_pipe_t *p = r->pipe;
+
+	dfs_log_error(dfs_cycle->error_log, DFS_LOG_ERROR, 0,
+		"%ud blk reads not back in %d ms, conn_fd: %d", p->reading,
+		DN_PIPE_READ_TIMEOUT, r->conn->fd);
+
+	shutdown(r->conn->fd, SHUT_RDWR);
+
+	pipe_fail(r, DN_REQUEST_ERROR_TIMEOUT);
+}
+
+static void pipe_muted(dn_request_t *r)
+{
+    dfs_log_debug(dfs_cycle->error_log, DFS_LOG_DEBUG, 0,
+		"blk read failed, waiting for the reads in flight");
+}
+
+// the request outlives the reads it has in flight
+static void pipe_fail(dn_request_t *r, uint32_t err)
+{
+    dn_read_pipe_t *p = r->pipe;
+	conn_t         *c = r->conn;
+
+	if (!p->err)
+	{
+	    p->err = err;
+        r->write_event_handler = pipe_muted;
+		r->read_event_handler = pipe_muted;
+
+		if (c->write->timer_set)
+		{
+            event_timer_del(c->ev_timer, c->write);
+		}
+	}
+
+	if (!p->reading)
+	{
+        p->done(r, p->err);
+	}
+}
+
+// enough reads ahead to cover one read at the going send rate
+static void pipe_adapt(dn_read_pipe_t *p)
+{
+    uint64_t depth = 0;
+
+	depth = p->net_us ? p->disk_us / p->net_us + DN_PIPE_DEPTH_MIN
+		: p->nslots;
+
+	if (depth < DN_PIPE_DEPTH_MIN)
+	{
+        depth = DN_PIPE_DEPTH_MIN;
+	}
+
+	if (depth > p->nslots)
+	{
+        depth = p->nslots;
+	}
+
+	p->depth = depth;
+}
+
+static uint64_t ewma(uint64_t avg, uint64_t sample)
+{
+    return avg ? avg - avg / 4 + sample / 4 : sample;
+}
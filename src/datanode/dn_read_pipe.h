@@ -0,0 +1,68 @@
+#ifndef DN_READ_PIPE_H
+#define DN_READ_PIPE_H
+
+#include "dfs_types.h"
+#include "dfs_chain.h"
+#include "dfs_event.h"
+#include "cfs_fio.h"
+
+#define DN_PIPE_DEPTH_MAX_N   16
+#define DN_PIPE_DEPTH_MIN     2
+#define DN_PIPE_DEPTH_INIT    4
+#define DN_PIPE_ALIGN         4096 // O_DIRECT offsets, lengths and buffers
+#define DEF_READ_PIPE_DEPTH   8
+#define DN_PIPE_READ_TIMEOUT  30000 // ms with no read back, the client goes
+
+enum
+{
+    DN_READ_SENDFILE = 1, // sendfile straight from the page cache
+	DN_READ_BUFFERED,     // pread into fio buffers, writev out
+	DN_READ_DIRECT        // as buffered, the blks opened O_DIRECT
+};
+
+enum
+{
+    DN_SLOT_FREE = 0,
+	DN_SLOT_READING,      // pread in a faio thread
+	DN_SLOT_READY         // data in the buffer, waiting for the socket
+};
+
+struct dn_request_s;
+
+typedef void (*dn_read_pipe_done_pt)(struct dn_request_s *r, uint32_t err);
+
+typedef struct dn_read_slot_s
+{
+    file_io_t *fio;
+	chain_t    cl;
+	int        state;
+} dn_read_slot_t;
+
+// reads run ahead of the socket, sent strictly in order from head
+typedef struct dn_read_pipe_s
+{
+    dn_read_slot_t       slots[DN_PIPE_DEPTH_MAX_N];
+	uint32_t             nslots;  // slots with a fio
+	uint32_t             head;    // oldest, the one going out
+	uint32_t             tail;    // next one to read into
+	uint32_t             busy;    // reading or ready
+	uint32_t             reading; // in faio threads
+	uint32_t             depth;   // reads kept ahead, adapted
+	uint32_t             align;   // reads start and end on it
+	uint64_t             next;    // file offset of the next read
+	uint64_t             start;   // first byte to send
+	uint64_t             end;     // right after the last byte to send
+	uint64_t             disk_us; // ewma of a chunk read
+	uint64_t             net_us;  // ewma of a chunk going out
+	uint64_t             head_us; // head got ready to send
+	int                  err;     // finish once the reads in flight are back
+	event_t              timer;   // no read back in time
+	dn_read_pipe_done_pt done;
+} dn_read_pipe_t;
+
+void dn_read_pipe_start(struct dn_request_s *r, dn_read_pipe_done_pt done);
+void dn_read_pipe_release(struct dn_request_s *r);
+// DFS_TRUE while reads are in flight, the last one closes r once back
+int  dn_read_pipe_close_deferred(struct dn_request_s *r, uint32_t err);
+
+#endif
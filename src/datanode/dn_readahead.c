@@ -0,0 +1,360 @@
+#include <fcntl.h>
+#include <netinet/in.h>
+
+#include "dn_readahead.h"
+#include "dn_request.h"
+#include "dn_data_storage.h"
+#include "dn_metrics.h"
+#include "dn_conf.h"
+#include "dn_fd_cache.h"
+#include "dn_thread.h"
+#include "dfs_lock.h"
+#include "dfs_memory.h"
+#include "dfs_error_log.h"
+#include "cfs.h"
+
+// the hint for a blk other than the open one, carried in the fio buffer
+typedef struct ra_task_s
+{
+    block_info_t blk;
+	uint64_t     offset;
+	uint64_t     len;
+	int          advice;
+} ra_task_t;
+
+static dn_ra_stream_t *g_ra_streams = NULL;
+
+static dn_ra_stream_t *ra_slot(uint32_t peer, long ns_id, long blk_id);
+static int  ra_lock(dn_ra_stream_t *s);
+static void ra_unlock(dn_ra_stream_t *s);
+static int  ra_match(dn_ra_stream_t *s, uint32_t peer, long ns_id,
+	long blk_id);
+static void ra_advise_blk(long ns_id, long blk_id, uint64_t offset,
+	uint64_t len, int advice);
+static ssize_t ra_advise_work(file_io_t *fio);
+static int  ra_advise_done(void *data, void *arg);
+
+int dn_readahead_worker_init(cycle_t *cycle)
+{
+    int i = 0;
+
+    g_ra_streams = (dn_ra_stream_t *)memory_calloc(sizeof(dn_ra_stream_t)
+		* DN_RA_SLOTS);
+	if (!g_ra_streams)
+	{
+	    dfs_log_error(cycle->error_log, DFS_LOG_ALERT, errno,
+			"calloc readahead streams err");
+
+        return DFS_ERROR;
+	}
+
+	for (i = 0; i < DN_RA_SLOTS; i++)
+	{
+        g_ra_streams[i].blk_id = -1;
+	}
+
+	return DFS_OK;
+}
+
+int dn_readahead_worker_release(cycle_t *cycle)
+{
+    if (g_ra_streams)
+	{
+        memory_free(g_ra_streams, sizeof(dn_ra_stream_t) * DN_RA_SLOTS);
+		g_ra_streams = NULL;
+	}
+
+	return DFS_OK;
+}
+
+// runs once the blk is open, before the data goes out; the hints are
+// best effort, a busy slot just skips them
+void dn_readahead_open(dn_request_t *r, block_info_t *blk)
+{
+    conf_server_t  *sconf = (conf_server_t *)dfs_cycle->sconf;
+	dn_ra_stream_t *s = NULL;
+	dn_ra_stream_t *prev = NULL;
+	dn_metrics_t   *m = NULL;
+	uint32_t        peer = 0;
+	uint64_t        start = 0;
+	uint64_t        end = 0;
+	uint64_t        len = 0;
+	uint64_t        window = 0;
+	uint64_t        hinted = 0;
+	uint64_t        to = 0;
+	uint64_t        over = 0;
+	uint64_t        next_from = 0;
+	uint64_t        next_to = 0;
+	uint64_t        prev_from = 0;
+	uint64_t        prev_to = 0;
+	uint64_t        drop_from = 0;
+	uint64_t        drop_to = 0;
+
+	if (!g_ra_streams || sconf->readahead != DN_RA_ADAPTIVE
+		|| sconf->read_io == DN_READ_DIRECT || blk->zip
+		|| !r->header.len || r->store_fd < 0)
+	{
+        return;
+	}
+
+	if (r->conn->sockaddr)
+	{
+        peer = ((struct sockaddr_in *)r->conn->sockaddr)->sin_addr.s_addr;
+	}
+
+	start = r->header.start_offset;
+	len = r->header.len;
+	end = start + len;
+
+	s = ra_slot(peer, blk->ns_id, blk->id);
+	if (!ra_lock(s))
+	{
+        return;
+	}
+
+	if (!ra_match(s, peer, blk->ns_id, blk->id))
+	{
+	    s->peer = peer;
+		s->ns_id = blk->ns_id;
+		s->blk_id = blk->id;
+		s->size = (uint64_t)blk->size > end ? (uint64_t)blk->size : end;
+		s->seq = 0;
+		s->ra_end = 0;
+		s->next_ra = 0;
+		s->dropped = start;
+		s->cold = DFS_FALSE;
+
+		// a reader walking blk ids takes its stream along
+		prev = start ? NULL : ra_slot(peer, blk->ns_id, blk->id - 1);
+		if (prev && prev != s && ra_lock(prev))
+		{
+		    if (ra_match(prev, peer, blk->ns_id, blk->id - 1)
+				&& prev->seq >= DN_RA_SEQ_MIN && prev->next >= prev->size)
+			{
+                s->seq = prev->seq + 1;
+				s->cold = prev->cold;
+				s->ra_end = prev->next_ra;
+
+				if (prev->cold && prev->seq >= DN_RA_DROP_SEQ)
+				{
+                    prev_from = prev->dropped;
+					prev_to = prev->size;
+				}
+
+				prev->blk_id = -1;
+			}
+
+			ra_unlock(prev);
+		}
+
+		if (!s->seq)
+		{
+            s->cold = cfs_resident(r->store_fd, start,
+				len < CFS_CACHED_CHUNK ? len : CFS_CACHED_CHUNK)
+				== DFS_DECLINED;
+		}
+	}
+	else if (start == s->next)
+	{
+        s->seq++;
+	}
+	else
+	{
+	    // a seek starts over, never drop behind it
+        s->seq = 0;
+		s->ra_end = 0;
+		s->next_ra = 0;
+		s->dropped = start;
+	}
+
+	s->next = end;
+
+	if (s->seq >= DN_RA_SEQ_MIN)
+	{
+	    window = len << (s->seq < DN_RA_SHIFT_MAX ? s->seq : DN_RA_SHIFT_MAX);
+		if (window > sconf->readahead_max)
+		{
+            window = sconf->readahead_max;
+		}
+
+		if (s->ra_end < end)
+		{
+            s->ra_end = end;
+		}
+
+		// refilled once half of the window is read
+		if (s->ra_end - end < window / 2)
+		{
+		    to = end + window < s->size ? end + window : s->size;
+			if (to > s->ra_end)
+			{
+                posix_fadvise(r->store_fd, s->ra_end, to - s->ra_end,
+					POSIX_FADV_WILLNEED);
+				hinted = to - s->ra_end;
+				s->ra_end = to;
+			}
+
+			over = end + window > s->size ? end + window - s->size : 0;
+			if (over > s->next_ra)
+			{
+                next_from = s->next_ra;
+				next_to = over;
+				s->next_ra = over;
+			}
+		}
+	}
+
+	// pages of a blk another request reads too are left alone
+	if (s->cold && s->seq >= DN_RA_DROP_SEQ && start > s->dropped
+		&& !(r->fd_ent && dn_fd_cache_shared(r->fd_ent)))
+	{
+	    drop_from = s->dropped;
+		drop_to = start;
+		s->dropped = start;
+	}
+
+	ra_unlock(s);
+
+	if (drop_to)
+	{
+        posix_fadvise(r->store_fd, drop_from, drop_to - drop_from,
+			POSIX_FADV_DONTNEED);
+	}
+
+	if (next_to)
+	{
+        ra_advise_blk(blk->ns_id, blk->id + 1, next_from,
+			next_to - next_from, POSIX_FADV_WILLNEED);
+	}
+
+	if (prev_to > prev_from)
+	{
+        ra_advise_blk(blk->ns_id, blk->id - 1, prev_from,
+			prev_to - prev_from, POSIX_FADV_DONTNEED);
+	}
+
+	m = dn_metrics_local();
+	if (m)
+	{
+        m->ra_hinted += hinted;
+		m->ra_dropped += drop_to - drop_from;
+	}
+}
+
+static dn_ra_stream_t *ra_slot(uint32_t peer, long ns_id, long blk_id)
+{
+    uint64_t h = 0;
+
+	h = ((uint64_t)blk_id * 0x9e3779b97f4a7c15ULL) ^ ((uint64_t)ns_id << 32)
+		^ peer;
+	h ^= h >> 29;
+
+	return &g_ra_streams[h % DN_RA_SLOTS];
+}
+
+static int ra_lock(dn_ra_stream_t *s)
+{
+    return !s->lock && CAS(&s->lock, 0, 1);
+}
+
+static void ra_unlock(dn_ra_stream_t *s)
+{
+    __atomic_store_n(&s->lock, 0, __ATOMIC_RELEASE);
+}
+
+static int ra_match(dn_ra_stream_t *s, uint32_t peer, long ns_id,
+	long blk_id)
+{
+    return s->blk_id == blk_id && s->ns_id == ns_id && s->peer == peer;
+}
+
+// for a blk other than the one the request has open, opening it may go
+// to disk so it runs on faio; the bytes are counted once it is done
+static void ra_advise_blk(long ns_id, long blk_id, uint64_t offset,
+	uint64_t len, int advice)
+{
+    dfs_thread_t *thread = get_local_thread();
+	file_io_t    *fio = NULL;
+	ra_task_t    *t = NULL;
+
+	fio = cfs_fio_manager_alloc(&thread->fio_mgr);
+	if (!fio)
+	{
+        return;
+	}
+
+	t = (ra_task_t *)fio->b->start;
+	if (block_object_get(ns_id, blk_id, &t->blk) != DFS_OK)
+	{
+	    cfs_fio_manager_free(fio, &thread->fio_mgr);
+
+        return;
+	}
+
+	t->offset = offset;
+	t->len = len;
+	t->advice = advice;
+
+	fio->work = ra_advise_work;
+	fio->event = AIO_WRITE_EV;
+	fio->need = 0;
+	fio->data = NULL;
+	fio->h = ra_advise_done;
+	fio->io_event = &thread->io_events;
+	fio->faio_noty = &thread->faio_notify;
+	fio->faio_ret = DFS_ERROR;
+
+	if (cfs_write((cfs_t *)dfs_cycle->cfs, fio, dfs_cycle->error_log)
+		!= DFS_OK)
+	{
+        cfs_fio_manager_free(fio, &thread->fio_mgr);
+	}
+}
+
+// on a faio thread
+static ssize_t ra_advise_work(file_io_t *fio)
+{
+    ra_task_t   *t = (ra_task_t *)fio->b->start;
+	dn_fd_ent_t *ent = NULL;
+	ssize_t      done = 0;
+
+	ent = dn_fd_cache_get(&t->blk);
+	if (!ent)
+	{
+        return 0;
+	}
+
+	if (t->advice != POSIX_FADV_DONTNEED || !dn_fd_cache_shared(ent))
+	{
+	    posix_fadvise(ent->fd, t->offset, t->len, t->advice);
+		done = t->len;
+	}
+
+	dn_fd_cache_put(ent);
+
+	return done;
+}
+
+static int ra_advise_done(void *data, void *arg)
+{
+    file_io_t    *fio = (file_io_t *)arg;
+	ra_task_t    *t = (ra_task_t *)fio->b->start;
+	dn_metrics_t *m = NULL;
+
+	m = dn_metrics_local();
+	if (m && fio->ret > 0)
+	{
+	    if (t->advice == POSIX_FADV_DONTNEED)
+		{
+            m->ra_dropped += fio->ret;
+		}
+		else
+		{
+            m->ra_hinted += fio->ret;
+		}
+	}
+
+	cfs_fio_manager_free(fio, &get_local_thread()->fio_mgr);
+
+	return DFS_OK;
+}
@@ -0,0 +1,41 @@
+#ifndef DN_READAHEAD_H
+#define DN_READAHEAD_H
+
+#include "dn_cycle.h"
+
+enum
+{
+    DN_RA_ADAPTIVE = 1, // hints by stream, drop-behind for cold scans
+	DN_RA_KERNEL        // kernel defaults only
+};
+
+// one reader walking a blk, and on into the next blk id
+typedef struct dn_ra_stream_s
+{
+    volatile uint64_t lock;
+	uint32_t          peer;    // client ipv4
+	uint32_t          seq;     // sequential reads in a row
+	long              ns_id;
+	long              blk_id;  // -1 for a free slot
+	uint64_t          size;    // of blk_id
+	uint64_t          next;    // offset right after the last read
+	uint64_t          ra_end;  // WILLNEED hinted up to here
+	uint64_t          next_ra; // WILLNEED hinted of blk_id + 1
+	uint64_t          dropped; // DONTNEED up to here
+	int               cold;    // started on pages not in the cache
+} dn_ra_stream_t;
+
+struct dn_request_s;
+struct block_info_s;
+
+int  dn_readahead_worker_init(cycle_t *cycle);
+int  dn_readahead_worker_release(cycle_t *cycle);
+void dn_readahead_open(struct dn_request_s *r, struct block_info_s *blk);
+
+#define DN_RA_SLOTS           1024 // streams per worker process
+#define DN_RA_SEQ_MIN         1    // sequential reads before any hint
+#define DN_RA_DROP_SEQ        2    // a cold stream this long is a scan
+#define DN_RA_SHIFT_MAX       4    // window grows up to len << 4
+#define DEF_READAHEAD_MAX     (8 * 1024 * 1024)
+
+#endif
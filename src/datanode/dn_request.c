@@ -14,6 +14,12 @@
 #include "dn_thread.h"
 #include "dn_data_storage.h"
 #include "dn_conf.h"
+#include "dn_time.h"
+#include "dn_readahead.h"
+#include "dn_fd_cache.h"
+#include "dn_read_pipe.h"
+#include "dn_ec.h"
+#include "cfs_zblk.h"
 
 static void dn_empty_handler(event_t *ev);
 static void dn_request_process_handler(event_t *ev);
@@ -36,6 +42,7 @@ static void dn_request_send_block(dn_request_t *r);
 static void fio_task_alloc_timeout(event_t *ev);
 static int block_read_complete(void *data, void *task);
 static void dn_request_send_block_again(dn_request_t *r);
+static void dn_request_send_block_cached(dn_request_t *r);
 static void dn_request_recv_block(dn_request_t *r);
 static void recv_block_handler(dn_request_t *r);
 static int block_write_complete(void *data, void *task);
@@ -43,6 +50,10 @@ static void dn_request_write_done_response(dn_request_t *r);
 static void dn_request_send_write_done_response(dn_request_t *r);
 static void dn_request_read_done_response(dn_request_t *r);
 static void dn_request_send_read_done_response(dn_request_t *r);
+static void trace_fio_done(dn_request_t *r, file_io_t *fio, int next);
+static void read_pipe_done(dn_request_t *r, uint32_t err);
+static void ec_header_done(dn_request_t *r, uint32_t err);
+static void ec_done(dn_request_t *r, uint32_t err);
 
 // listen_rev_handler
 void dn_conn_init(conn_t *c)
@@ -80,6 +91,14 @@ void dn_conn_init(conn_t *c)
 	r->conn = c;
 	memset(&r->header, 0x00, sizeof(data_transfer_header_t));
 	r->store_fd = -1;
+	r->fd_ent = NULL;
+	r->pipe = NULL;
+	r->ec = NULL;
+	r->zip = DFS_FALSE;
+	r->vol = -1;
+	r->vol_held = 0;
+	r->start_us = 0;
+	dn_trace_begin(r);
 
 	r->pool = pool_create(CONN_POOL_SZ, CONN_POOL_SZ, dfs_cycle->error_log);
     if (!r->pool) 
@@ -241,25 +260,67 @@ static void dn_request_close(dn_request_t *r, uint32_t err)
 {
     conn_t       *c = NULL;
 	dfs_thread_t *thread = NULL;
+	uint64_t      lat = 0;
+	int           op = DN_OP_READ;
 
 	dfs_log_debug(dfs_cycle->error_log, DFS_LOG_DEBUG, 0, 
 		"dn_request_close err: %d", err);
 
+	// faio still works on the pipe or ec buffers, the task out comes
+	// back to close r
+	if (dn_read_pipe_close_deferred(r, err) || dn_ec_close_deferred(r, err))
+	{
+        return;
+	}
+
 	c = r->conn;
 	thread = get_local_thread();
 
+	dn_trace_end(r, err);
+
+	if (r->start_us) 
+	{
+	    if (r->header.op_type == OP_WRITE_BLOCK 
+			|| r->header.op_type == OP_EC_WRITE_GROUP
+			|| r->header.op_type == OP_EC_RECONSTRUCT) 
+		{
+            op = DN_OP_WRITE;
+		}
+
+		lat = time_monotonic_us() - r->start_us;
+        dn_metrics_record(thread->metrics, op, lat);
+		dn_metrics_record_vol(thread->metrics, r->vol, 
+			op == DN_OP_WRITE ? DN_VOL_WRITE : DN_VOL_READ, lat);
+		dn_metrics_error(thread->metrics, op, err);
+		r->start_us = 0;
+	}
+
+	dn_read_pipe_release(r);
+	dn_ec_release(r);
+
 	if (r->fio) 
 	{
         cfs_fio_manager_free(r->fio, &thread->fio_mgr);
 		r->fio = NULL;
 	}
 
-	if (r->store_fd > 0) 
+	if (r->fd_ent) 
+	{
+        dn_fd_cache_put(r->fd_ent);
+		r->fd_ent = NULL;
+		r->store_fd = -1;
+	}
+	else if (r->store_fd > 0) 
 	{
         cfs_close((cfs_t *)dfs_cycle->cfs, r->store_fd);
 		r->store_fd = -1;
 	}
 
+	if (r->vol >= 0) 
+	{
+        block_volume_release(r);
+	}
+
 	if (r->pool) 
 	{
         pool_destroy(r->pool);
@@ -276,6 +337,8 @@ static void dn_request_parse_header(dn_request_t *r)
         int op_type = r->header.op_type;
 	
     r->read_event_handler = dn_request_block_reading;
+	r->start_us = time_monotonic_us();
+	dn_trace_stage(r, DN_TRACE_OPEN, 0);
 	
     switch (op_type) 
 	{
@@ -286,6 +349,11 @@ static void dn_request_parse_header(dn_request_t *r)
 	case OP_READ_BLOCK:
 		dn_request_read_file(r);
 		break;
+
+	case OP_EC_WRITE_GROUP:
+	case OP_EC_RECONSTRUCT:
+		dn_ec_start(r, ec_header_done);
+		break;
 		
 	default:
 		dfs_log_error(dfs_cycle->error_log, DFS_LOG_ALERT, 0, 
@@ -321,7 +389,7 @@ static void dn_request_block_writing(dn_request_t *r)
 	event_t *wev = NULL;
 
 	c = r->conn;
-	wev = c->read;
+	wev = c->write;
 	
     if (epoll_del_event(c->ev_base, wev, EVENT_WRITE_EVENT, EVENT_CLEAR_EVENT)
 		== DFS_ERROR)
@@ -335,11 +403,10 @@ static void dn_request_block_writing(dn_request_t *r)
 
 static void dn_request_read_file(dn_request_t *r)
 {
-    block_info_t *blk = NULL;
-	int           fd = -1;
+    block_info_t  blk;
 
-	blk = block_object_get(r->header.block_id);
-	if (!blk) 
+	if (block_object_get(r->header.namespace_id, r->header.block_id, &blk) 
+		!= DFS_OK) 
 	{
         dfs_log_error(dfs_cycle->error_log,
              DFS_LOG_FATAL, 0, "blk %d does't exist", r->header.block_id);
@@ -351,21 +418,32 @@ static void dn_request_read_file(dn_request_t *r)
 
 	if (r->store_fd < 0) 
 	{
-        fd = cfs_open((cfs_t *)dfs_cycle->cfs, (uchar_t *)blk->path, O_RDONLY, 
-			dfs_cycle->error_log);
-		if (fd < 0) 
+	    // shared with the other readers of the blk, not closed by us
+        r->fd_ent = dn_fd_cache_get(&blk);
+		if (!r->fd_ent) 
 		{
 		    dfs_log_error(dfs_cycle->error_log, 
-				DFS_LOG_FATAL, errno, "open file %s err", blk->path);
+				DFS_LOG_FATAL, errno, "open file %s err", blk.path);
 			
 		    dn_request_close(r, DN_STATUS_INTERNAL_SERVER_ERROR);
 			
             return;
 		}
 
-		r->store_fd = fd;
+		r->store_fd = r->fd_ent->fd;
+	}
+
+	r->zip = blk.zip;
+
+	// readers count as load of the volume too
+	if (r->vol < 0 && block_volume_stat(blk.vol)) 
+	{
+	    r->vol = blk.vol;
+        vol_stat_hold(block_volume_stat(blk.vol), 0);
 	}
 
+	dn_readahead_open(r, &blk);
+
 	dn_request_header_response(r);
 }
 
@@ -396,6 +474,8 @@ static void dn_request_write_file(dn_request_t *r)
 		return;
 	}
 
+	r->zip = r->header.len > 0 && block_volume_compress(r->vol);
+
 	if (r->store_fd < 0) 
 	{
         fd = cfs_open((cfs_t *)dfs_cycle->cfs, r->path, 
@@ -430,6 +510,8 @@ static void dn_request_header_response(dn_request_t *r)
 	c = r->conn;
 	header_sz = sizeof(data_transfer_header_rsp_t);
 
+	dn_trace_stage(r, DN_TRACE_RESPONSE, 0);
+
 	out = chain_alloc(r->pool);
 	if (!out) 
 	{
@@ -645,6 +727,11 @@ static void dn_request_process_body(dn_request_t *r)
 	    r->fio = cfs_fio_manager_alloc(&thread->fio_mgr);
 		if (!r->fio) 
 		{
+		    if (r->trace_stage != DN_TRACE_FIO_WAIT) 
+			{
+                dn_trace_stage(r, DN_TRACE_FIO_WAIT, 0);
+			}
+			
             memset(&r->ev_timer, 0x00, sizeof(event_t));
             r->ev_timer.handler = fio_task_alloc_timeout;
             r->ev_timer.data = r;
@@ -663,14 +750,31 @@ static void dn_request_process_body(dn_request_t *r)
 	{
         dn_request_send_block(r);
 	}
+	else if (r->header.op_type == OP_EC_WRITE_GROUP 
+		|| r->header.op_type == OP_EC_RECONSTRUCT)
+	{
+        dn_ec_process(r, ec_done);
+	}
 }
 
 static void dn_request_send_block(dn_request_t *r)
 {
 	conn_t                *c = NULL;
+	conf_server_t         *sconf = NULL;
 	sendfile_chain_task_t *sf_chain_task = NULL;
 
 	c = r->conn;
+	sconf = (conf_server_t *)dfs_cycle->sconf;
+
+	// no sendfile out of fio buffers, pread ahead and writev instead.
+	// a compressed blk has to come through them to be decompressed
+	if (sconf->read_io != DN_READ_SENDFILE || r->zip) 
+	{
+	    dn_trace_stage(r, DN_TRACE_DISK, r->header.len);
+        dn_read_pipe_start(r, read_pipe_done);
+
+		return;
+	}
 
 	r->write_event_handler = dn_request_block_writing;
 
@@ -691,8 +795,16 @@ static void dn_request_send_block(dn_request_t *r)
 
 		sf_chain_task->conn_fd = c->fd;
         sf_chain_task->store_fd = r->store_fd;
+		sf_chain_task->limit = sconf->sendfile_slice;
 		
 		r->fio->sf_chain_task = sf_chain_task;
+
+		// a slow client parks on the write event, not in sendfile
+		if (conn_tcp_notsent_lowat(c->fd, (int)sconf->send_lowat) < 0) 
+		{
+            dfs_log_error(dfs_cycle->error_log, DFS_LOG_WARN, errno, 
+				"set TCP_NOTSENT_LOWAT on conn_fd %d failed", c->fd);
+		}
 	}
 
 	r->fio->fd = r->store_fd;
@@ -703,6 +815,83 @@ static void dn_request_send_block(dn_request_t *r)
     r->fio->io_event = &get_local_thread()->io_events;
     r->fio->faio_ret = DFS_ERROR;
     r->fio->faio_noty = &get_local_thread()->faio_notify;
+	r->fio->submit_us = 0;
+	r->fio->b->pos = r->fio->b->last = r->fio->b->start;
+
+	dn_request_send_block_cached(r);
+}
+
+// a hot blk goes out right here, only a page cache miss is worth the 
+// hop to a faio thread and back
+static void dn_request_send_block_cached(dn_request_t *r)
+{
+    conn_t       *c = NULL;
+	dn_metrics_t *m = NULL;
+	int           rs = DFS_ERROR;
+
+	c = r->conn;
+	m = dn_metrics_local();
+
+	dn_trace_stage(r, DN_TRACE_DISK, r->fio->need);
+
+	rs = cfs_send_cached((cfs_t *)dfs_cycle->cfs, r->fio, 
+		dfs_cycle->error_log);
+	if (rs == DFS_OK) 
+	{
+	    // the faio thread may have sent a part before the socket filled
+	    if (m && r->fio->submit_us) 
+		{
+            m->bytes_read += r->header.len;
+			m->reads_offloaded++;
+		}
+		else if (m) 
+		{
+            m->bytes_read += r->header.len;
+			m->reads_inline++;
+		}
+
+		dn_trace_stage(r, DN_TRACE_DONE, 0);
+		dn_request_read_done_response(r);
+
+		return;
+	}
+	else if (rs == DFS_AGAIN) 
+	{
+	    c->write->ready = DFS_FALSE;
+	    r->write_event_handler = dn_request_send_block_again;
+
+		dn_trace_stage(r, DN_TRACE_SEND_BLOCKED, 0);
+		
+	    if (event_handle_write(c->ev_base, c->write, 0) == DFS_ERROR) 
+	    {
+            dfs_log_error(dfs_cycle->error_log, DFS_LOG_ALERT, 0, 
+				"add write event failed");
+        
+            dn_request_close(r, DN_REQUEST_ERROR_CONN);
+		
+            return;
+        }
+    
+        event_timer_add(c->ev_timer, c->write, CONN_TIME_OUT);
+
+		return;
+	}
+	else if (rs == DFS_ERROR) 
+	{
+	    dfs_log_error(dfs_cycle->error_log, DFS_LOG_ALERT, 0, 
+			"send block failed");
+		
+	    dn_request_close(r, DN_REQUEST_ERROR_CONN);
+		
+        return;
+	}
+
+	// the fio is busy until block_read_complete, mute the socket; a
+	// client gone in the meantime shows up on the next send
+	r->write_event_handler = dn_request_block_writing;
+	r->read_event_handler = dn_request_block_reading;
+
+	dn_trace_stage(r, DN_TRACE_FAIO_QUEUE, r->fio->need);
 	
     if (cfs_sendfile_chain((cfs_t *)dfs_cycle->cfs, r->fio, 
 		dfs_cycle->error_log) != DFS_OK) 
@@ -737,24 +926,35 @@ static int block_read_complete(void *data, void *task)
     dn_request_t *r = NULL;
 	conn_t       *c = NULL;
 	file_io_t    *fio = NULL;
+	dn_metrics_t *m = NULL;
 	int           rs = DFS_ERROR;
 
 	r = (dn_request_t *)data;
 	c = r->conn;
 	fio = (file_io_t *)task;
 	rs = fio->faio_ret;
+	m = dn_metrics_local();
+
+	r->read_event_handler = dn_request_check_read_connection;
+
+	dn_metrics_record_fio(m, fio, DFS_TRUE);
+	trace_fio_done(r, fio, rs == DFS_EAGAIN ? DN_TRACE_SEND_BLOCKED 
+		: rs == DFS_AGAIN ? DN_TRACE_DISK : DN_TRACE_DONE);
 
-	if (rs == DFS_EAGAIN) 
+	if (rs == DFS_AGAIN) 
+	{
+	    // a slice is out, the rest queues up behind the others
+	    dn_request_send_block_cached(r);
+
+		return DFS_OK;
+	}
+	else if (rs == DFS_EAGAIN) 
 	{
+	    // the socket was full a moment ago, wait for it to drain rather
+	    // than bounce through faio again on a stale ready
+	    c->write->ready = DFS_FALSE;
 	    r->write_event_handler = dn_request_send_block_again;
 		
-	    if (c->write->ready) 
-	    {
-            dn_request_send_block_again(r);
-		
-            return DFS_OK;
-        }
-		
 	    if (event_handle_write(c->ev_base, c->write, 0) == DFS_ERROR) 
 	    {
             dfs_log_error(dfs_cycle->error_log, DFS_LOG_ALERT, 0, 
@@ -779,9 +979,14 @@ static int block_read_complete(void *data, void *task)
         return DFS_ERROR;
 	}
 
-	dn_request_read_done_response(r);
+	if (m) 
+	{
+        m->bytes_read += r->header.len;
+		m->reads_offloaded++;
+	}
 
-	dn_request_close(r, DN_REQUEST_ERROR_NONE);
+	// closes the request once the response is out
+	dn_request_read_done_response(r);
 	
     return DFS_OK;
 }
@@ -810,12 +1015,8 @@ static void dn_request_send_block_again(dn_request_t *r)
 	{
         event_timer_del(c->ev_timer, wev);
     }
-	
-    if (cfs_sendfile_chain((cfs_t *)dfs_cycle->cfs, r->fio, 
-		dfs_cycle->error_log) != DFS_OK) 
-	{
-        dn_request_close(r, DN_STATUS_INTERNAL_SERVER_ERROR);
-    }
+
+	dn_request_send_block_cached(r);
 }
 
 static void dn_request_recv_block(dn_request_t *r)
@@ -829,6 +1030,8 @@ static void dn_request_recv_block(dn_request_t *r)
 	r->read_event_handler = recv_block_handler;
     r->write_event_handler = dn_request_block_writing;
 
+	dn_trace_stage(r, DN_TRACE_RECV, 0);
+
 	if (rev->ready) 
 	{
         recv_block_handler(r);
@@ -851,10 +1054,11 @@ static void dn_request_recv_block(dn_request_t *r)
 
 static void recv_block_handler(dn_request_t *r)
 {
-    int      rs = 0;
-	size_t   blen = 0;
-	conn_t  *c = NULL;
-	event_t *rev = NULL;
+    int         rs = 0;
+	size_t      blen = 0;
+	conn_t     *c = NULL;
+	event_t    *rev = NULL;
+	vol_stat_t *vol = NULL;
 
 	c = r->conn;
 	rev = c->read;
@@ -920,6 +1124,21 @@ static void recv_block_handler(dn_request_t *r)
 
 	r->read_event_handler = dn_request_block_reading;
 
+	// compressed by the faio thread, chunk by chunk
+	if (r->zip && !r->fio->zblk) 
+	{
+        r->fio->zblk = cfs_zblk_create(r->pool, r->header.len);
+		if (!r->fio->zblk) 
+		{
+		    dfs_log_error(dfs_cycle->error_log, DFS_LOG_ALERT, 0, 
+				"cfs_zblk_create failed");
+
+			dn_request_close(r, DN_STATUS_INTERNAL_SERVER_ERROR);
+
+			return;
+		}
+	}
+
 	r->fio->fd = r->store_fd;
 	r->fio->b = r->input;
 	r->fio->need = buffer_size(r->input);
@@ -930,9 +1149,22 @@ static void recv_block_handler(dn_request_t *r)
     r->fio->faio_ret = DFS_ERROR;
     r->fio->faio_noty = &get_local_thread()->faio_notify;
 	
+	vol = block_volume_stat(r->vol);
+	if (vol) 
+	{
+        r->io_start = vol_io_begin(vol);
+	}
+
+	dn_trace_stage(r, DN_TRACE_FAIO_QUEUE, r->fio->need);
+	
     if (cfs_write((cfs_t *)dfs_cycle->cfs, r->fio, 
 		dfs_cycle->error_log) != DFS_OK) 
 	{
+	    if (vol) 
+		{
+            vol_io_end(vol, r->io_start, DFS_FALSE);
+		}
+		
         dn_request_close(r, DN_STATUS_INTERNAL_SERVER_ERROR);
     }
 }
@@ -942,23 +1174,38 @@ static int block_write_complete(void *data, void *task)
 {
     dn_request_t *r = NULL;
 	file_io_t    *fio = NULL;
+	vol_stat_t   *vol = NULL;
+	dn_metrics_t *m = NULL;
+	uint64_t      start = 0;
 	int           rs = DFS_ERROR;
+	int           full = DFS_FALSE;
 
 	r = (dn_request_t *)data;
 	fio = (file_io_t *)task;
 	rs = fio->faio_ret;
+	full = rs >= 0 && (uint32_t)rs == fio->need;
+
+	vol = block_volume_stat(r->vol);
+	if (vol) 
+	{
+        vol_io_end(vol, r->io_start, full);
+	}
+
+	dn_metrics_record_fio(dn_metrics_local(), fio, DFS_FALSE);
+	trace_fio_done(r, fio, full && r->done + rs < r->header.len 
+		? DN_TRACE_RECV : DN_TRACE_FINALIZE);
 
 	if (rs == DFS_ERROR) 
 	{
-	    dfs_log_error(dfs_cycle->error_log, DFS_LOG_ALERT, 0, 
-			"do fio task failed");
+	    dfs_log_error(dfs_cycle->error_log, DFS_LOG_ALERT, 
+			fio->faio_task.err.sys, "do fio task failed");
 
 		dn_request_close(r, DN_STATUS_INTERNAL_SERVER_ERROR);
 		
         return DFS_ERROR;
 	}
 
-	if (rs != fio->need) 
+	if (!full) 
 	{
         dfs_log_error(dfs_cycle->error_log, DFS_LOG_ALERT, 0, 
 			"write block failed, rs: %d, need: %d", rs, fio->need);
@@ -969,6 +1216,12 @@ static int block_write_complete(void *data, void *task)
 	}
 
 	r->done += rs;// 完成了多少
+	m = dn_metrics_local();
+	if (m) 
+	{
+        m->bytes_written += rs;
+	}
+
 	if (r->done < r->header.len)  // 数据没有发送或者接受完就继续发送或者接收
 	{
 	    buffer_reset(r->input);
@@ -978,16 +1231,23 @@ static int block_write_complete(void *data, void *task)
         return DFS_OK;
 	}
 
+	if (m && fio->zblk) 
+	{
+        m->zip_logical += r->header.len;
+		m->zip_stored += ((cfs_zblk_t *)fio->zblk)->stored;
+	}
+
 	// close fd
 	cfs_close((cfs_t *)dfs_cycle->cfs, r->store_fd);
 	r->store_fd = -1;
 
+	start = time_monotonic_us();
 	write_block_done(r);
+	dn_metrics_record(m, DN_OP_FINALIZE, time_monotonic_us() - start);
+	dn_trace_stage(r, DN_TRACE_DONE, 0);
 
 	dn_request_write_done_response(r);
 
-	dn_request_close(r, DN_REQUEST_ERROR_NONE);
-
     return DFS_OK;
 }
 
@@ -1098,6 +1358,8 @@ static void dn_request_send_write_done_response(dn_request_t *r)
 	rs = send_header_response(r);
 	if (rs == DFS_OK) 
 	{
+	    dn_request_close(r, DN_REQUEST_ERROR_NONE);
+		
 	    return;
 	}
 	else if (rs == DFS_AGAIN) 
@@ -1217,6 +1479,8 @@ static void dn_request_send_read_done_response(dn_request_t *r)
 	rs = send_header_response(r);
 	if (rs == DFS_OK) 
 	{
+	    dn_request_close(r, DN_REQUEST_ERROR_NONE);
+		
 	    return;
 	}
 	else if (rs == DFS_AGAIN) 
@@ -1229,3 +1493,66 @@ static void dn_request_send_read_done_response(dn_request_t *r)
 	dn_request_close(r, DN_REQUEST_ERROR_SPECIAL_RESPONSE);
 }
 
+// the faio thread stamped when the disk part ran
+static void trace_fio_done(dn_request_t *r, file_io_t *fio, int next)
+{
+    if (fio->submit_us && fio->start_us >= fio->submit_us 
+		&& fio->end_us >= fio->start_us) 
+	{
+        dn_trace_stage_at(r, DN_TRACE_DISK, 0, fio->start_us);
+		dn_trace_stage_at(r, next, 0, fio->end_us);
+
+		return;
+	}
+
+	dn_trace_stage(r, next, 0);
+}
+
+static void read_pipe_done(dn_request_t *r, uint32_t err)
+{
+    dn_metrics_t *m = NULL;
+
+	if (err) 
+	{
+        dn_request_close(r, err);
+
+		return;
+	}
+
+	m = dn_metrics_local();
+	if (m) 
+	{
+        m->bytes_read += r->header.len;
+		m->reads_piped++;
+	}
+
+	dn_trace_stage(r, DN_TRACE_DONE, 0);
+	dn_request_read_done_response(r);
+}
+
+// the internal blks are open, the client may send the group
+static void ec_header_done(dn_request_t *r, uint32_t err)
+{
+    if (err) 
+	{
+        dn_request_close(r, err);
+
+		return;
+	}
+
+	dn_request_header_response(r);
+}
+
+static void ec_done(dn_request_t *r, uint32_t err)
+{
+    if (err) 
+	{
+        dn_request_close(r, err);
+
+		return;
+	}
+
+	dn_trace_stage(r, DN_TRACE_DONE, 0);
+	dn_request_write_done_response(r);
+}
+
@@ -6,6 +6,7 @@
 #include "dfs_chain.h"
 #include "cfs_fio.h"
 #include "dfs_task_cmd.h"
+#include "dn_trace.h"
 
 #define CONN_POOL_SZ  4096
 #define CONN_TIME_OUT 60000
@@ -59,9 +60,22 @@ typedef struct dn_request_s
     char                    ipaddr[32];
 	data_transfer_header_t  header; // 头信息
 	int                     store_fd; // 接收时用于存储文件的fd
+	struct dn_fd_ent_s     *fd_ent; // store_fd of a read, from the fd cache
 	uchar_t                *path;
 	long                    done;// 数据完成的长度
 	file_io_t              *fio;
+	struct dn_read_pipe_s  *pipe; // buffered and direct reads only
+	struct dn_ec_s         *ec; // ec group ops only
+	int                     zip; // the blk is stored compressed
+	int                     vol; // storage dir of the blk, -1 if none yet
+	uint64_t                vol_held; // bytes held on vol for the write
+	uint64_t                io_start; // of the faio task in flight, us
+	uint64_t                start_us; // header parsed, 0 if not yet
+	uint64_t                trace_id; // 0 once closed
+	uint64_t                trace_start; // accepted, us
+	uint64_t                trace_ts; // current stage began, us
+	uint32_t                trace_stage;
+	uint32_t                trace_us[DN_TRACE_STAGE_N]; // time per stage
 } dn_request_t;
 
 void dn_conn_init(conn_t *c);
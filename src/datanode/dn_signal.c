@@ -104,6 +104,12 @@ int dn_signal_setup(void)
 	{
         return DFS_ERROR;
     }
+
+    ret = sigaction(SIGNAL_TRACE, &sig_act, NULL);
+    if (ret != DFS_OK) 
+	{
+        return DFS_ERROR;
+    }
  
     return ret;
 }
@@ -162,6 +168,11 @@ static void signal_handler(int sig, siginfo_t *info, void *context)
     case SIGUSR1:
         process_doing |= PROCESS_DOING_BACKUP;
         return;
+
+    // the master passes it on, workers dump their trace rings
+    case SIGNAL_TRACE:
+        process_doing |= PROCESS_DOING_TRACE;
+        return;
 		
     //ignored signals
     case SIGIO:
@@ -190,6 +201,9 @@ static void signal_handler(int sig, siginfo_t *info, void *context)
 		
         break;
     }
+
+    // the flusher thread is gone with the process, write what it holds
+    error_log_async_crash(dfs_cycle->error_log);
    
     sz = backtrace(fun_array, 8192);
     fun_name = backtrace_symbols(fun_array, sz);
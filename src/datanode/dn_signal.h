@@ -6,6 +6,7 @@
 #define SIGNAL_KILL       SIGKILL
 #define SIGNAL_TERMINATE  SIGTERM
 #define SIGNAL_TEST_STORE (__SIGRTMIN + 10)
+#define SIGNAL_TRACE      SIGUSR2
 
 int dn_signal_setup();
 
@@ -0,0 +1,202 @@
+#include <sys/mman.h>
+#include "dn_stats.h"
+#include "dn_conf.h"
+#include "dn_time.h"
+#include "dn_data_storage.h"
+#include "dfs_memory.h"
+#include "dfs_error_log.h"
+#include "faio_manager.h"
+
+extern dfs_thread_t   *woker_threads;
+extern int             woker_num;
+extern faio_manager_t *faio_mgr;
+
+// the layout mirrors the metrics, keep them in step
+typedef char dn_shm_ops_check[DN_SHM_OPS == DN_OP_N ? 1 : -1];
+typedef char dn_shm_errors_check[DN_SHM_ERRORS == METRICS_ERRORS ? 1 : -1];
+
+// mapped by the master before the fork, workers inherit it
+static dn_shm_t *g_stats_shm = NULL;
+
+static void stats_timer_handler(event_t *ev);
+static void stats_publish_thread(dfs_thread_t *thread, dn_shm_thread_t *s);
+static void stats_publish_global(dn_shm_global_t *g);
+
+// dfs_shmem is anonymous, dfsstat needs a file to map
+int dn_stats_master_init(cycle_t *cycle)
+{
+    conf_server_t *sconf = (conf_server_t *)cycle->sconf;
+	char          *path = (char *)sconf->stats_file.data;
+	void          *p = NULL;
+	int            fd = -1;
+
+	fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+	{
+	    dfs_log_error(cycle->error_log, DFS_LOG_WARN, errno,
+			"open stats file %s err, no stats", path);
+
+        return DFS_OK;
+	}
+
+	if (ftruncate(fd, sizeof(dn_shm_t)) != DFS_OK)
+	{
+	    dfs_log_error(cycle->error_log, DFS_LOG_WARN, errno,
+			"ftruncate stats file %s err, no stats", path);
+
+		close(fd);
+
+        return DFS_OK;
+	}
+
+	p = mmap(NULL, sizeof(dn_shm_t), PROT_READ | PROT_WRITE, MAP_SHARED,
+		fd, 0);
+	close(fd);
+
+	if (p == MAP_FAILED)
+	{
+	    dfs_log_error(cycle->error_log, DFS_LOG_WARN, errno,
+			"mmap stats file %s err, no stats", path);
+
+        return DFS_OK;
+	}
+
+	g_stats_shm = (dn_shm_t *)p;
+	g_stats_shm->version = DN_SHM_VERSION;
+	g_stats_shm->size = sizeof(dn_shm_t);
+	g_stats_shm->pid = getpid();
+	g_stats_shm->start_ms = dfs_current_msec;
+	g_stats_shm->threads_n = sconf->worker_n < DN_SHM_THREADS_MAX
+		? sconf->worker_n : DN_SHM_THREADS_MAX;
+	snprintf(g_stats_shm->trace_file, DN_SHM_PATH_MAX, "%s",
+		(char *)sconf->trace_file.data);
+
+	// readers check the magic last
+	__sync_synchronize();
+	g_stats_shm->magic = DN_SHM_MAGIC;
+
+	return DFS_OK;
+}
+
+int dn_stats_master_release(cycle_t *cycle)
+{
+    conf_server_t *sconf = (conf_server_t *)cycle->sconf;
+
+	if (!g_stats_shm)
+	{
+        return DFS_OK;
+	}
+
+	munmap(g_stats_shm, sizeof(dn_shm_t));
+	g_stats_shm = NULL;
+	unlink((char *)sconf->stats_file.data);
+
+	return DFS_OK;
+}
+
+int dn_stats_thread_init(dfs_thread_t *thread)
+{
+    int idx = thread - woker_threads;
+
+	if (!g_stats_shm || idx < 0 || idx >= (int)g_stats_shm->threads_n)
+	{
+        return DFS_OK;
+	}
+
+	memory_zero(&thread->stats_ev, sizeof(event_t));
+	thread->stats_ev.handler = stats_timer_handler;
+	thread->stats_ev.data = thread;
+
+	event_timer_add(&thread->event_timer, &thread->stats_ev,
+		DN_STATS_PUBLISH_MS);
+
+	return DFS_OK;
+}
+
+static void stats_timer_handler(event_t *ev)
+{
+    dfs_thread_t *thread = (dfs_thread_t *)ev->data;
+	int           idx = thread - woker_threads;
+
+	stats_publish_thread(thread, &g_stats_shm->threads[idx]);
+
+	if (!idx)
+	{
+        stats_publish_global(&g_stats_shm->global);
+	}
+
+	event_timer_add(&thread->event_timer, &thread->stats_ev,
+		DN_STATS_PUBLISH_MS);
+}
+
+// copies of what the thread counts anyway, once a second
+static void stats_publish_thread(dfs_thread_t *thread, dn_shm_thread_t *s)
+{
+    dn_metrics_t  *m = thread->metrics;
+	fio_manager_t *mgr = &thread->fio_mgr;
+
+	dn_shm_write_begin(s);
+
+	s->update_ms = dfs_current_msec;
+	s->conns = thread->conn_pool.used_n;
+	s->fio_busy = mgr->busy;
+	s->fio_free = mgr->nelts > mgr->busy ? mgr->nelts - mgr->busy : 0;
+
+	if (m)
+	{
+	    s->bytes_read = m->bytes_read;
+		s->bytes_written = m->bytes_written;
+        memory_memcpy(s->errors, m->errors, sizeof(s->errors));
+		memory_memcpy(s->ops, m->ops, sizeof(s->ops));
+	}
+
+	dn_shm_write_end(s);
+}
+
+static void stats_publish_global(dn_shm_global_t *g)
+{
+    dn_shm_vol_t *sv = NULL;
+	vol_stat_t   *v = NULL;
+	int           n = 0;
+	int           i = 0;
+
+	n = block_volume_num();
+	if (n > DN_SHM_VOLS_MAX)
+	{
+        n = DN_SHM_VOLS_MAX;
+	}
+
+	dn_shm_write_begin(g);
+
+	g->update_ms = dfs_current_msec;
+	g->vols_n = n;
+	g->blk_count = block_object_count();
+
+	if (faio_mgr)
+	{
+	    g->faio_queue = faio_mgr->data_manager.req_queue.size;
+        g->faio_threads = faio_mgr->worker_manager.started;
+		g->faio_idle = faio_mgr->worker_manager.idle;
+	}
+
+	for (i = 0; i < n; i++)
+	{
+	    v = block_volume_stat(i);
+		sv = &g->vols[i];
+
+		vol_stat_refresh(v, DFS_FALSE);
+
+        sv->capacity = v->total;
+		sv->used = v->total > v->avail ? v->total - v->avail : 0;
+		sv->remaining = vol_stat_room(v);
+		sv->io_errors = v->io_errors;
+		sv->chosen = v->chosen;
+		sv->active = v->active;
+		sv->io_pending = v->io_pending;
+		sv->io_lat_us = v->io_lat_us;
+		sv->failed = v->failed;
+	}
+
+	dn_shm_write_end(g);
+}
+
@@ -0,0 +1,16 @@
+#ifndef DN_STATS_H
+#define DN_STATS_H
+
+#include "dn_cycle.h"
+#include "dn_thread.h"
+#include "dn_stats_shm.h"
+
+#define DN_STATS_PUBLISH_MS  1000
+#define DEF_STATS_FILE       "/dev/shm/datanode.stats"
+
+int dn_stats_master_init(cycle_t *cycle);
+int dn_stats_master_release(cycle_t *cycle);
+int dn_stats_thread_init(dfs_thread_t *thread);
+
+#endif
+
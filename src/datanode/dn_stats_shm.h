@@ -0,0 +1,78 @@
+#ifndef DN_STATS_SHM_H
+#define DN_STATS_SHM_H
+
+#include <stdint.h>
+#include "dn_hist.h"
+
+// layout of the stats file the datanode maps shared and dfsstat maps
+// read only. fixed size, any change of it bumps DN_SHM_VERSION
+#define DN_SHM_MAGIC        0x54534644 // "DFST"
+#define DN_SHM_VERSION      2
+#define DN_SHM_THREADS_MAX  64
+#define DN_SHM_VOLS_MAX     32
+#define DN_SHM_OPS          6  // DN_OP_N
+#define DN_SHM_ERRORS       16 // METRICS_ERRORS
+#define DN_SHM_PATH_MAX     256
+
+// every section has its own writer. seq is odd while it writes, a
+// reader copies the section and retries if seq was odd or moved
+#define dn_shm_write_begin(s)  do { (s)->seq++; __sync_synchronize(); } while (0)
+#define dn_shm_write_end(s)    do { __sync_synchronize(); (s)->seq++; } while (0)
+
+typedef struct dn_shm_vol_s
+{
+    uint64_t capacity;
+	uint64_t used;
+	uint64_t remaining;
+	uint64_t io_errors;
+	uint64_t chosen;     // new blks placed here
+	uint32_t active;     // requests reading or writing
+	uint32_t io_pending; // faio tasks queued or running
+	uint32_t io_lat_us;
+	uint32_t failed;
+} dn_shm_vol_t;
+
+// written by worker thread 0
+typedef struct dn_shm_global_s
+{
+    volatile uint32_t seq;
+	uint32_t          vols_n;
+	uint64_t          update_ms; // wall clock
+	uint64_t          blk_count;
+	uint64_t          faio_queue;
+	uint32_t          faio_threads;
+	uint32_t          faio_idle;
+	dn_shm_vol_t      vols[DN_SHM_VOLS_MAX];
+} dn_shm_global_t;
+
+// written by its worker thread, counters since the worker started
+typedef struct dn_shm_thread_s
+{
+    volatile uint32_t seq;
+	uint32_t          pad;
+	uint64_t          update_ms;
+	uint64_t          conns;
+	uint64_t          fio_busy;
+	uint64_t          fio_free;
+	uint64_t          bytes_read;
+	uint64_t          bytes_written;
+	uint64_t          errors[DN_SHM_OPS][DN_SHM_ERRORS];
+	dn_hist_t         ops[DN_SHM_OPS];
+} dn_shm_thread_t;
+
+typedef struct dn_shm_s
+{
+    uint32_t        magic;
+	uint32_t        version;
+	uint32_t        size;      // sizeof(dn_shm_t)
+	uint32_t        pid;       // of the master
+	uint64_t        start_ms;  // wall clock
+	uint32_t        threads_n;
+	uint32_t        pad;
+	char            trace_file[DN_SHM_PATH_MAX]; // SIGUSR2 to pid dumps it
+	dn_shm_global_t global;
+	dn_shm_thread_t threads[DN_SHM_THREADS_MAX];
+} dn_shm_t;
+
+#endif
+
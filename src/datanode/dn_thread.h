@@ -10,6 +10,10 @@
 #include "dfs_notice.h"
 #include "dn_cycle.h"
 #include "cfs.h"
+#include "dn_blk_report.h"
+#include "dn_ns_client.h"
+#include "dn_metrics.h"
+#include "dn_trace.h"
 
 typedef void *(*TREAD_FUNC)(void *);
 typedef struct dfs_thread_s dfs_thread_t;
@@ -19,7 +23,18 @@ typedef struct ns_srv_info_s
     char    ip[32];
 	int     port;
     int64_t namespaceID;
-	int     sockfd;
+	int                 registered;
+	int                 wire_ver;      // TASK_V1 until DN_REGISTER says more
+	ns_lane_t           lanes[NS_LANE_N];
+	notice_t            notice;        // new blk events for this namenode
+	event_t             hb_ev;
+	event_t             flush_ev;      // closes the increment window
+	uint32_t            report_req;    // full report requests served
+	int                 report_full;   // a full report is due
+	blk_report_cursor_t report_cursor; // survives a reconnect
+	uint32_t            report_seq;    // of the next chunk posted
+	queue_t             report_chunks; // built, not posted yet
+	blk_report_incr_t   incr_report;
 } ns_srv_info_t;
 
 struct dfs_thread_s 
@@ -38,6 +53,10 @@ struct dfs_thread_s
 	faio_notifier_manager_t faio_notify;
 	io_event_t              io_events;
 	fio_manager_t           fio_mgr;
+	dn_metrics_t           *metrics; // worker threads only
+	event_t                 stats_ev; // publishes to the stats file
+	dn_trace_ring_t        *trace; // worker threads only
+	event_t                 trace_ev; // watches for the dump signal
 };
 
 enum 
@@ -0,0 +1,478 @@
+#include <stdio.h>
+#include "dn_trace.h"
+#include "dn_thread.h"
+#include "dn_request.h"
+#include "dn_process.h"
+#include "dn_conf.h"
+#include "dn_time.h"
+#include "dfs_memory.h"
+#include "dfs_error_log.h"
+#include "dfs_task_cmd.h"
+#include "cfs.h"
+
+extern dfs_thread_t *woker_threads;
+extern int           woker_num;
+extern uint32_t      process_doing;
+
+static char *stage_names[DN_TRACE_STAGE_N + 1] = { "header", "open",
+	"response", "fio wait", "recv", "faio queue", "disk", "send blocked",
+	"finalize", "done", "close" };
+
+// indexed by op_type - OP_WRITE_BLOCK
+static char *op_names[] = { "write", "read", "read meta", "replace",
+	"copy", "checksum", "read accel", "ec write", "ec rebuild" };
+
+static int trace_dumping = DFS_FALSE; // worker 0 only
+
+static void trace_push(dn_request_t *r, int stage, uint32_t arg,
+	uint64_t ts);
+static void trace_check_handler(event_t *ev);
+static ssize_t trace_dump_work(file_io_t *fio);
+static int  trace_dump_done(void *data, void *arg);
+static char *trace_op_name(uint16_t op);
+static void trace_slow_log(dn_request_t *r, uint64_t total);
+static int  trace_snapshot(dn_trace_ring_t *ring, dn_trace_rec_t *out);
+static void trace_write_thread(FILE *fp, int tid, dn_trace_rec_t *recs,
+	int n, uint32_t *map, uint32_t map_mask, int *first);
+
+int dn_trace_thread_init(dfs_thread_t *thread)
+{
+    conf_server_t   *sconf = (conf_server_t *)dfs_cycle->sconf;
+	dn_trace_ring_t *ring = NULL;
+	uint64_t         size = 1;
+	int              idx = thread - woker_threads;
+
+	if (idx < 0 || idx >= woker_num)
+	{
+        return DFS_OK;
+	}
+
+	while (size < sconf->trace_ring_size)
+	{
+        size <<= 1;
+	}
+
+	ring = (dn_trace_ring_t *)memory_calloc(sizeof(dn_trace_ring_t));
+	if (!ring)
+	{
+	    dfs_log_error(dfs_cycle->error_log, DFS_LOG_ALERT, errno,
+			"calloc trace ring err");
+
+        return DFS_ERROR;
+	}
+
+	ring->recs = (dn_trace_rec_t *)memory_calloc(size
+		* sizeof(dn_trace_rec_t));
+	if (!ring->recs)
+	{
+	    dfs_log_error(dfs_cycle->error_log, DFS_LOG_ALERT, errno,
+			"calloc trace ring of %uL records err", size);
+		memory_free(ring, sizeof(dn_trace_ring_t));
+
+        return DFS_ERROR;
+	}
+
+	ring->mask = size - 1;
+	ring->index = idx;
+	thread->trace = ring;
+
+	// one thread watches for the dump signal
+	if (!idx)
+	{
+	    memory_zero(&thread->trace_ev, sizeof(event_t));
+		thread->trace_ev.handler = trace_check_handler;
+		thread->trace_ev.data = thread;
+
+		event_timer_add(&thread->event_timer, &thread->trace_ev,
+			DN_TRACE_CHECK_MS);
+	}
+
+	return DFS_OK;
+}
+
+int dn_trace_thread_release(dfs_thread_t *thread)
+{
+    dn_trace_ring_t *ring = thread->trace;
+
+	if (!ring)
+	{
+        return DFS_OK;
+	}
+
+	thread->trace = NULL;
+	memory_free(ring->recs, (ring->mask + 1) * sizeof(dn_trace_rec_t));
+	memory_free(ring, sizeof(dn_trace_ring_t));
+
+	return DFS_OK;
+}
+
+// the dump itself runs on a faio thread, a signal that comes while one
+// is running waits for it
+static void trace_check_handler(event_t *ev)
+{
+    dfs_thread_t *thread = (dfs_thread_t *)ev->data;
+	file_io_t    *fio = NULL;
+
+	if ((process_doing & PROCESS_DOING_TRACE) && !trace_dumping)
+	{
+	    fio = cfs_fio_manager_alloc(&thread->fio_mgr);
+	}
+
+	if (fio)
+	{
+	    fio->work = trace_dump_work;
+		fio->event = AIO_WRITE_EV;
+		fio->need = 0;
+		fio->data = NULL;
+		fio->h = trace_dump_done;
+		fio->io_event = &thread->io_events;
+		fio->faio_noty = &thread->faio_notify;
+		fio->faio_ret = DFS_ERROR;
+
+		if (cfs_write((cfs_t *)dfs_cycle->cfs, fio, dfs_cycle->error_log)
+			== DFS_OK)
+		{
+		    __sync_fetch_and_and(&process_doing, ~PROCESS_DOING_TRACE);
+            trace_dumping = DFS_TRUE;
+		}
+		else
+		{
+            cfs_fio_manager_free(fio, &thread->fio_mgr);
+		}
+	}
+
+	event_timer_add(&thread->event_timer, &thread->trace_ev,
+		DN_TRACE_CHECK_MS);
+}
+
+// on a faio thread
+static ssize_t trace_dump_work(file_io_t *fio)
+{
+    conf_server_t *sconf = (conf_server_t *)dfs_cycle->sconf;
+
+	return dn_trace_dump((char *)sconf->trace_file.data) == DFS_OK ? 1 : 0;
+}
+
+static int trace_dump_done(void *data, void *arg)
+{
+    file_io_t *fio = (file_io_t *)arg;
+
+	trace_dumping = DFS_FALSE;
+	cfs_fio_manager_free(fio, &get_local_thread()->fio_mgr);
+
+	return DFS_OK;
+}
+
+static char *trace_op_name(uint16_t op)
+{
+    if (op < OP_WRITE_BLOCK || op > OP_EC_RECONSTRUCT)
+	{
+        return "other";
+	}
+
+	return op_names[op - OP_WRITE_BLOCK];
+}
+
+// single writer, the record is complete before head moves past it
+static void trace_push(dn_request_t *r, int stage, uint32_t arg,
+	uint64_t ts)
+{
+    dfs_thread_t    *thread = get_local_thread();
+	dn_trace_ring_t *ring = thread ? thread->trace : NULL;
+	dn_trace_rec_t  *rec = NULL;
+	uint64_t         head = 0;
+
+	if (!ring)
+	{
+        return;
+	}
+
+	head = ring->head;
+	rec = &ring->recs[head & ring->mask];
+
+	rec->ts_us = ts;
+	rec->req = r->trace_id;
+	rec->blk_id = r->header.block_id;
+	rec->stage = stage;
+	rec->op = r->header.op_type;
+	rec->arg = arg;
+
+	__atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+void dn_trace_begin(dn_request_t *r)
+{
+    dfs_thread_t    *thread = get_local_thread();
+	dn_trace_ring_t *ring = thread ? thread->trace : NULL;
+	uint64_t         now = time_monotonic_us();
+
+	r->trace_id = ring ? ((uint64_t)ring->index << 48) | ++ring->seq : 1;
+	r->trace_start = now;
+	r->trace_ts = now;
+	r->trace_stage = DN_TRACE_HEADER;
+	memory_zero(r->trace_us, sizeof(r->trace_us));
+
+	trace_push(r, DN_TRACE_HEADER, 0, now);
+}
+
+void dn_trace_stage(dn_request_t *r, int stage, uint32_t arg)
+{
+    dn_trace_stage_at(r, stage, arg, time_monotonic_us());
+}
+
+// ts may come from another thread, e.g. when a faio task started
+void dn_trace_stage_at(dn_request_t *r, int stage, uint32_t arg,
+	uint64_t ts)
+{
+    if (!r->trace_id)
+	{
+        return;
+	}
+
+	if (ts < r->trace_ts)
+	{
+        ts = r->trace_ts;
+	}
+
+	r->trace_us[r->trace_stage] += ts - r->trace_ts;
+	r->trace_stage = stage;
+	r->trace_ts = ts;
+
+	trace_push(r, stage, arg, ts);
+}
+
+void dn_trace_end(dn_request_t *r, uint32_t err)
+{
+    conf_server_t *sconf = (conf_server_t *)dfs_cycle->sconf;
+	uint64_t       total = 0;
+
+	if (!r->trace_id)
+	{
+        return;
+	}
+
+	dn_trace_stage(r, DN_TRACE_CLOSE, err);
+	total = r->trace_ts - r->trace_start;
+
+	if (total >= (uint64_t)sconf->slow_request_ms * 1000)
+	{
+        trace_slow_log(r, total);
+	}
+
+	r->trace_id = 0;
+}
+
+static void trace_slow_log(dn_request_t *r, uint64_t total)
+{
+    char *p = NULL;
+	char *last = NULL;
+	char  buf[512];
+	int   i = 0;
+
+	p = buf;
+	last = buf + sizeof(buf);
+	buf[0] = '\0';
+
+	for (i = 0; i < DN_TRACE_STAGE_N && p < last; i++)
+	{
+	    if (!r->trace_us[i])
+		{
+            continue;
+		}
+
+		p += snprintf(p, last - p, ", %s %u", stage_names[i],
+			r->trace_us[i]);
+	}
+
+	dfs_log_error(dfs_cycle->error_log, DFS_LOG_WARN, 0,
+		"slow request %s blk %uL from %s, %uL us%s",
+		trace_op_name(r->header.op_type),
+		r->header.block_id, r->ipaddr, total, buf);
+}
+
+// copies what can be trusted, the writer may lap us meanwhile
+static int trace_snapshot(dn_trace_ring_t *ring, dn_trace_rec_t *out)
+{
+    uint64_t size = ring->mask + 1;
+	uint64_t head = 0;
+	uint64_t start = 0;
+	uint64_t valid = 0;
+	uint64_t i = 0;
+
+	head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+	start = head > size ? head - size : 0;
+
+	for (i = start; i < head; i++)
+	{
+        out[i - start] = ring->recs[i & ring->mask];
+	}
+
+	// the slot of index h - size is the one being written now
+	head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+	valid = head >= size ? head - size + 1 : 0;
+
+	if (valid <= start)
+	{
+        return i - start;
+	}
+
+	if (valid >= i)
+	{
+        return 0;
+	}
+
+	memmove(out, out + (valid - start), (i - valid) * sizeof(dn_trace_rec_t));
+
+	return i - valid;
+}
+
+// a stage becomes a complete event when the next record of its request
+// shows up, stages still running end up as instant events
+static void trace_write_thread(FILE *fp, int tid, dn_trace_rec_t *recs,
+	int n, uint32_t *map, uint32_t map_mask, int *first)
+{
+    dn_trace_rec_t *rec = NULL;
+	dn_trace_rec_t *prev = NULL;
+	uint32_t        slot = 0;
+	int             pid = getpid();
+	int             i = 0;
+
+	memory_zero(map, (map_mask + 1) * sizeof(uint32_t));
+
+	fprintf(fp, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,"
+		"\"tid\":%d,\"args\":{\"name\":\"worker %d\"}}",
+		*first ? "" : ",\n", pid, tid, tid);
+	*first = DFS_FALSE;
+
+	for (i = 0; i < n; i++)
+	{
+	    rec = &recs[i];
+		slot = (uint32_t)(rec->req * 0x9E3779B97F4A7C15ULL >> 32) & map_mask;
+
+		// map holds index + 1 of the last record of a request
+		while (map[slot] && recs[map[slot] - 1].req != rec->req)
+		{
+            slot = (slot + 1) & map_mask;
+		}
+
+		if (map[slot])
+		{
+		    prev = &recs[map[slot] - 1];
+
+			fprintf(fp, ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\","
+				"\"ts\":%lu,\"dur\":%lu,\"pid\":%d,\"tid\":%d,\"args\":"
+				"{\"req\":%lu,\"blk\":%lu,\"arg\":%u}}",
+				stage_names[prev->stage],
+				trace_op_name(rec->op),
+				(unsigned long)prev->ts_us,
+				(unsigned long)(rec->ts_us - prev->ts_us), pid, tid,
+				(unsigned long)prev->req, (unsigned long)prev->blk_id,
+				prev->arg);
+		}
+
+		map[slot] = i + 1;
+	}
+
+	for (slot = 0; slot <= map_mask; slot++)
+	{
+	    if (!map[slot] || recs[map[slot] - 1].stage == DN_TRACE_CLOSE)
+		{
+            continue;
+		}
+
+		rec = &recs[map[slot] - 1];
+
+		fprintf(fp, ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"i\","
+			"\"s\":\"t\",\"ts\":%lu,\"pid\":%d,\"tid\":%d,\"args\":"
+			"{\"req\":%lu,\"blk\":%lu,\"arg\":%u}}",
+			stage_names[rec->stage],
+			trace_op_name(rec->op),
+			(unsigned long)rec->ts_us, pid, tid, (unsigned long)rec->req,
+			(unsigned long)rec->blk_id, rec->arg);
+	}
+}
+
+// chrome trace json of every worker ring, loads in perfetto too
+int dn_trace_dump(char *path)
+{
+    dn_trace_ring_t *ring = NULL;
+	dn_trace_rec_t  *recs = NULL;
+	uint32_t        *map = NULL;
+	FILE            *fp = NULL;
+	uint64_t         size = 0;
+	uint64_t         total = 0;
+	char             tmp[PATH_MAX];
+	int              first = DFS_TRUE;
+	int              n = 0;
+	int              i = 0;
+
+	for (i = 0; i < woker_num; i++)
+	{
+	    if (woker_threads[i].trace
+			&& woker_threads[i].trace->mask + 1 > size)
+		{
+            size = woker_threads[i].trace->mask + 1;
+		}
+	}
+
+	if (!size)
+	{
+        return DFS_ERROR;
+	}
+
+	recs = (dn_trace_rec_t *)memory_alloc(size * sizeof(dn_trace_rec_t));
+	map = (uint32_t *)memory_alloc(2 * size * sizeof(uint32_t));
+	snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+	fp = recs && map ? fopen(tmp, "w") : NULL;
+
+	if (!fp)
+	{
+	    dfs_log_error(dfs_cycle->error_log, DFS_LOG_ERROR, errno,
+			"dump trace to %s err", tmp);
+
+		goto out;
+	}
+
+	fprintf(fp, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+
+	for (i = 0; i < woker_num; i++)
+	{
+	    ring = woker_threads[i].trace;
+		if (!ring)
+		{
+            continue;
+		}
+
+		n = trace_snapshot(ring, recs);
+		trace_write_thread(fp, i, recs, n, map, 2 * size - 1, &first);
+		total += n;
+	}
+
+	fprintf(fp, "\n]}\n");
+
+	if (fclose(fp) != 0 || rename(tmp, path) != DFS_OK)
+	{
+	    dfs_log_error(dfs_cycle->error_log, DFS_LOG_ERROR, errno,
+			"write trace %s err", path);
+		unlink(tmp);
+
+		goto out;
+	}
+
+	dfs_log_error(dfs_cycle->error_log, DFS_LOG_INFO, 0,
+		"trace of %uL records dumped to %s", total, path);
+
+out:
+	if (recs)
+	{
+        memory_free(recs, size * sizeof(dn_trace_rec_t));
+	}
+
+	if (map)
+	{
+        memory_free(map, 2 * size * sizeof(uint32_t));
+	}
+
+	return total ? DFS_OK : DFS_ERROR;
+}
+
@@ -0,0 +1,61 @@
+#ifndef DN_TRACE_H
+#define DN_TRACE_H
+
+#include "dfs_types.h"
+
+// stages of a request, each one lasts until the next one starts
+enum
+{
+    DN_TRACE_HEADER = 0,    // accepted, waiting for the header
+	DN_TRACE_OPEN,          // blk lookup, volume, open
+	DN_TRACE_RESPONSE,      // sending the header response
+	DN_TRACE_FIO_WAIT,      // no free fio, waiting on the alloc timer
+	DN_TRACE_RECV,          // reading blk data from the socket
+	DN_TRACE_FAIO_QUEUE,    // queued for a faio thread
+	DN_TRACE_DISK,          // pwrite or sendfile, inline or in a faio thread
+	DN_TRACE_SEND_BLOCKED,  // sendfile hit EAGAIN, waiting for the socket
+	DN_TRACE_FINALIZE,      // rename and index of a written blk
+	DN_TRACE_DONE,          // done response
+	DN_TRACE_STAGE_N,
+	DN_TRACE_CLOSE = DN_TRACE_STAGE_N // last record of a request
+};
+
+// fixed size, written by its own thread only
+typedef struct dn_trace_rec_s
+{
+    uint64_t ts_us;  // time_monotonic_us
+	uint64_t req;    // thread index << 48 | sequence
+	uint64_t blk_id;
+	uint16_t stage;
+	uint16_t op;
+	uint32_t arg;    // bytes for io stages, the error on close
+} dn_trace_rec_t;
+
+typedef struct dn_trace_ring_s
+{
+    volatile uint64_t head; // records ever written
+	uint64_t          mask;
+	uint64_t          seq;
+	int               index;
+	dn_trace_rec_t   *recs;
+} dn_trace_ring_t;
+
+struct dfs_thread_s;
+struct dn_request_s;
+
+int  dn_trace_thread_init(struct dfs_thread_s *thread);
+int  dn_trace_thread_release(struct dfs_thread_s *thread);
+void dn_trace_begin(struct dn_request_s *r);
+void dn_trace_stage(struct dn_request_s *r, int stage, uint32_t arg);
+void dn_trace_stage_at(struct dn_request_s *r, int stage, uint32_t arg,
+	uint64_t ts);
+void dn_trace_end(struct dn_request_s *r, uint32_t err);
+int  dn_trace_dump(char *path);
+
+#define DEF_TRACE_RING_SIZE   4096 // records per thread
+#define DEF_SLOW_REQUEST_MS   1000
+#define DEF_TRACE_FILE        "/tmp/datanode.trace.json"
+#define DN_TRACE_CHECK_MS     200
+
+#endif
+
@@ -0,0 +1,272 @@
+#include <sys/statvfs.h>
+#include "dn_vol_policy.h"
+#include "dfs_lock.h"
+#include "dfs_error_log.h"
+#include "dn_cycle.h"
+#include "dn_time.h"
+
+static int               g_vol_policy = VOL_POLICY_SPACE;
+static uint64_t          g_vol_min_free = DEF_VOL_RESERVED;
+static volatile uint64_t g_vol_seq = 0;
+
+static uint64_t vol_room(vol_stat_t *v);
+static int vol_choose_space(vol_stat_t **vols, int n, uint64_t len);
+static int vol_choose_inflight(vol_stat_t **vols, int n, uint64_t len);
+static int vol_choose_rr(vol_stat_t **vols, int n, uint64_t len);
+
+int vol_policy_init(int policy, uint64_t min_free)
+{
+    char *names[] = { "", "space", "inflight", "round robin" };
+
+    if (policy < VOL_POLICY_SPACE || policy > VOL_POLICY_RR)
+	{
+        policy = VOL_POLICY_SPACE;
+	}
+
+	g_vol_policy = policy;
+	g_vol_min_free = min_free;
+
+	dfs_log_error(dfs_cycle->error_log, DFS_LOG_INFO, 0,
+		"volume choosing policy: %s, reserved: %uL", names[policy], min_free);
+
+	return DFS_OK;
+}
+
+// free space not promised to anyone yet. reserved counts the full
+// length of a blk until it is done, so it is conservative
+static uint64_t vol_room(vol_stat_t *v)
+{
+    uint64_t used = v->reserved + g_vol_min_free;
+
+	if (v->failed)
+	{
+        return 0;
+	}
+
+	return v->avail > used ? v->avail - used : 0;
+}
+
+uint64_t vol_stat_room(vol_stat_t *v)
+{
+    return vol_room(v);
+}
+
+// returns the start time to hand back to vol_io_end
+uint64_t vol_io_begin(vol_stat_t *v)
+{
+    __sync_fetch_and_add(&v->io_pending, 1);
+
+	return time_monotonic_us();
+}
+
+void vol_io_end(vol_stat_t *v, uint64_t start, int ok)
+{
+    uint64_t lat = time_monotonic_us() - start;
+	uint32_t avg = v->io_lat_us;
+
+	__sync_fetch_and_sub(&v->io_pending, 1);
+
+	if (!ok)
+	{
+        __sync_fetch_and_add(&v->io_errors, 1);
+	}
+
+	// 1/8 weight, racing updates only lose a sample
+	v->io_lat_us = avg ? avg - (avg >> 3) + (uint32_t)(lat >> 3) 
+		: (uint32_t)lat;
+}
+
+// statvfs at most once per VOL_STATFS_CACHE_MS, by whoever sees it stale
+void vol_stat_refresh(vol_stat_t *v, int force)
+{
+    struct statvfs st;
+
+	if (!force && dfs_current_msec - v->stat_ms < VOL_STATFS_CACHE_MS)
+	{
+        return;
+	}
+
+	if (!CAS(&v->refreshing, 0, 1))
+	{
+        return;
+	}
+
+	if (statvfs(v->path, &st) == DFS_OK)
+	{
+        v->avail = (uint64_t)st.f_bavail * st.f_frsize;
+		v->total = (uint64_t)st.f_blocks * st.f_frsize;
+		v->failed = DFS_FALSE;
+	}
+	else
+	{
+	    dfs_log_error(dfs_cycle->error_log, DFS_LOG_ERROR, errno,
+			"statvfs %s err", v->path);
+
+		v->avail = 0;
+		v->failed = DFS_TRUE;
+	}
+
+	v->stat_ms = dfs_current_msec;
+	v->refreshing = 0;
+}
+
+void vol_stat_hold(vol_stat_t *v, uint64_t len)
+{
+    __sync_fetch_and_add(&v->reserved, len);
+	__sync_fetch_and_add(&v->active, 1);
+}
+
+void vol_stat_unhold(vol_stat_t *v, uint64_t len)
+{
+    __sync_fetch_and_sub(&v->reserved, len);
+	__sync_fetch_and_sub(&v->active, 1);
+}
+
+// the vol index for a new blk of len bytes, DFS_ERROR if none has room.
+// the space is held on the chosen vol until vol_stat_unhold
+int vol_choose(vol_stat_t **vols, int n, uint64_t len)
+{
+    int i = 0;
+	int vol = DFS_ERROR;
+
+	for (i = 0; i < n; i++)
+	{
+        vol_stat_refresh(vols[i], DFS_FALSE);
+	}
+
+	switch (g_vol_policy)
+	{
+	case VOL_POLICY_INFLIGHT:
+		vol = vol_choose_inflight(vols, n, len);
+		break;
+
+	case VOL_POLICY_RR:
+		vol = vol_choose_rr(vols, n, len);
+		break;
+
+	default:
+		vol = vol_choose_space(vols, n, len);
+		break;
+	}
+
+	if (vol == DFS_ERROR)
+	{
+	    dfs_log_error(dfs_cycle->error_log, DFS_LOG_ERROR, 0,
+			"no volume has room for %uL bytes", len);
+
+        return DFS_ERROR;
+	}
+
+	vol_stat_hold(vols[vol], len);
+	__sync_fetch_and_add(&vols[vol]->chosen, 1);
+
+	return vol;
+}
+
+// a fuller disk is picked less often, but still picked
+static int vol_choose_space(vol_stat_t **vols, int n, uint64_t len)
+{
+    uint64_t sum = 0;
+	uint64_t room = 0;
+	uint64_t r = 0;
+	int      i = 0;
+
+	for (i = 0; i < n; i++)
+	{
+	    room = vol_room(vols[i]);
+        if (room >= len)
+		{
+            sum += room;
+		}
+	}
+
+	if (!sum)
+	{
+        return DFS_ERROR;
+	}
+
+	// fibonacci hashing of a counter spreads well enough
+	r = __sync_fetch_and_add(&g_vol_seq, 1) * 0x9E3779B97F4A7C15ULL;
+	r = (r >> 16) % sum;
+
+	for (i = 0; i < n; i++)
+	{
+	    room = vol_room(vols[i]);
+        if (room < len)
+		{
+            continue;
+		}
+
+		if (r < room)
+		{
+            return i;
+		}
+
+		r -= room;
+	}
+
+	// room changed under us
+	for (i = n - 1; i >= 0; i--)
+	{
+        if (vol_room(vols[i]) >= len)
+		{
+            return i;
+		}
+	}
+
+	return DFS_ERROR;
+}
+
+// a slow or busy disk keeps more io queued and gets skipped
+static int vol_choose_inflight(vol_stat_t **vols, int n, uint64_t len)
+{
+    uint64_t load = 0;
+	uint64_t best_load = 0;
+	uint64_t room = 0;
+	uint64_t best_room = 0;
+	int      best = DFS_ERROR;
+	int      i = 0;
+
+	for (i = 0; i < n; i++)
+	{
+	    room = vol_room(vols[i]);
+        if (room < len)
+		{
+            continue;
+		}
+
+		load = (uint64_t)vols[i]->io_pending + vols[i]->active;
+
+		if (best == DFS_ERROR || load < best_load
+			|| (load == best_load && room > best_room))
+		{
+            best = i;
+			best_load = load;
+			best_room = room;
+		}
+	}
+
+	return best;
+}
+
+static int vol_choose_rr(vol_stat_t **vols, int n, uint64_t len)
+{
+    uint64_t start = 0;
+	int      i = 0;
+	int      vol = 0;
+
+	start = __sync_fetch_and_add(&g_vol_seq, 1);
+
+	for (i = 0; i < n; i++)
+	{
+	    vol = (start + i) % n;
+
+		if (vol_room(vols[vol]) >= len)
+		{
+            return vol;
+		}
+	}
+
+	return DFS_ERROR;
+}
+
@@ -0,0 +1,42 @@
+#ifndef DN_VOL_POLICY_H
+#define DN_VOL_POLICY_H
+
+#include "dfs_types.h"
+
+// volume choosing policies for new blks
+#define VOL_POLICY_SPACE     1 // weighted by available space
+#define VOL_POLICY_INFLIGHT  2 // least in flight io
+#define VOL_POLICY_RR        3 // round robin over volumes with room
+
+#define VOL_STATFS_CACHE_MS  1000
+#define DEF_VOL_RESERVED     (1024LL * 1024 * 1024) // kept free on every volume
+
+// what the policies know about one volume, updated without locks
+typedef struct vol_stat_s
+{
+    int               id;
+	char             *path;
+	volatile uint64_t avail;      // statvfs, cached
+	volatile uint64_t total;
+	volatile uint64_t stat_ms;
+	volatile uint32_t refreshing;
+	volatile uint64_t reserved;   // bytes promised to blks being written
+	volatile uint32_t active;     // requests reading or writing a blk
+	volatile uint32_t io_pending; // faio tasks queued or running
+	volatile uint32_t io_lat_us;  // moving average of the faio tasks
+	volatile uint64_t io_errors;
+	volatile uint32_t failed;     // statvfs or io failed, no new blks
+	volatile uint64_t chosen;
+} vol_stat_t;
+
+int  vol_policy_init(int policy, uint64_t min_free);
+int  vol_choose(vol_stat_t **vols, int n, uint64_t len);
+void vol_stat_refresh(vol_stat_t *v, int force);
+void vol_stat_hold(vol_stat_t *v, uint64_t len);
+void vol_stat_unhold(vol_stat_t *v, uint64_t len);
+uint64_t vol_stat_room(vol_stat_t *v);
+uint64_t vol_io_begin(vol_stat_t *v);
+void vol_io_end(vol_stat_t *v, uint64_t start, int ok);
+
+#endif
+
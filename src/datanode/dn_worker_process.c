@@ -56,6 +56,7 @@ static void *thread_ns_service_cycle(void * args);
 static void stop_ns_service_thread();
 static void dio_event_handler(event_t * ev);
 static int create_data_blk_scanner(cycle_t *cycle);
+static int create_vol_stat_refresher(cycle_t *cycle);
 
 static int thread_setup(dfs_thread_t *thread, int type)
 {
@@ -217,6 +218,14 @@ void worker_processer(cycle_t *cycle, void *data)
 		
         exit(PROCESS_FATAL_EXIT);
 	}
+
+	if (create_vol_stat_refresher(cycle) != DFS_OK) 
+	{
+        dfs_log_error(cycle->error_log, DFS_LOG_ALERT, errno, 
+            "create_vol_stat_refresher failed");
+		
+        exit(PROCESS_FATAL_EXIT);
+	}
     //创建worker线程
     //处理posted events？
     if (create_worker_thread(cycle) != DFS_OK)
@@ -594,6 +603,21 @@ static int create_ns_service_thread(cycle_t *cycle)
         // namenode 的run func
 		ns_service_threads[i].run_func = thread_ns_service_cycle;
 
+		// its own event loop and namenode lanes
+		if (ns_service_init(&ns_service_threads[i]) != DFS_OK) 
+		{
+		    dfs_log_error(cycle->error_log, DFS_LOG_FATAL, 0, 
+				"ns_service_init err");
+			
+            return DFS_ERROR;
+		}
+
+		// its own copy of the incremental blk reports
+		if (blk_report_queue_register(&ns_service_threads[i]) != DFS_OK) 
+		{
+            return DFS_ERROR;
+		}
+
         ns_service_threads[i].running = DFS_TRUE;
         ns_service_threads[i].state = THREAD_ST_UNSTART;
 		// 线程创建之后运行 thread_ns_service_cycle，参数是thread 本身
@@ -659,21 +683,16 @@ static void *thread_ns_service_cycle(void * args)
     //
     register_thread_initialized();
 
+    // 连接上 namenode 获取 namespaceid, then heartbeats and blk reports
+    ns_service_start(me);
+
     while (me->running) 
 	{
-        // 连接上 namenode 获取 namespaceid
-        if (dn_register(me) != DFS_OK) 
-		{
-            sleep(1);
-
-			continue;
-		}
-		// 检查 version namespace id ，创建子文件夹
-		setup_ns_storage(me);
-        // namenode 上报 receivedblock_report、 block_report
-		offer_service(me);
+        thread_event_process(me);
     }
 
+	ns_service_stop(me);
+
 	register_thread_exit();
     me->state = THREAD_ST_EXIT;
 	
@@ -704,3 +723,20 @@ static int create_data_blk_scanner(cycle_t *cycle)
     return DFS_OK;
 }
 
+// keeps the volume space fresh for heartbeats and the volume policy
+static int create_vol_stat_refresher(cycle_t *cycle)
+{
+    pthread_t pid;
+
+	if (pthread_create(&pid, NULL, &vol_stat_refresher_start, NULL) 
+		!= DFS_OK) 
+    {
+	    dfs_log_error(dfs_cycle->error_log, DFS_LOG_ALERT, errno, 
+			"create vol_stat_refresher thread failed");
+
+		return DFS_ERROR;
+	}
+
+    return DFS_OK;
+}
+
@@ -0,0 +1,1458 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include "dfs_types.h"
+#include "dfs_error_log.h"
+#include "dfs_memory.h"
+#include "dfs_memory_pool.h"
+#include "dfs_hashtable.h"
+#include "dfs_mblks.h"
+#include "dfs_mem_allocator.h"
+#include "dfs_shmem_allocator.h"
+#include "dfs_shmem.h"
+#include "dfs_slabs.h"
+#include "dfs_lock.h"
+#include "dfs_event.h"
+#include "dfs_event_timer.h"
+#include "dfs_buffer.h"
+#include "dfs_chain.h"
+#include "dfs_conn.h"
+#include "dfs_sysio.h"
+#include "dfs_time.h"
+#include "dfs_lz.h"
+#include "dfs_gf.h"
+#include "dfs_rs.h"
+
+// microbenchmarks of the src/core primitives. every scenario runs -r
+// times, the median ns/op counts. allocations are counted by wrapping
+// malloc, cache misses come from perf_event_open when the kernel allows
+
+#define BENCH_OPS          1000000
+#define BENCH_REPS         5
+#define BENCH_THREADS      4
+#define BENCH_THREADS_MAX  64
+#define BENCH_REPS_MAX     32
+#define BENCH_THRESHOLD    10.0 // % slower than the baseline
+#define BENCH_NAME_LEN     32
+#define BENCH_BASE_MAX     128
+
+#define HT_KEYS            65536
+#define WINDOW             64   // blocks held at once by the alloc scenarios
+#define MBLKS_COUNT        4096
+#define SHMEM_SIZE         (64 << 20)
+#define TIMERS             4096
+#define CHAIN_BUFS         8
+#define CHAIN_BUF_SIZE     4096
+#define POOL_RESET_OPS     256
+#define LZ_CHUNK           (64 * 1024) // the unit compressed blks are stored in
+#define RS_K               6
+#define RS_M               3
+#define RS_CELL            (64 * 1024)
+
+typedef struct bench_thread_s
+{
+    int       index;
+	uint64_t  rnd;
+	uint64_t  ns;
+	uint64_t  allocs;
+	int64_t   misses;  // -1 when perf is not available
+	void     *priv;
+	uint64_t  sink;
+} bench_thread_t;
+
+typedef struct bench_s
+{
+    char  *name;
+	int    mt;    // runs on -t threads, else on one
+	int    div;   // ops are -n / div, for the slow ones
+	int  (*init)(int threads);
+	void (*release)(void);
+	int  (*thread_init)(bench_thread_t *t);
+	void (*thread_release)(bench_thread_t *t);
+	void (*run)(bench_thread_t *t, uint64_t n);
+} bench_t;
+
+typedef struct bench_result_s
+{
+    char    name[BENCH_NAME_LEN];
+	int     threads;
+	double  ns_op;
+	double  mops;
+	double  allocs_op;
+	double  misses_op; // < 0 when perf is not available
+} bench_result_t;
+
+typedef struct bench_conf_s
+{
+    char     *filter;
+	uint64_t  ops;
+	int       reps;
+	int       threads;
+	int       pin;
+	char     *save;
+	char     *base;
+	double    threshold;
+} bench_conf_t;
+
+typedef struct bench_run_s
+{
+    bench_t           *b;
+	bench_thread_t    *t;
+	uint64_t           ops;
+	pthread_barrier_t *barrier;
+} bench_run_t;
+
+static bench_conf_t     conf;
+static bench_result_t   base[BENCH_BASE_MAX];
+static int              base_n;
+static open_file_t      null_file;
+static log_t            null_log;
+static __thread uint64_t bench_allocs;
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t n, size_t size);
+extern void *__libc_realloc(void *p, size_t size);
+extern void *__libc_memalign(size_t alignment, size_t size);
+extern void  __libc_free(void *p);
+
+void *malloc(size_t size)
+{
+    bench_allocs++;
+
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t n, size_t size)
+{
+    bench_allocs++;
+
+	return __libc_calloc(n, size);
+}
+
+void *realloc(void *p, size_t size)
+{
+    bench_allocs++;
+
+	return __libc_realloc(p, size);
+}
+
+int posix_memalign(void **p, size_t alignment, size_t size)
+{
+    void *m = NULL;
+
+	bench_allocs++;
+
+	m = __libc_memalign(alignment, size);
+	if (!m)
+	{
+        return ENOMEM;
+	}
+
+	*p = m;
+
+	return 0;
+}
+
+void free(void *p)
+{
+    __libc_free(p);
+}
+
+static uint64_t now_ns()
+{
+    struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static uint64_t rand_next(bench_thread_t *t)
+{
+    t->rnd ^= t->rnd << 13;
+	t->rnd ^= t->rnd >> 7;
+	t->rnd ^= t->rnd << 17;
+
+	return t->rnd;
+}
+
+static int perf_open()
+{
+    struct perf_event_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = PERF_TYPE_HARDWARE;
+	attr.config = PERF_COUNT_HW_CACHE_MISSES;
+	attr.disabled = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+
+	// this thread on any cpu
+	return (int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+/* hashtable: the block index shape, 8 byte ids */
+
+typedef struct ht_item_s
+{
+    dfs_hashtable_link_t link;
+	uint64_t             id;
+} ht_item_t;
+
+static dfs_hashtable_t *ht;
+static ht_item_t       *ht_items;
+
+static int ht_init(int threads)
+{
+    int i = 0;
+
+	ht = dfs_hashtable_create(memcmp, DFS_HASHTABLE_DEFAULT_SIZE,
+		dfs_hashtable_hash_key8, NULL);
+	ht_items = (ht_item_t *)__libc_calloc(HT_KEYS, sizeof(ht_item_t));
+	if (!ht || !ht_items)
+	{
+        return DFS_ERROR;
+	}
+
+	for (i = 0; i < HT_KEYS; i++)
+	{
+	    ht_items[i].id = ((uint64_t)i << 20) ^ 0x5bd1e995;
+		ht_items[i].link.key = &ht_items[i].id;
+		ht_items[i].link.len = sizeof(uint64_t);
+        dfs_hashtable_join(ht, &ht_items[i].link);
+	}
+
+	return DFS_OK;
+}
+
+static void ht_release()
+{
+    dfs_hashtable_free_memory(ht);
+	__libc_free(ht_items);
+	ht = NULL;
+	ht_items = NULL;
+}
+
+static void ht_lookup_run(bench_thread_t *t, uint64_t n)
+{
+    uint64_t i = 0;
+	uint64_t id = 0;
+
+	for (i = 0; i < n; i++)
+	{
+	    id = ht_items[rand_next(t) % HT_KEYS].id;
+        t->sink += dfs_hashtable_lookup(ht, &id, sizeof(id)) != NULL;
+	}
+}
+
+static void ht_join_remove_run(bench_thread_t *t, uint64_t n)
+{
+    uint64_t   i = 0;
+	ht_item_t *item = NULL;
+
+	for (i = 0; i < n; i++)
+	{
+	    item = &ht_items[rand_next(t) % HT_KEYS];
+		dfs_hashtable_remove_link(ht, &item->link);
+        dfs_hashtable_join(ht, &item->link);
+	}
+}
+
+/* mem_mblks: fixed size blocks behind an atomic lock */
+
+static struct mem_mblks *mblks;
+
+static void *mblks_alloc(void *priv, size_t size)
+{
+    return malloc(size);
+}
+
+static void mblks_free(void *priv, void *p)
+{
+    free(p);
+}
+
+static int mblks_init(int threads)
+{
+    mem_mblks_param_t param;
+
+	param.mem_alloc = mblks_alloc;
+	param.mem_free = mblks_free;
+	param.priv = NULL;
+
+	mblks = mem_mblks_new_fn(64, (int64_t)MBLKS_COUNT * threads, &param);
+
+	return mblks ? DFS_OK : DFS_ERROR;
+}
+
+static void mblks_release()
+{
+    mem_mblks_destroy(mblks);
+	mblks = NULL;
+}
+
+static void mblks_run(bench_thread_t *t, uint64_t n)
+{
+    void     *held[WINDOW];
+	uint64_t  i = 0;
+	int       slot = 0;
+
+	memset(held, 0, sizeof(held));
+
+	for (i = 0; i < n; i++)
+	{
+	    slot = i % WINDOW;
+		if (held[slot])
+		{
+            mem_put(held[slot]);
+		}
+
+		held[slot] = mem_get(mblks);
+		if (held[slot])
+		{
+            *(char *)held[slot] = (char)i;
+		}
+	}
+
+	for (slot = 0; slot < WINDOW; slot++)
+	{
+        mem_put(held[slot]);
+	}
+}
+
+/* dfs_shmem and dfs_slabs on top of it */
+
+static dfs_shmem_t         *shm;
+static dfs_mem_allocator_t *slab_allocator;
+static dfs_slab_manager_t  *slabs;
+
+static int shmem_init(int threads)
+{
+    unsigned int err = 0;
+
+	shm = dfs_shmem_create(SHMEM_SIZE, DFS_SHMEM_DEFAULT_MIN_SIZE,
+		DFS_SHMEM_DEFAULT_MAX_SIZE, DFS_SHMEM_LEVEL_TYPE_EXP,
+		DFS_SHMEM_EXP_FACTOR, &err);
+
+	return shm ? DFS_OK : DFS_ERROR;
+}
+
+static void shmem_release()
+{
+    unsigned int err = 0;
+
+	dfs_shmem_release(&shm, &err);
+}
+
+static void shmem_run(bench_thread_t *t, uint64_t n)
+{
+    void         *held[WINDOW];
+	uint64_t      i = 0;
+	int           slot = 0;
+	unsigned int  err = 0;
+
+	memset(held, 0, sizeof(held));
+
+	for (i = 0; i < n; i++)
+	{
+	    slot = i % WINDOW;
+		if (held[slot])
+		{
+            dfs_shmem_free(shm, held[slot], &err);
+		}
+
+		held[slot] = dfs_shmem_alloc(shm, 32 + rand_next(t) % 4064, &err);
+	}
+
+	for (slot = 0; slot < WINDOW; slot++)
+	{
+	    if (held[slot])
+		{
+            dfs_shmem_free(shm, held[slot], &err);
+		}
+	}
+}
+
+static int slabs_init(int threads)
+{
+    dfs_shmem_allocator_param_t param;
+	dfs_slab_errno_t            err;
+
+	memset(&param, 0, sizeof(param));
+	param.size = SHMEM_SIZE;
+	param.min_size = DFS_SHMEM_DEFAULT_MIN_SIZE;
+	param.max_size = DFS_SHMEM_DEFAULT_MAX_SIZE;
+	param.level_type = DFS_SHMEM_LEVEL_TYPE_EXP;
+	param.factor = DFS_SHMEM_EXP_FACTOR;
+
+	slab_allocator = dfs_mem_allocator_new_init(DFS_MEM_ALLOCATOR_TYPE_SHMEM,
+		&param);
+	if (!slab_allocator)
+	{
+        return DFS_ERROR;
+	}
+
+	slabs = dfs_slabs_create(slab_allocator, DFS_SLAB_UPTYPE_POWER,
+		DFS_SLAB_POWER_FACTOR, 64, 8192, &err);
+
+	return slabs ? DFS_OK : DFS_ERROR;
+}
+
+static void slabs_release()
+{
+    dfs_slab_errno_t err;
+
+	dfs_slabs_release(&slabs, &err);
+	dfs_mem_allocator_delete(slab_allocator);
+	slabs = NULL;
+	slab_allocator = NULL;
+}
+
+static void slabs_run(bench_thread_t *t, uint64_t n)
+{
+    void             *held[WINDOW];
+	uint64_t          i = 0;
+	int               slot = 0;
+	size_t            size = 0;
+	dfs_slab_errno_t  err;
+
+	memset(held, 0, sizeof(held));
+
+	for (i = 0; i < n; i++)
+	{
+	    slot = i % WINDOW;
+		if (held[slot])
+		{
+            dfs_slabs_free(slabs, held[slot], &err);
+		}
+
+		held[slot] = dfs_slabs_alloc(slabs, DFS_SLAB_ALLOC_TYPE_REQ,
+			64 + rand_next(t) % 4032, &size, &err);
+	}
+
+	for (slot = 0; slot < WINDOW; slot++)
+	{
+	    if (held[slot])
+		{
+            dfs_slabs_free(slabs, held[slot], &err);
+		}
+	}
+}
+
+/* pool_t, the per request and per conn pool */
+
+static int pool_thread_init(bench_thread_t *t)
+{
+    t->priv = pool_create(CONN_DEFAULT_POOL_SIZE, CONN_DEFAULT_POOL_SIZE, &null_log);
+
+	return t->priv ? DFS_OK : DFS_ERROR;
+}
+
+static void pool_thread_release(bench_thread_t *t)
+{
+    pool_destroy((pool_t *)t->priv);
+	t->priv = NULL;
+}
+
+static void pool_alloc_run(bench_thread_t *t, uint64_t n)
+{
+    pool_t   *pool = (pool_t *)t->priv;
+	uint64_t  i = 0;
+
+	for (i = 0; i < n; i++)
+	{
+	    if (i % POOL_RESET_OPS == 0)
+		{
+            pool_reset(pool);
+		}
+
+        t->sink += (uintptr_t)pool_alloc(pool, 16 + rand_next(t) % 240);
+	}
+}
+
+static void pool_create_run(bench_thread_t *t, uint64_t n)
+{
+    pool_t   *pool = NULL;
+	uint64_t  i = 0;
+	int       j = 0;
+
+	for (i = 0; i < n; i++)
+	{
+	    pool = pool_create(CONN_DEFAULT_POOL_SIZE, CONN_DEFAULT_POOL_SIZE, &null_log);
+		for (j = 0; j < 4; j++)
+		{
+            t->sink += (uintptr_t)pool_alloc(pool, 128);
+		}
+
+		pool_destroy(pool);
+	}
+}
+
+/* event_timer_t: the rbtree behind every conn timeout */
+
+typedef struct timer_priv_s
+{
+    event_timer_t timer;
+	event_t       evs[TIMERS];
+} timer_priv_t;
+
+static rb_msec_t bench_msec()
+{
+    return 1000000;
+}
+
+static void timer_handler(event_t *ev)
+{
+}
+
+static int timer_thread_init(bench_thread_t *t)
+{
+    timer_priv_t *p = NULL;
+	int           i = 0;
+
+	p = (timer_priv_t *)__libc_calloc(1, sizeof(timer_priv_t));
+	if (!p)
+	{
+        return DFS_ERROR;
+	}
+
+	event_timer_init(&p->timer, bench_msec, &null_log);
+
+	for (i = 0; i < TIMERS; i++)
+	{
+	    p->evs[i].handler = timer_handler;
+        event_timer_add(&p->timer, &p->evs[i], 1 + rand_next(t) % 60000);
+	}
+
+	t->priv = p;
+
+	return DFS_OK;
+}
+
+static void timer_thread_release(bench_thread_t *t)
+{
+    __libc_free(t->priv);
+	t->priv = NULL;
+}
+
+static void timer_run(bench_thread_t *t, uint64_t n)
+{
+    timer_priv_t *p = (timer_priv_t *)t->priv;
+	event_t      *ev = NULL;
+	uint64_t      i = 0;
+
+	for (i = 0; i < n; i++)
+	{
+	    ev = &p->evs[rand_next(t) % TIMERS];
+		event_timer_del(&p->timer, ev);
+        event_timer_add(&p->timer, ev, 1 + rand_next(t) % 60000);
+	}
+}
+
+/* chain_t through sysio_writev_chain, into /dev/null */
+
+typedef struct chain_priv_s
+{
+    conn_t    conn;
+	event_t   wev;
+	pool_t   *pool;
+	chain_t  *out;
+} chain_priv_t;
+
+static int chain_thread_init(bench_thread_t *t)
+{
+    chain_priv_t *p = NULL;
+	chain_t      *cl = NULL;
+	buffer_t     *b = NULL;
+	int           i = 0;
+
+	p = (chain_priv_t *)__libc_calloc(1, sizeof(chain_priv_t));
+	if (!p)
+	{
+        return DFS_ERROR;
+	}
+
+	t->priv = p;
+	p->conn.fd = open("/dev/null", O_WRONLY);
+	p->conn.write = &p->wev;
+	p->conn.log = &null_log;
+	p->wev.data = &p->conn;
+	p->wev.write = 1;
+	p->pool = pool_create(CHAIN_BUFS * (CHAIN_BUF_SIZE + 256),
+		DEFAULT_PAGESIZE, &null_log);
+	if (p->conn.fd < 0 || !p->pool)
+	{
+        return DFS_ERROR;
+	}
+
+	for (i = 0; i < CHAIN_BUFS; i++)
+	{
+	    cl = chain_alloc(p->pool);
+		b = buffer_create(p->pool, CHAIN_BUF_SIZE);
+		if (!cl || !b)
+		{
+            return DFS_ERROR;
+		}
+
+		b->last = b->end;
+		cl->buf = b;
+        chain_append_all(&p->out, cl);
+	}
+
+	return DFS_OK;
+}
+
+static void chain_thread_release(bench_thread_t *t)
+{
+    chain_priv_t *p = (chain_priv_t *)t->priv;
+
+	if (p->conn.fd >= 0)
+	{
+        close(p->conn.fd);
+	}
+
+	if (p->pool)
+	{
+        pool_destroy(p->pool);
+	}
+
+	__libc_free(p);
+	t->priv = NULL;
+}
+
+static void chain_run(bench_thread_t *t, uint64_t n)
+{
+    chain_priv_t *p = (chain_priv_t *)t->priv;
+	chain_t      *cl = NULL;
+	uint64_t      i = 0;
+
+	for (i = 0; i < n; i++)
+	{
+	    for (cl = p->out; cl; cl = cl->next)
+		{
+            cl->buf->pos = cl->buf->start;
+		}
+
+		p->wev.ready = 1;
+        t->sink += sysio_writev_chain(&p->conn, p->out, 0) == NULL;
+	}
+}
+
+/* dfs_lz, one chunk of text like data per op */
+
+typedef struct lz_priv_s
+{
+    uchar_t src[LZ_CHUNK];
+	uchar_t z[dfs_lz_bound(LZ_CHUNK)];
+	uchar_t out[LZ_CHUNK];
+	size_t  zlen;
+} lz_priv_t;
+
+static int lz_thread_init(bench_thread_t *t)
+{
+    static const char *words[] = { "block", "datanode", "namespace ",
+		"\n", "read", "write", "the ", "of ", "len: ", "offset", " = ",
+		"fio", "->", "conn_fd", "error", "0x", "{ ", " }", ", ", "id" };
+	lz_priv_t *p = NULL;
+	size_t     i = 0;
+	size_t     len = 0;
+	uint64_t   r = 0;
+
+	p = (lz_priv_t *)__libc_calloc(1, sizeof(lz_priv_t));
+	if (!p)
+	{
+        return DFS_ERROR;
+	}
+
+	t->priv = p;
+
+	// mostly words off a small list, one byte in eight random
+	while (i < LZ_CHUNK)
+	{
+	    r = rand_next(t);
+
+		if (r % 8 == 0)
+		{
+            p->src[i++] = (uchar_t)(r >> 8);
+
+			continue;
+		}
+
+		len = strlen(words[(r >> 8) % 20]);
+		if (len > LZ_CHUNK - i)
+		{
+            len = LZ_CHUNK - i;
+		}
+
+		memcpy(p->src + i, words[(r >> 8) % 20], len);
+		i += len;
+	}
+
+	p->zlen = dfs_lz_compress(p->src, LZ_CHUNK, p->z, sizeof(p->z));
+
+	return p->zlen ? DFS_OK : DFS_ERROR;
+}
+
+static void lz_thread_release(bench_thread_t *t)
+{
+    __libc_free(t->priv);
+	t->priv = NULL;
+}
+
+static void lz_compress_run(bench_thread_t *t, uint64_t n)
+{
+    lz_priv_t *p = (lz_priv_t *)t->priv;
+	uint64_t   i = 0;
+
+	for (i = 0; i < n; i++)
+	{
+        t->sink += dfs_lz_compress(p->src, LZ_CHUNK, p->z, sizeof(p->z));
+	}
+}
+
+static void lz_decompress_run(bench_thread_t *t, uint64_t n)
+{
+    lz_priv_t *p = (lz_priv_t *)t->priv;
+	uint64_t   i = 0;
+
+	for (i = 0; i < n; i++)
+	{
+        t->sink += dfs_lz_decompress(p->z, p->zlen, p->out, LZ_CHUNK);
+	}
+}
+
+/* dfs_rs, RS(6, 3) over one stripe of cells per op */
+
+typedef struct rs_priv_s
+{
+    dfs_rs_t rs;
+	uchar_t *units[RS_K + RS_M];
+	uchar_t *src[RS_K];   // the last data units and the parity
+	uint8_t  coef[RS_K];  // give back the first data units
+	uchar_t  out[RS_CELL];
+} rs_priv_t;
+
+static int rs_setup(bench_thread_t *t, int kernel)
+{
+    rs_priv_t *p = NULL;
+	int        have[RS_K];
+	int        i = 0;
+	int        j = 0;
+
+	if (dfs_gf_use(kernel) != DFS_OK)
+	{
+        return DFS_ERROR;
+	}
+
+	p = (rs_priv_t *)__libc_calloc(1, sizeof(rs_priv_t));
+	if (!p)
+	{
+        return DFS_ERROR;
+	}
+
+	t->priv = p;
+
+	for (i = 0; i < RS_K + RS_M; i++)
+	{
+	    p->units[i] = (uchar_t *)__libc_malloc(RS_CELL);
+		if (!p->units[i])
+		{
+            return DFS_ERROR;
+		}
+
+		for (j = 0; i < RS_K && j < RS_CELL; j += 8)
+		{
+            *(uint64_t *)(p->units[i] + j) = rand_next(t);
+		}
+	}
+
+	dfs_rs_init(&p->rs, RS_K, RS_M);
+	dfs_rs_encode(&p->rs, p->units, p->units + RS_K, RS_CELL);
+
+	// as many lost as the code takes, rebuilding the first one
+	for (i = 0; i < RS_K; i++)
+	{
+	    have[i] = RS_M + i;
+		p->src[i] = p->units[RS_M + i];
+	}
+
+	return dfs_rs_decode_coef(&p->rs, have, 0, p->coef);
+}
+
+// the widest kernel this cpu runs
+static int rs_thread_init(bench_thread_t *t)
+{
+    if (dfs_gf_use(DFS_GF_AVX2) == DFS_OK)
+	{
+        return rs_setup(t, DFS_GF_AVX2);
+	}
+
+	if (dfs_gf_use(DFS_GF_SSSE3) == DFS_OK)
+	{
+        return rs_setup(t, DFS_GF_SSSE3);
+	}
+
+	return rs_setup(t, DFS_GF_SCALAR);
+}
+
+static int rs_scalar_thread_init(bench_thread_t *t)
+{
+    return rs_setup(t, DFS_GF_SCALAR);
+}
+
+static void rs_thread_release(bench_thread_t *t)
+{
+    rs_priv_t *p = (rs_priv_t *)t->priv;
+	int        i = 0;
+
+	if (p)
+	{
+	    for (i = 0; i < RS_K + RS_M; i++)
+		{
+            __libc_free(p->units[i]);
+		}
+	}
+
+    __libc_free(p);
+	t->priv = NULL;
+}
+
+static void rs_encode_run(bench_thread_t *t, uint64_t n)
+{
+    rs_priv_t *p = (rs_priv_t *)t->priv;
+	uint64_t   i = 0;
+
+	for (i = 0; i < n; i++)
+	{
+	    dfs_rs_encode(&p->rs, p->units, p->units + RS_K, RS_CELL);
+        t->sink += p->units[RS_K][i % RS_CELL];
+	}
+}
+
+static void rs_decode_run(bench_thread_t *t, uint64_t n)
+{
+    rs_priv_t *p = (rs_priv_t *)t->priv;
+	uint64_t   i = 0;
+
+	for (i = 0; i < n; i++)
+	{
+	    dfs_gf_dot(p->coef, p->src, RS_K, p->out, RS_CELL);
+        t->sink += p->out[i % RS_CELL] == p->units[0][i % RS_CELL];
+	}
+}
+
+/* dfs_atomic_lock_t, alone and fought over */
+
+static dfs_atomic_lock_t bench_lock;
+static uint64_t          bench_locked;
+
+static int lock_init(int threads)
+{
+    dfs_atomic_lock_init(&bench_lock);
+	bench_locked = 0;
+
+	return DFS_OK;
+}
+
+static void lock_run(bench_thread_t *t, uint64_t n)
+{
+    dfs_lock_errno_t err;
+	uint64_t         i = 0;
+
+	for (i = 0; i < n; i++)
+	{
+	    dfs_atomic_lock_on(&bench_lock, &err);
+		bench_locked++;
+        dfs_atomic_lock_off(&bench_lock, &err);
+	}
+}
+
+/* plain malloc, the reference for the allocators above */
+
+static void malloc_run(bench_thread_t *t, uint64_t n)
+{
+    void     *held[WINDOW];
+	uint64_t  i = 0;
+	int       slot = 0;
+
+	memset(held, 0, sizeof(held));
+
+	for (i = 0; i < n; i++)
+	{
+	    slot = i % WINDOW;
+		free(held[slot]);
+        held[slot] = malloc(16 + rand_next(t) % 4080);
+	}
+
+	for (slot = 0; slot < WINDOW; slot++)
+	{
+        free(held[slot]);
+	}
+}
+
+static bench_t benches[] =
+{
+    { "hashtable_lookup", 0, 1, ht_init, ht_release, NULL, NULL,
+		ht_lookup_run },
+	{ "hashtable_join_remove", 0, 1, ht_init, ht_release, NULL, NULL,
+		ht_join_remove_run },
+	{ "mblks_get_put", 0, 1, mblks_init, mblks_release, NULL, NULL,
+		mblks_run },
+	{ "mblks_get_put_mt", 1, 1, mblks_init, mblks_release, NULL, NULL,
+		mblks_run },
+	{ "shmem_alloc_free", 0, 1, shmem_init, shmem_release, NULL, NULL,
+		shmem_run },
+	{ "slabs_alloc_free", 0, 1, slabs_init, slabs_release, NULL, NULL,
+		slabs_run },
+	{ "pool_alloc", 0, 1, NULL, NULL, pool_thread_init, pool_thread_release,
+		pool_alloc_run },
+	{ "pool_alloc_mt", 1, 1, NULL, NULL, pool_thread_init,
+		pool_thread_release, pool_alloc_run },
+	{ "pool_create_destroy", 0, 4, NULL, NULL, NULL, NULL, pool_create_run },
+	{ "timer_add_del", 0, 1, NULL, NULL, timer_thread_init,
+		timer_thread_release, timer_run },
+	{ "chain_writev", 0, 10, NULL, NULL, chain_thread_init,
+		chain_thread_release, chain_run },
+	{ "lz_compress", 0, 1000, NULL, NULL, lz_thread_init,
+		lz_thread_release, lz_compress_run },
+	{ "lz_decompress", 0, 1000, NULL, NULL, lz_thread_init,
+		lz_thread_release, lz_decompress_run },
+	{ "rs_encode", 0, 1000, NULL, NULL, rs_thread_init, rs_thread_release,
+		rs_encode_run },
+	{ "rs_encode_scalar", 0, 1000, NULL, NULL, rs_scalar_thread_init,
+		rs_thread_release, rs_encode_run },
+	{ "rs_decode", 0, 1000, NULL, NULL, rs_thread_init, rs_thread_release,
+		rs_decode_run },
+	{ "atomic_lock", 0, 1, lock_init, NULL, NULL, NULL, lock_run },
+	{ "atomic_lock_mt", 1, 1, lock_init, NULL, NULL, NULL, lock_run },
+	{ "malloc_free", 0, 1, NULL, NULL, NULL, NULL, malloc_run },
+	{ "malloc_free_mt", 1, 1, NULL, NULL, NULL, NULL, malloc_run },
+	{ NULL, 0, 0, NULL, NULL, NULL, NULL, NULL }
+};
+
+static void *bench_thread(void *arg)
+{
+    bench_run_t    *run = (bench_run_t *)arg;
+	bench_thread_t *t = run->t;
+	cpu_set_t       set;
+	uint64_t        allocs = 0;
+	uint64_t        start = 0;
+	int             fd = -1;
+
+	if (conf.pin)
+	{
+	    CPU_ZERO(&set);
+		CPU_SET(t->index % sysconf(_SC_NPROCESSORS_ONLN), &set);
+        pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+	}
+
+	t->misses = -1;
+	fd = perf_open();
+
+	pthread_barrier_wait(run->barrier);
+
+	if (fd >= 0)
+	{
+	    ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+	}
+
+	allocs = bench_allocs;
+	start = now_ns();
+
+	run->b->run(t, run->ops);
+
+	t->ns = now_ns() - start;
+	t->allocs = bench_allocs - allocs;
+
+	if (fd >= 0)
+	{
+	    ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+		if (read(fd, &t->misses, sizeof(t->misses)) != sizeof(t->misses))
+		{
+            t->misses = -1;
+		}
+
+		close(fd);
+	}
+
+	return NULL;
+}
+
+// one rep: all threads start together, each times its own loop
+static int bench_rep(bench_t *b, int threads, uint64_t ops,
+	bench_result_t *res)
+{
+    pthread_t          tids[BENCH_THREADS_MAX];
+	bench_thread_t     ts[BENCH_THREADS_MAX];
+	bench_run_t        runs[BENCH_THREADS_MAX];
+	pthread_barrier_t  barrier;
+	uint64_t           ns = 0;
+	uint64_t           max_ns = 0;
+	uint64_t           allocs = 0;
+	int64_t            misses = 0;
+	int                i = 0;
+	int                rc = DFS_OK;
+
+	memset(ts, 0, sizeof(ts));
+	pthread_barrier_init(&barrier, NULL, threads);
+
+	for (i = 0; i < threads; i++)
+	{
+	    ts[i].index = i;
+		ts[i].rnd = 0x9E3779B97F4A7C15ULL * (i + 1);
+		runs[i].b = b;
+		runs[i].t = &ts[i];
+		runs[i].ops = ops;
+		runs[i].barrier = &barrier;
+
+		if (b->thread_init && b->thread_init(&ts[i]) != DFS_OK)
+		{
+            rc = DFS_ERROR;
+		}
+	}
+
+	for (i = 0; rc == DFS_OK && i < threads; i++)
+	{
+	    if (pthread_create(&tids[i], NULL, bench_thread, &runs[i]) != 0)
+		{
+		    fprintf(stderr, "pthread_create: %s\n", strerror(errno));
+
+            exit(1);
+		}
+	}
+
+	for (i = 0; rc == DFS_OK && i < threads; i++)
+	{
+	    pthread_join(tids[i], NULL);
+
+		ns += ts[i].ns;
+		allocs += ts[i].allocs;
+		max_ns = ts[i].ns > max_ns ? ts[i].ns : max_ns;
+
+		if (misses >= 0)
+		{
+            misses = ts[i].misses < 0 ? -1 : misses + ts[i].misses;
+		}
+	}
+
+	for (i = 0; i < threads; i++)
+	{
+	    if (b->thread_release && ts[i].priv)
+		{
+            b->thread_release(&ts[i]);
+		}
+	}
+
+	pthread_barrier_destroy(&barrier);
+
+	if (rc != DFS_OK)
+	{
+        return rc;
+	}
+
+	res->ns_op = (double)ns / (ops * threads);
+	res->mops = max_ns ? (double)ops * threads * 1000 / max_ns : 0;
+	res->allocs_op = (double)allocs / (ops * threads);
+	res->misses_op = misses < 0 ? -1 : (double)misses / (ops * threads);
+
+	return DFS_OK;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *)a;
+	double y = *(const double *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static int bench_one(bench_t *b, bench_result_t *res)
+{
+    bench_result_t reps[BENCH_REPS_MAX];
+	double         ns[BENCH_REPS_MAX];
+	bench_result_t warm;
+	uint64_t       ops = 0;
+	int            threads = 0;
+	int            i = 0;
+	int            mid = 0;
+
+	threads = b->mt ? conf.threads : 1;
+	ops = conf.ops / b->div;
+	if (!ops)
+	{
+        ops = 1;
+	}
+
+	if (b->init && b->init(threads) != DFS_OK)
+	{
+	    fprintf(stderr, "%s: init failed\n", b->name);
+
+        return DFS_ERROR;
+	}
+
+	// warm the caches and the allocator, not counted
+	if (bench_rep(b, threads, ops / 10 ? ops / 10 : 1, &warm) != DFS_OK)
+	{
+        goto failed;
+	}
+
+	for (i = 0; i < conf.reps; i++)
+	{
+	    if (bench_rep(b, threads, ops, &reps[i]) != DFS_OK)
+		{
+            goto failed;
+		}
+
+		ns[i] = reps[i].ns_op;
+	}
+
+	if (b->release)
+	{
+        b->release();
+	}
+
+	qsort(ns, conf.reps, sizeof(double), cmp_double);
+	mid = conf.reps / 2;
+
+	// the rep that gave the median, so the columns belong together
+	for (i = 0; i < conf.reps; i++)
+	{
+	    if (reps[i].ns_op == ns[mid])
+		{
+            *res = reps[i];
+
+			break;
+		}
+	}
+
+	snprintf(res->name, sizeof(res->name), "%s", b->name);
+	res->threads = threads;
+
+	return DFS_OK;
+
+failed:
+	fprintf(stderr, "%s: run failed\n", b->name);
+
+	if (b->release)
+	{
+        b->release();
+	}
+
+	return DFS_ERROR;
+}
+
+static int bench_match(char *name)
+{
+    char  buf[256];
+	char *tok = NULL;
+	char *save = NULL;
+
+	if (!conf.filter)
+	{
+        return DFS_TRUE;
+	}
+
+	snprintf(buf, sizeof(buf), "%s", conf.filter);
+
+	for (tok = strtok_r(buf, ",", &save); tok;
+		tok = strtok_r(NULL, ",", &save))
+	{
+	    if (strstr(name, tok))
+		{
+            return DFS_TRUE;
+		}
+	}
+
+	return DFS_FALSE;
+}
+
+// "name threads ns/op allocs/op misses/op" a line, # starts a comment
+static int base_load(char *path)
+{
+    FILE           *fp = NULL;
+	char            line[256];
+	bench_result_t *r = NULL;
+
+	fp = fopen(path, "r");
+	if (!fp)
+	{
+	    fprintf(stderr, "%s: %s\n", path, strerror(errno));
+
+        return DFS_ERROR;
+	}
+
+	while (base_n < BENCH_BASE_MAX && fgets(line, sizeof(line), fp))
+	{
+	    if (line[0] == '#' || line[0] == '\n')
+		{
+            continue;
+		}
+
+		r = &base[base_n];
+		if (sscanf(line, "%31s %d %lf %lf %lf", r->name, &r->threads,
+			&r->ns_op, &r->allocs_op, &r->misses_op) == 5)
+		{
+            base_n++;
+		}
+	}
+
+	fclose(fp);
+
+	return DFS_OK;
+}
+
+static bench_result_t *base_find(bench_result_t *res)
+{
+    int i = 0;
+
+	for (i = 0; i < base_n; i++)
+	{
+	    if (!strcmp(base[i].name, res->name)
+			&& base[i].threads == res->threads)
+		{
+            return &base[i];
+		}
+	}
+
+	return NULL;
+}
+
+static int base_save(char *path, bench_result_t *res, int n)
+{
+    FILE *fp = NULL;
+	char  tmp[PATH_MAX];
+	int   i = 0;
+
+	snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+
+	fp = fopen(tmp, "w");
+	if (!fp)
+	{
+	    fprintf(stderr, "%s: %s\n", tmp, strerror(errno));
+
+        return DFS_ERROR;
+	}
+
+	fprintf(fp, "# core_bench baseline, ops %lu reps %d\n"
+		"# name threads ns/op allocs/op misses/op\n",
+		(unsigned long)conf.ops, conf.reps);
+
+	for (i = 0; i < n; i++)
+	{
+        fprintf(fp, "%s %d %.2f %.3f %.3f\n", res[i].name, res[i].threads,
+			res[i].ns_op, res[i].allocs_op, res[i].misses_op);
+	}
+
+	if (fclose(fp) != 0 || rename(tmp, path) != 0)
+	{
+	    fprintf(stderr, "%s: %s\n", path, strerror(errno));
+
+        return DFS_ERROR;
+	}
+
+	return DFS_OK;
+}
+
+static void print_header()
+{
+    printf("%-22s %3s %10s %9s %9s %9s", "scenario", "thr", "ns/op",
+		"Mops/s", "allocs/op", "miss/op");
+
+	if (base_n)
+	{
+        printf(" %10s %8s", "base ns/op", "delta");
+	}
+
+	printf("\n");
+}
+
+// returns 1 when the result is slower than the baseline allows
+static int print_result(bench_result_t *res)
+{
+    bench_result_t *b = NULL;
+	char            miss[16];
+	double          delta = 0;
+	int             regressed = 0;
+
+	if (res->misses_op < 0)
+	{
+        snprintf(miss, sizeof(miss), "-");
+	}
+	else
+	{
+        snprintf(miss, sizeof(miss), "%.3f", res->misses_op);
+	}
+
+	printf("%-22s %3d %10.2f %9.2f %9.3f %9s", res->name, res->threads,
+		res->ns_op, res->mops, res->allocs_op, miss);
+
+	if (base_n)
+	{
+	    b = base_find(res);
+		if (b && b->ns_op > 0)
+		{
+		    delta = (res->ns_op - b->ns_op) * 100 / b->ns_op;
+			regressed = delta > conf.threshold;
+
+			printf(" %10.2f %+7.1f%%%s", b->ns_op, delta,
+				regressed ? "  SLOWER" : "");
+		}
+		else
+		{
+            printf(" %10s %8s", "-", "new");
+		}
+	}
+
+	printf("\n");
+	fflush(stdout);
+
+	return regressed;
+}
+
+static void usage(char *prog)
+{
+    bench_t *b = NULL;
+
+	fprintf(stderr,
+		"usage: %s [-f names] [-n ops] [-r reps] [-t threads] [-a]\n"
+		"          [-S file] [-B file] [-T pct]\n"
+		"  -f  only scenarios containing one of the comma separated names\n"
+		"  -n  ops per thread and rep, default %d\n"
+		"  -r  reps, the median is reported, default %d\n"
+		"  -t  threads of the _mt scenarios, default %d\n"
+		"  -a  pin each thread to a cpu\n"
+		"  -S  save the results as a baseline file\n"
+		"  -B  compare with a baseline file, exit 3 when slower\n"
+		"  -T  allowed slowdown against the baseline in %%, default %.0f\n"
+		"scenarios:",
+		prog, BENCH_OPS, BENCH_REPS, BENCH_THREADS, BENCH_THRESHOLD);
+
+	for (b = benches; b->name; b++)
+	{
+        fprintf(stderr, " %s", b->name);
+	}
+
+	fprintf(stderr, "\n");
+}
+
+int main(int argc, char **argv)
+{
+    bench_result_t  results[sizeof(benches) / sizeof(benches[0])];
+	bench_t        *b = NULL;
+	int             n = 0;
+	int             ch = 0;
+	int             regressed = 0;
+
+	conf.ops = BENCH_OPS;
+	conf.reps = BENCH_REPS;
+	conf.threads = BENCH_THREADS;
+	conf.threshold = BENCH_THRESHOLD;
+
+	while ((ch = getopt(argc, argv, "f:n:r:t:aS:B:T:h")) != -1)
+	{
+	    switch (ch)
+		{
+		case 'f':
+			conf.filter = optarg;
+			break;
+
+		case 'n':
+			conf.ops = strtoull(optarg, NULL, 10);
+			break;
+
+		case 'r':
+			conf.reps = atoi(optarg);
+			break;
+
+		case 't':
+			conf.threads = atoi(optarg);
+			break;
+
+		case 'a':
+			conf.pin = 1;
+			break;
+
+		case 'S':
+			conf.save = optarg;
+			break;
+
+		case 'B':
+			conf.base = optarg;
+			break;
+
+		case 'T':
+			conf.threshold = atof(optarg);
+			break;
+
+		default:
+			usage(argv[0]);
+
+			return 1;
+		}
+	}
+
+	if (!conf.ops || conf.reps <= 0 || conf.reps > BENCH_REPS_MAX
+		|| conf.threads <= 0 || conf.threads > BENCH_THREADS_MAX)
+	{
+	    usage(argv[0]);
+
+        return 1;
+	}
+
+	if (conf.base && base_load(conf.base) != DFS_OK)
+	{
+        return 1;
+	}
+
+	// the core code logs through this, nothing gets written
+	null_file.fd = DFS_INVALID_FILE;
+	null_log.file = &null_file;
+	null_log.log_level = DFS_LOG_EMERG;
+
+	print_header();
+
+	for (b = benches; b->name; b++)
+	{
+	    if (!bench_match(b->name))
+		{
+            continue;
+		}
+
+		if (bench_one(b, &results[n]) != DFS_OK)
+		{
+            return 1;
+		}
+
+		regressed += print_result(&results[n]);
+		n++;
+	}
+
+	if (conf.save && base_save(conf.save, results, n) != DFS_OK)
+	{
+        return 1;
+	}
+
+	if (regressed)
+	{
+	    fprintf(stderr, "%d scenario(s) more than %.0f%% slower than %s\n",
+			regressed, conf.threshold, conf.base);
+
+        return 3;
+	}
+
+	return 0;
+}
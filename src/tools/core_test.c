@@ -0,0 +1,1073 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include "dfs_types.h"
+#include "dfs_error_log.h"
+#include "dfs_memory.h"
+#include "dfs_memory_pool.h"
+#include "dfs_lz.h"
+#include "cfs_zblk.h"
+#include "dfs_gf.h"
+#include "dfs_rs.h"
+#include "dfs_task.h"
+#include "dn_hist.h"
+#include "dn_blk_report.h"
+#include "dn_data_storage.h"
+#include "dn_cycle.h"
+
+// self tests of the codecs and counters the datanode builds on, run by
+// ctest. every case prints ok or the first check that failed, the
+// exit code is the number of failed cases
+
+#define TEST_SEED       0x9e3779b97f4a7c15ULL
+#define LZ_CHUNK        (64 * 1024)
+#define ZBLK_SIZE       (5 * CFS_ZBLK_CHUNK + 1234) // a short last chunk
+#define ZBLK_POOL       (1024 * 1024)
+#define RS_K            6
+#define RS_M            3
+#define RS_LEN          4099 // not a multiple of any vector width
+#define TASK_BUF        4096
+#define REPORT_BLKS     300000 // several chunks per volume
+#define REPORT_VOLS     2
+
+#define test_check(c)                                                  \
+	do {                                                               \
+	    if (!(c))                                                      \
+		{                                                              \
+            fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #c);    \
+			return DFS_ERROR;                                          \
+		}                                                              \
+	} while (0)
+
+typedef struct test_s
+{
+    char  *name;
+	int  (*run)();
+} test_t;
+
+static open_file_t null_file;
+static log_t       null_log;
+static cycle_t     null_cycle;
+static uint64_t    test_rnd = TEST_SEED;
+
+cycle_t *dfs_cycle = &null_cycle;
+
+static uint64_t rand_next()
+{
+    test_rnd ^= test_rnd << 13;
+	test_rnd ^= test_rnd >> 7;
+	test_rnd ^= test_rnd << 17;
+
+	return test_rnd;
+}
+
+// mostly words off a small list, one byte in eight random
+static void fill_text(uchar_t *p, size_t n)
+{
+    static const char *words[] = { "block", "datanode", "namespace ",
+		"\n", "read", "write", "the ", "of ", "len: ", "offset", " = ",
+		"fio", "->", "conn_fd", "error", "0x", "{ ", " }", ", ", "id" };
+	size_t   i = 0;
+	size_t   len = 0;
+	uint64_t r = 0;
+
+	while (i < n)
+	{
+	    r = rand_next();
+
+		if (r % 8 == 0)
+		{
+            p[i++] = (uchar_t)(r >> 8);
+
+			continue;
+		}
+
+		len = strlen(words[(r >> 8) % 20]);
+		if (len > n - i)
+		{
+            len = n - i;
+		}
+
+		memcpy(p + i, words[(r >> 8) % 20], len);
+		i += len;
+	}
+}
+
+static void fill_random(uchar_t *p, size_t n)
+{
+    size_t i = 0;
+
+	for (i = 0; i < n; i++)
+	{
+        p[i] = (uchar_t)(rand_next() >> 24);
+	}
+}
+
+/* dfs_lz */
+
+static int lz_round_trip()
+{
+    static uchar_t src[LZ_CHUNK];
+	static uchar_t z[dfs_lz_bound(LZ_CHUNK)];
+	static uchar_t out[LZ_CHUNK];
+	size_t         sizes[] = { 1, 13, 100, 4095, 4096, LZ_CHUNK };
+	size_t         zlen = 0;
+	size_t         i = 0;
+
+	for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+	{
+	    fill_text(src, sizes[i]);
+
+		zlen = dfs_lz_compress(src, sizes[i], z, sizeof(z));
+		if (!zlen)
+		{
+		    // too short to come out smaller
+		    test_check(sizes[i] < 100);
+
+            continue;
+		}
+
+		test_check(zlen < sizes[i]);
+		test_check(dfs_lz_decompress(z, zlen, out, sizes[i])
+			== (ssize_t)sizes[i]);
+		test_check(!memcmp(src, out, sizes[i]));
+	}
+
+	// a run of one byte is all matches
+	memset(src, 'a', LZ_CHUNK);
+	zlen = dfs_lz_compress(src, LZ_CHUNK, z, sizeof(z));
+	test_check(zlen > 0 && zlen < LZ_CHUNK / 100);
+	test_check(dfs_lz_decompress(z, zlen, out, LZ_CHUNK) == LZ_CHUNK);
+	test_check(!memcmp(src, out, LZ_CHUNK));
+
+	// nothing to gain on noise
+	fill_random(src, LZ_CHUNK);
+	test_check(dfs_lz_compress(src, LZ_CHUNK, z, sizeof(z)) == 0);
+
+	return DFS_OK;
+}
+
+static int lz_corrupt()
+{
+    static uchar_t src[LZ_CHUNK];
+	static uchar_t z[dfs_lz_bound(LZ_CHUNK)];
+	static uchar_t bad[dfs_lz_bound(LZ_CHUNK)];
+	static uchar_t out[LZ_CHUNK];
+	size_t         zlen = 0;
+	size_t         cut = 0;
+	ssize_t        rs = 0;
+	int            i = 0;
+
+	fill_text(src, LZ_CHUNK);
+	zlen = dfs_lz_compress(src, LZ_CHUNK, z, sizeof(z));
+	test_check(zlen > 0);
+
+	// a cut stream never yields the whole chunk
+	for (cut = 0; cut < zlen; cut += cut < 64 ? 1 : 97)
+	{
+        test_check(dfs_lz_decompress(z, cut, out, LZ_CHUNK) != LZ_CHUNK);
+	}
+
+	// less room than the chunk needs
+	test_check(dfs_lz_decompress(z, zlen, out, LZ_CHUNK - 1) == -1);
+
+	// flipped bytes may decode to garbage but stay within the output
+	for (i = 0; i < 1000; i++)
+	{
+	    memcpy(bad, z, zlen);
+		bad[rand_next() % zlen] ^= (uchar_t)(1 + rand_next() % 255);
+
+		rs = dfs_lz_decompress(bad, zlen, out, LZ_CHUNK);
+		test_check(rs == -1 || (rs >= 0 && rs <= LZ_CHUNK));
+	}
+
+	for (i = 0; i < 1000; i++)
+	{
+	    fill_random(bad, 1 + rand_next() % 512);
+
+		rs = dfs_lz_decompress(bad, 1 + rand_next() % 512, out, LZ_CHUNK);
+		test_check(rs == -1 || (rs >= 0 && rs <= LZ_CHUNK));
+	}
+
+	return DFS_OK;
+}
+
+/* cfs_zblk */
+
+static int zblk_tmp()
+{
+    char tmp[] = "/tmp/core_test.XXXXXX";
+	int  fd = -1;
+
+	fd = mkstemp(tmp);
+	if (fd >= 0)
+	{
+        unlink(tmp);
+	}
+
+	return fd;
+}
+
+// written in uneven pieces so chunks get split across calls
+static int zblk_write_all(int fd, uchar_t *src, uint64_t size)
+{
+    pool_t     *pool = NULL;
+	cfs_zblk_t *z = NULL;
+	uint64_t    off = 0;
+	size_t      len = 0;
+	int         rs = DFS_OK;
+
+	pool = pool_create(ZBLK_POOL, ZBLK_POOL, &null_log);
+	if (!pool)
+	{
+        return DFS_ERROR;
+	}
+
+	z = cfs_zblk_create(pool, size);
+
+	while (z && off < size && rs == DFS_OK)
+	{
+	    len = 1 + rand_next() % (CFS_ZBLK_CHUNK + CFS_ZBLK_CHUNK / 2);
+		if (len > size - off)
+		{
+            len = size - off;
+		}
+
+		rs = cfs_zblk_write(z, fd, src + off, len) == (ssize_t)len
+			? DFS_OK : DFS_ERROR;
+		off += len;
+	}
+
+	pool_destroy(pool);
+
+	return z ? rs : DFS_ERROR;
+}
+
+static int zblk_round_trip()
+{
+    static uchar_t src[ZBLK_SIZE];
+	static uchar_t out[6 * CFS_ZBLK_CHUNK];
+	uint64_t       size = 0;
+	char           path[64];
+	int            fd = -1;
+
+	// one chunk of noise is stored raw between compressed ones
+	fill_text(src, ZBLK_SIZE);
+	fill_random(src + 2 * CFS_ZBLK_CHUNK, CFS_ZBLK_CHUNK);
+
+	fd = zblk_tmp();
+	test_check(fd >= 0);
+	test_check(zblk_write_all(fd, src, ZBLK_SIZE) == DFS_OK);
+
+	test_check(cfs_zblk_read(fd, out, sizeof(out), 0) == ZBLK_SIZE);
+	test_check(!memcmp(src, out, ZBLK_SIZE));
+
+	// from a chunk in the middle, across the raw one
+	test_check(cfs_zblk_read(fd, out, 2 * CFS_ZBLK_CHUNK, CFS_ZBLK_CHUNK)
+		== 2 * CFS_ZBLK_CHUNK);
+	test_check(!memcmp(src + CFS_ZBLK_CHUNK, out, 2 * CFS_ZBLK_CHUNK));
+
+	// the short last chunk, and past the end
+	test_check(cfs_zblk_read(fd, out, CFS_ZBLK_CHUNK, 5 * CFS_ZBLK_CHUNK)
+		== 1234);
+	test_check(!memcmp(src + 5 * CFS_ZBLK_CHUNK, out, 1234));
+	test_check(cfs_zblk_read(fd, out, CFS_ZBLK_CHUNK, 6 * CFS_ZBLK_CHUNK)
+		== 0);
+
+	snprintf(path, sizeof(path), "/proc/self/fd/%d", fd);
+	test_check(cfs_zblk_probe(path, &size) == DFS_OK);
+	test_check(size == ZBLK_SIZE);
+
+	close(fd);
+
+	return DFS_OK;
+}
+
+static int zblk_unaligned()
+{
+    static uchar_t src[ZBLK_SIZE];
+	static uchar_t out[2 * CFS_ZBLK_CHUNK];
+	int            fd = -1;
+
+	fill_text(src, ZBLK_SIZE);
+
+	fd = zblk_tmp();
+	test_check(fd >= 0);
+	test_check(zblk_write_all(fd, src, ZBLK_SIZE) == DFS_OK);
+
+	errno = 0;
+	test_check(cfs_zblk_read(fd, out, CFS_ZBLK_CHUNK, 4096) == DFS_ERROR);
+	test_check(errno == EINVAL);
+
+	errno = 0;
+	test_check(cfs_zblk_read(fd, out, CFS_ZBLK_CHUNK + 1, 0) == DFS_ERROR);
+	test_check(errno == EINVAL);
+
+	errno = 0;
+	test_check(cfs_zblk_read(fd, out, CFS_ZBLK_CHUNK, CFS_ZBLK_CHUNK - 1)
+		== DFS_ERROR);
+	test_check(errno == EINVAL);
+
+	close(fd);
+
+	return DFS_OK;
+}
+
+static int zblk_corrupt()
+{
+    static uchar_t src[ZBLK_SIZE];
+	static uchar_t out[6 * CFS_ZBLK_CHUNK];
+	cfs_zblk_hdr_t hdr;
+	uint64_t       idx[2];
+	uint64_t       size = 0;
+	off_t          end = 0;
+	char           path[64];
+	int            fd = -1;
+
+	fill_text(src, ZBLK_SIZE);
+
+	fd = zblk_tmp();
+	test_check(fd >= 0);
+	test_check(zblk_write_all(fd, src, ZBLK_SIZE) == DFS_OK);
+	snprintf(path, sizeof(path), "/proc/self/fd/%d", fd);
+
+	// an index that runs backwards
+	test_check(pread(fd, idx, sizeof(idx), sizeof(hdr) + sizeof(uint64_t))
+		== sizeof(idx));
+	test_check(pwrite(fd, &idx[1], sizeof(uint64_t),
+		sizeof(hdr) + sizeof(uint64_t)) == sizeof(uint64_t));
+	test_check(pwrite(fd, &idx[0], sizeof(uint64_t),
+		sizeof(hdr) + 2 * sizeof(uint64_t)) == sizeof(uint64_t));
+	errno = 0;
+	test_check(cfs_zblk_read(fd, out, sizeof(out), 0) == DFS_ERROR);
+	test_check(errno == EIO);
+	test_check(pwrite(fd, idx, sizeof(idx), sizeof(hdr) + sizeof(uint64_t))
+		== sizeof(idx));
+	test_check(cfs_zblk_read(fd, out, sizeof(out), 0) == ZBLK_SIZE);
+
+	// a file cut short ends in the middle of the data
+	end = lseek(fd, 0, SEEK_END);
+	test_check(ftruncate(fd, end - 100) == 0);
+	errno = 0;
+	test_check(cfs_zblk_read(fd, out, sizeof(out), 0) == DFS_ERROR);
+	test_check(errno == EIO);
+	test_check(cfs_zblk_probe(path, &size) == DFS_DECLINED);
+
+	// the first chunk still reads
+	test_check(cfs_zblk_read(fd, out, CFS_ZBLK_CHUNK, 0) == CFS_ZBLK_CHUNK);
+	test_check(!memcmp(src, out, CFS_ZBLK_CHUNK));
+
+	// a header that does not match its checksum, even the first chunk
+	// is refused now
+	test_check(pread(fd, &hdr, sizeof(hdr), 0) == sizeof(hdr));
+	hdr.size--;
+	test_check(pwrite(fd, &hdr, sizeof(hdr), 0) == sizeof(hdr));
+	errno = 0;
+	test_check(cfs_zblk_read(fd, out, CFS_ZBLK_CHUNK, 0) == DFS_ERROR);
+	test_check(errno == EIO);
+
+	// not a zblk at all
+	test_check(ftruncate(fd, 0) == 0);
+	errno = 0;
+	test_check(cfs_zblk_read(fd, out, sizeof(out), 0) == DFS_ERROR);
+	test_check(errno == EIO);
+
+	close(fd);
+
+	return DFS_OK;
+}
+
+/* dfs_gf, dfs_rs */
+
+static int gf_field()
+{
+    int a = 0;
+	int b = 0;
+
+	dfs_gf_init();
+
+	for (a = 0; a < 256; a++)
+	{
+	    test_check(dfs_gf_mul(a, 0) == 0);
+		test_check(dfs_gf_mul(a, 1) == a);
+
+		if (a)
+		{
+            test_check(dfs_gf_mul(a, dfs_gf_inv(a)) == 1);
+		}
+
+		for (b = 0; b < 256; b += 7)
+		{
+		    test_check(dfs_gf_mul(a, b) == dfs_gf_mul(b, a));
+			test_check(dfs_gf_mul(a, b ^ 0x53)
+				== (dfs_gf_mul(a, b) ^ dfs_gf_mul(a, 0x53)));
+		}
+	}
+
+	// the reduction polynomial
+	test_check(dfs_gf_mul(0x80, 2) == (DFS_GF_POLY & 0xff));
+
+	return DFS_OK;
+}
+
+// every kernel the cpu runs gives the scalar bytes, at any length
+static int gf_kernels()
+{
+    static uchar_t units[RS_K][RS_LEN];
+	static uchar_t ref[RS_LEN];
+	static uchar_t out[RS_LEN];
+	uchar_t       *src[RS_K];
+	uint8_t        coef[RS_K];
+	size_t         len = 0;
+	int            kernel = 0;
+	int            i = 0;
+
+	for (i = 0; i < RS_K; i++)
+	{
+	    fill_random(units[i], RS_LEN);
+		src[i] = units[i];
+		coef[i] = (uint8_t)rand_next();
+	}
+
+	for (kernel = DFS_GF_SSSE3; kernel <= DFS_GF_AVX2; kernel++)
+	{
+	    if (dfs_gf_use(kernel) != DFS_OK)
+		{
+            continue;
+		}
+
+		for (len = 0; len <= RS_LEN; len += len < 80 ? 1 : 61)
+		{
+		    dfs_gf_use(DFS_GF_SCALAR);
+			dfs_gf_dot(coef, src, RS_K, ref, len);
+
+			dfs_gf_use(kernel);
+			memset(out, 0xa5, sizeof(out));
+			dfs_gf_dot(coef, src, RS_K, out, len);
+
+			test_check(!memcmp(ref, out, len));
+			test_check(len == RS_LEN || out[len] == 0xa5);
+		}
+	}
+
+	return DFS_OK;
+}
+
+// any k of the k + m units give back every unit
+static int rs_decode()
+{
+    static uchar_t units[RS_K + RS_M][RS_LEN];
+	static uchar_t out[RS_LEN];
+	dfs_rs_t       rs;
+	uchar_t       *all[RS_K + RS_M];
+	uchar_t       *src[RS_K];
+	uint8_t        coef[RS_K];
+	int            have[RS_K];
+	int            mask = 0;
+	int            n = 0;
+	int            i = 0;
+
+	test_check(dfs_rs_init(&rs, 0, RS_M) == DFS_ERROR);
+	test_check(dfs_rs_init(&rs, RS_K, DFS_RS_MAX_UNITS) == DFS_ERROR);
+	test_check(dfs_rs_init(&rs, RS_K, RS_M) == DFS_OK);
+
+	for (i = 0; i < RS_K + RS_M; i++)
+	{
+        all[i] = units[i];
+	}
+
+	for (i = 0; i < RS_K; i++)
+	{
+        fill_random(units[i], RS_LEN);
+	}
+
+	dfs_rs_encode(&rs, all, all + RS_K, RS_LEN);
+
+	for (mask = 0; mask < 1 << (RS_K + RS_M); mask++)
+	{
+	    if (__builtin_popcount(mask) != RS_K)
+		{
+            continue;
+		}
+
+		for (i = 0, n = 0; i < RS_K + RS_M; i++)
+		{
+		    if (mask >> i & 1)
+			{
+			    have[n] = i;
+				src[n++] = units[i];
+			}
+		}
+
+		for (i = 0; i < RS_K + RS_M; i++)
+		{
+		    test_check(dfs_rs_decode_coef(&rs, have, i, coef) == DFS_OK);
+
+			dfs_gf_dot(coef, src, RS_K, out, RS_LEN);
+			test_check(!memcmp(out, units[i], RS_LEN));
+		}
+	}
+
+	// a unit twice is one too few
+	for (i = 0; i < RS_K; i++)
+	{
+        have[i] = i ? i - 1 : 0;
+	}
+
+	test_check(dfs_rs_decode_coef(&rs, have, RS_K, coef) == DFS_ERROR);
+	test_check(dfs_rs_decode_coef(&rs, have, RS_K + RS_M, coef)
+		== DFS_ERROR);
+
+	return DFS_OK;
+}
+
+/* dfs_task */
+
+static int task_round_trip()
+{
+    static char buf[TASK_BUF];
+	task_t      t;
+	task_t      o;
+	char        d[100];
+	int         n = 0;
+	int         i = 0;
+
+	for (i = 0; i < (int)sizeof(d); i++)
+	{
+        d[i] = (char)i;
+	}
+
+	memset(&t, 0, sizeof(t));
+	t.cmd = DN_HEARTBEAT;
+	t.ret = -17;
+	t.seq = 77;
+	t.master_nodeid = -3;
+	t.permission = 0755;
+	strcpy(t.key, "10.0.0.12");
+	strcpy(t.user, "hdfs");
+	strcpy(t.group, "supergroup");
+	t.data = d;
+	t.data_len = sizeof(d);
+
+	n = task_encode2str_v2(&t, buf, sizeof(buf));
+	test_check(n == task_encode_size(&t, TASK_V2));
+	test_check(n < task_encode_size(&t, TASK_V1));
+	test_check(task_frame_version(buf, n) == TASK_V2);
+
+	test_check(task_decodefstr_any(buf, n, &o) == n);
+	test_check(o.cmd == t.cmd && o.ret == t.ret && o.seq == t.seq);
+	test_check(o.master_nodeid == t.master_nodeid);
+	test_check(o.permission == t.permission);
+	test_check(!strcmp(o.key, t.key) && !strcmp(o.user, t.user)
+		&& !strcmp(o.group, t.group));
+
+	// data is borrowed from the frame
+	test_check(o.data_len == t.data_len && !memcmp(o.data, d, sizeof(d)));
+	test_check((char *)o.data > buf && (char *)o.data < buf + n);
+
+	task_frame_set_seq(buf, 99);
+	test_check(task_decodefstr_any(buf, n, &o) == n && o.seq == 99);
+
+	// no strings and no data, nothing but the header and three varints
+	memset(&t, 0, sizeof(t));
+	t.cmd = DN_REGISTER;
+	n = task_encode2str_v2(&t, buf, sizeof(buf));
+	test_check(n == TASK_V2_HDR_LEN + 3);
+	test_check(task_decodefstr_any(buf, n, &o) == n);
+	test_check(o.cmd == DN_REGISTER && !o.data && !o.data_len && !o.key[0]);
+
+	// too small a buffer, the same answer as v1 gives
+	t.data = d;
+	t.data_len = sizeof(d);
+	test_check(task_encode2str_v2(&t, buf, TASK_V2_HDR_LEN + 10)
+		== TASK_EAGIN);
+
+	// v1 still decodes, and renumbers in its own place
+	memset(&t, 0, sizeof(t));
+	t.cmd = DN_REGISTER;
+	t.seq = 5;
+	t.data = d;
+	t.data_len = 8;
+	n = task_encode2str_ver(&t, TASK_V1, buf, sizeof(buf));
+	test_check(task_frame_version(buf, n) == TASK_V1);
+
+	task_frame_set_seq(buf, 6);
+	test_check(task_decodefstr_any(buf, n, &o) == n);
+	test_check(o.seq == 6 && o.data_len == 8 && !memcmp(o.data, d, 8));
+
+	return DFS_OK;
+}
+
+static int task_corrupt()
+{
+    static char       buf[TASK_BUF];
+	unsigned char     f[64];
+	task_wire_hello_t hello = { TASK_WIRE_HELLO_MAGIC, TASK_V1, TASK_V2 };
+	task_t            t;
+	task_t            o;
+	char              d[10];
+	int               n = 0;
+	int               m = 0;
+	int               i = 0;
+
+	memset(d, 7, sizeof(d));
+	memset(&t, 0, sizeof(t));
+	t.cmd = DN_HEARTBEAT;
+	strcpy(t.key, "192.168.100.200");
+	t.data = d;
+	t.data_len = sizeof(d);
+	n = task_encode2str_v2(&t, buf, sizeof(buf));
+
+	// a frame still coming in asks for more
+	for (i = 6; i < n; i++)
+	{
+        test_check(task_decodefstr_any(buf, i, &o) == TASK_EAGIN);
+	}
+
+	// data_len past the end of the frame
+	m = n - 5;
+	memcpy(buf, &m, sizeof(int));
+	test_check(task_decodefstr_any(buf, m, &o) == TASK_ERROR);
+
+	// a length shorter than the header
+	m = TASK_V2_HDR_LEN - 1;
+	memcpy(buf, &m, sizeof(int));
+	test_check(task_decodefstr_any(buf, n, &o) == TASK_ERROR);
+
+	// a string longer than its field
+	memset(&t, 0, sizeof(t));
+	t.cmd = 1;
+	strcpy(t.user, "bob");
+	n = task_encode2str_v2(&t, buf, sizeof(buf));
+	buf[TASK_V2_HDR_LEN + 4] = OWNER_LEN + 1;
+	test_check(task_decodefstr_any(buf, n, &o) == TASK_ERROR);
+
+	// a tag it does not know is skipped: cmd 11, ret 0, 2 data bytes,
+	// tag 9 "abc", key "k1", end, the data
+	memset(f, 0, sizeof(f));
+	f[4] = TASK_V2_MAGIC;
+	f[5] = TASK_V2;
+	f[6] = 1;
+	m = TASK_V2_HDR_LEN;
+	f[m++] = 11;
+	f[m++] = 0;
+	f[m++] = 2;
+	f[m++] = 9;
+	f[m++] = 3;
+	memcpy(f + m, "abc", 3);
+	m += 3;
+	f[m++] = 1;
+	f[m++] = 2;
+	memcpy(f + m, "k1", 2);
+	m += 2;
+	f[m++] = 0;
+	f[m++] = 7;
+	f[m++] = 8;
+	memcpy(f, &m, sizeof(int));
+
+	test_check(task_decodefstr_any((char *)f, m, &o) == m);
+	test_check(o.cmd == 11 && !strcmp(o.key, "k1") && o.data_len == 2);
+	test_check(((char *)o.data)[0] == 7 && ((char *)o.data)[1] == 8);
+
+	// a version it does not speak
+	f[5] = TASK_V2 + 1;
+	test_check(task_frame_version((char *)f, m) == TASK_ERROR);
+
+	test_check(task_wire_negotiate(&hello, sizeof(hello), TASK_V2)
+		== TASK_V2);
+	test_check(task_wire_negotiate(&hello, sizeof(hello), TASK_V1)
+		== TASK_V1);
+	test_check(task_wire_negotiate(NULL, 0, TASK_V2) == TASK_V1);
+	hello.magic = 0;
+	test_check(task_wire_negotiate(&hello, sizeof(hello), TASK_V2)
+		== TASK_V1);
+
+	return DFS_OK;
+}
+
+/* dn_blk_report, over an index of REPORT_BLKS blks: blk i has id 3i,
+ * lives on vol i % 2 and one in five belongs to another namespace */
+
+int block_volume_num()
+{
+    return REPORT_VOLS;
+}
+
+uint32_t block_volume_gen(int vol)
+{
+    return 7 + vol;
+}
+
+// in no particular order, like the index
+void block_object_walk(blk_index_walk_pt fn, void *arg)
+{
+    blk_entry_t e;
+	int64_t     i = 0;
+
+	memset(&e, 0, sizeof(e));
+
+	for (i = REPORT_BLKS; i > 0; i--)
+	{
+	    e.blk_id = i * 3;
+		e.ns_id = i % 5 ? 1 : 2;
+		e.vol = i % REPORT_VOLS;
+		e.size = i;
+
+		fn(&e, arg);
+	}
+}
+
+static uint64_t report_get_varint(uchar_t **p)
+{
+    uint64_t v = 0;
+	int      shift = 0;
+
+	while (**p & 0x80)
+	{
+	    v |= (uint64_t)(**p & 0x7f) << shift;
+		shift += 7;
+		(*p)++;
+	}
+
+	v |= (uint64_t)**p << shift;
+	(*p)++;
+
+	return v;
+}
+
+// walks the chunks back into recs, checking what every chunk claims
+static int report_decode(queue_t *chunks, blk_report_rec_t *recs, int cap,
+	int *n, int *nchunks)
+{
+    blk_report_chunk_t *c = NULL;
+	queue_t            *q = NULL;
+	uchar_t            *p = NULL;
+	int64_t             prev = 0;
+	uint32_t            k = 0;
+
+	*n = 0;
+	*nchunks = 0;
+
+	for (q = queue_head(chunks); q != queue_sentinel(chunks);
+		q = queue_next(q))
+	{
+	    c = queue_data(q, blk_report_chunk_t, me);
+		p = blk_report_chunk_data(c);
+		prev = c->hdr.base;
+
+		test_check(c->len <= BLK_REPORT_CHUNK_MAX);
+
+		for (k = 0; k < c->hdr.count; k++)
+		{
+		    test_check(*n < cap);
+
+			recs[*n].id = prev + (int64_t)report_get_varint(&p);
+			recs[*n].size = (int64_t)report_get_varint(&p);
+
+			test_check(k || recs[*n].id == c->hdr.base);
+			test_check(!k || recs[*n].id > prev);
+
+			prev = recs[*n].id;
+			(*n)++;
+		}
+
+		test_check(p - blk_report_chunk_data(c) == c->len);
+		test_check(!c->hdr.count || c->last == prev);
+		(*nchunks)++;
+	}
+
+	return DFS_OK;
+}
+
+static int report_encode()
+{
+    static blk_report_rec_t recs[REPORT_BLKS];
+	static blk_report_rec_t out[REPORT_BLKS];
+	blk_report_chunk_t     *c = NULL;
+	blk_report_rec_t        tmp;
+	queue_t                 chunks;
+	int64_t                 id = 0;
+	int                     n = 0;
+	int                     nchunks = 0;
+	int                     i = 0;
+	int                     j = 0;
+
+	queue_init(&chunks);
+
+	// gaps from 1 to 2^40, sizes up to a full blk
+	for (i = 0; i < REPORT_BLKS; i++)
+	{
+	    id += 1 + (int64_t)(rand_next() % (i % 1000 ? 1000 : 1ULL << 40));
+		recs[i].id = id;
+		recs[i].size = (int64_t)(rand_next() % (128ULL << 20));
+	}
+
+	memcpy(out, recs, sizeof(recs));
+
+	for (i = REPORT_BLKS - 1; i > 0; i--)
+	{
+	    j = (int)(rand_next() % (i + 1));
+		tmp = out[i];
+		out[i] = out[j];
+		out[j] = tmp;
+	}
+
+	blk_report_sort(out, REPORT_BLKS);
+	test_check(!memcmp(out, recs, sizeof(recs)));
+
+	// an increment
+	test_check(blk_report_encode(recs, REPORT_BLKS, 1, -1, 0, 0, &chunks)
+		== DFS_OK);
+	test_check(report_decode(&chunks, out, REPORT_BLKS, &n, &nchunks)
+		== DFS_OK);
+	test_check(n == REPORT_BLKS && nchunks > 1);
+	test_check(!memcmp(out, recs, sizeof(recs)));
+
+	c = queue_data(queue_tail(&chunks), blk_report_chunk_t, me);
+	test_check(c->hdr.vol == -1 && !(c->hdr.flags & BLK_REPORT_VOL_END));
+	blk_report_free(&chunks);
+	test_check(queue_empty(&chunks));
+
+	// nothing to report is still one chunk, the end of its volume
+	test_check(blk_report_encode(recs, 0, 1, 0, 3, BLK_REPORT_FULL, &chunks)
+		== DFS_OK);
+	test_check(report_decode(&chunks, out, REPORT_BLKS, &n, &nchunks)
+		== DFS_OK);
+	test_check(n == 0 && nchunks == 1);
+
+	c = queue_data(queue_head(&chunks), blk_report_chunk_t, me);
+	test_check(c->hdr.flags == (BLK_REPORT_FULL | BLK_REPORT_VOL_END));
+	test_check(c->hdr.vol_gen == 3);
+	blk_report_free(&chunks);
+
+	return DFS_OK;
+}
+
+static int report_build()
+{
+    static blk_report_rec_t out[REPORT_BLKS];
+	blk_report_cursor_t     cur;
+	blk_report_chunk_t     *c = NULL;
+	queue_t                 chunks;
+	queue_t                *q = NULL;
+	int                     vol_ends = 0;
+	int                     n = 0;
+	int                     nchunks = 0;
+	int                     i = 0;
+
+	queue_init(&chunks);
+	memset(&cur, 0, sizeof(cur));
+	cur.ns_id = 1;
+	cur.last = INT64_MIN;
+
+	// vol 0 then vol 1, sorted within each, ns 2 left out
+	test_check(blk_report_build(&cur, &chunks) == DFS_OK);
+	test_check(report_decode(&chunks, out, REPORT_BLKS, &n, &nchunks)
+		== DFS_OK);
+	test_check(n == REPORT_BLKS / 5 * 4);
+
+	for (i = 0; i < n; i++)
+	{
+	    test_check(out[i].id == out[i].size * 3);
+		test_check(out[i].size % 5);
+		test_check(out[i].size % REPORT_VOLS == (i < n / 2 ? 0 : 1));
+	}
+
+	for (q = queue_head(&chunks); q != queue_sentinel(&chunks);
+		q = queue_next(q))
+	{
+	    c = queue_data(q, blk_report_chunk_t, me);
+
+		test_check(c->hdr.flags & BLK_REPORT_FULL);
+		test_check(c->hdr.vol_gen == block_volume_gen(c->hdr.vol));
+		vol_ends += (c->hdr.flags & BLK_REPORT_VOL_END) != 0;
+	}
+
+	test_check(vol_ends == REPORT_VOLS);
+	blk_report_free(&chunks);
+
+	// resumed within vol 1 after an acked chunk
+	cur.vol = 1;
+	cur.last = 450000;
+	cur.vol_gen = block_volume_gen(1);
+
+	test_check(blk_report_build(&cur, &chunks) == DFS_OK);
+	test_check(report_decode(&chunks, out, REPORT_BLKS, &n, &nchunks)
+		== DFS_OK);
+	test_check(n > 0 && out[0].id > 450000 && out[0].size % 2);
+	test_check(out[n - 1].id == (REPORT_BLKS - 1) * 3);
+	blk_report_free(&chunks);
+
+	// vol 1 changed since, it is sent again from its start
+	cur.vol_gen--;
+
+	test_check(blk_report_build(&cur, &chunks) == DFS_OK);
+	test_check(report_decode(&chunks, out, REPORT_BLKS, &n, &nchunks)
+		== DFS_OK);
+	test_check(n == REPORT_BLKS / 5 * 2 && out[0].id == 3);
+	blk_report_free(&chunks);
+
+	return DFS_OK;
+}
+
+/* dn_hist */
+
+// every value comes back within 1/16 below it, never above the max
+static int hist_error()
+{
+    static dn_hist_t h;
+	uint64_t         v = 0;
+	uint64_t         r = 0;
+
+	memset(&h, 0, sizeof(h));
+	test_check(dn_hist_percentile(&h, 0.5) == 0);
+
+	for (v = 1; v < (1ULL << METRICS_EXP_MAX); v = v * 3 + 1)
+	{
+	    memset(&h, 0, sizeof(h));
+		dn_hist_add(&h, v);
+
+		r = dn_hist_percentile(&h, 0.5);
+		test_check(r <= v && v - r <= v / METRICS_SUB_N);
+		test_check(v >= METRICS_SUB_N || r == v);
+	}
+
+	// past the last power of two everything lands in the top bucket
+	memset(&h, 0, sizeof(h));
+	dn_hist_add(&h, 1ULL << 50);
+	test_check(h.max == 1ULL << 50);
+	test_check(h.counts[METRICS_BUCKETS - 1] == 1);
+
+	return DFS_OK;
+}
+
+static int hist_percentiles()
+{
+    static dn_hist_t a;
+	static dn_hist_t b;
+	static dn_hist_t all;
+	static dn_hist_t d;
+	uint64_t         p50 = 0;
+	uint64_t         p99 = 0;
+	uint64_t         i = 0;
+
+	memset(&a, 0, sizeof(a));
+	memset(&b, 0, sizeof(b));
+	memset(&all, 0, sizeof(all));
+
+	// uniform 1..1000, odd ones in a, even ones in b
+	for (i = 1; i <= 100000; i++)
+	{
+	    dn_hist_add(i % 2 ? &a : &b, (i - 1) % 1000 + 1);
+		dn_hist_add(&all, (i - 1) % 1000 + 1);
+	}
+
+	p50 = dn_hist_percentile(&all, 0.5);
+	p99 = dn_hist_percentile(&all, 0.99);
+	// a bucket stands for its middle, either side of the true value
+	test_check(p50 + 500 / METRICS_SUB_N >= 500
+		&& p50 <= 500 + 500 / METRICS_SUB_N);
+	test_check(p99 + 990 / METRICS_SUB_N >= 990
+		&& p99 <= 990 + 990 / METRICS_SUB_N);
+	test_check(dn_hist_percentile(&all, 1.0) == 1000);
+
+	// the merge of the halves is the whole
+	dn_hist_merge(&a, &b);
+	test_check(!memcmp(&a, &all, sizeof(dn_hist_t)));
+
+	// what came in after a snapshot
+	memcpy(&b, &all, sizeof(dn_hist_t));
+
+	for (i = 0; i < 1000; i++)
+	{
+        dn_hist_add(&all, 100000 + i);
+	}
+
+	dn_hist_sub(&d, &all, &b);
+	test_check(d.n == 1000);
+	test_check(d.sum == 1000 * 100000 + 999 * 1000 / 2);
+	test_check(d.max <= all.max);
+	test_check(dn_hist_percentile(&d, 0.0)
+		>= 100000 - 100000 / METRICS_SUB_N);
+
+	return DFS_OK;
+}
+
+static test_t tests[] =
+{
+    { "lz_round_trip", lz_round_trip },
+	{ "lz_corrupt", lz_corrupt },
+	{ "zblk_round_trip", zblk_round_trip },
+	{ "zblk_unaligned", zblk_unaligned },
+	{ "zblk_corrupt", zblk_corrupt },
+	{ "gf_field", gf_field },
+	{ "gf_kernels", gf_kernels },
+	{ "rs_decode", rs_decode },
+	{ "task_round_trip", task_round_trip },
+	{ "task_corrupt", task_corrupt },
+	{ "hist_error", hist_error },
+	{ "hist_percentiles", hist_percentiles },
+	{ "report_encode", report_encode },
+	{ "report_build", report_build },
+	{ NULL, NULL }
+};
+
+static int test_match(char *name, int argc, char **argv)
+{
+    int i = 0;
+
+	if (argc < 2)
+	{
+        return DFS_TRUE;
+	}
+
+	for (i = 1; i < argc; i++)
+	{
+	    if (strstr(name, argv[i]))
+		{
+            return DFS_TRUE;
+		}
+	}
+
+	return DFS_FALSE;
+}
+
+// core_test [names], only the cases containing one of the names
+int main(int argc, char **argv)
+{
+    test_t *t = NULL;
+	int     failed = 0;
+
+	// the core code logs through this, nothing gets written
+	null_file.fd = DFS_INVALID_FILE;
+	null_log.file = &null_file;
+	null_log.log_level = DFS_LOG_EMERG;
+	null_cycle.error_log = &null_log;
+
+	for (t = tests; t->name; t++)
+	{
+	    if (!test_match(t->name, argc, argv))
+		{
+            continue;
+		}
+
+		test_rnd = TEST_SEED;
+
+		if (t->run() != DFS_OK)
+		{
+		    printf("%-24s FAIL\n", t->name);
+			failed++;
+
+			continue;
+		}
+
+		printf("%-24s ok\n", t->name);
+	}
+
+	return failed;
+}
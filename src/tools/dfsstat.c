@@ -0,0 +1,407 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "dn_stats_shm.h"
+
+// top like view of a running datanode, reads the stats file it maps
+
+#define DEF_STATS_FILE  "/dev/shm/datanode.stats"
+#define SEQ_RETRIES     1000
+#define MB              (1024.0 * 1024.0)
+#define TRACE_WAIT_MS   5000
+
+static char *op_names[DN_SHM_OPS] = { "read", "write", "faio wait",
+	"faio service", "sendfile", "finalize" };
+
+typedef struct stat_snap_s
+{
+    dn_shm_global_t global;
+	dn_shm_thread_t sum; // of every thread
+	uint64_t        conns;
+	uint64_t        fio_busy;
+	uint64_t        fio_free;
+	uint64_t        stale_ms; // oldest thread update
+	uint64_t        taken_ms;
+} stat_snap_t;
+
+static uint64_t now_ms()
+{
+    struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// seqlock read, 0 if the writer kept it busy
+static int read_section(volatile uint32_t *seq, void *dst, void *src,
+	size_t len)
+{
+    uint32_t before = 0;
+	int      i = 0;
+
+	for (i = 0; i < SEQ_RETRIES; i++)
+	{
+	    before = *seq;
+		__sync_synchronize();
+
+		if (before & 1)
+		{
+		    usleep(10);
+
+            continue;
+		}
+
+		memcpy(dst, src, len);
+		__sync_synchronize();
+
+		if (*seq == before)
+		{
+            return 1;
+		}
+	}
+
+	return 0;
+}
+
+static dn_shm_t *stats_map(char *path)
+{
+    struct stat st;
+	dn_shm_t   *shm = NULL;
+	int         fd = -1;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+	{
+	    fprintf(stderr, "open %s: %s\n", path, strerror(errno));
+
+        return NULL;
+	}
+
+	if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(dn_shm_t))
+	{
+	    fprintf(stderr, "%s: not a datanode stats file\n", path);
+		close(fd);
+
+        return NULL;
+	}
+
+	shm = (dn_shm_t *)mmap(NULL, sizeof(dn_shm_t), PROT_READ, MAP_SHARED,
+		fd, 0);
+	close(fd);
+
+	if (shm == MAP_FAILED)
+	{
+	    fprintf(stderr, "mmap %s: %s\n", path, strerror(errno));
+
+        return NULL;
+	}
+
+	if (shm->magic != DN_SHM_MAGIC || shm->version != DN_SHM_VERSION
+		|| shm->size != sizeof(dn_shm_t))
+	{
+	    fprintf(stderr, "%s: magic %x version %u size %u, expected "
+			"version %u size %u\n", path, shm->magic, shm->version,
+			shm->size, DN_SHM_VERSION, (uint32_t)sizeof(dn_shm_t));
+		munmap(shm, sizeof(dn_shm_t));
+
+        return NULL;
+	}
+
+	return shm;
+}
+
+static void stats_take(dn_shm_t *shm, stat_snap_t *s, dn_shm_thread_t *t)
+{
+    uint32_t n = shm->threads_n;
+	uint64_t oldest = 0;
+	uint32_t i = 0;
+	int      j = 0;
+	int      k = 0;
+
+	memset(s, 0, sizeof(stat_snap_t));
+	s->taken_ms = now_ms();
+
+	read_section(&shm->global.seq, &s->global, &shm->global,
+		sizeof(dn_shm_global_t));
+
+	if (n > DN_SHM_THREADS_MAX)
+	{
+        n = DN_SHM_THREADS_MAX;
+	}
+
+	for (i = 0; i < n; i++)
+	{
+	    if (!read_section(&shm->threads[i].seq, t, &shm->threads[i],
+			sizeof(dn_shm_thread_t)) || !t->update_ms)
+		{
+            continue;
+		}
+
+		if (!oldest || t->update_ms < oldest)
+		{
+            oldest = t->update_ms;
+		}
+
+		s->conns += t->conns;
+		s->fio_busy += t->fio_busy;
+		s->fio_free += t->fio_free;
+		s->sum.bytes_read += t->bytes_read;
+		s->sum.bytes_written += t->bytes_written;
+
+		for (j = 0; j < DN_SHM_OPS; j++)
+		{
+		    dn_hist_merge(&s->sum.ops[j], &t->ops[j]);
+
+			for (k = 0; k < DN_SHM_ERRORS; k++)
+			{
+                s->sum.errors[j][k] += t->errors[j][k];
+			}
+		}
+	}
+
+	s->stale_ms = oldest && s->taken_ms > oldest ? s->taken_ms - oldest : 0;
+}
+
+static void stats_print(dn_shm_t *shm, stat_snap_t *now, stat_snap_t *prev,
+	dn_hist_t *d)
+{
+    dn_shm_global_t *g = &now->global;
+	dn_shm_vol_t    *v = NULL;
+	double           secs = 0;
+	uint64_t         errs = 0;
+	uint64_t         up = 0;
+	uint32_t         i = 0;
+	int              k = 0;
+
+	secs = prev ? (now->taken_ms - prev->taken_ms) / 1000.0 : 0;
+	up = now->taken_ms > shm->start_ms ? (now->taken_ms - shm->start_ms) / 1000
+		: 0;
+
+	printf("datanode pid %u, up %lus, threads %u, updated %lums ago\n",
+		shm->pid, (unsigned long)up, shm->threads_n,
+		(unsigned long)now->stale_ms);
+	printf("conns %lu  fio busy %lu free %lu  faio queue %lu threads %u "
+		"idle %u  blks %lu\n", (unsigned long)now->conns,
+		(unsigned long)now->fio_busy, (unsigned long)now->fio_free,
+		(unsigned long)g->faio_queue, g->faio_threads, g->faio_idle,
+		(unsigned long)g->blk_count);
+
+	if (secs > 0)
+	{
+	    printf("read %.2f MB/s  write %.2f MB/s\n",
+			(now->sum.bytes_read - prev->sum.bytes_read) / MB / secs,
+			(now->sum.bytes_written - prev->sum.bytes_written) / MB / secs);
+	}
+	else
+	{
+	    printf("read %.2f MB  written %.2f MB total\n",
+			now->sum.bytes_read / MB, now->sum.bytes_written / MB);
+	}
+
+	printf("\n%-13s %9s %9s %9s %9s %9s %9s %7s\n", "op(us)", "ops/s",
+		"avg", "p50", "p99", "p999", "max", "errors");
+
+	for (i = 0; i < DN_SHM_OPS; i++)
+	{
+	    // the window since the last sample, or everything on the first
+		if (prev)
+		{
+            dn_hist_sub(d, &now->sum.ops[i], &prev->sum.ops[i]);
+		}
+		else
+		{
+            memcpy(d, &now->sum.ops[i], sizeof(dn_hist_t));
+		}
+
+		errs = 0;
+		for (k = 1; k < DN_SHM_ERRORS; k++)
+		{
+		    errs += now->sum.errors[i][k];
+			errs -= prev ? prev->sum.errors[i][k] : 0;
+		}
+
+		printf("%-13s %9.1f %9lu %9lu %9lu %9lu %9lu %7lu\n", op_names[i],
+			secs > 0 ? d->n / secs : (double)d->n,
+			(unsigned long)(d->n ? d->sum / d->n : 0),
+			(unsigned long)dn_hist_percentile(d, 0.5),
+			(unsigned long)dn_hist_percentile(d, 0.99),
+			(unsigned long)dn_hist_percentile(d, 0.999),
+			(unsigned long)d->max, (unsigned long)errs);
+	}
+
+	printf("\n%-4s %10s %10s %10s %7s %7s %9s %8s %9s %s\n", "vol",
+		"cap(MB)", "used(MB)", "room(MB)", "active", "pending", "lat(us)",
+		"errors", "chosen", "state");
+
+	for (i = 0; i < g->vols_n && i < DN_SHM_VOLS_MAX; i++)
+	{
+	    v = &g->vols[i];
+
+		printf("%-4u %10.0f %10.0f %10.0f %7u %7u %9u %8lu %9lu %s\n", i,
+			v->capacity / MB, v->used / MB, v->remaining / MB, v->active,
+			v->io_pending, v->io_lat_us, (unsigned long)v->io_errors,
+			(unsigned long)v->chosen, v->failed ? "FAILED" : "ok");
+	}
+
+	printf("\n");
+	fflush(stdout);
+}
+
+// asks the datanode to dump its trace rings and waits for the new file
+static int stats_trace(dn_shm_t *shm)
+{
+    struct stat before;
+	struct stat st;
+	char       *path = shm->trace_file;
+	int         waited = 0;
+
+	memset(&before, 0, sizeof(before));
+	stat(path, &before);
+
+	if (kill(shm->pid, SIGUSR2) < 0)
+	{
+	    fprintf(stderr, "kill %u: %s\n", shm->pid, strerror(errno));
+
+        return 1;
+	}
+
+	// the dump is renamed into place, a new inode means it is complete
+	for (waited = 0; waited < TRACE_WAIT_MS; waited += 100)
+	{
+	    usleep(100 * 1000);
+
+		if (stat(path, &st) == 0 && (st.st_ino != before.st_ino
+			|| st.st_mtime != before.st_mtime))
+		{
+		    printf("trace written to %s, %lu bytes\n", path,
+				(unsigned long)st.st_size);
+
+            return 0;
+		}
+	}
+
+	fprintf(stderr, "no trace in %s after %d ms\n", path, TRACE_WAIT_MS);
+
+	return 1;
+}
+
+static void usage(char *prog)
+{
+    fprintf(stderr, "usage: %s [-f stats_file] [-i interval_s] [-n count] "
+		"[-b] [-t]\n"
+		"  -f  stats file of the datanode, default %s\n"
+		"  -i  seconds between samples, default 1\n"
+		"  -n  samples to print, default until killed\n"
+		"  -b  batch mode, do not clear the screen\n"
+		"  -t  dump the request trace as chrome trace json and exit\n",
+		prog, DEF_STATS_FILE);
+}
+
+int main(int argc, char **argv)
+{
+    char        *path = DEF_STATS_FILE;
+	dn_shm_t    *shm = NULL;
+	stat_snap_t *snaps = NULL;
+	stat_snap_t *now = NULL;
+	stat_snap_t *prev = NULL;
+	dn_shm_thread_t *t = NULL;
+	dn_hist_t   *d = NULL;
+	int          interval = 1;
+	int          count = -1;
+	int          batch = 0;
+	int          trace = 0;
+	int          i = 0;
+	int          c = 0;
+
+	while ((c = getopt(argc, argv, "f:i:n:bth")) != -1)
+	{
+	    switch (c)
+		{
+		case 'f':
+			path = optarg;
+			break;
+
+		case 'i':
+			interval = atoi(optarg);
+			break;
+
+		case 'n':
+			count = atoi(optarg);
+			break;
+
+		case 'b':
+			batch = 1;
+			break;
+
+		case 't':
+			trace = 1;
+			break;
+
+		default:
+			usage(argv[0]);
+
+			return 1;
+		}
+	}
+
+	if (interval <= 0)
+	{
+        interval = 1;
+	}
+
+	shm = stats_map(path);
+	if (!shm)
+	{
+        return 1;
+	}
+
+	if (trace)
+	{
+        return stats_trace(shm);
+	}
+
+	snaps = (stat_snap_t *)calloc(2, sizeof(stat_snap_t));
+	t = (dn_shm_thread_t *)malloc(sizeof(dn_shm_thread_t));
+	d = (dn_hist_t *)malloc(sizeof(dn_hist_t));
+	if (!snaps || !t || !d)
+	{
+	    fprintf(stderr, "out of memory\n");
+
+        return 1;
+	}
+
+	for (i = 0; count < 0 || i < count; i++)
+	{
+	    if (i)
+		{
+            sleep(interval);
+		}
+
+		now = &snaps[i & 1];
+		stats_take(shm, now, t);
+
+		if (!batch)
+		{
+            printf("\033[H\033[2J");
+		}
+
+		stats_print(shm, now, prev, d);
+		prev = now;
+	}
+
+	munmap(shm, sizeof(dn_shm_t));
+	free(snaps);
+	free(t);
+	free(d);
+
+	return 0;
+}
+
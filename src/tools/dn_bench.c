@@ -0,0 +1,800 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include "dfs_task_cmd.h"
+#include "dn_hist.h"
+
+// load generator for the datanode data transfer protocol. one request
+// per connection, like the datanode serves them. with -R the arrival is
+// open loop and latency counts from when a request was due, so a stalled
+// datanode can not hide its queueing (coordinated omission)
+
+#define BENCH_CONNS_MAX  4096
+#define BENCH_TICK_MS    100
+#define BENCH_DRAIN_MS   5000
+#define BENCH_IO_MAX     (1 << 20)
+
+enum
+{
+    BENCH_WRITE = 0,
+	BENCH_READ,
+	BENCH_OP_N
+};
+
+enum
+{
+    ST_IDLE = 0,
+	ST_CONNECTING,
+	ST_SEND_HEADER,
+	ST_RECV_RSP,
+	ST_SEND_BODY,
+	ST_RECV_BODY,
+	ST_RECV_DONE
+};
+
+typedef struct bench_conf_s
+{
+    char     *host;
+	int       port;
+	int       conns;
+	uint64_t  blk_size;
+	int       write_pct;
+	uint64_t  rate;      // ops/s, 0 for closed loop
+	int       duration;  // s
+	long      ns_id;
+	long      blk_base;
+	int       prefill;
+	int       quiet;
+} bench_conf_t;
+
+typedef struct bench_stat_s
+{
+    dn_hist_t lat;      // from when the op was due
+	dn_hist_t service;  // from when it was sent
+	uint64_t  ops;
+	uint64_t  errors;
+	uint64_t  bytes;
+} bench_stat_t;
+
+typedef struct bench_conn_s
+{
+    int      fd;
+	int      state;
+	int      op;
+	long     blk_id;
+	uint64_t due_us;
+	uint64_t start_us;
+	uint64_t done;   // bytes of the current state
+	uint64_t need;
+	data_transfer_header_t     header;
+	data_transfer_header_rsp_t rsp;
+} bench_conn_t;
+
+static bench_conf_t  conf;
+static bench_conn_t *conns;
+static bench_stat_t  stats[BENCH_OP_N];
+static char         *io_buf;
+static long         *written;   // blks that can be read back
+static uint64_t      written_n;
+static uint64_t      written_max;
+static long          next_blk;
+static int           epfd = -1;
+static int           inflight;
+static uint64_t      rnd = 0x9E3779B97F4A7C15ULL;
+static volatile int  stop;
+
+static uint64_t now_us()
+{
+    struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static uint64_t rand_next()
+{
+    rnd ^= rnd << 13;
+	rnd ^= rnd >> 7;
+	rnd ^= rnd << 17;
+
+	return rnd;
+}
+
+static uint64_t parse_size(char *s)
+{
+    char     *end = NULL;
+	uint64_t  v = strtoull(s, &end, 10);
+
+	switch (*end)
+	{
+	case 'k':
+	case 'K':
+		return v << 10;
+
+	case 'm':
+	case 'M':
+		return v << 20;
+
+	case 'g':
+	case 'G':
+		return v << 30;
+	}
+
+	return v;
+}
+
+static void on_signal(int sig)
+{
+    stop = 1;
+}
+
+static void conn_reset(bench_conn_t *c)
+{
+    if (c->fd >= 0)
+	{
+	    epoll_ctl(epfd, EPOLL_CTL_DEL, c->fd, NULL);
+        close(c->fd);
+	}
+
+	c->fd = -1;
+	c->state = ST_IDLE;
+}
+
+static void op_finish(bench_conn_t *c, int ok)
+{
+    bench_stat_t *st = &stats[c->op];
+	uint64_t      now = now_us();
+
+	if (ok)
+	{
+	    st->ops++;
+		st->bytes += conf.blk_size;
+		dn_hist_add(&st->lat, now - c->due_us);
+		dn_hist_add(&st->service, now - c->start_us);
+
+		if (c->op == BENCH_WRITE && written_n < written_max)
+		{
+            written[written_n++] = c->blk_id;
+		}
+	}
+	else
+	{
+        st->errors++;
+	}
+
+	conn_reset(c);
+	inflight--;
+}
+
+static int op_start(bench_conn_t *c, uint64_t due, int force_write)
+{
+    struct sockaddr_in  addr;
+	struct epoll_event  ev;
+	int                 fd = -1;
+	int                 one = 1;
+
+	c->op = BENCH_WRITE;
+	if (!force_write && written_n
+		&& (int)(rand_next() % 100) >= conf.write_pct)
+	{
+        c->op = BENCH_READ;
+	}
+
+	c->blk_id = c->op == BENCH_WRITE ? next_blk++
+		: written[rand_next() % written_n];
+
+	memset(&c->header, 0, sizeof(c->header));
+	c->header.op_type = c->op == BENCH_WRITE ? OP_WRITE_BLOCK
+		: OP_READ_BLOCK;
+	c->header.namespace_id = conf.ns_id;
+	c->header.block_id = c->blk_id;
+	c->header.generation_stamp = 1;
+	c->header.start_offset = 0;
+	c->header.len = conf.blk_size;
+
+	c->due_us = due;
+	c->start_us = now_us();
+	c->done = 0;
+	c->need = sizeof(c->header);
+	inflight++;
+
+	fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+	if (fd < 0)
+	{
+	    perror("socket");
+		c->fd = -1;
+		op_finish(c, 0);
+
+        return -1;
+	}
+
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(conf.port);
+	inet_pton(AF_INET, conf.host, &addr.sin_addr);
+
+	c->fd = fd;
+	c->state = ST_CONNECTING;
+
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0
+		&& errno != EINPROGRESS)
+	{
+	    op_finish(c, 0);
+
+        return -1;
+	}
+
+	ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP;
+	ev.data.ptr = c;
+	epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+
+	return 0;
+}
+
+static void conn_want(bench_conn_t *c, uint32_t events)
+{
+    struct epoll_event ev;
+
+	ev.events = events | EPOLLRDHUP;
+	ev.data.ptr = c;
+	epoll_ctl(epfd, EPOLL_CTL_MOD, c->fd, &ev);
+}
+
+// returns 1 when the state's bytes are all through, 0 to wait, -1 err
+static int conn_send(bench_conn_t *c, char *buf, int wrap)
+{
+    ssize_t n = 0;
+	size_t  len = 0;
+
+	while (c->done < c->need)
+	{
+	    len = c->need - c->done;
+		if (wrap && len > BENCH_IO_MAX)
+		{
+            len = BENCH_IO_MAX;
+		}
+
+		n = send(c->fd, wrap ? buf : buf + c->done, len, MSG_NOSIGNAL);
+		if (n > 0)
+		{
+		    c->done += n;
+
+            continue;
+		}
+
+		return n < 0 && errno == EAGAIN ? 0 : -1;
+	}
+
+	return 1;
+}
+
+static int conn_recv(bench_conn_t *c, char *buf, int wrap)
+{
+    ssize_t n = 0;
+	size_t  len = 0;
+
+	while (c->done < c->need)
+	{
+	    len = c->need - c->done;
+		if (wrap && len > BENCH_IO_MAX)
+		{
+            len = BENCH_IO_MAX;
+		}
+
+		n = recv(c->fd, wrap ? buf : buf + c->done, len, 0);
+		if (n > 0)
+		{
+		    c->done += n;
+
+            continue;
+		}
+
+		return n < 0 && errno == EAGAIN ? 0 : -1;
+	}
+
+	return 1;
+}
+
+static void conn_process(bench_conn_t *c)
+{
+    int rs = 0;
+	int err = 0;
+	socklen_t len = sizeof(err);
+
+	for ( ;; )
+	{
+	    switch (c->state)
+		{
+		case ST_CONNECTING:
+			if (getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0
+				|| err)
+			{
+			    op_finish(c, 0);
+
+                return;
+			}
+
+			c->state = ST_SEND_HEADER;
+			break;
+
+		case ST_SEND_HEADER:
+			rs = conn_send(c, (char *)&c->header, 0);
+			if (rs <= 0)
+			{
+                goto wait;
+			}
+
+			c->state = ST_RECV_RSP;
+			c->done = 0;
+			c->need = sizeof(c->rsp);
+			conn_want(c, EPOLLIN);
+			break;
+
+		case ST_RECV_RSP:
+			rs = conn_recv(c, (char *)&c->rsp, 0);
+			if (rs <= 0)
+			{
+                goto wait;
+			}
+
+			if (c->rsp.op_status != OP_STATUS_SUCCESS)
+			{
+			    op_finish(c, 0);
+
+                return;
+			}
+
+			c->done = 0;
+
+			if (c->op == BENCH_WRITE)
+			{
+			    c->state = ST_SEND_BODY;
+				c->need = conf.blk_size;
+				conn_want(c, EPOLLOUT);
+			}
+			else
+			{
+			    // the data, then the done response
+			    c->state = ST_RECV_BODY;
+				c->need = conf.blk_size + sizeof(c->rsp);
+			}
+
+			break;
+
+		case ST_SEND_BODY:
+			rs = conn_send(c, io_buf, 1);
+			if (rs <= 0)
+			{
+                goto wait;
+			}
+
+			c->state = ST_RECV_DONE;
+			c->done = 0;
+			c->need = sizeof(c->rsp);
+			conn_want(c, EPOLLIN);
+			break;
+
+		case ST_RECV_BODY:
+			rs = conn_recv(c, io_buf, 1);
+			if (rs <= 0)
+			{
+                goto wait;
+			}
+
+			op_finish(c, 1);
+
+			return;
+
+		case ST_RECV_DONE:
+			rs = conn_recv(c, (char *)&c->rsp, 0);
+			if (rs <= 0)
+			{
+                goto wait;
+			}
+
+			op_finish(c, c->rsp.op_status == OP_STATUS_SUCCESS);
+
+			return;
+
+		default:
+			return;
+		}
+	}
+
+wait:
+	if (rs < 0)
+	{
+        op_finish(c, 0);
+	}
+}
+
+static bench_conn_t *conn_idle()
+{
+    int i = 0;
+
+	for (i = 0; i < conf.conns; i++)
+	{
+	    if (conns[i].state == ST_IDLE)
+		{
+            return &conns[i];
+		}
+	}
+
+	return NULL;
+}
+
+static void run_prefill()
+{
+    struct epoll_event events[256];
+	bench_conn_t      *c = NULL;
+	int                started = 0;
+	int                n = 0;
+	int                i = 0;
+
+	while ((started < conf.prefill || inflight) && !stop)
+	{
+	    while (started < conf.prefill && (c = conn_idle()))
+		{
+		    op_start(c, now_us(), 1);
+			started++;
+		}
+
+		n = epoll_wait(epfd, events, 256, BENCH_TICK_MS);
+		for (i = 0; i < n; i++)
+		{
+            conn_process((bench_conn_t *)events[i].data.ptr);
+		}
+	}
+
+	memset(stats, 0, sizeof(stats));
+}
+
+static void print_progress(int sec, uint64_t *last_ops, uint64_t *last_bytes,
+	uint64_t backlog)
+{
+    uint64_t ops = 0;
+	uint64_t bytes = 0;
+	uint64_t errs = 0;
+	int      i = 0;
+
+	for (i = 0; i < BENCH_OP_N; i++)
+	{
+	    ops += stats[i].ops;
+		bytes += stats[i].bytes;
+		errs += stats[i].errors;
+	}
+
+	fprintf(stderr, "%4ds: %8lu ops/s %9.1f MB/s  inflight %d  backlog %lu"
+		"  errors %lu\n", sec, (unsigned long)(ops - *last_ops),
+		(bytes - *last_bytes) / 1048576.0, inflight,
+		(unsigned long)backlog, (unsigned long)errs);
+
+	*last_ops = ops;
+	*last_bytes = bytes;
+}
+
+static void run_bench(uint64_t *elapsed)
+{
+    struct epoll_event events[256];
+	bench_conn_t      *c = NULL;
+	uint64_t           start = now_us();
+	uint64_t           end = start + (uint64_t)conf.duration * 1000000;
+	uint64_t           issued = 0;
+	uint64_t           due = 0;
+	uint64_t           now = 0;
+	uint64_t           last_ops = 0;
+	uint64_t           last_bytes = 0;
+	uint64_t           backlog = 0;
+	int                sec = 1;
+	int                timeout = 0;
+	int                n = 0;
+	int                i = 0;
+
+	for ( ;; )
+	{
+	    now = now_us();
+
+		if (now >= end || stop)
+		{
+            break;
+		}
+
+		if (conf.rate)
+		{
+		    // every op that is due gets a conn, or waits with its due time
+		    for ( ;; )
+			{
+			    due = start + issued * 1000000 / conf.rate;
+				if (due > now || !(c = conn_idle()))
+				{
+                    break;
+				}
+
+				op_start(c, due, 0);
+				issued++;
+			}
+
+			due = start + issued * 1000000 / conf.rate;
+			backlog = due <= now ? (now - due) * conf.rate / 1000000 + 1 : 0;
+			timeout = due > now ? (int)((due - now + 999) / 1000) : 1;
+		}
+		else
+		{
+		    while ((c = conn_idle()))
+			{
+                op_start(c, now, 0);
+			}
+
+			timeout = BENCH_TICK_MS;
+		}
+
+		if (timeout > BENCH_TICK_MS)
+		{
+            timeout = BENCH_TICK_MS;
+		}
+
+		n = epoll_wait(epfd, events, 256, timeout);
+		for (i = 0; i < n; i++)
+		{
+            conn_process((bench_conn_t *)events[i].data.ptr);
+		}
+
+		if (!conf.quiet && now_us() >= start + (uint64_t)sec * 1000000)
+		{
+		    print_progress(sec, &last_ops, &last_bytes, backlog);
+			sec++;
+		}
+	}
+
+	*elapsed = now_us() - start;
+
+	// whatever is in flight still counts
+	end = now_us() + BENCH_DRAIN_MS * 1000;
+	while (inflight && now_us() < end)
+	{
+	    n = epoll_wait(epfd, events, 256, BENCH_TICK_MS);
+		for (i = 0; i < n; i++)
+		{
+            conn_process((bench_conn_t *)events[i].data.ptr);
+		}
+	}
+}
+
+static void print_hist(char *name, dn_hist_t *h, bench_stat_t *st,
+	double secs)
+{
+    printf("%-8s %9lu %7lu %9.1f %9.1f %8lu %8lu %8lu %8lu %8lu %8lu\n",
+		name, (unsigned long)st->ops, (unsigned long)st->errors,
+		st->ops / secs, st->bytes / 1048576.0 / secs,
+		(unsigned long)(h->n ? h->sum / h->n : 0),
+		(unsigned long)dn_hist_percentile(h, 0.5),
+		(unsigned long)dn_hist_percentile(h, 0.9),
+		(unsigned long)dn_hist_percentile(h, 0.99),
+		(unsigned long)dn_hist_percentile(h, 0.999),
+		(unsigned long)h->max);
+}
+
+static void print_table(char *title, int service, double secs)
+{
+    bench_stat_t all;
+	dn_hist_t   *h = NULL;
+	char        *names[BENCH_OP_N] = { "write", "read" };
+	int          i = 0;
+
+	memset(&all, 0, sizeof(all));
+
+	printf("\n%s\n%-8s %9s %7s %9s %9s %8s %8s %8s %8s %8s %8s\n", title,
+		"op", "ops", "errors", "ops/s", "MB/s", "avg(us)", "p50", "p90",
+		"p99", "p99.9", "max");
+
+	for (i = 0; i < BENCH_OP_N; i++)
+	{
+	    h = service ? &stats[i].service : &stats[i].lat;
+		print_hist(names[i], h, &stats[i], secs);
+
+		dn_hist_merge(service ? &all.service : &all.lat, h);
+		all.ops += stats[i].ops;
+		all.errors += stats[i].errors;
+		all.bytes += stats[i].bytes;
+	}
+
+	print_hist("all", service ? &all.service : &all.lat, &all, secs);
+}
+
+static void usage(char *prog)
+{
+    fprintf(stderr, "usage: %s [options]\n"
+		"  -H host        datanode address, default 127.0.0.1\n"
+		"  -P port        datanode port, default 8100\n"
+		"  -c conns       requests in flight, default 16\n"
+		"  -s size        blk size, k/m/g suffixes, default 1m\n"
+		"  -w percent     writes of all ops, default 50\n"
+		"  -R rate        ops/s open loop, default closed loop\n"
+		"  -d seconds     duration, default 10\n"
+		"  -N ns_id       namespace id the datanode registered with\n"
+		"  -b blk_id      first blk id to write, default from the clock\n"
+		"  -p count       blks written before measuring, default conns\n"
+		"  -q             no per second progress\n", prog);
+}
+
+int main(int argc, char **argv)
+{
+    struct sigaction sa;
+	uint64_t         elapsed = 0;
+	double           secs = 0;
+	int              ch = 0;
+	int              i = 0;
+
+	conf.host = "127.0.0.1";
+	conf.port = 8100;
+	conf.conns = 16;
+	conf.blk_size = 1 << 20;
+	conf.write_pct = 50;
+	conf.duration = 10;
+	conf.ns_id = 0;
+	conf.blk_base = 0;
+	conf.prefill = -1;
+
+	while ((ch = getopt(argc, argv, "H:P:c:s:w:R:d:N:b:p:qh")) != -1)
+	{
+	    switch (ch)
+		{
+		case 'H':
+			conf.host = optarg;
+			break;
+
+		case 'P':
+			conf.port = atoi(optarg);
+			break;
+
+		case 'c':
+			conf.conns = atoi(optarg);
+			break;
+
+		case 's':
+			conf.blk_size = parse_size(optarg);
+			break;
+
+		case 'w':
+			conf.write_pct = atoi(optarg);
+			break;
+
+		case 'R':
+			conf.rate = strtoull(optarg, NULL, 10);
+			break;
+
+		case 'd':
+			conf.duration = atoi(optarg);
+			break;
+
+		case 'N':
+			conf.ns_id = atol(optarg);
+			break;
+
+		case 'b':
+			conf.blk_base = atol(optarg);
+			break;
+
+		case 'p':
+			conf.prefill = atoi(optarg);
+			break;
+
+		case 'q':
+			conf.quiet = 1;
+			break;
+
+		default:
+			usage(argv[0]);
+
+			return 1;
+		}
+	}
+
+	if (conf.conns <= 0 || conf.conns > BENCH_CONNS_MAX || !conf.blk_size
+		|| conf.write_pct < 0 || conf.write_pct > 100 || conf.duration <= 0)
+	{
+	    usage(argv[0]);
+
+        return 1;
+	}
+
+	if (!conf.ns_id)
+	{
+	    fprintf(stderr, "-N: the namespace id is needed, see NS-<id> in "
+			"the data dirs\n");
+
+        return 1;
+	}
+
+	if (conf.prefill < 0)
+	{
+        conf.prefill = conf.write_pct < 100 ? conf.conns : 0;
+	}
+
+	// fresh ids so runs do not overwrite each other
+	next_blk = conf.blk_base ? conf.blk_base : (long)time(NULL) << 20;
+	rnd ^= (uint64_t)next_blk;
+
+	written_max = 1 << 20;
+	conns = (bench_conn_t *)calloc(conf.conns, sizeof(bench_conn_t));
+	written = (long *)malloc(written_max * sizeof(long));
+	io_buf = (char *)malloc(BENCH_IO_MAX);
+	epfd = epoll_create1(0);
+
+	if (!conns || !written || !io_buf || epfd < 0)
+	{
+	    fprintf(stderr, "init failed: %s\n", strerror(errno));
+
+        return 1;
+	}
+
+	for (i = 0; i < BENCH_IO_MAX; i++)
+	{
+        io_buf[i] = (char)(i * 31 + 7);
+	}
+
+	for (i = 0; i < conf.conns; i++)
+	{
+	    conns[i].fd = -1;
+        conns[i].state = ST_IDLE;
+	}
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = on_signal;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	printf("dn_bench %s:%d, %d conns, %lu byte blks, %d%% writes, ",
+		conf.host, conf.port, conf.conns, (unsigned long)conf.blk_size,
+		conf.write_pct);
+
+	if (conf.rate)
+	{
+        printf("open loop %lu ops/s, ", (unsigned long)conf.rate);
+	}
+	else
+	{
+        printf("closed loop, ");
+	}
+
+	printf("%d s\n", conf.duration);
+	fflush(stdout);
+
+	run_prefill();
+
+	if (conf.write_pct < 100 && !written_n)
+	{
+	    fprintf(stderr, "prefill wrote nothing, is the datanode up and "
+			"is -N right?\n");
+
+        return 1;
+	}
+
+	run_bench(&elapsed);
+	secs = elapsed / 1000000.0;
+
+	print_table(conf.rate ? "latency from the due time (corrected)"
+		: "latency", 0, secs);
+
+	if (conf.rate)
+	{
+        print_table("service time from the send", 1, secs);
+	}
+
+	return stats[BENCH_WRITE].errors || stats[BENCH_READ].errors ? 2 : 0;
+}
+
@@ -0,0 +1,868 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <signal.h>
+#include <sys/time.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include "dfs_task.h"
+#include "dfs_task_cmd.h"
+
+// stand-in namenode for running datanodes on one machine. it answers
+// DN_REGISTER with a namespace id, acks heartbeats and blk reports, can
+// send blk deletes with the heartbeat answers and records what the
+// datanodes report and how long full reports take
+
+#define NN_CONNS_MAX     1024
+#define NN_FRAME_MAX     (64 * 1024 * 1024)
+#define NN_BUF_INIT      (256 * 1024)
+#define NN_REPORTS_MAX   64        // full reports in flight
+#define NN_KNOWN_MAX     (1 << 20) // blk ids kept to pick deletes from
+#define NN_DELETES_MAX   4096      // per heartbeat
+#define NN_VARINT_MAX    10
+
+typedef struct nn_conf_s
+{
+    char     *host;
+	int       port;
+	long      ns_id;
+	int       max_ver;
+	int       deletes;  // per heartbeat
+	int       interval; // s between summaries, 0 for none
+	char     *record;
+	int       quiet;
+} nn_conf_t;
+
+typedef struct nn_conn_s
+{
+    int       fd;
+	char      peer[32];
+	char     *rbuf;
+	int       rlen;
+	int       rsize;
+	char     *wbuf;
+	int       wpos;
+	int       wlen;
+	int       wsize;
+	int       want_out;
+} nn_conn_t;
+
+// a full report, from its first chunk to the one flagged as the end
+typedef struct nn_report_s
+{
+    uint64_t  report_id;
+	int64_t   ns_id;
+	char      peer[32];
+	uint64_t  start_ms;
+	uint64_t  chunks;
+	uint64_t  blks;
+	uint64_t  bytes;
+	int       vols;
+} nn_report_t;
+
+typedef struct nn_stat_s
+{
+    uint64_t  conns;
+	uint64_t  registers;
+	uint64_t  heartbeats;
+	uint64_t  recv_blks;
+	uint64_t  del_blks;
+	uint64_t  incr_bytes;
+	uint64_t  chunks;
+	uint64_t  chunk_blks;
+	uint64_t  chunk_bytes;
+	uint64_t  reports;
+	uint64_t  report_ms;  // of the last full report
+	uint64_t  report_blks;
+	uint64_t  deletes;
+	uint64_t  bad;
+} nn_stat_t;
+
+static nn_conf_t    conf;
+static nn_conn_t   *conns[NN_CONNS_MAX];
+static nn_report_t  reports[NN_REPORTS_MAX];
+static nn_stat_t    nn_stats;
+static int64_t     *known;     // blk ids the datanodes reported
+static uint64_t     known_n;
+static uint64_t     known_seen;
+static FILE        *record;
+static int          epfd = -1;
+static uint64_t     rnd = 0x9E3779B97F4A7C15ULL;
+static volatile int stop;
+
+static uint64_t now_ms()
+{
+    struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+
+	return (uint64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+static uint64_t rand_next()
+{
+    rnd ^= rnd << 13;
+	rnd ^= rnd >> 7;
+	rnd ^= rnd << 17;
+
+	return rnd;
+}
+
+static void on_signal(int sig)
+{
+    stop = 1;
+}
+
+static int get_varint(unsigned char **p, unsigned char *end, uint64_t *v)
+{
+    uint64_t r = 0;
+	int      shift = 0;
+	int      i = 0;
+
+	for (i = 0; i < NN_VARINT_MAX && *p < end; i++)
+	{
+	    r |= (uint64_t)(**p & 0x7f) << shift;
+		shift += 7;
+
+		if (!(*(*p)++ & 0x80))
+		{
+		    *v = r;
+
+            return 0;
+		}
+	}
+
+	return -1;
+}
+
+static void log_record(char *peer, const char *fmt, ...)
+	__attribute__((format(printf, 2, 3)));
+
+static void log_record(char *peer, const char *fmt, ...)
+{
+    va_list ap;
+
+	if (!record)
+	{
+        return;
+	}
+
+	fprintf(record, "%llu %s ", (unsigned long long)now_ms(), peer);
+
+	va_start(ap, fmt);
+	vfprintf(record, fmt, ap);
+	va_end(ap);
+
+	fputc('\n', record);
+}
+
+// a reservoir sample, so deletes hit blks of every volume and age
+static void known_add(int64_t id)
+{
+    uint64_t j = 0;
+
+	known_seen++;
+
+	if (known_n < NN_KNOWN_MAX)
+	{
+	    known[known_n++] = id;
+
+        return;
+	}
+
+	j = rand_next() % known_seen;
+	if (j < NN_KNOWN_MAX)
+	{
+        known[j] = id;
+	}
+}
+
+static int64_t known_take()
+{
+    uint64_t j = rand_next() % known_n;
+	int64_t  id = known[j];
+
+	known[j] = known[--known_n];
+
+	return id;
+}
+
+static nn_report_t *report_get(blk_report_hdr_t *hdr, char *peer)
+{
+    nn_report_t *free_r = NULL;
+	nn_report_t *oldest = NULL;
+	int          i = 0;
+
+	for (i = 0; i < NN_REPORTS_MAX; i++)
+	{
+	    if (reports[i].report_id == hdr->report_id)
+		{
+            return &reports[i];
+		}
+
+		if (!reports[i].report_id)
+		{
+		    free_r = free_r ? free_r : &reports[i];
+
+            continue;
+		}
+
+		if (!oldest || reports[i].start_ms < oldest->start_ms)
+		{
+            oldest = &reports[i];
+		}
+	}
+
+	// an abandoned report makes room
+	free_r = free_r ? free_r : oldest;
+
+	memset(free_r, 0, sizeof(nn_report_t));
+	free_r->report_id = hdr->report_id;
+	free_r->ns_id = hdr->ns_id;
+	free_r->start_ms = now_ms();
+	snprintf(free_r->peer, sizeof(free_r->peer), "%s", peer);
+
+	return free_r;
+}
+
+// decodes the varint pairs, ids go to the delete candidates
+static int report_chunk(nn_conn_t *c, task_t *in)
+{
+    blk_report_hdr_t  hdr;
+	nn_report_t      *r = NULL;
+	unsigned char    *p = NULL;
+	unsigned char    *end = NULL;
+	uint64_t          delta = 0;
+	uint64_t          size = 0;
+	uint64_t          id = 0;
+	uint32_t          i = 0;
+	char             *kind = NULL;
+
+	if (in->data_len < (int)sizeof(hdr))
+	{
+        return TASK_ERROR;
+	}
+
+	memcpy(&hdr, in->data, sizeof(hdr));
+	p = (unsigned char *)in->data + sizeof(hdr);
+	end = (unsigned char *)in->data + in->data_len;
+	id = (uint64_t)hdr.base;
+
+	for (i = 0; i < hdr.count; i++)
+	{
+	    if (get_varint(&p, end, &delta) || get_varint(&p, end, &size))
+		{
+            return TASK_ERROR;
+		}
+
+		id += delta;
+
+		if (in->cmd != DN_DEL_BLK_REPORT)
+		{
+            known_add((int64_t)id);
+		}
+	}
+
+	switch (in->cmd)
+	{
+	case DN_RECV_BLK_REPORT:
+		kind = "recv";
+		nn_stats.recv_blks += hdr.count;
+		nn_stats.incr_bytes += in->data_len;
+		break;
+
+	case DN_DEL_BLK_REPORT:
+		kind = "del";
+		nn_stats.del_blks += hdr.count;
+		nn_stats.incr_bytes += in->data_len;
+		break;
+
+	default:
+		kind = "full";
+		nn_stats.chunks++;
+		nn_stats.chunk_blks += hdr.count;
+		nn_stats.chunk_bytes += in->data_len;
+		break;
+	}
+
+	log_record(c->peer, "report %s id %llu seq %u vol %d count %u bytes %d",
+		kind, (unsigned long long)hdr.report_id, hdr.seq, hdr.vol,
+		hdr.count, in->data_len);
+
+	if (!(hdr.flags & BLK_REPORT_FULL))
+	{
+        return TASK_OK;
+	}
+
+	r = report_get(&hdr, c->peer);
+	r->chunks++;
+	r->blks += hdr.count;
+	r->bytes += in->data_len;
+	r->vols += (hdr.flags & BLK_REPORT_VOL_END) ? 1 : 0;
+
+	if (hdr.flags & BLK_REPORT_END)
+	{
+	    nn_stats.reports++;
+		nn_stats.report_ms = now_ms() - r->start_ms;
+		nn_stats.report_blks = r->blks;
+
+		log_record(c->peer, "report_done id %llu ns %lld vols %d chunks %llu "
+			"blks %llu bytes %llu ms %llu",
+			(unsigned long long)r->report_id, (long long)r->ns_id, r->vols,
+			(unsigned long long)r->chunks, (unsigned long long)r->blks,
+			(unsigned long long)r->bytes,
+			(unsigned long long)nn_stats.report_ms);
+
+		if (!conf.quiet)
+		{
+		    printf("full report of %s done: %llu blks in %llu chunks, "
+				"%llu ms\n", r->peer, (unsigned long long)r->blks,
+				(unsigned long long)r->chunks,
+				(unsigned long long)nn_stats.report_ms);
+		}
+
+		r->report_id = 0;
+	}
+
+	return TASK_OK;
+}
+
+static void heartbeat_record(nn_conn_t *c, task_t *in, int deletes)
+{
+    dn_stats_hdr_t hdr;
+
+	if (in->data_len < (int)sizeof(hdr))
+	{
+	    log_record(c->peer, "heartbeat deletes %d", deletes);
+
+        return;
+	}
+
+	memcpy(&hdr, in->data, sizeof(hdr));
+
+	log_record(c->peer, "heartbeat vols %u failed %u capacity %llu used %llu "
+		"remaining %llu xceivers %u io_pending %u io_lat_us %u deletes %d",
+		hdr.vol_n, hdr.failed_vols, (unsigned long long)hdr.capacity,
+		(unsigned long long)hdr.used, (unsigned long long)hdr.remaining,
+		hdr.xceivers, hdr.io_pending, hdr.io_lat_us, deletes);
+}
+
+static int conn_reserve(char **buf, int *size, int need)
+{
+    char *p = NULL;
+	int   n = *size ? *size : NN_BUF_INIT;
+
+	while (n < need)
+	{
+        n <<= 1;
+	}
+
+	if (n == *size)
+	{
+        return 0;
+	}
+
+	p = (char *)realloc(*buf, n);
+	if (!p)
+	{
+        return -1;
+	}
+
+	*buf = p;
+	*size = n;
+
+	return 0;
+}
+
+// answers in the version the request came in
+static int conn_answer(nn_conn_t *c, task_t *in, int ver, void *data,
+	int data_len)
+{
+    task_t out;
+	int    len = 0;
+
+	out = *in;
+	out.ret = TASK_OK;
+	out.data = data;
+	out.data_len = data_len;
+
+	len = task_encode_size(&out, ver);
+	if (conn_reserve(&c->wbuf, &c->wsize, c->wlen + len))
+	{
+        return -1;
+	}
+
+	len = task_encode2str_ver(&out, ver, c->wbuf + c->wlen,
+		c->wsize - c->wlen);
+	if (len < 0)
+	{
+        return -1;
+	}
+
+	c->wlen += len;
+
+	return 0;
+}
+
+static int conn_dispatch(nn_conn_t *c, char *frame, int len)
+{
+    task_t             in;
+	task_wire_hello_t  hello;
+	char               reg[sizeof(int64_t) + sizeof(task_wire_hello_t)];
+	int64_t            dels[NN_DELETES_MAX];
+	int64_t            ns_id = conf.ns_id;
+	int                ver = task_frame_version(frame, len);
+	int                n = 0;
+
+	memset(&in, 0, sizeof(in));
+
+	if (task_decodefstr_any(frame, len, &in) != len)
+	{
+        return -1;
+	}
+
+	switch (in.cmd)
+	{
+	case DN_REGISTER:
+		nn_stats.registers++;
+
+		hello.magic = TASK_WIRE_HELLO_MAGIC;
+		hello.min_ver = TASK_V1;
+		hello.max_ver = task_wire_negotiate(in.data, in.data_len,
+			conf.max_ver);
+
+		memcpy(reg, &ns_id, sizeof(int64_t));
+		memcpy(reg + sizeof(int64_t), &hello, sizeof(hello));
+
+		log_record(c->peer, "register ns %ld wire v%d", conf.ns_id,
+			hello.max_ver);
+
+		if (!conf.quiet)
+		{
+		    printf("%s registered, ns %ld, wire v%d\n", c->peer,
+				conf.ns_id, hello.max_ver);
+		}
+
+		return conn_answer(c, &in, ver, reg, sizeof(reg));
+
+	case DN_HEARTBEAT:
+		nn_stats.heartbeats++;
+
+		while (n < conf.deletes && known_n > 0)
+		{
+            dels[n++] = known_take();
+		}
+
+		nn_stats.deletes += n;
+		heartbeat_record(c, &in, n);
+
+		return conn_answer(c, &in, ver, n ? dels : NULL,
+			n * (int)sizeof(int64_t));
+
+	case DN_RECV_BLK_REPORT:
+	case DN_DEL_BLK_REPORT:
+	case DN_BLK_REPORT_BULK:
+		if (report_chunk(c, &in) != TASK_OK)
+		{
+            return -1;
+		}
+
+		return conn_answer(c, &in, ver, NULL, 0);
+
+	default:
+		log_record(c->peer, "cmd %d len %d", in.cmd, len);
+
+		return conn_answer(c, &in, ver, NULL, 0);
+	}
+}
+
+static void conn_close(nn_conn_t *c)
+{
+    log_record(c->peer, "close");
+
+	epoll_ctl(epfd, EPOLL_CTL_DEL, c->fd, NULL);
+	close(c->fd);
+
+	conns[c->fd] = NULL;
+	free(c->rbuf);
+	free(c->wbuf);
+	free(c);
+}
+
+static int conn_flush(nn_conn_t *c)
+{
+    struct epoll_event ev;
+	ssize_t            n = 0;
+	int                want = 0;
+
+	while (c->wpos < c->wlen)
+	{
+	    n = send(c->fd, c->wbuf + c->wpos, c->wlen - c->wpos, MSG_NOSIGNAL);
+		if (n < 0)
+		{
+		    if (errno == EAGAIN || errno == EINTR)
+			{
+                break;
+			}
+
+            return -1;
+		}
+
+		c->wpos += n;
+	}
+
+	if (c->wpos == c->wlen)
+	{
+        c->wpos = c->wlen = 0;
+	}
+
+	want = c->wlen > 0;
+	if (want != c->want_out)
+	{
+	    ev.events = EPOLLIN | (want ? EPOLLOUT : 0);
+		ev.data.ptr = c;
+		epoll_ctl(epfd, EPOLL_CTL_MOD, c->fd, &ev);
+        c->want_out = want;
+	}
+
+	return 0;
+}
+
+static int conn_read(nn_conn_t *c)
+{
+    ssize_t n = 0;
+	int     pos = 0;
+	int     len = 0;
+
+	for ( ;; )
+	{
+	    if (conn_reserve(&c->rbuf, &c->rsize, c->rlen + 4096))
+		{
+            return -1;
+		}
+
+		n = recv(c->fd, c->rbuf + c->rlen, c->rsize - c->rlen, 0);
+		if (n == 0)
+		{
+            return -1;
+		}
+
+		if (n < 0)
+		{
+		    if (errno == EAGAIN)
+			{
+                break;
+			}
+
+			if (errno == EINTR)
+			{
+                continue;
+			}
+
+            return -1;
+		}
+
+		c->rlen += n;
+
+		while (c->rlen - pos >= (int)sizeof(int))
+		{
+		    memcpy(&len, c->rbuf + pos, sizeof(int));
+
+			if (len < TASK_V2_HDR_LEN || len > NN_FRAME_MAX)
+			{
+			    nn_stats.bad++;
+
+                return -1;
+			}
+
+			if (c->rlen - pos < len)
+			{
+                break;
+			}
+
+			if (conn_dispatch(c, c->rbuf + pos, len))
+			{
+			    nn_stats.bad++;
+
+                return -1;
+			}
+
+			pos += len;
+		}
+
+		if (pos > 0)
+		{
+		    memmove(c->rbuf, c->rbuf + pos, c->rlen - pos);
+			c->rlen -= pos;
+			pos = 0;
+		}
+	}
+
+	return conn_flush(c);
+}
+
+static void conn_accept(int lfd)
+{
+    struct sockaddr_in  sin;
+	struct epoll_event  ev;
+	socklen_t           slen = sizeof(sin);
+	nn_conn_t          *c = NULL;
+	int                 fd = -1;
+	int                 one = 1;
+
+	for ( ;; )
+	{
+	    fd = accept4(lfd, (struct sockaddr *)&sin, &slen, SOCK_NONBLOCK);
+		if (fd < 0)
+		{
+            return;
+		}
+
+		if (fd >= NN_CONNS_MAX)
+		{
+		    close(fd);
+
+            continue;
+		}
+
+		c = (nn_conn_t *)calloc(1, sizeof(nn_conn_t));
+		if (!c)
+		{
+		    close(fd);
+
+            continue;
+		}
+
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+		c->fd = fd;
+		snprintf(c->peer, sizeof(c->peer), "%s:%d",
+			inet_ntoa(sin.sin_addr), ntohs(sin.sin_port));
+
+		ev.events = EPOLLIN;
+		ev.data.ptr = c;
+		epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+
+		conns[fd] = c;
+		nn_stats.conns++;
+
+		log_record(c->peer, "accept");
+		slen = sizeof(sin);
+	}
+}
+
+static void print_summary(char *title)
+{
+    printf("%s: conns %llu registers %llu heartbeats %llu incr recv %llu "
+		"del %llu (%llu B), chunks %llu (%llu blks, %llu B), full reports "
+		"%llu (last %llu blks, %llu ms), known %llu, deletes %llu\n", title,
+		(unsigned long long)nn_stats.conns, (unsigned long long)nn_stats.registers,
+		(unsigned long long)nn_stats.heartbeats,
+		(unsigned long long)nn_stats.recv_blks, (unsigned long long)nn_stats.del_blks,
+		(unsigned long long)nn_stats.incr_bytes, (unsigned long long)nn_stats.chunks,
+		(unsigned long long)nn_stats.chunk_blks,
+		(unsigned long long)nn_stats.chunk_bytes,
+		(unsigned long long)nn_stats.reports,
+		(unsigned long long)nn_stats.report_blks,
+		(unsigned long long)nn_stats.report_ms, (unsigned long long)known_n,
+		(unsigned long long)nn_stats.deletes);
+	fflush(stdout);
+}
+
+static void usage(char *prog)
+{
+    fprintf(stderr, "usage: %s [options]\n"
+		"  -H host        address to listen on, default 127.0.0.1\n"
+		"  -P port        port, server.ns_srv of the datanodes, default 8001\n"
+		"  -N ns_id       namespace id handed out at register, default 1234\n"
+		"  -v version     highest task wire version to agree on, default %d\n"
+		"  -D count       blk deletes sent with each heartbeat answer\n"
+		"  -o file        record registers, heartbeats and reports\n"
+		"  -i seconds     summary interval, 0 for none, default 10\n"
+		"  -q             only the summaries\n", prog, TASK_WIRE_MAX);
+}
+
+int main(int argc, char **argv)
+{
+    struct sigaction    sa;
+	struct sockaddr_in  sin;
+	struct epoll_event  evs[64];
+	struct epoll_event  ev;
+	nn_conn_t          *c = NULL;
+	uint64_t            next = 0;
+	int                 lfd = -1;
+	int                 one = 1;
+	int                 ch = 0;
+	int                 n = 0;
+	int                 i = 0;
+
+	conf.host = "127.0.0.1";
+	conf.port = 8001;
+	conf.ns_id = 1234;
+	conf.max_ver = TASK_WIRE_MAX;
+	conf.interval = 10;
+
+	while ((ch = getopt(argc, argv, "H:P:N:v:D:o:i:qh")) != -1)
+	{
+	    switch (ch)
+		{
+		case 'H':
+			conf.host = optarg;
+			break;
+
+		case 'P':
+			conf.port = atoi(optarg);
+			break;
+
+		case 'N':
+			conf.ns_id = atol(optarg);
+			break;
+
+		case 'v':
+			conf.max_ver = atoi(optarg);
+			break;
+
+		case 'D':
+			conf.deletes = atoi(optarg);
+			break;
+
+		case 'o':
+			conf.record = optarg;
+			break;
+
+		case 'i':
+			conf.interval = atoi(optarg);
+			break;
+
+		case 'q':
+			conf.quiet = 1;
+			break;
+
+		default:
+			usage(argv[0]);
+
+			return 1;
+		}
+	}
+
+	if (conf.ns_id <= 0 || conf.max_ver < TASK_V1
+		|| conf.max_ver > TASK_WIRE_MAX || conf.deletes < 0
+		|| conf.deletes > NN_DELETES_MAX || conf.interval < 0)
+	{
+	    usage(argv[0]);
+
+        return 1;
+	}
+
+	if (conf.record)
+	{
+	    record = fopen(conf.record, "w");
+		if (!record)
+		{
+		    fprintf(stderr, "%s: %s\n", conf.record, strerror(errno));
+
+            return 1;
+		}
+
+		setvbuf(record, NULL, _IOLBF, 0);
+	}
+
+	known = (int64_t *)malloc(NN_KNOWN_MAX * sizeof(int64_t));
+	epfd = epoll_create1(0);
+	lfd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+
+	if (!known || epfd < 0 || lfd < 0)
+	{
+	    fprintf(stderr, "init failed: %s\n", strerror(errno));
+
+        return 1;
+	}
+
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_port = htons(conf.port);
+	inet_pton(AF_INET, conf.host, &sin.sin_addr);
+
+	setsockopt(lfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+	if (bind(lfd, (struct sockaddr *)&sin, sizeof(sin)) < 0
+		|| listen(lfd, 128) < 0)
+	{
+	    fprintf(stderr, "listen on %s:%d: %s\n", conf.host, conf.port,
+			strerror(errno));
+
+        return 1;
+	}
+
+	ev.events = EPOLLIN;
+	ev.data.ptr = NULL;
+	epoll_ctl(epfd, EPOLL_CTL_ADD, lfd, &ev);
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = on_signal;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	printf("mock namenode on %s:%d, ns %ld, wire up to v%d, deletes %d "
+		"per heartbeat\n", conf.host, conf.port, conf.ns_id, conf.max_ver,
+		conf.deletes);
+	fflush(stdout);
+
+	next = now_ms() + conf.interval * 1000;
+
+	while (!stop)
+	{
+	    n = epoll_wait(epfd, evs, 64, 1000);
+
+		for (i = 0; i < n; i++)
+		{
+		    c = (nn_conn_t *)evs[i].data.ptr;
+			if (!c)
+			{
+			    conn_accept(lfd);
+
+                continue;
+			}
+
+			if ((evs[i].events & (EPOLLERR | EPOLLHUP))
+				|| ((evs[i].events & EPOLLIN) && conn_read(c))
+				|| ((evs[i].events & EPOLLOUT) && conn_flush(c)))
+			{
+                conn_close(c);
+			}
+		}
+
+		if (conf.interval && now_ms() >= next)
+		{
+		    print_summary("stats");
+            next += conf.interval * 1000;
+		}
+	}
+
+	for (i = 0; i < NN_CONNS_MAX; i++)
+	{
+	    if (conns[i])
+		{
+            conn_close(conns[i]);
+		}
+	}
+
+	print_summary("total");
+
+	if (record)
+	{
+        fclose(record);
+	}
+
+	return 0;
+}